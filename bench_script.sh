@@ -0,0 +1,283 @@
+#!/bin/bash
+#
+# End-to-end transfer benchmark.
+#
+# Starts N nfs_client instances and one nfs_manager, syncs a generated
+# workload over N sync pairs (pair i: client i -> client i+1, wrapping)
+# and reports MB/s, files/s, per-file latency percentiles and manager CPU
+# time. Results are appended to a JSON Lines file, one object per run,
+# so runs of different engines, queues or commits can be compared.
+#
+# Latency percentiles come from the manager's nfs_transfer_seconds
+# histogram (-m endpoint) and are bucket upper bounds.
+
+usage() {
+    cat <<EOF
+Usage: $0 [options]
+  -c <clients>    nfs_client instances, one sync pair each (default 2)
+  -n <workers>    manager worker threads (default 4)
+  -b <buffer>     manager job queue size (default 32)
+  -w <workloads>  comma-separated: tiny, huge, mixed (default tiny,huge,mixed)
+  -e <engine>     transfer engine: splice, copy or pipeline (default splice)
+  -q <queue>      job queue: list, ring or steal (default list)
+  -S <MiB>        size of each file of the huge workload (default 64)
+  -r <runs>       runs per workload (default 1)
+  -o <file>       JSON Lines output (default bench_results.jsonl)
+  -p <port>       first port to use (default 9700)
+  -x <args>       extra nfs_manager arguments
+  -t <seconds>    give up on a run after this long (default 300)
+  -k              keep the work directory
+EOF
+    exit 1
+}
+
+CLIENTS=2
+WORKERS=4
+BUFFER=32
+WORKLOADS="tiny,huge,mixed"
+ENGINE=splice
+QUEUE=list
+HUGE_MIB=64
+RUNS=1
+OUT=bench_results.jsonl
+BASE_PORT=9700
+EXTRA_ARGS=""
+TIMEOUT=300
+KEEP=false
+
+while getopts "c:n:b:w:e:q:S:r:o:p:x:t:kh" opt; do
+    case $opt in
+        c) CLIENTS=$OPTARG ;;
+        n) WORKERS=$OPTARG ;;
+        b) BUFFER=$OPTARG ;;
+        w) WORKLOADS=$OPTARG ;;
+        e) ENGINE=$OPTARG ;;
+        q) QUEUE=$OPTARG ;;
+        S) HUGE_MIB=$OPTARG ;;
+        r) RUNS=$OPTARG ;;
+        o) OUT=$OPTARG ;;
+        p) BASE_PORT=$OPTARG ;;
+        x) EXTRA_ARGS=$OPTARG ;;
+        t) TIMEOUT=$OPTARG ;;
+        k) KEEP=true ;;
+        *) usage ;;
+    esac
+done
+
+ROOT=$(cd "$(dirname "$0")" && pwd)
+for exec in nfs_manager nfs_client; do
+    if [ ! -x "$ROOT/$exec" ]; then
+        echo "❌ $exec not built, run make all first"
+        exit 1
+    fi
+done
+if [ "$CLIENTS" -lt 1 ]; then
+    echo "❌ Need at least one client"
+    exit 1
+fi
+case "$OUT" in
+    /*) ;;
+    *) OUT="$PWD/$OUT" ;;
+esac
+
+MANAGER_PORT=$BASE_PORT
+METRICS_PORT=$((BASE_PORT + 1))
+CLIENT_PORT=$((BASE_PORT + 10))
+CLK_TCK=$(getconf CLK_TCK)
+COMMIT=$(git -C "$ROOT" rev-parse --short HEAD 2>/dev/null || echo unknown)
+WORK=$(mktemp -d "${TMPDIR:-/tmp}/nfs_bench.XXXXXX")
+PIDS=()
+
+cleanup() {
+    for pid in "${PIDS[@]}"; do
+        kill "$pid" 2>/dev/null
+    done
+    wait 2>/dev/null
+    if [ "$KEEP" = true ]; then
+        echo "Work directory kept: $WORK"
+    else
+        rm -rf "$WORK"
+    fi
+}
+trap cleanup EXIT
+trap 'exit 130' INT TERM
+
+# Fill <dir> with <count> random files of <bytes> bytes named <prefix>N.bin
+make_files() {
+    local dir=$1 count=$2 bytes=$3 prefix=$4 i
+    for i in $(seq 1 "$count"); do
+        head -c "$bytes" /dev/urandom > "$dir/$prefix$i.bin"
+    done
+}
+
+# Create the source tree of a workload in <dir>
+make_workload() {
+    local dir=$1
+    mkdir -p "$dir"
+    case $2 in
+        tiny)  make_files "$dir" 2000 4096 t ;;
+        huge)  make_files "$dir" 3 $((HUGE_MIB * 1024 * 1024)) h ;;
+        mixed) make_files "$dir" 500 16384 s
+               make_files "$dir" 50 $((1024 * 1024)) m
+               make_files "$dir" 2 $((16 * 1024 * 1024)) l ;;
+        *)     echo "❌ Unknown workload: $2"; return 1 ;;
+    esac
+}
+
+# Print the manager's metrics, empty if the endpoint does not answer
+scrape() {
+    exec 3<>/dev/tcp/127.0.0.1/$METRICS_PORT 2>/dev/null || return
+    printf 'GET /metrics HTTP/1.0\r\n\r\n' >&3
+    sed '1,/^\r$/d' <&3
+    exec 3<&-
+}
+
+# Sum all samples of a metric in scraped text on stdin
+metric_sum() {
+    awk -v name="$1" '$1 == name || index($1, name "{") == 1 { sum += $NF } END { printf "%d", sum }'
+}
+
+# Upper bound in ms of the bucket holding quantile <q> of a histogram
+histogram_quantile_ms() {
+    awk -v name="$1_bucket" -v q="$2" '
+        index($1, name "{") == 1 {
+            match($1, /le="[^"]*"/)
+            le[n] = substr($1, RSTART + 4, RLENGTH - 5)
+            count[n++] = $NF
+        }
+        END {
+            if (n == 0 || count[n - 1] == 0) { print "null"; exit }
+            rank = q * count[n - 1]
+            for (i = 0; i < n; i++) {
+                if (count[i] >= rank) {
+                    if (le[i] == "+Inf") print "null"; else printf "%.3f\n", le[i] * 1000
+                    exit
+                }
+            }
+        }'
+}
+
+# Evaluate a floating point expression
+calc() {
+    awk "BEGIN { printf \"%.6f\", $1 }"
+}
+
+# Run one workload once and append its result
+run_workload() {
+    local workload=$1 run=$2 i
+    local dir="$WORK/$workload.$run"
+    mkdir -p "$dir"
+    cd "$dir" || return 1
+
+    local config="$dir/config.txt"
+    : > "$config"
+    for i in $(seq 0 $((CLIENTS - 1))); do
+        make_workload "src_$i" "$workload" || return 1
+        mkdir -p "dst_$i"
+        local target=$(( (i + 1) % CLIENTS ))
+        echo "/src_$i@127.0.0.1:$((CLIENT_PORT + i)) /dst_$i@127.0.0.1:$((CLIENT_PORT + target))" >> "$config"
+    done
+    local files=$(find src_* -type f | wc -l)
+    local bytes=$(find src_* -type f -printf '%s\n' | awk '{ sum += $1 } END { printf "%d", sum }')
+
+    PIDS=()
+    for i in $(seq 0 $((CLIENTS - 1))); do
+        "$ROOT/nfs_client" -p $((CLIENT_PORT + i)) > "client_$i.out" 2>&1 &
+        PIDS+=($!)
+    done
+    sleep 0.5
+
+    local start=$(date +%s.%N) started=$SECONDS
+    # shellcheck disable=SC2086
+    "$ROOT/nfs_manager" -l manager.log -c "$config" -n "$WORKERS" -p "$MANAGER_PORT" -b "$BUFFER" \
+        -e "$ENGINE" -q "$QUEUE" -m "$METRICS_PORT" $EXTRA_ARGS > manager.out 2>&1 &
+    local manager=$!
+    PIDS+=($manager)
+
+    # Done once every file is synced or has failed
+    local metrics="" done_files=0 errors=0 status=ok
+    while :; do
+        sleep 0.05
+        if ! kill -0 "$manager" 2>/dev/null; then
+            status=manager_exited
+            break
+        fi
+        metrics=$(scrape)
+        done_files=$(metric_sum nfs_pair_files_total <<< "$metrics")
+        errors=$(metric_sum nfs_pair_errors_total <<< "$metrics")
+        if [ $((done_files + errors)) -ge "$files" ]; then
+            break
+        fi
+        if [ $((SECONDS - started)) -ge "$TIMEOUT" ]; then
+            status=timeout
+            break
+        fi
+    done
+    local end=$(date +%s.%N)
+
+    # utime + stime of the manager, before it starts shutting down
+    local cpu_ticks=0
+    if [ -r "/proc/$manager/stat" ]; then
+        cpu_ticks=$(sed 's/.*) //' "/proc/$manager/stat" | awk '{ print $12 + $13 }')
+    fi
+
+    kill -TERM "$manager" 2>/dev/null
+    wait "$manager" 2>/dev/null
+    for pid in "${PIDS[@]}"; do
+        kill "$pid" 2>/dev/null
+    done
+    wait 2>/dev/null
+    PIDS=()
+
+    if [ "$status" = ok ] && [ "$errors" -gt 0 ]; then
+        status=errors
+    fi
+    for i in $(seq 0 $((CLIENTS - 1))); do
+        if [ "$status" = ok ] && ! diff -q <(cd "src_$i" && find . -type f | sort) \
+                                             <(cd "dst_$i" 2>/dev/null && find . -type f | sort) > /dev/null; then
+            status=incomplete
+        fi
+    done
+
+    local seconds=$(calc "$end - $start")
+    local p50=$(histogram_quantile_ms nfs_transfer_seconds 0.50 <<< "$metrics")
+    local p99=$(histogram_quantile_ms nfs_transfer_seconds 0.99 <<< "$metrics")
+    local moved=$(metric_sum nfs_pair_bytes_total <<< "$metrics")
+    local cpu_seconds=$(calc "$cpu_ticks / $CLK_TCK")
+    local mb_per_s=$(calc "$bytes / 1000000 / $seconds")
+    local files_per_s=$(calc "$done_files / $seconds")
+
+    local result
+    result=$(printf '{"workload":"%s","run":%d,"status":"%s","commit":"%s","engine":"%s","queue":"%s",' \
+                    "$workload" "$run" "$status" "$COMMIT" "$ENGINE" "$QUEUE")
+    result+=$(printf '"clients":%d,"workers":%d,"buffer":%d,"extra_args":"%s",' \
+                     "$CLIENTS" "$WORKERS" "$BUFFER" "${EXTRA_ARGS//\"/\\\"}")
+    result+=$(printf '"files":%d,"files_synced":%d,"errors":%d,"bytes":%d,"bytes_moved":%d,' \
+                     "$files" "$done_files" "$errors" "$bytes" "$moved")
+    result+=$(printf '"seconds":%.3f,"mb_per_s":%.2f,"files_per_s":%.1f,' "$seconds" "$mb_per_s" "$files_per_s")
+    result+=$(printf '"p50_ms":%s,"p99_ms":%s,"manager_cpu_s":%.2f,"manager_cpu_pct":%.1f}' "$p50" "$p99" \
+                     "$cpu_seconds" "$(calc "100 * $cpu_seconds / $seconds")")
+    echo "$result" >> "$OUT"
+
+    printf "  %-6s run %d: %-10s %8.1f MB/s %9.1f files/s  p50 %s ms  p99 %s ms  cpu %.2fs\n" \
+           "$workload" "$run" "$status" "$mb_per_s" "$files_per_s" "$p50" "$p99" "$cpu_seconds"
+
+    cd "$WORK" || return 1
+    if [ "$KEEP" != true ]; then
+        rm -rf "$dir"
+    fi
+}
+
+echo "📊 NFS transfer benchmark"
+echo "   clients=$CLIENTS workers=$WORKERS buffer=$BUFFER engine=$ENGINE queue=$QUEUE commit=$COMMIT"
+
+FAILED=0
+IFS=',' read -ra WORKLOAD_LIST <<< "$WORKLOADS"
+for workload in "${WORKLOAD_LIST[@]}"; do
+    for run in $(seq 1 "$RUNS"); do
+        run_workload "$workload" "$run" || FAILED=1
+    done
+done
+
+echo "Results appended to $OUT"
+exit $FAILED
@@ -29,20 +29,28 @@
 #include <sys/stat.h>
 #include <dirent.h>
 #include <stdarg.h>
+#include <stdint.h>
 
 // System Constants
 #define MAX_PATH 1024              ///< Maximum path length for directories and files
 #define MAX_BUFFER_SIZE 8192       ///< Maximum buffer size for I/O operations
 #define MAX_COMMAND_SIZE 4096      ///< Maximum size for command strings
-#define MAX_CONNECTIONS 10         ///< Maximum concurrent connections
+#define MAX_CONNECTIONS 128        ///< Listen backlog for server sockets
 #define DEFAULT_WORKERS 5          ///< Default number of worker threads
+#define DEFAULT_CLIENT_WORKERS 16  ///< Default number of nfs_client connection handlers
 #define MAX_FILENAME 256           ///< Maximum filename length
 #define MAX_HOST_SIZE 256          ///< Maximum hostname/IP address length
+#define JOB_INLINE_NAME 64         ///< File names shorter than this are stored in the job
+#define DEFAULT_SPLIT_SIZE (64LL * 1024 * 1024) ///< Files larger than this move as parallel ranges
+#define DEFAULT_PRIORITY 1         ///< Scheduling weight of a pair without priority=
+#define MAX_PRIORITY 100           ///< Largest accepted priority=
+#define MAX_RATE_KIB (16LL * 1024 * 1024) ///< Largest accepted rate= and -R (KiB/s, 16 GiB/s)
 
 // Protocol Commands
 #define CMD_ADD "add"              ///< Console command to add sync pair
 #define CMD_CANCEL "cancel"        ///< Console command to cancel sync
 #define CMD_SHUTDOWN "shutdown"    ///< Console command to shutdown manager
+#define CMD_STATS "stats"          ///< Console command to show transfer metrics
 #define CMD_LIST "LIST"            ///< Client command to list directory files
 #define CMD_PULL "PULL"            ///< Client command to retrieve file
 #define CMD_PUSH "PUSH"            ///< Client command to store file
@@ -55,24 +63,81 @@
 #define DT_REG 8                   ///< Regular file type identifier
 #endif
 
+struct range_group;
+struct file_batch;
+struct job_ring;
+struct worker_queue;
+struct worker_stats;
+struct pair_queue;
+struct sync_info;
+struct throttle_endpoint;
+struct throttle_host;
+
 /**
  * @brief Structure representing a file synchronization job
  *
  * This structure contains all information needed for a worker thread
  * to synchronize a single file between source and target locations.
  * Jobs are queued and processed by the thread pool.
+ *
+ * Endpoints and directories are those of the sync pair, which every
+ * job of the pair shares by reference instead of copying them.
  */
 typedef struct sync_job {
-    char source_host[MAX_HOST_SIZE];  ///< Source server hostname/IP
-    int source_port;                  ///< Source server port number
-    char source_dir[MAX_PATH];        ///< Source directory path
-    char target_host[MAX_HOST_SIZE];  ///< Target server hostname/IP
-    int target_port;                  ///< Target server port number
-    char target_dir[MAX_PATH];        ///< Target directory path
-    char filename[MAX_FILENAME];     ///< Name of file to synchronize
+    struct sync_info *info;           ///< Sync pair of the file (one reference held)
+    char *filename;                   ///< Name of file to synchronize (name_inline or heap)
+    uint32_t delta_block_size;        ///< Block size for a delta update, 0 copies the whole file
+    int64_t range_offset;             ///< First byte of a ranged job
+    int64_t range_length;             ///< Bytes of a ranged job
+    struct range_group *group;        ///< File the range belongs to, NULL for whole-file jobs
+    struct file_batch *batch;         ///< Small files moved together, NULL for single-file jobs
+    uint64_t enqueued_us;             ///< When the job was queued (metrics_now_us())
+    uint64_t journal_id;              ///< Id of the job in the journal (journal.h), 0 if not recorded
+    int64_t mtime;                    ///< Source mtime set by a resumed whole file (range_length > 0, no group)
     struct sync_job *next;           ///< Pointer to next job in queue
+    char name_inline[JOB_INLINE_NAME]; ///< Storage for short file names
 } sync_job_t;
 
+/**
+ * @brief How a sync pair decides whether a file must be copied
+ */
+typedef enum {
+    SYNC_CHECK_NONE = 0,              ///< Always copy every file
+    SYNC_CHECK_MTIME,                 ///< Skip files with same size and mtime on target
+    SYNC_CHECK_HASH                   ///< Skip files with same size and content hash
+} sync_check_t;
+
+/**
+ * @brief Per-pair options, given as key=value after the target spec
+ *
+ * On config lines and in the console 'add' command, for example:
+ * "/src@host:8001 /dst@host:8002 check=hash".
+ */
+typedef struct {
+    sync_check_t check;               ///< Change detection (check=none|mtime|hash)
+    int delta;                        ///< Update large changed files with block deltas (delta=on|off)
+    int64_t split_size;               ///< Larger files move as parallel ranges of this size, 0 disables (split=<MiB>|off)
+    int priority;                     ///< Jobs dispatched per scheduling round (priority=1..MAX_PRIORITY)
+    int watch;                        ///< Follow source changes after the first sync (watch=on|off)
+    int compress;                     ///< zlib level of file data on the wire, 0 sends it raw (compress=on|off|1-9)
+    int batch;                        ///< Move small files in batch jobs (batch=on|off)
+    int recursive;                    ///< Sync subdirectories too (recursive=on|off)
+    int64_t rate;                     ///< File data of the pair in bytes per second, 0 for no limit (rate=<KiB/s>|off)
+} sync_options_t;
+
+/**
+ * @brief Token bucket of a rate limit (see throttle.h)
+ *
+ * All zero is a bucket that was never used; it starts full.
+ */
+typedef struct {
+    double tokens;                    ///< Bytes that may go out now, negative while in debt
+    uint64_t updated_us;              ///< When tokens was last refilled, 0 if never
+    int busy;                         ///< Spin lock of the two above (throttle.c)
+} token_bucket_t;
+
+struct manifest;
+
 /**
  * @brief Structure for tracking directory synchronization pairs
  *
@@ -89,23 +154,62 @@ typedef struct sync_info {
     int active;                       ///< Whether sync is currently active
     time_t last_sync_time;           ///< Timestamp of last synchronization
     int error_count;                 ///< Number of errors encountered
+    uint64_t bytes_synced;           ///< Bytes pushed to the target
+    uint64_t files_synced;           ///< Files brought up to date
+    sync_options_t options;          ///< Per-pair options
+    token_bucket_t bucket;           ///< Rate limit of options.rate (throttle.h)
+    struct throttle_endpoint *capped[2]; ///< Capped source and target client, NULL if uncapped (throttle.c)
+    struct throttle_host *limited[2]; ///< Rate-limited source and target host, NULL if unlimited (throttle.c)
+    int throttle_generation;         ///< Limits the two above were looked up under, 0 if not yet
+    struct manifest *manifest;       ///< Last known target file state
+    int id;                          ///< Pair id reported to the console, 0 until stored
+    int refcount;                    ///< References held by the store and queued jobs
+    int watching;                    ///< A watch thread follows the source directory
+    struct pair_queue *queue;        ///< Its round-robin queue while it has jobs there (queue_mutex)
     struct sync_info *next;          ///< Pointer to next sync info in list
+    struct sync_info *prev;          ///< Previous sync info in list
+    struct sync_info *hash_next;     ///< Next sync info in the same store bucket
 } sync_info_t;
 
+/**
+ * @brief Buffered reader over a connected socket
+ *
+ * Lets protocol code consume a stream byte-exactly: command headers are
+ * read out of the buffer without ever swallowing payload bytes that
+ * belong to the next read. Each reader is owned by one connection.
+ */
+typedef struct {
+    int fd;                          ///< Socket being read
+    char data[MAX_BUFFER_SIZE];      ///< Read-ahead buffer
+    size_t start;                    ///< Offset of first unread byte
+    size_t end;                      ///< Offset one past last buffered byte
+} buffered_reader_t;
+
 /**
  * @brief Thread pool structure for managing worker threads
  *
  * Implements a producer-consumer pattern with a bounded buffer for
  * synchronization jobs. Provides thread-safe job queuing and processing
  * with proper synchronization primitives.
+ *
+ * The buffer is a set of per-pair queues under queue_mutex, served in
+ * weighted round-robin, a lock-free ring (ring set) or one queue per
+ * worker with work stealing (workers set). With
+ * the ring and worker queues, queue_mutex and the condition variables
+ * are only used by threads that found the buffer empty or full.
  */
 typedef struct {
     pthread_t *threads;               ///< Array of worker thread handles
     int thread_count;                 ///< Number of worker threads
-    sync_job_t *job_queue_head;      ///< Head of job queue linked list
-    sync_job_t *job_queue_tail;      ///< Tail of job queue linked list
-    int queue_size;                  ///< Current number of jobs in queue
+    struct pair_queue *current_pair; ///< Pair queue served next (circular list of non-empty queues)
+    int queue_size;                  ///< Current number of jobs in queue (list and worker queues)
     int buffer_size;                 ///< Maximum queue capacity
+    struct job_ring *ring;           ///< Lock-free job ring, NULL if unused
+    struct worker_queue *workers;    ///< Per-worker queues (thread_count), NULL if unused
+    struct worker_stats *stats;      ///< Counters of each worker (thread_count)
+    int next_worker;                 ///< Index handed to the next worker that starts
+    int waiting_consumers;           ///< Workers sleeping on an empty ring or worker queues
+    int waiting_producers;           ///< Producers sleeping on a full ring or worker queues
     pthread_mutex_t queue_mutex;     ///< Mutex for queue access
     pthread_cond_t queue_not_empty;  ///< Condition variable for consumers
     pthread_cond_t queue_not_full;   ///< Condition variable for producers
@@ -169,6 +273,69 @@ int send_command(int sockfd, const char *command);
  */
 int receive_response(int sockfd, char *buffer, size_t buffer_size);
 
+/**
+ * @brief Receive exactly len bytes from a socket
+ * @param sockfd Socket file descriptor
+ * @param buf Output buffer
+ * @param len Number of bytes to receive
+ * @return 0 on success, -1 on EOF or error before len bytes arrived
+ *
+ * Never consumes more than len bytes from the socket.
+ */
+int recv_exact(int sockfd, void *buf, size_t len);
+
+/**
+ * @brief Initialize buffered reader for a socket
+ * @param reader Reader to initialize
+ * @param fd Connected socket file descriptor
+ */
+void reader_init(buffered_reader_t *reader, int fd);
+
+/**
+ * @brief Read a single byte through the reader
+ * @param reader Buffered reader
+ * @return Byte value (0-255) on success, -1 on EOF or error
+ */
+int reader_getc(buffered_reader_t *reader);
+
+/**
+ * @brief Read up to len bytes, draining buffered data first
+ * @param reader Buffered reader
+ * @param buf Output buffer
+ * @param len Maximum number of bytes to read
+ * @return Number of bytes read, 0 on EOF, -1 on error
+ *
+ * Large reads with an empty buffer go straight to recv() to avoid
+ * an extra copy.
+ */
+ssize_t reader_read(buffered_reader_t *reader, void *buf, size_t len);
+
+/**
+ * @brief Read exactly len bytes through the reader
+ * @param reader Buffered reader
+ * @param buf Output buffer
+ * @param len Number of bytes to read
+ * @return 0 on success, -1 on EOF or error before len bytes arrived
+ */
+int reader_read_exact(buffered_reader_t *reader, void *buf, size_t len);
+
+/**
+ * @brief Read a newline-terminated line
+ * @param reader Buffered reader
+ * @param line Output buffer (newline stripped, always NUL-terminated)
+ * @param size Size of output buffer
+ * @return Line length on success, -1 on EOF/error or if line does not fit
+ */
+int reader_read_line(buffered_reader_t *reader, char *line, size_t size);
+
+/**
+ * @brief Wait until the reader has data or the peer closed
+ * @param reader Buffered reader
+ * @param timeout_ms Maximum wait in milliseconds (-1 waits forever)
+ * @return Positive if a read will not block, 0 on timeout, -1 on error
+ */
+int reader_wait(buffered_reader_t *reader, int timeout_ms);
+
 // Parsing Functions
 
 /**
@@ -195,4 +362,31 @@ int parse_directory_spec(const char *spec, char *host, int *port, char *dir);
 int parse_config_line(const char *line, char *source_host, int *source_port, 
                      char *source_dir, char *target_host, int *target_port, char *target_dir);
 
+/**
+ * @brief Set per-pair options to their defaults
+ * @param options Options to initialize (check=none: every file is copied, as without options)
+ */
+void init_sync_options(sync_options_t *options);
+
+/**
+ * @brief Parse space-separated key=value pair options
+ * @param text Option text, e.g. "check=hash" (NULL or empty keeps defaults)
+ * @param options Options to update
+ * @return 0 on success, -1 on unknown key or invalid value
+ */
+int parse_sync_options(const char *text, sync_options_t *options);
+
+// Hashing
+
+#define FNV1A_INIT 0xcbf29ce484222325ULL  ///< FNV-1a 64-bit offset basis
+
+/**
+ * @brief Continue a 64-bit FNV-1a hash over more bytes
+ * @param hash Hash so far (FNV1A_INIT to start)
+ * @param data Bytes to add
+ * @param len Number of bytes
+ * @return Updated hash
+ */
+uint64_t fnv1a_update(uint64_t hash, const void *data, size_t len);
+
 #endif // COMMON_H
\ No newline at end of file
@@ -0,0 +1,89 @@
+/**
+ * @file compress.h
+ * @brief Per-frame zlib compression of file data
+ *
+ * Pairs with compress=on (or a level 1-9) ask the source for compressed
+ * file data. The source compresses every DATA frame of a PULL or RANGE
+ * reply as its own zlib stream of at most COMPRESS_CHUNK_SIZE file bytes
+ * and marks it with DATA_FLAG_ZLIB; the manager relays those frames
+ * untouched and the target inflates them while writing. Since no stream
+ * spans frames, both ends only ever hold one chunk in memory.
+ *
+ * The first chunk of a file doubles as a sample: when it does not shrink
+ * by COMPRESS_MIN_SAVING percent, the file is taken to be compressed
+ * already (archives, images, media) and the rest of it is sent raw, still
+ * with zero-copy I/O. Later chunks that do not shrink are sent raw too.
+ */
+
+#ifndef COMPRESS_H
+#define COMPRESS_H
+
+#include "common.h"
+
+#define COMPRESS_CHUNK_SIZE (256 * 1024)     ///< File bytes per compressed DATA frame
+#define COMPRESS_MIN_SAVING 10               ///< Percent a chunk must shrink to be sent compressed
+#define COMPRESS_DEFAULT_LEVEL 1             ///< zlib level of compress=on
+#define COMPRESS_MAX_LEVEL 9                 ///< Highest zlib level
+
+/**
+ * @brief Receiver of inflated data
+ * @return 0 on success, -1 to stop inflating
+ */
+typedef int (*inflate_emit_fn)(void *ctx, const void *data, size_t len);
+
+/**
+ * @brief Inflate state of one compressed DATA frame
+ */
+typedef struct {
+    void *stream;                    ///< zlib stream (z_stream)
+    uint64_t produced;               ///< Bytes inflated so far
+    int finished;                    ///< The zlib stream ended
+} frame_inflater_t;
+
+/**
+ * @brief Largest compressed size of a chunk
+ * @param len Chunk length
+ * @return Output buffer size compress_frame() needs for len bytes
+ */
+size_t compress_frame_bound(size_t len);
+
+/**
+ * @brief Compress one chunk as a self-contained zlib stream
+ * @param in Chunk bytes
+ * @param len Chunk length
+ * @param out Output buffer of compress_frame_bound(len) bytes
+ * @param out_size Size of out
+ * @param level zlib level (1-9)
+ * @return Compressed length, 0 if the chunk does not shrink by
+ *         COMPRESS_MIN_SAVING percent (send it raw), -1 on error
+ */
+long compress_frame(const void *in, size_t len, void *out, size_t out_size, int level);
+
+/**
+ * @brief Start inflating a compressed DATA frame
+ * @param inflater State to initialize
+ * @return 0 on success, -1 on error
+ */
+int frame_inflate_begin(frame_inflater_t *inflater);
+
+/**
+ * @brief Inflate the next piece of a compressed DATA frame
+ * @param inflater State from frame_inflate_begin()
+ * @param in Compressed bytes, in order
+ * @param len Number of bytes
+ * @param emit Receiver of inflated data
+ * @param ctx Passed to emit
+ * @return 0 on success, -1 if the data is corrupt, inflates to more than
+ *         FRAME_DATA_MAX bytes or emit failed
+ */
+int frame_inflate_feed(frame_inflater_t *inflater, const void *in, size_t len,
+                       inflate_emit_fn emit, void *ctx);
+
+/**
+ * @brief Finish inflating a frame and free its state
+ * @param inflater State from frame_inflate_begin()
+ * @return 0 if the zlib stream ended exactly at the end of the frame, -1 otherwise
+ */
+int frame_inflate_end(frame_inflater_t *inflater);
+
+#endif // COMPRESS_H
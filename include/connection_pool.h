@@ -0,0 +1,127 @@
+/**
+ * @file connection_pool.h
+ * @brief Persistent sessions between nfs_manager and nfs_client instances
+ *
+ * Every PULL, PUSH and LIST used to run on a fresh TCP connection, so a
+ * directory of many small files cost two handshakes (and two TIME_WAIT
+ * sockets) per file. This module keeps idle sessions per (host, port)
+ * endpoint and hands them out to worker threads, which return them after
+ * the exchange if the protocol state allows it.
+ *
+ * A session is only returned to the pool when its stream is in a clean
+ * state: every reply byte has been consumed and no stream is left open.
+ * Idle sessions are health-checked before reuse and expire after
+ * POOL_IDLE_TIMEOUT_SEC, well before nfs_client drops idle connections.
+ *
+ * Only version 2 sessions are kept. Clients that answer HELLO as version
+ * 1 serve one connection at a time, so an idle session would block them;
+ * the connection that refused HELLO is replaced by a fresh one, and they
+ * are remembered as legacy for a while so that new connections to them
+ * skip the HELLO round trip. A HELLO that fails or times out says
+ * nothing about the version and never marks an endpoint legacy.
+ */
+
+#ifndef CONNECTION_POOL_H
+#define CONNECTION_POOL_H
+
+#include "common.h"
+
+#define POOL_MAX_IDLE_PER_HOST 4    ///< Default idle sessions kept per endpoint
+#define POOL_IDLE_TIMEOUT_SEC 30    ///< Idle sessions older than this are closed
+
+/**
+ * @brief Connected session to an nfs_client
+ */
+typedef struct {
+    int fd;                          ///< Connected socket, -1 if none
+    int version;                     ///< Negotiated protocol version
+    char host[MAX_HOST_SIZE];        ///< Endpoint host
+    int port;                        ///< Endpoint port
+    uint32_t features;               ///< FEATURE_* flags the client accepted
+} client_conn_t;
+
+/**
+ * @brief Idle session kept by the pool
+ */
+typedef struct pooled_conn {
+    int fd;                          ///< Connected socket
+    int version;                     ///< Negotiated protocol version
+    uint32_t features;               ///< FEATURE_* flags the client accepted
+    time_t last_used;                ///< When the session was returned
+    struct pooled_conn *next;        ///< Next idle session of the endpoint
+} pooled_conn_t;
+
+/**
+ * @brief Idle sessions of one (host, port) endpoint
+ */
+typedef struct pool_endpoint {
+    char host[MAX_HOST_SIZE];        ///< Endpoint host
+    int port;                        ///< Endpoint port
+    pooled_conn_t *idle;             ///< Idle sessions, most recently used first
+    int idle_count;                  ///< Number of idle sessions
+    time_t legacy_until;             ///< Endpoint answered as version 1 until then
+    struct pool_endpoint *next;      ///< Next endpoint in pool
+} pool_endpoint_t;
+
+/**
+ * @brief Thread-safe pool of idle client sessions
+ */
+typedef struct connection_pool {
+    pool_endpoint_t *endpoints;      ///< Known endpoints
+    int max_idle_per_host;           ///< Idle sessions kept per endpoint (0 disables reuse)
+    int idle_timeout;                ///< Seconds an idle session may be kept
+    long connects;                   ///< New connections opened
+    long reuses;                     ///< Sessions handed out again
+    pthread_mutex_t mutex;           ///< Mutex for thread-safe access
+} connection_pool_t;
+
+// Pool Management
+
+/**
+ * @brief Create connection pool
+ * @param max_idle_per_host Idle sessions kept per endpoint (0 disables reuse)
+ * @param idle_timeout Seconds an idle session may be kept
+ * @return Pointer to new pool on success, NULL on error
+ */
+connection_pool_t* create_connection_pool(int max_idle_per_host, int idle_timeout);
+
+/**
+ * @brief Close all idle sessions and free the pool
+ * @param pool Pool to destroy (NULL is ignored)
+ */
+void destroy_connection_pool(connection_pool_t *pool);
+
+// Session Operations
+
+/**
+ * @brief Borrow a session to an endpoint
+ * @param pool Connection pool (NULL always opens a new connection)
+ * @param host Endpoint host
+ * @param port Endpoint port
+ * @param conn Output session
+ * @return 0 on success, -1 if no connection could be established
+ *
+ * Hands out the most recently used healthy idle session, or connects
+ * and negotiates the protocol version when none is available.
+ */
+int acquire_connection(connection_pool_t *pool, const char *host, int port, client_conn_t *conn);
+
+/**
+ * @brief Return a borrowed session
+ * @param pool Connection pool (NULL closes the session)
+ * @param conn Session to return; fd is reset to -1
+ * @param reusable Non-zero if the session stream is in a clean state
+ *
+ * Sessions that are not reusable, speak version 1, or exceed the
+ * per-endpoint idle limit, are closed.
+ */
+void release_connection(connection_pool_t *pool, client_conn_t *conn, int reusable);
+
+/**
+ * @brief Check whether an idle session is still usable
+ * @param fd Connected socket with no outstanding request
+ * @return 1 if healthy, 0 if the peer closed it or sent unexpected data
+ */
+int connection_is_healthy(int fd);
+
+#endif // CONNECTION_POOL_H
@@ -0,0 +1,164 @@
+/**
+ * @file delta.h
+ * @brief Block delta encoding for updating large files in place
+ *
+ * A delta transfer updates an existing target file (the basis) without
+ * sending the parts that did not change, in the manner of rsync:
+ *
+ * 1. The target splits the basis into blocks of block_size bytes and
+ *    sends one signature per full block: a rolling weak sum and a strong
+ *    FNV-1a hash (SIGS command).
+ * 2. The source slides a block-sized window over its copy of the file.
+ *    Wherever the window matches a basis block it emits a COPY
+ *    instruction, everything in between becomes LITERAL data (DELTA
+ *    command).
+ * 3. The target rebuilds the file from basis blocks and literals into a
+ *    temporary file, which replaces the basis once the stream completes.
+ *
+ * Signature records are DELTA_SIG_SIZE bytes: u32 weak sum, u64 strong
+ * hash. A delta stream starts with the u32 block size, followed by
+ * instructions, all big-endian:
+ * - DELTA_OP_COPY:    u64 first block index, u32 block count
+ * - DELTA_OP_LITERAL: u32 length, then length bytes of file data
+ *
+ * The strong hash is not cryptographic; the weak and strong sums together
+ * give 96 bits per block, which is enough for accidental changes but not
+ * against crafted collisions.
+ */
+
+#ifndef DELTA_H
+#define DELTA_H
+
+#include "common.h"
+
+#define DELTA_MIN_BLOCK 2048                 ///< Smallest block size used
+#define DELTA_MAX_BLOCK (128 * 1024)         ///< Largest block size used
+#define DELTA_MIN_FILE_SIZE (256 * 1024)     ///< Smaller files are always copied in full
+#define DELTA_SIG_SIZE 12                    ///< Bytes per block signature
+#define DELTA_MAX_SIGNATURES (64 * 1024 * 1024) ///< Largest signature set a source accepts (bytes)
+#define DELTA_LITERAL_MAX (1024 * 1024)      ///< Largest literal run in one instruction
+#define DELTA_READ_SIZE (1024 * 1024)        ///< Bytes the encoder reads ahead of its window
+
+#define DELTA_OP_COPY 'C'                    ///< Copy blocks from the basis
+#define DELTA_OP_LITERAL 'L'                 ///< Insert literal bytes
+
+/**
+ * @brief Rolling weak checksum over a window of bytes
+ */
+typedef struct {
+    uint32_t a;                      ///< Sum of bytes
+    uint32_t b;                      ///< Sum of running sums
+    size_t len;                      ///< Window length
+} rolling_sum_t;
+
+/**
+ * @brief Receiver of encoded delta output
+ * @return 0 on success, -1 to stop encoding
+ */
+typedef int (*delta_emit_fn)(void *ctx, const void *data, size_t len);
+
+/**
+ * @brief State of a target rebuilding a file from a delta stream
+ *
+ * The stream may be fed in arbitrary pieces; instruction headers split
+ * across pieces are reassembled.
+ */
+typedef struct {
+    int basis_fd;                    ///< Basis file, read with pread()
+    int out_fd;                      ///< File being rebuilt
+    uint32_t block_size;             ///< Block size from the stream header, 0 until read
+    unsigned char header[13];        ///< Partially received instruction header
+    size_t header_len;               ///< Bytes in header
+    uint32_t literal_left;           ///< Literal bytes still to come
+    uint64_t written;                ///< Bytes of the rebuilt file written so far
+    int error;                       ///< First errno hit, 0 if none
+} delta_patch_t;
+
+// Checksums
+
+/**
+ * @brief Compute weak sum of a window
+ * @param sum Output state
+ * @param data Window start
+ * @param len Window length
+ */
+void rolling_init(rolling_sum_t *sum, const unsigned char *data, size_t len);
+
+/**
+ * @brief Slide window by one byte
+ * @param sum Window state
+ * @param out Byte leaving the window
+ * @param in Byte entering the window
+ */
+void rolling_roll(rolling_sum_t *sum, unsigned char out, unsigned char in);
+
+/**
+ * @brief Current weak sum of the window
+ * @param sum Window state
+ * @return 32-bit weak sum
+ */
+uint32_t rolling_digest(const rolling_sum_t *sum);
+
+/**
+ * @brief Choose block size for a basis file
+ * @param file_size Size of the basis in bytes
+ * @return Power of two near sqrt(file_size), within DELTA_MIN_BLOCK..DELTA_MAX_BLOCK
+ */
+uint32_t delta_block_size(int64_t file_size);
+
+// Encoding
+
+/**
+ * @brief Write signatures of all full blocks of a file
+ * @param fd Basis file, read from the current position
+ * @param block_size Block size
+ * @param emit Output callback, called once per signature
+ * @param ctx Callback context
+ * @return Number of blocks on success, -1 on read or output error
+ */
+long delta_write_signatures(int fd, uint32_t block_size, delta_emit_fn emit, void *ctx);
+
+/**
+ * @brief Encode a file against basis signatures
+ * @param fd File to encode, read sequentially from the current position
+ * @param block_size Block size the signatures were made with
+ * @param sigs Signature records (DELTA_SIG_SIZE bytes each)
+ * @param sig_count Number of signatures
+ * @param emit Output callback
+ * @param ctx Callback context
+ * @return Number of file bytes encoded, -1 on read, allocation or output error
+ *
+ * The file is read through a window of a few blocks, so its size does
+ * not matter and concurrent changes to it cannot crash the reader.
+ * Consecutive matching blocks are merged into one COPY instruction.
+ */
+int64_t delta_encode(int fd, uint32_t block_size, const unsigned char *sigs, size_t sig_count,
+                     delta_emit_fn emit, void *ctx);
+
+// Decoding
+
+/**
+ * @brief Prepare to rebuild a file
+ * @param patch State to initialize
+ * @param basis_fd Basis file
+ * @param out_fd Output file, written sequentially
+ */
+void delta_patch_init(delta_patch_t *patch, int basis_fd, int out_fd);
+
+/**
+ * @brief Apply the next piece of a delta stream
+ * @param patch Patch state
+ * @param data Stream bytes
+ * @param len Number of bytes
+ * @return 0 on success, -1 on error (patch->error is set)
+ */
+int delta_patch_feed(delta_patch_t *patch, const unsigned char *data, size_t len);
+
+/**
+ * @brief Check that the stream ended on an instruction boundary
+ * @param patch Patch state
+ * @return 0 if complete, -1 otherwise
+ */
+int delta_patch_finish(delta_patch_t *patch);
+
+#endif // DELTA_H
@@ -0,0 +1,77 @@
+/**
+ * @file durability.h
+ * @brief How the client lands received files and when they reach the disk
+ *
+ * Every file a client receives is written under a hidden name next to its
+ * target path (the part file, see protocol.h) and renamed over the path
+ * once complete, so readers see the old copy or the new one, never a torn
+ * one, and a failed transfer leaves the old copy alone. durability_land()
+ * does that final step. What it does before acknowledging is set with
+ * nfs_client option -f:
+ * - none: nothing; the kernel writes the data back when it sees fit and a
+ *   power loss may leave renamed files empty or short;
+ * - file: fsync() of the file before the rename and of its directory
+ *   after it, so an acknowledged file is on disk;
+ * - group[:<files>[:<ms>]]: one syncfs() of the working directory's
+ *   filesystem once <files> files have landed, or <ms> milliseconds after
+ *   the first file not yet synced, whichever comes first. Files are
+ *   acknowledged before that sync, so a crash loses at most one group.
+ *
+ * The group sync runs on a thread of its own, started with the first
+ * file, so no connection worker waits for it.
+ */
+
+#ifndef DURABILITY_H
+#define DURABILITY_H
+
+#include "common.h"
+
+#define DURABILITY_GROUP_FILES 64       ///< Default files per group sync
+#define DURABILITY_GROUP_MS 100         ///< Default longest delay of a group sync
+
+/**
+ * @brief When landed files are flushed to disk
+ */
+typedef enum {
+    DURABILITY_NONE = 0,                ///< Leave write-back to the kernel
+    DURABILITY_FILE,                    ///< fsync() every file and its directory
+    DURABILITY_GROUP                    ///< syncfs() every few files or milliseconds
+} durability_mode_t;
+
+/**
+ * @brief Select the durability mode for subsequent files
+ * @param mode Mode to use
+ * @param group_files Files per group sync (DURABILITY_GROUP only, > 0)
+ * @param group_ms Longest delay of a group sync (DURABILITY_GROUP only, > 0)
+ */
+void set_durability(durability_mode_t mode, int group_files, int group_ms);
+
+/**
+ * @brief Parse a durability mode as given to -f and select it
+ * @param text "none", "file" or "group[:<files>[:<ms>]]"
+ * @return 0 on success, -1 if the text is malformed
+ */
+int parse_durability(const char *text);
+
+/**
+ * @brief The selected durability mode
+ * @return Mode set by set_durability() (DURABILITY_NONE by default)
+ */
+durability_mode_t durability_mode(void);
+
+/**
+ * @brief Close a complete part file and rename it over its target path
+ * @param fd Open part file, closed in any case
+ * @param part_path Path the file was written under
+ * @param path Target path
+ * @return 0 on success, -1 with errno set (the part file is left in place)
+ */
+int durability_land(int fd, const char *part_path, const char *path);
+
+/**
+ * @brief Files landed in group mode and not synced yet
+ * @return Files waiting for the next group sync
+ */
+int durability_pending(void);
+
+#endif // DURABILITY_H
@@ -0,0 +1,91 @@
+/**
+ * @file job_ring.h
+ * @brief Bounded lock-free multi-producer multi-consumer job ring
+ *
+ * The ring is an alternative to the mutex-protected job list of the
+ * thread pool (manager option -q ring). It follows Dmitry Vyukov's
+ * bounded MPMC queue: every cell carries a sequence number that tells
+ * producers and consumers whose turn it is, so push and pop only
+ * compete on one compare-and-swap of their own position counter and
+ * never take a lock.
+ *
+ * The capacity is the requested size rounded up to a power of two (at
+ * least 2, as one cell cannot tell a full ring from an empty one).
+ * Push fails when the ring is full and pop when it is empty; waiting in
+ * those cases is left to the caller.
+ */
+
+#ifndef JOB_RING_H
+#define JOB_RING_H
+
+#include "common.h"
+
+#define JOB_RING_CACHE_LINE 64      ///< Separation of the hot counters
+
+/**
+ * @brief Ring cell: one job slot and its turn counter
+ */
+typedef struct {
+    size_t sequence;                 ///< Position the cell is ready for
+    sync_job_t *job;                 ///< Stored job while the cell is full
+} job_ring_cell_t;
+
+/**
+ * @brief Bounded MPMC ring of jobs
+ *
+ * Producer and consumer positions live on separate cache lines so
+ * workers popping do not invalidate the line producers spin on.
+ */
+typedef struct job_ring {
+    job_ring_cell_t *cells;          ///< Cell array
+    size_t mask;                     ///< Capacity - 1
+    char pad0[JOB_RING_CACHE_LINE];
+    size_t enqueue_pos;              ///< Next position to push to
+    char pad1[JOB_RING_CACHE_LINE];
+    size_t dequeue_pos;              ///< Next position to pop from
+    char pad2[JOB_RING_CACHE_LINE];
+} job_ring_t;
+
+/**
+ * @brief Create empty ring
+ * @param capacity Minimum number of jobs the ring holds
+ * @return Pointer to new ring on success, NULL on error
+ */
+job_ring_t* create_job_ring(int capacity);
+
+/**
+ * @brief Free ring (queued jobs are not freed)
+ * @param ring Ring to destroy (NULL is ignored)
+ */
+void destroy_job_ring(job_ring_t *ring);
+
+/**
+ * @brief Number of cells
+ * @param ring Ring instance
+ * @return Capacity (a power of two)
+ */
+size_t job_ring_capacity(const job_ring_t *ring);
+
+/**
+ * @brief Approximate number of queued jobs
+ * @param ring Ring instance
+ * @return Jobs pushed and not yet popped, read without synchronization
+ */
+size_t job_ring_size(const job_ring_t *ring);
+
+/**
+ * @brief Append job without blocking
+ * @param ring Ring instance
+ * @param job Job to append
+ * @return 0 on success, -1 if the ring is full
+ */
+int job_ring_push(job_ring_t *ring, sync_job_t *job);
+
+/**
+ * @brief Take oldest job without blocking
+ * @param ring Ring instance
+ * @return Job, or NULL if the ring is empty
+ */
+sync_job_t* job_ring_pop(job_ring_t *ring);
+
+#endif // JOB_RING_H
@@ -0,0 +1,166 @@
+/**
+ * @file journal.h
+ * @brief Append-only job journal of the manager (-j <file>)
+ *
+ * The journal is a memory-mapped file of checksummed records:
+ * - pairs added from the console, and pairs cancelled;
+ * - every whole-file job of JOURNAL_MIN_FILE_SIZE bytes or more and every
+ *   range job, when it is queued;
+ * - the offset up to which each of those jobs has pushed its file data,
+ *   in a progress record written after the job's and overwritten in place
+ *   after every chunk, so the file does not grow with the data relayed;
+ * - the end of each job.
+ *
+ * Records go into the page cache with a memcpy, so they survive a crash
+ * or kill of the manager (not of the machine: the mapping is synced only
+ * when the journal is closed). A record torn by a crash fails its
+ * checksum, and it and everything after it is ignored.
+ *
+ * journal_open() replays the file. Console pairs come back with
+ * journal_pair_lines(). Jobs that never ended become resume entries: when
+ * the restarted sync lists the same file with the same size and mtime,
+ * journal_take_resume() hands them back and the file continues where it
+ * stopped instead of being copied again. Ranges that ended are not
+ * repeated, and unfinished ones carry on from their last offset into the
+ * part file of their range group on the target. A whole file carries on from its offset in
+ * its own part file (see FEATURE_PART in protocol.h), or, on a target
+ * that writes in place, when its copy is at least that long. The offset is kept one chunk
+ * behind what was relayed, so the chunk in flight is sent again.
+ * Compressed streams are not resumed: their wire offsets are not file
+ * offsets. Nor are failed jobs: they are ended like finished ones, as the
+ * target discards their part file, and the next listing copies the file
+ * again.
+ *
+ * After replay, and again whenever the file has grown by
+ * JOURNAL_COMPACT_SIZE since, the journal is rewritten (temporary file and
+ * rename) with only the pairs and the jobs still open.
+ *
+ * Every function accepts a NULL journal and then does nothing.
+ */
+
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include "common.h"
+
+#define JOURNAL_MAGIC "NFSJRNL1"            ///< First bytes of a journal file
+#define JOURNAL_GROW (1024 * 1024)          ///< Bytes the file and mapping grow by
+#define JOURNAL_COMPACT_SIZE (4 * 1024 * 1024) ///< Rewrite the journal once it grew by this
+#define JOURNAL_MIN_FILE_SIZE (1024 * 1024) ///< Smaller whole files are simply copied again
+
+/**
+ * @brief An unfinished job found on replay
+ */
+typedef struct journal_entry {
+    uint64_t id;                     ///< Journal id, kept by the resumed job
+    uint64_t pair_key;               ///< journal_pair_key() of its pair
+    int64_t size;                    ///< Source file size when queued
+    int64_t mtime;                   ///< Source file mtime when queued
+    int64_t offset;                  ///< First byte of the job
+    int64_t length;                  ///< Bytes of the job
+    int64_t committed;               ///< File data up to here is on the target
+    uint64_t group;                  ///< Range group of a split file, 0 for a whole file
+    char name[MAX_FILENAME];         ///< File name relative to the pair directory
+    struct journal_entry *next;
+} journal_entry_t;
+
+typedef struct journal journal_t;
+
+/**
+ * @brief Open or create a journal and replay it
+ * @param path Journal file
+ * @return Journal, or NULL if the file cannot be used (reported on stderr)
+ */
+journal_t* journal_open(const char *path);
+
+/**
+ * @brief Sync and close a journal
+ * @param journal Journal to close
+ *
+ * Jobs still open stay in the file and are resumed on the next start.
+ */
+void journal_close(journal_t *journal);
+
+/**
+ * @brief Key of a pair in the journal
+ * @param info Pair
+ * @return Hash of the source and target host, port and directory
+ */
+uint64_t journal_pair_key(const sync_info_t *info);
+
+/**
+ * @brief Record a pair added from the console
+ * @param journal Journal
+ * @param key journal_pair_key() of the pair
+ * @param line "<source> <target> [options]" as on a config line
+ */
+void journal_add_pair(journal_t *journal, uint64_t key, const char *line);
+
+/**
+ * @brief Record a cancelled pair: it is not restored and its jobs are not resumed
+ * @param journal Journal
+ * @param key journal_pair_key() of the pair
+ */
+void journal_drop_pair(journal_t *journal, uint64_t key);
+
+/**
+ * @brief Config lines of the console pairs in the journal
+ * @param journal Journal
+ * @param count Output number of lines
+ * @return Array of count lines, each and the array to free(); NULL if none
+ */
+char** journal_pair_lines(journal_t *journal, int *count);
+
+/**
+ * @brief Record a queued job
+ * @param journal Journal
+ * @param info Pair of the job
+ * @param name File name
+ * @param size Source file size
+ * @param mtime Source file mtime
+ * @param offset First byte of the job
+ * @param length Bytes of the job
+ * @param group Range group id (range_group_t) of a split file, 0 for a whole file
+ * @return Journal id of the job, 0 without a journal or on failure
+ */
+uint64_t journal_add_job(journal_t *journal, const sync_info_t *info, const char *name, int64_t size,
+                         int64_t mtime, int64_t offset, int64_t length, uint64_t group);
+
+/**
+ * @brief Record that a job's file data up to an offset reached the target
+ * @param journal Journal
+ * @param id Journal id of the job (0 is ignored)
+ * @param committed End offset in the file
+ */
+void journal_progress(journal_t *journal, uint64_t id, int64_t committed);
+
+/**
+ * @brief Record the end of a job, successful or not (a failed job is not resumed)
+ * @param journal Journal
+ * @param id Journal id of the job (0 is ignored)
+ */
+void journal_done(journal_t *journal, uint64_t id);
+
+/**
+ * @brief Take the resume entries of a listed file
+ * @param journal Journal
+ * @param info Pair being listed
+ * @param name File name
+ * @param size Listed size
+ * @param mtime Listed mtime
+ * @param entries Output list of entries, each to free()
+ * @return Number of entries; 0 if the file has none or changed since,
+ *         in which case its entries are ended
+ */
+int journal_take_resume(journal_t *journal, const sync_info_t *info, const char *name,
+                        int64_t size, int64_t mtime, journal_entry_t **entries);
+
+/**
+ * @brief End the resume entries of a pair the listing did not come across
+ * @param journal Journal
+ * @param info Pair whose listing finished
+ * @return Number of entries ended
+ */
+int journal_drop_resume(journal_t *journal, const sync_info_t *info);
+
+#endif // JOURNAL_H
@@ -0,0 +1,147 @@
+/**
+ * @file log.h
+ * @brief Asynchronous, leveled logging for the manager
+ *
+ * Logging threads never touch the log file. Each one formats its record
+ * into a ring of its own, a single-producer single-consumer ring that
+ * needs no lock, and goes on. A background flusher drains all rings
+ * every LOG_FLUSH_MS (sooner when a ring fills up), merges the records
+ * in time order, adds the timestamp and writes them out with one fflush
+ * per pass.
+ *
+ * Records below the runtime level (manager option -v) are dropped before
+ * they are formatted, and LOG_DEBUG() and friends compile to nothing for
+ * levels above LOG_COMPILE_LEVEL. Output is the usual "[time] message"
+ * text, or one JSON object per line (manager option -F json).
+ *
+ * Before log_start() and after log_stop(), or for files other than the
+ * one being flushed, records are written synchronously as before.
+ */
+
+#ifndef LOG_H
+#define LOG_H
+
+#include "common.h"
+
+#define LOG_RING_SLOTS 64            ///< Records buffered per thread (power of two)
+#define LOG_LINE_MAX 1024            ///< Longest record body, longer ones are cut
+#define LOG_FLUSH_MS 100             ///< Longest time a record waits for the flusher
+
+/**
+ * @brief Severity of a record, most severe first
+ */
+typedef enum {
+    LOG_LEVEL_ERROR = 0,             ///< Operation failed
+    LOG_LEVEL_WARN,                  ///< Something unexpected, work goes on
+    LOG_LEVEL_INFO,                  ///< Normal events (default level)
+    LOG_LEVEL_DEBUG                  ///< Tracing of individual steps
+} log_level_t;
+
+/**
+ * @brief Layout of written records
+ */
+typedef enum {
+    LOG_FORMAT_TEXT = 0,             ///< "[time] message" lines
+    LOG_FORMAT_JSON                  ///< One JSON object per line
+} log_format_t;
+
+#ifndef LOG_COMPILE_LEVEL
+#define LOG_COMPILE_LEVEL LOG_LEVEL_DEBUG ///< Most verbose level compiled in (-DLOG_COMPILE_LEVEL=...)
+#endif
+
+/// Log at a level; the arguments are not evaluated when the level is off
+#define LOG_AT(level, ...) \
+    do { \
+        if ((level) <= LOG_COMPILE_LEVEL && log_enabled(level)) log_write(level, __VA_ARGS__); \
+    } while (0)
+
+#define LOG_ERROR(...) LOG_AT(LOG_LEVEL_ERROR, __VA_ARGS__)
+#define LOG_WARN(...) LOG_AT(LOG_LEVEL_WARN, __VA_ARGS__)
+#define LOG_INFO(...) LOG_AT(LOG_LEVEL_INFO, __VA_ARGS__)
+#define LOG_DEBUG(...) LOG_AT(LOG_LEVEL_DEBUG, __VA_ARGS__)
+
+// Configuration
+
+/**
+ * @brief Set the most verbose level that is written
+ * @param level Runtime level (LOG_LEVEL_INFO by default)
+ */
+void set_log_level(log_level_t level);
+
+/**
+ * @brief Set the output format of records written afterwards
+ * @param format Record layout
+ */
+void set_log_format(log_format_t format);
+
+/**
+ * @brief Parse level name as given on the command line
+ * @param name "error", "warn", "info" or "debug"
+ * @param level Output level
+ * @return 0 on success, -1 if the name is unknown
+ */
+int parse_log_level(const char *name, log_level_t *level);
+
+/**
+ * @brief Parse format name as given on the command line
+ * @param name "text" or "json"
+ * @param format Output format
+ * @return 0 on success, -1 if the name is unknown
+ */
+int parse_log_format(const char *name, log_format_t *format);
+
+/**
+ * @brief Check whether records of a level are written
+ * @param level Level to check
+ * @return 1 if enabled, 0 otherwise
+ */
+int log_enabled(log_level_t level);
+
+// Flusher
+
+/**
+ * @brief Start the background flusher for a log file
+ * @param file Log file; log_message() calls for it become asynchronous
+ * @return 0 on success, -1 on error (logging stays synchronous)
+ */
+int log_start(FILE *file);
+
+/**
+ * @brief Write out everything buffered and stop the flusher
+ *
+ * Call once the other logging threads are gone; later records are
+ * written synchronously. Rings of threads still running stay registered
+ * and are drained again after the next log_start().
+ */
+void log_stop(void);
+
+// Records
+
+/**
+ * @brief Log a message to stdout, through the flusher when it runs
+ * @param level Record level
+ * @param format Printf-style format string
+ *
+ * These records take the place of the manager's old diagnostic printfs
+ * and, like them, never go to the log file, whose content stays the
+ * events and log_message() lines it always had.
+ */
+void log_write(log_level_t level, const char *format, ...);
+
+/**
+ * @brief Log a worker event of one sync pair at INFO level
+ * @param file Log file, written synchronously unless it is the flushed one
+ * @param source Source spec ("dir@host:port")
+ * @param target Target spec
+ * @param op Operation ("PULL", "PUSH", ...)
+ * @param result Outcome ("SUCCESS", "ERROR", ...)
+ * @param format Printf-style format string of the details
+ *
+ * Text lines keep the "[time] [source] [target] [thread] [op] [result]
+ * [details]" layout; JSON records carry each as a field. Not echoed.
+ * Events with an ERROR result are logged at LOG_LEVEL_ERROR.
+ */
+void log_event(FILE *file, const char *source, const char *target, const char *op,
+               const char *result, const char *format, ...);
+
+#endif // LOG_H
@@ -0,0 +1,122 @@
+/**
+ * @file manifest.h
+ * @brief Per-pair record of file metadata for incremental synchronization
+ *
+ * A manifest maps file names to size, modification time and (optionally)
+ * content hash. The manager fills it from a metadata LIST of the target
+ * directory and checks every source entry against it, so only new or
+ * changed files are enqueued.
+ *
+ * Metadata LIST lines (protocol version 2, CMD frame flag LIST_FLAG_META)
+ * have the form "<size> <mtime> <hash> <name>", where hash is 16 hex
+ * digits of the FNV-1a content hash, or "-" when it was not requested.
+ * The name comes last so that it may contain spaces.
+ */
+
+#ifndef MANIFEST_H
+#define MANIFEST_H
+
+#include "common.h"
+
+#define MANIFEST_BUCKETS 1024       ///< Initial hash table size
+
+/**
+ * @brief Metadata of one listed file
+ */
+typedef struct {
+    char name[MAX_FILENAME];         ///< File name relative to the pair directory
+    int64_t size;                    ///< Size in bytes, -1 if unknown
+    int64_t mtime;                   ///< Modification time (seconds since epoch)
+    uint64_t hash;                   ///< FNV-1a content hash
+    int has_hash;                    ///< Whether hash is valid
+} file_meta_t;
+
+/**
+ * @brief Manifest hash table entry
+ */
+typedef struct manifest_entry {
+    file_meta_t meta;                ///< Recorded metadata
+    struct manifest_entry *next;     ///< Next entry in bucket
+} manifest_entry_t;
+
+/**
+ * @brief Thread-safe table of file metadata, keyed by name
+ */
+typedef struct manifest {
+    manifest_entry_t **buckets;      ///< Bucket array
+    size_t bucket_count;             ///< Number of buckets (power of two)
+    size_t count;                    ///< Number of entries
+    pthread_mutex_t mutex;           ///< Mutex for thread-safe access
+} manifest_t;
+
+// Manifest Management
+
+/**
+ * @brief Create empty manifest
+ * @return Pointer to new manifest on success, NULL on error
+ */
+manifest_t* create_manifest(void);
+
+/**
+ * @brief Free manifest and all entries
+ * @param manifest Manifest to destroy (NULL is ignored)
+ */
+void destroy_manifest(manifest_t *manifest);
+
+/**
+ * @brief Remove all entries
+ * @param manifest Manifest to clear
+ */
+void manifest_clear(manifest_t *manifest);
+
+// Entry Operations
+
+/**
+ * @brief Insert or replace metadata of a file
+ * @param manifest Manifest instance
+ * @param meta Metadata to record
+ * @return 0 on success, -1 on allocation failure
+ */
+int manifest_put(manifest_t *manifest, const file_meta_t *meta);
+
+/**
+ * @brief Look up metadata of a file
+ * @param manifest Manifest instance
+ * @param name File name
+ * @param meta Output metadata (may be NULL)
+ * @return 1 if found, 0 if not
+ */
+int manifest_get(manifest_t *manifest, const char *name, file_meta_t *meta);
+
+/**
+ * @brief Decide whether a source file has to be copied
+ * @param manifest Known target state
+ * @param source Metadata of the source file
+ * @param check Change detection mode of the pair
+ * @return 1 if the file is new or changed, 0 if the target copy is current
+ *
+ * SYNC_CHECK_MTIME compares size and mtime, SYNC_CHECK_HASH compares
+ * size and content hash (falling back to mtime if a hash is missing).
+ */
+int manifest_needs_sync(manifest_t *manifest, const file_meta_t *source, sync_check_t check);
+
+// Listing Format
+
+/**
+ * @brief Parse metadata LIST line
+ * @param line Line without newline
+ * @param meta Output metadata
+ * @return 0 on success, -1 if the line is malformed
+ */
+int parse_list_entry(const char *line, file_meta_t *meta);
+
+/**
+ * @brief Format metadata LIST line
+ * @param meta Metadata to format
+ * @param out Output buffer (receives a trailing newline)
+ * @param size Size of output buffer
+ * @return Line length, or -1 if it does not fit
+ */
+int format_list_entry(const file_meta_t *meta, char *out, size_t size);
+
+#endif // MANIFEST_H
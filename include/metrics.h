@@ -0,0 +1,117 @@
+/**
+ * @file metrics.h
+ * @brief Counters and latency histograms of the manager
+ *
+ * Workers count bytes, files and errors per sync pair (in sync_info_t)
+ * and per worker (in thread_pool_t), and record how long each job waited
+ * in the queue and took to transfer. The connection pool records how long
+ * new client connections take. Everything is updated with relaxed atomic
+ * adds, so recording costs no lock on the transfer path.
+ *
+ * The numbers are read by the console 'stats' command, as a summary, and
+ * by an optional HTTP endpoint (manager option -m <port>) in the
+ * Prometheus text exposition format.
+ *
+ * Histograms have METRICS_BUCKETS buckets whose upper bounds double from
+ * METRICS_FIRST_BOUND_US, plus one for everything slower.
+ */
+
+#ifndef METRICS_H
+#define METRICS_H
+
+#include "common.h"
+
+#define METRICS_BUCKETS 18               ///< Bounded histogram buckets
+#define METRICS_FIRST_BOUND_US 100       ///< Upper bound of the first bucket (microseconds)
+#define METRICS_MAX_REQUEST 4096         ///< Largest HTTP request read by the endpoint
+
+struct sync_info_store;
+
+/**
+ * @brief Latency histogram
+ */
+typedef struct {
+    uint64_t buckets[METRICS_BUCKETS + 1]; ///< Observations per bucket, the last has no bound
+    uint64_t sum_us;                 ///< Sum of observed values (microseconds)
+} histogram_t;
+
+/**
+ * @brief Manager-wide metrics
+ */
+typedef struct {
+    histogram_t transfer;            ///< Time per successful job, from dequeue to done
+    histogram_t queue_wait;          ///< Time jobs spent queued
+    histogram_t connect;             ///< New client connections, connect and negotiation
+    uint64_t connect_errors;         ///< Connections that could not be opened
+} metrics_t;
+
+/**
+ * @brief Per-worker counters, one per worker thread of the pool
+ */
+typedef struct worker_stats {
+    uint64_t jobs;                   ///< Jobs finished
+    uint64_t errors;                 ///< Jobs that failed
+    uint64_t bytes;                  ///< Bytes pushed to targets
+    uint64_t busy_us;                ///< Time spent running jobs (microseconds)
+} worker_stats_t;
+
+/**
+ * @brief Metrics recorded by this process
+ */
+extern metrics_t g_metrics;
+
+// Recording
+
+/**
+ * @brief Current monotonic time in microseconds
+ * @return Microseconds since an arbitrary start
+ */
+uint64_t metrics_now_us(void);
+
+/**
+ * @brief Record one observation
+ * @param histogram Histogram to update
+ * @param value_us Observed value in microseconds
+ */
+void histogram_observe(histogram_t *histogram, uint64_t value_us);
+
+/**
+ * @brief Estimate a quantile from the buckets
+ * @param histogram Histogram to read
+ * @param quantile Quantile between 0 and 1
+ * @return Upper bound of the bucket holding the quantile in microseconds,
+ *         0 if empty, UINT64_MAX if it is beyond the last bound
+ */
+uint64_t histogram_quantile(const histogram_t *histogram, double quantile);
+
+// Reporting
+
+/**
+ * @brief Write all metrics in the Prometheus text format
+ * @param out Output stream
+ * @param pool Thread pool whose queue and workers are reported, may be NULL
+ * @param store Sync pairs to report, may be NULL
+ */
+void write_metrics(FILE *out, thread_pool_t *pool, struct sync_info_store *store);
+
+/**
+ * @brief Write the human-readable summary sent for the console 'stats' command
+ * @param out Output stream
+ * @param pool Thread pool whose queue and workers are reported, may be NULL
+ * @param store Sync pairs to report, may be NULL
+ */
+void write_stats_summary(FILE *out, thread_pool_t *pool, struct sync_info_store *store);
+
+/**
+ * @brief Answer one HTTP request on the metrics endpoint
+ * @param client_fd Accepted connection, closed by the caller
+ * @param pool Thread pool to report
+ * @param store Sync pairs to report
+ * @return 0 on success, -1 on error
+ *
+ * Any GET gets the metrics, other methods 405. The connection is not
+ * kept alive.
+ */
+int serve_metrics_request(int client_fd, thread_pool_t *pool, struct sync_info_store *store);
+
+#endif // METRICS_H
@@ -9,7 +9,10 @@
  * Supported operations:
  * - LIST: Return directory file listing
  * - PULL: Send file content to requesting client
- * - PUSH: Receive and store file content from manager
+ * - PUSH: Receive and store file content from manager, landing each file
+ *   with a rename once complete (see durability.h)
+ * - SIGS/DELTA: Block signatures and deltas for updating large files (see delta.h)
+ * - WATCH: Push metadata of changed files as they are written (see protocol.h)
  *
  * The client uses low-level I/O syscalls for all file operations as required
  * by the specification, avoiding high-level library functions.
@@ -19,6 +22,95 @@
 #define NFS_CLIENT_LOGIC_H
 
 #include "common.h"
+#include "protocol.h"
+#include "delta.h"
+#include "durability.h"
+
+#define MAX_SESSION_STREAMS 16       ///< Concurrent PUSH streams per v2 session
+#define CLIENT_IDLE_TIMEOUT_MS 60000 ///< Idle sessions are closed after this long
+#define WATCH_QUIET_MS 200           ///< Changes are sent once a watched directory is this long quiet
+#define WATCH_MAX_DELAY_MS 2000      ///< ... but never held back longer than this
+#define WATCH_BATCH_MAX 256          ///< Distinct changed names collected per batch
+
+/**
+ * @brief State of an in-progress PUSH transfer
+ *
+ * Tracks the file being received between the start (-1) and end (0)
+ * PUSH markers of a text transfer, or between the OPEN and END frames
+ * of a protocol version 2 stream.
+ */
+typedef struct {
+    int fd;                          ///< Open target file, -1 when idle
+    off_t offset;                    ///< File position the next chunk is written at
+    char path[MAX_PATH];             ///< Path the transfer was started for
+    uint32_t stream_id;              ///< Stream id (version 2 only)
+    int in_use;                      ///< Slot holds an open stream (version 2 only)
+    int error;                       ///< First errno hit by the stream, 0 if none
+    delta_patch_t *patch;            ///< Rebuild state of a delta stream, NULL for plain data
+    int basis_fd;                    ///< Existing file a delta stream is applied to
+    char temp_path[MAX_PATH + 32];   ///< Part file written and renamed over path at the end (not for ranges)
+    int resumable;                   ///< Keep the part file if the session drops (plain version 2 streams)
+} push_transfer_t;
+
+/**
+ * @brief Per-connection state of a client session
+ *
+ * Every accepted connection owns exactly one session, living on the stack
+ * of the thread that serves it. Because nothing is shared between sessions,
+ * many files can be received in parallel without any locking.
+ */
+typedef struct {
+    buffered_reader_t reader;        ///< Buffered input from the connection
+    int version;                     ///< Negotiated protocol version (1 = text)
+    push_transfer_t push;            ///< Current text PUSH transfer, if any
+    push_transfer_t streams[MAX_SESSION_STREAMS]; ///< Open version 2 streams
+} client_session_t;
+
+/**
+ * @brief File I/O engine used to serve PULL and store PUSH requests
+ *
+ * CLIENT_IO_URING batches file reads with socket sends (PULL) and socket
+ * receives with file writes (PUSH) on a per-worker io_uring with
+ * registered buffers. Where io_uring is unavailable it falls back to the
+ * buffered system call path; compressed and delta chunks always use it.
+ */
+typedef enum {
+    CLIENT_IO_SENDFILE = 0,          ///< Zero-copy sendfile(), falls back to buffered
+    CLIENT_IO_BUFFERED,              ///< read() into a user buffer + send()
+    CLIENT_IO_URING                  ///< Batched io_uring reads, writes, sends and receives
+} client_io_engine_t;
+
+/**
+ * @brief Select the I/O engine for subsequent PULL and PUSH requests
+ * @param engine Engine to use
+ */
+void set_client_io_engine(client_io_engine_t engine);
+
+/**
+ * @brief Parse I/O engine name as given on the command line
+ * @param name Engine name ("sendfile", "buffered" or "uring")
+ * @param engine Output engine value
+ * @return 0 on success, -1 if the name is unknown
+ */
+int parse_client_io_engine(const char *name, client_io_engine_t *engine);
+
+// Session Management
+
+/**
+ * @brief Initialize session state for a freshly accepted connection
+ * @param session Session to initialize
+ * @param client_fd Connected socket
+ */
+void init_client_session(client_session_t *session, int client_fd);
+
+/**
+ * @brief Release resources held by a session
+ * @param session Session to clean up
+ *
+ * Closes any file left open by an unfinished PUSH transfer or stream.
+ * Does not close the connection socket.
+ */
+void close_client_session(client_session_t *session);
 
 // Command Handlers
 
@@ -29,7 +121,9 @@
  *
  * Scans the specified directory and sends a list of regular files
  * to the client, one filename per line, terminated with a "." marker.
- * Uses stat() for portable file type detection.
+ * Uses fstatat() for portable file type detection. Lines are batched
+ * into MAX_BUFFER_SIZE sends. The "." marker is also sent when the
+ * directory cannot be opened, so the listing is always terminated.
  */
 void handle_list_command(int client_fd, const char *dir_path);
 
@@ -37,28 +131,40 @@ void handle_list_command(int client_fd, const char *dir_path);
  * @brief Handle PULL command to send file content
  * @param client_fd Socket connected to requesting client
  * @param file_path Local file path to send
+ * @return 0 on success, -1 if the connection can no longer be used
  *
  * Opens the specified file, sends the file size followed by a space,
  * then streams the complete file content. Sends error code (-1) and
- * error message if file cannot be accessed.
+ * error message if file cannot be accessed. When the content cannot be
+ * sent in full (the peer went away, or the file shrank while being sent)
+ * the caller must close the connection: the peer is still waiting for
+ * the advertised bytes.
+ *
+ * With the sendfile engine the content goes from the page cache straight
+ * to the socket. If sendfile() is not supported for the descriptors the
+ * remainder is sent through the buffered read()/send() path.
  */
-void handle_pull_command(int client_fd, const char *file_path);
+int handle_pull_command(int client_fd, const char *file_path);
 
 /**
  * @brief Handle PUSH command to receive file content
- * @param client_fd Socket connected to sending client
+ * @param session Session of the sending connection
  * @param file_path Local file path to create/write
  * @param chunk_size Size of data chunk to receive
+ * @return 0 on success, -1 if the connection can no longer be used
  *
  * Handles chunked file reception with special chunk sizes:
- * - chunk_size = -1: Start new file (truncate if exists)
- * - chunk_size = 0: End of file (close file)
+ * - chunk_size = -1: Start new file in its hidden part file
+ * - chunk_size = 0: End of file (rename the part file over the path,
+ *   see durability_land())
  * - chunk_size > 0: Data chunk to append to file
  *
- * Maintains static file descriptor across multiple PUSH calls
- * for the same file transfer operation.
+ * The open file lives in the session's transfer context, so concurrent
+ * sessions never see each other's files. Chunk data is always consumed
+ * from the socket, even when it cannot be written, to keep the stream
+ * in sync.
  */
-void handle_push_command(int client_fd, const char *file_path, int chunk_size);
+int handle_push_command(client_session_t *session, const char *file_path, int chunk_size);
 
 // Connection Management
 
@@ -74,7 +180,34 @@ void handle_push_command(int client_fd, const char *file_path, int chunk_size);
  * - "LIST <directory_path>"
  * - "PULL <file_path>"
  * - "PUSH <file_path> <chunk_size> [data]"
+ * - "HELLO <version>": switch the connection to binary framing
+ *
+ * After a successful "HELLO 2" the rest of the session is read as frames
+ * (see protocol.h). LIST and PULL arrive as CMD frames; PUSH transfers
+ * arrive as OPEN/DATA/END streams, and several can be open at once.
+ * Each stream is acknowledged with END or ERROR once it has been closed.
+ * SIGS and DELTA are only served on version 2 sessions. A stream opened
+ * with OPEN_FLAG_DELTA is rebuilt next to the existing file and renamed
+ * over it once END confirms the size.
+ *
+ * The manager keeps sessions open across jobs, so any number of commands
+ * may follow each other. A session idle for CLIENT_IDLE_TIMEOUT_MS is
+ * closed to free its connection worker.
  */
 void handle_client_connection(int client_fd);
 
+/**
+ * @brief Serve connections on a listening socket with a bounded worker pool
+ * @param server_fd Listening socket created by create_server_socket()
+ * @param worker_count Number of connection handler threads to run
+ * @return 0 when all workers have exited, -1 if no worker could be started
+ *
+ * Starts worker_count threads that each block in accept() on the shared
+ * listening socket and run handle_client_connection() for the sessions
+ * they accept. This lets one nfs_client serve as many concurrent LIST,
+ * PULL and PUSH sessions as there are workers, while the kernel spreads
+ * incoming connections across idle threads. Blocks until the workers exit.
+ */
+int run_client_workers(int server_fd, int worker_count);
+
 #endif //NFS_CLIENT_LOGIC_H
\ No newline at end of file
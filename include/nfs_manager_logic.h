@@ -21,6 +21,44 @@
 #include "common.h"
 #include "thread_pool.h"
 #include "sync_info.h"
+#include "connection_pool.h"
+#include "protocol.h"
+#include "manifest.h"
+#include "delta.h"
+#include "log.h"
+#include "metrics.h"
+#include "throttle.h"
+#include "journal.h"
+
+#define ENUMERATOR_THREADS 2        ///< Pairs listed concurrently in the background
+#define WATCH_POLL_MS 1000          ///< How often watch threads check for cancel and shutdown
+#define METRICS_POLL_MS 1000        ///< How often the metrics thread checks for shutdown
+
+/**
+ * @brief Pair waiting to be listed
+ */
+typedef struct enum_request {
+    sync_info_t *info;               ///< Pair to list (one reference held)
+    struct enum_request *next;       ///< Next request in queue
+} enum_request_t;
+
+/**
+ * @brief Background stage that lists sync pairs and feeds the pool
+ *
+ * 'add' (and the config file) only queue the pair here, so the console
+ * gets its answer at once. Enumerator threads run the LIST and enqueue
+ * the jobs, and they are the ones that wait when the job queue is full,
+ * never a console thread.
+ */
+typedef struct {
+    pthread_t threads[ENUMERATOR_THREADS]; ///< Enumerator threads
+    int thread_count;                ///< Threads started
+    enum_request_t *head;            ///< Oldest pending request
+    enum_request_t *tail;            ///< Newest pending request
+    pthread_mutex_t mutex;           ///< Protects the request queue
+    pthread_cond_t not_empty;        ///< Signaled when a request arrives
+    int shutdown;                    ///< Threads exit when set
+} enumerator_t;
 
 /**
  * @brief Main manager structure containing all system state
@@ -32,6 +70,7 @@
 typedef struct {
     char *logfile_path;               ///< Path to manager log file
     char *config_file_path;           ///< Path to configuration file
+    char *journal_path;               ///< Path to the job journal (-j), NULL without one
     int worker_limit;                 ///< Maximum number of worker threads
     int port;                         ///< TCP port for console connections
     int buffer_size;                  ///< Maximum job queue size
@@ -39,6 +78,21 @@ typedef struct {
     int server_sockfd;                ///< Server socket for console connections
     thread_pool_t *thread_pool;       ///< Worker thread pool instance
     sync_info_store_t *sync_store;    ///< Sync pair information store
+    connection_pool_t *connection_pool; ///< Idle sessions to nfs_client instances
+    int pool_idle_limit;              ///< Idle sessions kept per client (0 disables reuse)
+    int relay_buffer_kib;             ///< Buffer size of the pipeline engine in KiB (-B)
+    int relay_depth;                  ///< Buffers in the ring of the pipeline engine (-D)
+    enumerator_t enumerator;          ///< Background listing of added pairs
+    int consoles;                     ///< Console connections being served
+    pthread_mutex_t console_mutex;    ///< Protects consoles
+    pthread_cond_t consoles_done;     ///< Signaled when a console thread exits
+    int watches;                      ///< Pairs followed by a watch thread (watch=on)
+    pthread_mutex_t watch_mutex;      ///< Protects watches
+    pthread_cond_t watches_done;      ///< Signaled when a watch thread exits
+    int metrics_port;                 ///< Port of the HTTP metrics endpoint, 0 if disabled
+    int metrics_sockfd;               ///< Listening socket of the endpoint, -1 if none
+    pthread_t metrics_thread;         ///< Thread serving the endpoint
+    int metrics_started;              ///< metrics_thread is running
     int shutdown_requested;           ///< Shutdown flag
 } nfs_manager_t;
 
@@ -98,15 +152,24 @@ void cleanup_manager(nfs_manager_t *manager);
  * @param manager Manager instance
  * @param source_spec Source directory specification (/path@host:port)
  * @param target_spec Target directory specification (/path@host:port)
+ * @param options Per-pair key=value options, e.g. "check=hash" (may be NULL)
+ * @param pair_id Output id of the new pair (may be NULL)
  * @return 0 on success, 1 if already exists, -1 on error
+ *
+ * Returns as soon as the pair is stored; the directory is listed by the
+ * enumeration stage, whose failures go to the log.
  */
-int handle_add_command(nfs_manager_t *manager, const char *source_spec, const char *target_spec);
+int handle_add_command(nfs_manager_t *manager, const char *source_spec, const char *target_spec,
+                       const char *options, int *pair_id);
 
 /**
  * @brief Handle 'cancel' command to stop synchronization
  * @param manager Manager instance
  * @param source_spec Source directory specification to cancel
  * @return 0 on success, 1 if not found, -1 on error
+ *
+ * Drops the pair's queued jobs at once (see purge_sync_jobs()); transfers
+ * already running stop before their next chunk and abort their stream.
  */
 int handle_cancel_command(nfs_manager_t *manager, const char *source_spec);
 
@@ -117,6 +180,18 @@ int handle_cancel_command(nfs_manager_t *manager, const char *source_spec);
  */
 int handle_shutdown_command(nfs_manager_t *manager);
 
+/**
+ * @brief Handle 'stats' command
+ * @param manager Manager instance
+ * @param response Output buffer for the summary
+ * @param size Size of response; a longer summary is cut
+ * @return 0 on success, -1 on error
+ *
+ * Reports queue depth, latency percentiles and the counters of every
+ * pair and worker (see write_stats_summary()).
+ */
+int handle_stats_command(nfs_manager_t *manager, char *response, size_t size);
+
 // Connection Handling
 
 /**
@@ -129,6 +204,62 @@ int handle_shutdown_command(nfs_manager_t *manager);
  */
 void handle_console_connection(nfs_manager_t *manager, int client_fd);
 
+/**
+ * @brief Serve console connection on its own thread
+ * @param manager Manager instance
+ * @param client_fd Connected console socket (closed by the thread)
+ * @return 0 on success, -1 if no thread could be started (fd is closed)
+ *
+ * Several consoles can be connected at once; cleanup_manager() waits
+ * for their threads, which notice shutdown within a second.
+ */
+int start_console_thread(nfs_manager_t *manager, int client_fd);
+
+// Enumeration Stage
+
+/**
+ * @brief Start enumerator threads
+ * @param manager Manager whose thread pool receives the jobs
+ * @return 0 on success, -1 on error
+ */
+int start_enumerator(nfs_manager_t *manager);
+
+/**
+ * @brief Queue sync pair for background listing
+ * @param manager Manager instance
+ * @param info Pair to list (a reference is taken)
+ * @return 0 on success, -1 on error or shutdown
+ */
+int request_enumeration(nfs_manager_t *manager, sync_info_t *info);
+
+/**
+ * @brief Stop enumerator threads and drop pending requests
+ * @param manager Manager instance
+ *
+ * The thread pool must already be shutting down, so that a thread
+ * blocked on a full job queue returns.
+ */
+void stop_enumerator(nfs_manager_t *manager);
+
+// Metrics Endpoint
+
+/**
+ * @brief Serve metrics over HTTP on manager->metrics_port
+ * @param manager Manager instance, its pool and store already created
+ * @return 0 on success, -1 on error
+ *
+ * One thread answers scrapes one at a time (see serve_metrics_request()).
+ */
+int start_metrics_endpoint(nfs_manager_t *manager);
+
+/**
+ * @brief Stop the metrics thread and close its socket
+ * @param manager Manager instance
+ *
+ * The thread notices manager->shutdown_requested within METRICS_POLL_MS.
+ */
+void stop_metrics_endpoint(nfs_manager_t *manager);
+
 // Synchronization Operations
 
 /**
@@ -138,7 +269,13 @@ void handle_console_connection(nfs_manager_t *manager, int client_fd);
  * @return 0 on success, -1 on error
  *
  * Connects to source client, retrieves file list, and creates
- * synchronization jobs for each file in the worker queue.
+ * synchronization jobs for each file in the worker queue. Blocks while
+ * the queue is full; runs on enumerator threads. Listing stops early
+ * when the pair is cancelled or the pool shuts down.
+ *
+ * Pairs with watch=on are also followed afterwards: a watch thread holds
+ * a WATCH session to the source and enqueues files as the client reports
+ * them changed, until the pair is cancelled or the manager shuts down.
  */
 int start_directory_sync(nfs_manager_t *manager, sync_info_t *sync_info);
 
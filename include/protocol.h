@@ -0,0 +1,344 @@
+/**
+ * @file protocol.h
+ * @brief Binary framing used between nfs_manager workers and nfs_client
+ *
+ * Protocol version 1 is the original text protocol: LIST, PULL and PUSH
+ * command lines, with every PUSH chunk carrying its own text header.
+ * Version 2 is negotiated per connection with "HELLO 2" / "OK 2". After
+ * that, everything on the connection travels as frames: a fixed 16-byte
+ * header followed by length payload bytes.
+ *
+ * Frame header layout (all fields big-endian):
+ * - byte 0:      magic (FRAME_MAGIC)
+ * - byte 1:      opcode (frame_opcode_t)
+ * - bytes 2-3:   flags (opcode specific, 0 if unused)
+ * - bytes 4-7:   stream id
+ * - bytes 8-15:  payload length
+ *
+ * A file transfer is a stream. The target path is sent once, in the
+ * OPEN frame, and is followed by any number of large DATA frames and one
+ * END frame. Requests such as LIST and PULL are sent as CMD frames that
+ * carry the usual text command line. Their replies come back as DATA
+ * frames on the same stream id, closed by END or ERROR. A PULL reply
+ * therefore already has the shape of a PUSH stream, so the manager can
+ * forward it to the target frame by frame.
+ *
+ * Delta transfers (see delta.h) add two commands. "SIGS <block> <path>"
+ * asks the target for the block signatures of its copy of a file.
+ * "DELTA <block> <path>" is followed by those signatures as DATA frames
+ * and an END frame; the source answers with the encoded delta. The
+ * delta reaches the target as a stream opened with OPEN_FLAG_DELTA, and
+ * its END carries the size of the rebuilt file.
+ *
+ * Large files can be moved as several byte ranges in parallel, each on
+ * its own session. "RANGE <offset> <length> <path>" is a PULL of part of
+ * a file. A stream opened with OPEN_FLAG_RANGE carries a u64 group id
+ * between the offset and the path, naming the transfer the range belongs
+ * to. It writes at the OPEN offset into the hidden part file of that
+ * group next to the target path, and its END carries the end offset of
+ * the range. Once every range has landed,
+ * "COMMIT <size> <mtime> <group> <path>" truncates the part file to size
+ * and renames it over the target path; with COMMIT_FLAG_DISCARD the part
+ * file is removed instead. Two transfers of one file thus never share a
+ * part file.
+ *
+ * "WATCH <dir>" turns the session into a change feed. The client watches
+ * the directory with inotify and, whenever files have been written or
+ * moved in and things have been quiet for a moment, sends their metadata
+ * LIST lines as one DATA frame. A WATCH_RESCAN line means events were
+ * lost and the directory should be listed again. The watch ends when the
+ * manager closes the session or sends ABORT on the stream (answered with
+ * END); ERROR reports a watch that could not be set up or broke.
+ *
+ * Optional features are offered after the version in HELLO and the
+ * client repeats those it supports in its reply ("HELLO 2 zlib" /
+ * "OK 2 zlib"). A client that accepted zlib compresses the DATA frames
+ * of a PULL or RANGE reply when the CMD flags carry a zlib level (see
+ * compress.h); such frames have DATA_FLAG_ZLIB set and are forwarded to
+ * the target as they are. END sizes always count file bytes.
+ *
+ * A client that accepted batch serves "BATCH <dir>", which moves many
+ * small files in one request. Like DELTA, the command is followed by DATA
+ * frames, here the file names relative to dir, one per line, and an END
+ * frame. The client then answers every name in order exactly as it would
+ * answer a PULL of <dir>/<name>: DATA frames and END, or ERROR, all on
+ * the stream of the BATCH. The CMD flags carry a zlib level as for PULL.
+ *
+ * A client that accepted tree walks subdirectories for a LIST with
+ * LIST_FLAG_RECURSIVE and names every file by its path relative to the
+ * listed directory ("a/b/file.txt"). A stream opened with
+ * OPEN_FLAG_MKDIRS creates the missing parent directories of its path.
+ *
+ * A client that accepted part writes every stream without OPEN_FLAG_RANGE
+ * into the part file of its path as well, and renames it over the path
+ * when END arrives, so the old copy stays whole until the new one is.
+ * ABORT, or an END answered with ERROR, removes that part file. A dropped
+ * session leaves it, and a later OPEN at an offset other than 0 continues
+ * it (ERROR at END if it is shorter than the offset), so a transfer cut
+ * off by a manager restart goes on where it stopped. The stream writing
+ * the part file holds a lock on it; a second stream of the same path
+ * opened at offset 0 writes a part file of its own instead, one opened
+ * at another offset fails. Part files nobody has written for
+ * PART_STALE_SEC are removed when LIST reads their directory.
+ */
+
+#ifndef PROTOCOL_H
+#define PROTOCOL_H
+
+#include "common.h"
+#include <stdint.h>
+
+#define PROTOCOL_VERSION 2              ///< Highest protocol version spoken
+#define CMD_HELLO "HELLO"               ///< Protocol negotiation command
+#define CMD_HELLO_PULL CMD_PULL " /.nfs-hello/" CMD_HELLO ///< HELLO as sent, a PULL to a v1 client
+#define FRAME_MAGIC 0xF5                ///< First byte of every frame
+#define FRAME_HEADER_SIZE 16            ///< Encoded frame header size
+#define FRAME_DATA_MAX (1024 * 1024)    ///< Largest DATA payload a sender emits
+#define OPEN_PAYLOAD_FIXED 12           ///< OPEN payload bytes before the path
+#define OPEN_PAYLOAD_GROUP 8            ///< Group id after them with OPEN_FLAG_RANGE
+#define END_PAYLOAD_SIZE 16             ///< END payload size
+#define NEGOTIATE_TIMEOUT_MS 90000      ///< How long to wait for a HELLO reply
+
+// CMD frame flags for LIST
+#define LIST_FLAG_META 0x1              ///< Lines carry size and mtime (see manifest.h)
+#define LIST_FLAG_HASH 0x2              ///< Lines also carry a content hash
+#define LIST_FLAG_RECURSIVE 0x4         ///< Walk subdirectories, names are relative paths
+
+// Delta transfer commands and OPEN flags
+#define CMD_SIGS "SIGS"                 ///< Send block signatures of a file
+#define CMD_DELTA "DELTA"               ///< Encode a file against the signatures that follow
+#define OPEN_FLAG_DELTA 0x1             ///< DATA carries a delta against the existing file
+
+// Ranged transfer commands and flags
+#define CMD_RANGE "RANGE"               ///< Send a byte range of a file
+#define CMD_COMMIT "COMMIT"             ///< Move an assembled part file into place
+#define OPEN_FLAG_RANGE 0x2             ///< Write a range of a file assembled from parts
+#define COMMIT_FLAG_DISCARD 0x1         ///< CMD flag: remove the part file instead
+
+// Compression (see compress.h)
+#define FEATURE_ZLIB 0x1                ///< Peer compresses and inflates DATA frames
+#define FEATURE_ZLIB_NAME "zlib"        ///< Name of FEATURE_ZLIB in HELLO and its reply
+#define FEATURES_SUPPORTED (FEATURE_ZLIB | FEATURE_BATCH | FEATURE_TREE | FEATURE_PART) ///< Features this build offers and accepts
+#define PULL_FLAG_LEVEL_MASK 0xF        ///< CMD flags of PULL and RANGE: zlib level, 0 sends raw data
+#define DATA_FLAG_ZLIB 0x1              ///< DATA payload is one zlib stream of file bytes
+
+// Batched transfers of small files
+#define FEATURE_BATCH 0x2               ///< Peer serves BATCH requests
+#define FEATURE_BATCH_NAME "batch"      ///< Name of FEATURE_BATCH in HELLO and its reply
+#define CMD_BATCH "BATCH"               ///< Send every file named in the lines that follow
+#define BATCH_MAX_FILES 128             ///< Most names a BATCH request carries
+
+// Recursive pairs
+#define FEATURE_TREE 0x4                ///< Peer lists trees and creates parent directories
+#define FEATURE_TREE_NAME "tree"        ///< Name of FEATURE_TREE in HELLO and its reply
+#define OPEN_FLAG_MKDIRS 0x4            ///< Create missing parent directories of the path
+
+// Whole files land through their part file
+#define FEATURE_PART 0x8                ///< Peer continues a whole-file part file at an OPEN offset
+#define FEATURE_PART_NAME "part"        ///< Name of FEATURE_PART in HELLO and its reply
+#define PART_STALE_SEC (24 * 60 * 60)   ///< Unwritten this long, a part file is removed
+
+// Change notification
+#define CMD_WATCH "WATCH"               ///< Stream changes of a directory until aborted
+#define WATCH_RESCAN "*"                ///< Watch line: events were lost, list again
+
+/**
+ * @brief Frame opcodes
+ */
+typedef enum {
+    FRAME_CMD = 1,      ///< Text command line (LIST, PULL, ...) as payload
+    FRAME_OPEN = 2,     ///< Start a PUSH stream: u32 flags, u64 offset, [u64 group], path
+    FRAME_DATA = 3,     ///< Payload bytes of a stream
+    FRAME_END = 4,      ///< End of stream: u64 total size, i64 mtime
+    FRAME_ERROR = 5,    ///< Stream failed: error message as payload
+    FRAME_ABORT = 6     ///< Discard a PUSH stream without committing it
+} frame_opcode_t;
+
+/**
+ * @brief Decoded frame header
+ */
+typedef struct {
+    uint8_t opcode;         ///< One of frame_opcode_t
+    uint16_t flags;         ///< Opcode specific flags
+    uint32_t stream_id;     ///< Stream the frame belongs to
+    uint64_t length;        ///< Number of payload bytes that follow
+} frame_header_t;
+
+// Encoding Helpers
+
+/**
+ * @brief Store 32-bit value big-endian
+ * @param out Destination (4 bytes)
+ * @param value Value to store
+ */
+void put_u32(unsigned char *out, uint32_t value);
+
+/**
+ * @brief Store 64-bit value big-endian
+ * @param out Destination (8 bytes)
+ * @param value Value to store
+ */
+void put_u64(unsigned char *out, uint64_t value);
+
+/**
+ * @brief Load big-endian 32-bit value
+ * @param in Source (4 bytes)
+ * @return Decoded value
+ */
+uint32_t get_u32(const unsigned char *in);
+
+/**
+ * @brief Load big-endian 64-bit value
+ * @param in Source (8 bytes)
+ * @return Decoded value
+ */
+uint64_t get_u64(const unsigned char *in);
+
+/**
+ * @brief Encode frame header into wire format
+ * @param header Header to encode
+ * @param out Output buffer of FRAME_HEADER_SIZE bytes
+ */
+void encode_frame_header(const frame_header_t *header, unsigned char *out);
+
+/**
+ * @brief Decode frame header from wire format
+ * @param in Input buffer of FRAME_HEADER_SIZE bytes
+ * @param header Output header
+ * @return 0 on success, -1 if the magic byte is wrong
+ */
+int decode_frame_header(const unsigned char *in, frame_header_t *header);
+
+/**
+ * @brief Allocate a process-wide unique stream id
+ * @return New stream id, unique until the 32-bit counter wraps
+ */
+uint32_t next_stream_id(void);
+
+// Frame I/O
+
+/**
+ * @brief Send a complete frame
+ * @param sockfd Connected socket
+ * @param opcode Frame opcode
+ * @param stream_id Stream id
+ * @param payload Payload bytes (may be NULL if len is 0)
+ * @param len Payload length
+ * @return 0 on success, -1 on error
+ *
+ * Header and payload leave in a single sendmsg() call.
+ */
+int send_frame(int sockfd, uint8_t opcode, uint32_t stream_id, const void *payload, size_t len);
+
+/**
+ * @brief Send a complete frame with opcode specific flags
+ * @param sockfd Connected socket
+ * @param opcode Frame opcode
+ * @param flags Opcode specific flags (e.g. LIST_FLAG_META on CMD)
+ * @param stream_id Stream id
+ * @param payload Payload bytes (may be NULL if len is 0)
+ * @param len Payload length
+ * @return 0 on success, -1 on error
+ */
+int send_frame_flags(int sockfd, uint8_t opcode, uint16_t flags, uint32_t stream_id,
+                     const void *payload, size_t len);
+
+/**
+ * @brief Send only a frame header, payload is sent separately
+ * @param sockfd Connected socket
+ * @param opcode Frame opcode
+ * @param stream_id Stream id
+ * @param len Payload length announced in the header
+ * @return 0 on success, -1 on error
+ *
+ * Used when the payload is sent with sendfile() or splice().
+ */
+int send_frame_header(int sockfd, uint8_t opcode, uint32_t stream_id, uint64_t len);
+
+/**
+ * @brief Send only a frame header with opcode specific flags
+ * @param sockfd Connected socket
+ * @param opcode Frame opcode
+ * @param flags Opcode specific flags (e.g. DATA_FLAG_ZLIB on DATA)
+ * @param stream_id Stream id
+ * @param len Payload length announced in the header
+ * @return 0 on success, -1 on error
+ */
+int send_frame_header_flags(int sockfd, uint8_t opcode, uint16_t flags, uint32_t stream_id, uint64_t len);
+
+/**
+ * @brief Read frame header through a buffered reader
+ * @param reader Buffered reader of the connection
+ * @param header Output header
+ * @return 0 on success, -1 on EOF, error or bad magic
+ */
+int read_frame_header(buffered_reader_t *reader, frame_header_t *header);
+
+/**
+ * @brief Read frame header directly from a socket
+ * @param sockfd Connected socket
+ * @param header Output header
+ * @return 0 on success, -1 on EOF, error or bad magic
+ *
+ * Consumes exactly FRAME_HEADER_SIZE bytes, so the payload can
+ * afterwards be moved with splice().
+ */
+int recv_frame_header(int sockfd, frame_header_t *header);
+
+/**
+ * @brief Send END frame for a stream
+ * @param sockfd Connected socket
+ * @param stream_id Stream id
+ * @param size Total number of payload bytes in the stream
+ * @param mtime Modification time of the file, 0 if unknown
+ * @return 0 on success, -1 on error
+ */
+int send_end_frame(int sockfd, uint32_t stream_id, uint64_t size, int64_t mtime);
+
+/**
+ * @brief Send ERROR frame with printf-style message
+ * @param sockfd Connected socket
+ * @param stream_id Stream id
+ * @param format Printf-style format string
+ * @return 0 on success, -1 on error
+ */
+int send_error_frame(int sockfd, uint32_t stream_id, const char *format, ...);
+
+// Negotiation
+
+/**
+ * @brief Negotiate protocol version with an nfs_client
+ * @param sockfd Freshly connected socket
+ * @param features Output: FEATURE_* flags the client accepted (may be NULL)
+ * @return Agreed version (1 or 2) on success, -1 on connection error or
+ *         timeout
+ *
+ * Sends "PULL /.nfs-hello/HELLO <PROTOCOL_VERSION> <feature...>" and
+ * waits up to NEGOTIATE_TIMEOUT_MS for "OK <version> [feature...]". A
+ * version 1 client takes the line for a PULL of a missing file and
+ * answers "-1 <error>" at once, which selects the version 1 text
+ * protocol. Its reply is left partly unread, so the connection must be
+ * replaced before any command is sent. A client serves a connection only
+ * once a worker is free, so the reply may come late; the timeout
+ * outlasts the time nfs_client keeps an idle session. Clients that
+ * predate features answer without any.
+ */
+int negotiate_protocol(int sockfd, uint32_t *features);
+
+/**
+ * @brief Parse a space-separated list of feature names
+ * @param text Feature names, may be NULL or empty
+ * @return FEATURE_* flags of the known names, unknown names are ignored
+ */
+uint32_t parse_feature_list(const char *text);
+
+/**
+ * @brief Format the client's reply to HELLO
+ * @param version Version the client agrees to
+ * @param features FEATURE_* flags it accepts, only sent for version 2
+ * @param buffer Output buffer
+ * @param size Size of buffer
+ */
+void format_hello_reply(int version, uint32_t features, char *buffer, size_t size);
+
+#endif // PROTOCOL_H
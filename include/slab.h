@@ -0,0 +1,72 @@
+/**
+ * @file slab.h
+ * @brief Fixed-size object allocator backed by large slabs
+ *
+ * The manager creates and frees one job per listed file. Instead of a
+ * malloc() per job, objects are carved out of slabs of SLAB_OBJECTS and
+ * freed objects go onto a free list for the next allocation, so a large
+ * listing costs a few big allocations and little allocator overhead.
+ * Slabs are kept until the pool is released with nothing allocated.
+ */
+
+#ifndef SLAB_H
+#define SLAB_H
+
+#include "common.h"
+
+#define SLAB_OBJECTS 256            ///< Objects carved from each slab
+#define SLAB_ALIGN 16               ///< Alignment of every object
+
+/**
+ * @brief Pool of equally sized objects
+ */
+typedef struct {
+    size_t object_size;              ///< Requested object size
+    void *free_list;                 ///< Free objects, linked through their first word
+    void *slabs;                     ///< Allocated slabs, linked through their header
+    size_t slab_count;               ///< Number of slabs
+    size_t in_use;                   ///< Objects currently allocated
+    pthread_mutex_t mutex;           ///< Protects all fields
+} slab_pool_t;
+
+/**
+ * @brief Static initializer for a pool of objects of the given size
+ */
+#define SLAB_POOL_INITIALIZER(size) { (size), NULL, NULL, 0, 0, PTHREAD_MUTEX_INITIALIZER }
+
+/**
+ * @brief Initialize empty pool
+ * @param pool Pool to initialize
+ * @param object_size Size of each object in bytes
+ * @return 0 on success, -1 on error
+ */
+int slab_pool_init(slab_pool_t *pool, size_t object_size);
+
+/**
+ * @brief Free all slabs and the pool mutex
+ * @param pool Pool whose objects have all been freed
+ */
+void slab_pool_destroy(slab_pool_t *pool);
+
+/**
+ * @brief Return slab memory to the system if no object is allocated
+ * @param pool Pool instance
+ * @return 0 if the slabs were freed, -1 if objects are still in use
+ */
+int slab_pool_release(slab_pool_t *pool);
+
+/**
+ * @brief Allocate one object
+ * @param pool Pool instance
+ * @return Uninitialized object, NULL if out of memory
+ */
+void* slab_alloc(slab_pool_t *pool);
+
+/**
+ * @brief Return object to the pool
+ * @param pool Pool the object came from
+ * @param object Object to free (NULL is ignored)
+ */
+void slab_free(slab_pool_t *pool, void *object);
+
+#endif // SLAB_H
@@ -6,9 +6,13 @@
  * pair information. It maintains metadata about source-target directory pairs
  * being monitored for synchronization, including status tracking and error counts.
  *
- * The store uses a simple linked list with mutex protection for thread safety.
- * Operations include adding new sync pairs, finding existing pairs, deactivating
- * synchronization, and removing pairs from the store.
+ * The store keeps pairs in a hash table on (source host, port, directory),
+ * so lookups, duplicate checks and removal take constant time however many
+ * pairs are configured. A linked list alongside it keeps the order in which
+ * pairs are printed. Lookups share a read-write lock; only add and remove
+ * take it exclusively. Operations include adding new sync pairs, finding
+ * existing pairs, deactivating synchronization, and removing pairs from the
+ * store.
  */
 
 #ifndef SYNC_INFO_H
@@ -16,16 +20,22 @@
 
 #include "common.h"
 
+#define SYNC_STORE_BUCKETS 64        ///< Initial hash table size
+
 /**
  * @brief Thread-safe store for synchronization pair information
  *
- * Maintains a linked list of sync_info_t structures with thread-safe
- * access through mutex protection. Tracks the total count of stored pairs.
+ * Indexes sync_info_t structures by source in a hash table and links
+ * them, newest first, in a doubly linked list for iteration. Tracks the
+ * total count of stored pairs.
  */
 typedef struct sync_info_store {
-    sync_info_t *head;               ///< Head of sync info linked list
-    pthread_mutex_t mutex;           ///< Mutex for thread-safe access
+    sync_info_t *head;               ///< Head of sync info linked list (newest pair)
+    sync_info_t **buckets;           ///< Hash chains, linked through hash_next
+    size_t bucket_count;             ///< Number of buckets (power of two)
+    pthread_rwlock_t lock;           ///< Shared for lookups, exclusive for changes
     int count;                       ///< Current number of sync pairs
+    int next_id;                     ///< Id given to the next added pair
 } sync_info_store_t;
 
 // Store Management
@@ -62,6 +72,7 @@ void destroy_sync_info_store(sync_info_store_t *store);
  *
  * Creates and initializes a new sync info structure with the provided
  * parameters. Sets active flag to true and initializes timestamps.
+ * The caller holds the only reference.
  */
 sync_info_t* create_sync_info(const char *source_host, int source_port, const char *source_dir,
                              const char *target_host, int target_port, const char *target_dir);
@@ -69,19 +80,40 @@ sync_info_t* create_sync_info(const char *source_host, int source_port, const ch
 /**
  * @brief Free synchronization info memory
  * @param info Sync info to free
+ *
+ * Only for entries nothing else references; shared entries are freed
+ * through release_sync_info().
  */
 void free_sync_info(sync_info_t *info);
 
+/**
+ * @brief Take another reference to a sync info
+ * @param info Sync info (its creator holds the first reference)
+ * @return info
+ *
+ * Jobs reference the pair they belong to, so the pair stays valid while
+ * they are queued even if it is removed from the store.
+ */
+sync_info_t* retain_sync_info(sync_info_t *info);
+
+/**
+ * @brief Drop a reference, freeing the sync info with the last one
+ * @param info Sync info (NULL is ignored)
+ */
+void release_sync_info(sync_info_t *info);
+
 // Store Operations  
 
 /**
  * @brief Add synchronization info to store
  * @param store Sync info store
- * @param info Sync info to add (ownership transferred to store)
+ * @param info Sync info to add (the caller's reference passes to the store)
  * @return 0 on success, 1 if already exists, -1 on error
  *
  * Thread-safe operation to add sync info to store. Checks for duplicates
- * based on source host, port, and directory. Adds to front of list.
+ * based on source host, port, and directory. Adds to front of list and
+ * gives the pair the next id (starting at 1). The table doubles once
+ * pairs outnumber buckets.
  */
 int add_sync_info(sync_info_store_t *store, sync_info_t *info);
 
@@ -106,8 +138,8 @@ sync_info_t* find_sync_info(sync_info_store_t *store, const char *source_host, i
  * @param source_dir Source directory to remove
  * @return 0 on success, 1 if not found, -1 on error
  *
- * Thread-safe removal operation. Frees the sync info memory and
- * updates the linked list structure.
+ * Thread-safe removal operation. Drops the store's reference and
+ * unlinks the pair from its bucket and the list.
  */
 int remove_sync_info(sync_info_store_t *store, const char *source_host, int source_port, const char *source_dir);
 
@@ -121,6 +153,7 @@ int remove_sync_info(sync_info_store_t *store, const char *source_host, int sour
  *
  * Sets the active flag to false, effectively stopping synchronization
  * while keeping the configuration for potential future reactivation.
+ * Only needs the shared lock.
  */
 int deactivate_sync_info(sync_info_store_t *store, const char *source_host, int source_port, const char *source_dir);
 
@@ -142,4 +175,17 @@ void print_sync_info_store(sync_info_store_t *store);
  */
 int get_sync_info_count(sync_info_store_t *store);
 
+/**
+ * @brief Callback of for_each_sync_info()
+ */
+typedef void (*sync_info_visit_fn)(const sync_info_t *info, void *ctx);
+
+/**
+ * @brief Call a function for every stored pair, newest first
+ * @param store Sync info store
+ * @param visit Callback, runs under the shared lock and must not change the store
+ * @param ctx Callback context
+ */
+void for_each_sync_info(sync_info_store_t *store, sync_info_visit_fn visit, void *ctx);
+
 #endif // SYNC_INFO_H
\ No newline at end of file
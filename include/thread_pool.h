@@ -7,8 +7,12 @@
  * a bounded queue, performing file transfers between nfs_client instances.
  *
  * Key features:
- * - Bounded job queue with blocking operations
+ * - Bounded job queue with blocking operations (per-pair lists with
+ *   weighted round-robin, lock-free ring, or per-worker queues with work
+ *   stealing)
  * - Thread-safe job submission and retrieval
+ * - Session caps per client and rate limits per host and pair
+ *   (throttle.h), passing over held back jobs instead of blocking
  * - Graceful shutdown with worker thread cleanup
  * - Individual file synchronization with error handling
  * - Comprehensive logging of sync operations
@@ -18,6 +22,117 @@
 #define THREAD_POOL_H
 
 #include "common.h"
+#include "job_ring.h"
+
+/**
+ * @brief Largest payload relayed under a single PUSH chunk header
+ */
+#define RELAY_CHUNK_SIZE (1024 * 1024)
+
+#define RELAY_BUFFER_DEFAULT (256 * 1024)   ///< Bytes per buffer of the pipeline engine
+#define RELAY_BUFFER_MIN (4 * 1024)         ///< Smallest accepted -B
+#define RELAY_BUFFER_MAX (16 * 1024 * 1024) ///< Largest accepted -B
+#define RELAY_DEPTH_DEFAULT 4               ///< Buffers in the ring of the pipeline engine
+#define RELAY_DEPTH_MAX 64                  ///< Largest accepted -D
+
+/**
+ * @brief How workers move file data from source to target
+ */
+typedef enum {
+    TRANSFER_ENGINE_SPLICE = 0,      ///< splice() through a pipe, falls back to copy
+    TRANSFER_ENGINE_COPY,            ///< recv() into a user buffer + send()
+    TRANSFER_ENGINE_PIPELINE         ///< Non-blocking recv() and send() overlapped over a buffer ring
+} transfer_engine_t;
+
+/**
+ * @brief Job buffer between producers and workers
+ */
+typedef enum {
+    JOB_QUEUE_LIST = 0,              ///< Per-pair lists under one mutex, served in weighted round-robin
+    JOB_QUEUE_RING,                  ///< Bounded lock-free MPMC ring (job_ring.h)
+    JOB_QUEUE_STEAL                  ///< Per-worker queues with source affinity and stealing
+} job_queue_type_t;
+
+/**
+ * @brief Jobs of one sync pair waiting in the pool (JOB_QUEUE_LIST)
+ *
+ * Pairs with queued jobs form a round. The current pair hands out up to
+ * weight jobs (its priority= option) before the turn passes to the next
+ * pair, so a pair with a few files waits at most one round behind a bulk
+ * backfill instead of behind every job queued before it. A pair joins
+ * at the end of the round when its first job arrives and leaves it when
+ * its last job is taken. A pair held back by its limits (throttle.h)
+ * keeps its turn while the pairs after it are served.
+ */
+typedef struct pair_queue {
+    struct sync_info *info;          ///< Pair whose jobs are queued here
+    sync_job_t *head;                ///< Oldest queued job
+    sync_job_t *tail;                ///< Newest queued job
+    int weight;                      ///< Jobs per turn
+    int credit;                      ///< Jobs left in the current turn
+    struct pair_queue *prev;         ///< Previous pair in the round
+    struct pair_queue *next;         ///< Next pair in the round
+} pair_queue_t;
+
+/**
+ * @brief Extra queued jobs a worker may have over the least loaded one
+ *        and still get a job for its source endpoint
+ */
+#define AFFINITY_SLACK 2
+
+/**
+ * @brief Job queue owned by one worker (JOB_QUEUE_STEAL)
+ *
+ * Producers append a job to the queue of the worker whose affinity
+ * matches the job's source endpoint, since that worker most likely has
+ * a pooled session to it, unless that queue is AFFINITY_SLACK jobs
+ * longer than the shortest one. A worker runs its own queue oldest
+ * first and, once it is empty, steals the oldest job of another worker,
+ * so a worker stuck on a slow host does not hold up its backlog.
+ */
+typedef struct worker_queue {
+    sync_job_t *head;                ///< Oldest queued job
+    sync_job_t *tail;                ///< Newest queued job
+    int length;                      ///< Number of queued jobs, read without the mutex
+    uint64_t affinity;               ///< Source endpoint key of the last job given or stolen, 0 if none
+    int sleeping;                    ///< Worker waits on wake (under pool queue_mutex)
+    pthread_mutex_t mutex;           ///< Protects head and tail
+    pthread_cond_t wake;             ///< Signaled when the worker should look for jobs
+} worker_queue_t;
+
+/**
+ * @brief Shared state of a file moved as several ranged jobs
+ *
+ * Every range job holds one reference. The worker that settles the last
+ * range commits the assembled file on the target, or discards it when
+ * any range failed.
+ */
+typedef struct range_group {
+    int pending;                     ///< Ranges not settled yet
+    int ranges;                      ///< Total number of ranges
+    int failed;                      ///< Some range failed
+    int64_t size;                    ///< File size from the source listing
+    int64_t mtime;                   ///< Source mtime applied on commit
+    uint64_t id;                     ///< Names the target part file of the group
+    pthread_mutex_t mutex;           ///< Protects pending and failed
+} range_group_t;
+
+#define BATCH_MAX_BYTES (4 * 1024 * 1024)   ///< Listed bytes after which a batch job is full
+#define BATCH_MAX_FILE_SIZE (64 * 1024)     ///< Larger files get a job of their own
+
+/**
+ * @brief Small files of one pair moved by a single job
+ *
+ * The job's filename is the first file of the batch. The names are kept
+ * as the body of the BATCH request, one per line.
+ */
+typedef struct file_batch {
+    int count;                       ///< Files in the batch
+    int64_t bytes;                   ///< Listed size of all files
+    size_t length;                   ///< Bytes used in names
+    size_t capacity;                 ///< Allocated bytes of names
+    char *names;                     ///< File names, each followed by '\n'
+} file_batch_t;
 
 // Thread Pool Management
 
@@ -30,6 +145,10 @@
  * Creates the specified number of worker threads and initializes
  * all synchronization primitives. Worker threads start immediately
  * and wait for jobs to be submitted.
+ *
+ * The job buffer is the one chosen with set_job_queue_type(). A ring
+ * holds buffer_size jobs rounded up to a power of two; per-worker queues
+ * hold buffer_size jobs between them.
  */
 thread_pool_t* create_thread_pool(int thread_count, int buffer_size);
 
@@ -65,27 +184,88 @@ int enqueue_sync_job(thread_pool_t *pool, sync_job_t *job);
  */
 sync_job_t* dequeue_sync_job(thread_pool_t *pool);
 
+/**
+ * @brief Drop the queued jobs of a cancelled pair
+ * @param pool Thread pool instance
+ * @param info Pair whose jobs are dropped (already inactive)
+ * @return Number of jobs removed from the queue
+ *
+ * Frees their queue slots at once, waking blocked producers. Range jobs
+ * stay queued so that a worker discards the part file of their file, and
+ * the ring queue cannot remove jobs from its middle; workers drop those
+ * without any I/O when they reach them.
+ */
+int purge_sync_jobs(thread_pool_t *pool, sync_info_t *info);
+
 /**
  * @brief Create new synchronization job
- * @param source_host Source server hostname
- * @param source_port Source server port
- * @param source_dir Source directory path
- * @param target_host Target server hostname
- * @param target_port Target server port
- * @param target_dir Target directory path
+ * @param info Sync pair the file belongs to (a reference is taken)
  * @param filename Name of file to synchronize
  * @return Pointer to new job on success, NULL on error
+ *
+ * Jobs come from a slab pool and keep short file names inline, so a
+ * job costs about a hundred bytes however long the pair's paths are.
  */
-sync_job_t* create_sync_job(const char *source_host, int source_port, const char *source_dir,
-                           const char *target_host, int target_port, const char *target_dir,
-                           const char *filename);
+sync_job_t* create_sync_job(sync_info_t *info, const char *filename);
 
 /**
  * @brief Free synchronization job memory
  * @param job Job to free
+ *
+ * A range job that never ran settles its range as failed. The job's
+ * memory goes back to the slab pool and its pair reference is dropped.
  */
 void free_sync_job(sync_job_t *job);
 
+// Ranged Transfers
+
+/**
+ * @brief Create range group for a file split into ranges
+ * @param size File size
+ * @param mtime Source modification time
+ * @param ranges Number of range jobs that will reference it
+ * @return Pointer to new group on success, NULL on error
+ */
+range_group_t* create_range_group(int64_t size, int64_t mtime, int ranges);
+
+/**
+ * @brief Settle one range of a group
+ * @param group Range group
+ * @param success Whether the range landed on the target
+ * @return 1 if it was the last range (the caller then finalizes and frees the group), 0 otherwise
+ */
+int finish_range(range_group_t *group, int success);
+
+/**
+ * @brief Free range group
+ * @param group Group to free (NULL is ignored)
+ */
+void free_range_group(range_group_t *group);
+
+// Batched Transfers
+
+/**
+ * @brief Add a file to a job's batch, creating the batch on first use
+ * @param job Job of the batch (its pair is the pair of every file)
+ * @param filename File name relative to the pair directories
+ * @param size Listed size of the file
+ * @return 0 on success, -1 on error
+ */
+int add_batch_file(sync_job_t *job, const char *filename, int64_t size);
+
+/**
+ * @brief Whether a batch job should be enqueued instead of growing
+ * @param job Job of the batch
+ * @return 1 once BATCH_MAX_FILES files or BATCH_MAX_BYTES bytes are in it, 0 otherwise
+ */
+int batch_full(const sync_job_t *job);
+
+/**
+ * @brief Turn a batch job of one file back into a plain job
+ * @param job Job of the batch
+ */
+void dissolve_batch(sync_job_t *job);
+
 // Worker Thread Functions
 
 /**
@@ -106,9 +286,69 @@ void* worker_thread(void *arg);
  * Connects to both source and target clients, retrieves file from source
  * using PULL command, and stores it on target using PUSH command.
  * Handles file transfer in chunks to support large files.
+ *
+ * With the splice engine the payload moves from the source socket to the
+ * target socket through a pipe and never enters user space; only the
+ * PUSH chunk headers are built by the worker.
+ *
+ * Jobs with a delta_block_size are first tried as a block delta (SIGS,
+ * DELTA and a delta stream, see delta.h) when both clients speak protocol
+ * version 2. If the target copy is gone or rejects the delta, the file is
+ * copied in full instead.
+ *
+ * Range jobs PULL their byte range with RANGE and write it into the
+ * target part file. The worker that settles the last range of a file
+ * sends COMMIT, so the file appears under its name only once complete.
+ *
+ * Batch jobs ask the source for all their files with one BATCH request
+ * and push them to the target as back-to-back streams, reading the
+ * acknowledgements only after the last one. The result is -1 if any file
+ * failed; every failed file beyond the first adds to the pair's error
+ * count here, the worker counts the first.
  */
 int sync_single_file(sync_job_t *job);
 
+/**
+ * @brief Select the engine used by sync_single_file()
+ * @param engine Engine for subsequent transfers
+ */
+void set_transfer_engine(transfer_engine_t engine);
+
+/**
+ * @brief Size the buffer ring of the pipeline engine
+ * @param buffer_size Bytes per buffer (RELAY_BUFFER_MIN to RELAY_BUFFER_MAX)
+ * @param depth Number of buffers (2 to RELAY_DEPTH_MAX)
+ * @return 0 on success, -1 if a value is out of range
+ *
+ * Each worker allocates its ring on its first pipelined transfer and
+ * keeps it until it exits. The source fills free buffers while the
+ * target drains full ones, so up to buffer_size * depth bytes are in
+ * flight per worker and neither socket waits for the other.
+ */
+int set_relay_buffers(size_t buffer_size, int depth);
+
+/**
+ * @brief Parse transfer engine name as given on the command line
+ * @param name Engine name ("splice", "copy" or "pipeline")
+ * @param engine Output engine value
+ * @return 0 on success, -1 if the name is unknown
+ */
+int parse_transfer_engine(const char *name, transfer_engine_t *engine);
+
+/**
+ * @brief Select the job buffer of pools created afterwards
+ * @param type Queue type for create_thread_pool()
+ */
+void set_job_queue_type(job_queue_type_t type);
+
+/**
+ * @brief Parse job queue name as given on the command line
+ * @param name Queue name ("list", "ring" or "steal")
+ * @param type Output queue type
+ * @return 0 on success, -1 if the name is unknown
+ */
+int parse_job_queue_type(const char *name, job_queue_type_t *type);
+
 // Thread Pool Control
 
 /**
@@ -0,0 +1,139 @@
+/**
+ * @file throttle.h
+ * @brief Bandwidth limits and session caps enforced by the job scheduler
+ *
+ * Three kinds of limits keep a sync from swamping one box:
+ * - a cap on the pooled sessions running jobs hold at once against one
+ *   client (host:port), given with manager option -H [host:port=]N;
+ * - a rate for all file data leaving or entering one host, given with
+ *   -R [host=]KiB/s;
+ * - a rate for the file data of one pair, its rate= option.
+ *
+ * Rates are token buckets that may run into debt: a worker takes the
+ * tokens of every chunk it relays and sleeps off the debt before the
+ * chunk goes out. Every bucket holds at most a quarter second of its
+ * rate (THROTTLE_BURST_MIN at least), so a limit is kept over any
+ * stretch longer than that. A bucket that was never used starts full.
+ *
+ * The scheduler asks throttle_admit() before it hands out a job. A job
+ * whose endpoints are at their session cap, or whose hosts or pair are
+ * in debt, stays queued and the worker takes a job of another pair
+ * instead. Only when every queued job is held back does it sleep, until
+ * a running job ends or the debt is paid. That needs queues a worker can
+ * pick from (-q list or -q steal); the lock-free ring is strictly FIFO,
+ * so it takes no session caps and only paces rates.
+ *
+ * A pair looks up the entries of its hosts and clients once and keeps
+ * them, and every bucket has a lock of its own, so pacing a chunk takes
+ * no table lock. Limits are set once at startup, before workers run.
+ */
+
+#ifndef THROTTLE_H
+#define THROTTLE_H
+
+#include "common.h"
+
+#define THROTTLE_BURST_MIN (64 * 1024)      ///< Smallest bucket size (bytes)
+#define THROTTLE_RETRY_MAX_US 100000        ///< Longest a worker sleeps before looking at held back jobs again
+
+/**
+ * @brief Microseconds until a bucket is out of debt
+ * @param bucket Bucket to refill up to now
+ * @param rate Bytes per second, > 0
+ * @param now_us Current time (metrics_now_us())
+ * @return 0 if the bucket holds tokens, the wait otherwise
+ */
+int64_t token_bucket_delay(token_bucket_t *bucket, int64_t rate, uint64_t now_us);
+
+/**
+ * @brief Take tokens from a bucket, running into debt if it is short
+ * @param bucket Bucket to take from
+ * @param rate Bytes per second, > 0
+ * @param bytes Tokens to take
+ * @param now_us Current time (metrics_now_us())
+ * @return Microseconds to wait before the bytes may go out, 0 if none
+ */
+int64_t token_bucket_take(token_bucket_t *bucket, int64_t rate, int64_t bytes, uint64_t now_us);
+
+/**
+ * @brief Cap the jobs running at once against a client
+ * @param host Client host, NULL to set the cap of every other client
+ * @param port Client port (ignored with host NULL)
+ * @param max_sessions Sessions at most, 0 for no cap
+ * @return 0 on success, -1 on a bad value or out of memory
+ */
+int throttle_set_sessions(const char *host, int port, int max_sessions);
+
+/**
+ * @brief Limit the file data rate of a host
+ * @param host Host name as in the pair specs, NULL to set the rate of every other host
+ * @param bytes_per_sec Rate, 0 for no limit
+ * @return 0 on success, -1 on a bad value or out of memory
+ */
+int throttle_set_rate(const char *host, int64_t bytes_per_sec);
+
+/**
+ * @brief Apply a session cap as given to -H
+ * @param text "N" for every client or "host:port=N" for one
+ * @return 0 on success, -1 if the text is malformed
+ */
+int parse_throttle_sessions(const char *text);
+
+/**
+ * @brief Apply a host rate as given to -R
+ * @param text "KiB/s" for every host or "host=KiB/s" for one
+ * @return 0 on success, -1 if the text is malformed
+ */
+int parse_throttle_rate(const char *text);
+
+/**
+ * @brief Whether any session cap is set
+ * @return 1 if throttle_set_sessions() set one, 0 otherwise
+ */
+int throttle_caps_sessions(void);
+
+/**
+ * @brief Let a job of a pair start if its limits allow it
+ * @param info Pair of the job
+ * @param retry_us Lowered to the microseconds after which the job may
+ *                 pass if it is held back now (0 in it counts as unset)
+ * @return 1 if the job may run (its sessions are taken), 0 if it is held back
+ *
+ * A job counts the sessions it holds: one against its source client and
+ * one against its target, so two against a client that is both. A job
+ * against a client with no session taken runs even when it needs more
+ * than the cap. Every admitted job must be handed to throttle_release()
+ * when it ends.
+ */
+int throttle_admit(sync_info_t *info, uint64_t *retry_us);
+
+/**
+ * @brief Give back the sessions of a job that ended
+ * @param info Pair of the job
+ * @return 1 if a capped session was freed (held back jobs may now pass), 0 otherwise
+ */
+int throttle_release(sync_info_t *info);
+
+/**
+ * @brief Take the tokens of a chunk and wait until it may go out
+ * @param info Pair the chunk belongs to
+ * @param bytes Bytes about to cross the network
+ *
+ * Returns early once the pair is cancelled.
+ */
+void throttle_pace(sync_info_t *info, size_t bytes);
+
+/**
+ * @brief Jobs running against a client
+ * @param host Client host
+ * @param port Client port
+ * @return Sessions of admitted jobs not yet released, 0 for clients without a cap
+ */
+int throttle_active_sessions(const char *host, int port);
+
+/**
+ * @brief Drop all limits and counters
+ */
+void throttle_reset(void);
+
+#endif // THROTTLE_H
@@ -0,0 +1,63 @@
+/**
+ * @file tree_walk.h
+ * @brief Parallel walk of a directory tree for recursive LIST
+ *
+ * The walk keeps a stack of directories still to read. Every walker
+ * thread pops one, reads it with readdir() relative to its descriptor
+ * (openat/fstatat, no path building against the root) and pushes the
+ * subdirectories it finds. Entry types come from d_type, so
+ * subdirectories and special files are never stat'ed; regular files only
+ * are when the caller needs their metadata. Helper threads are started
+ * only once a second directory is waiting, so a flat directory is read
+ * by the calling thread alone. Without TREE_WALK_RECURSIVE only the root
+ * is read, which is how a plain LIST works.
+ *
+ * Hidden entries (names starting with '.') are skipped, like in a flat
+ * LIST; with TREE_WALK_HIDDEN hidden files are handed to the visitor as
+ * they are, without a path, so it can tidy them up. Symbolic links are followed to regular files but never into
+ * directories, so a walk cannot loop.
+ */
+
+#ifndef TREE_WALK_H
+#define TREE_WALK_H
+
+#include "common.h"
+
+#define TREE_WALK_THREADS 4                 ///< Threads reading directories, the caller included
+#define TREE_WALK_STAT 0x1                  ///< Pass the stat of every regular file to the visitor
+#define TREE_WALK_RECURSIVE 0x2             ///< Descend into subdirectories, not just the root
+#define TREE_WALK_HIDDEN 0x4                ///< Also visit hidden files, with path and stat NULL
+
+/**
+ * @brief Called for every regular file of the tree
+ *
+ * Runs on any walker thread, several at once: the visitor does its own
+ * locking.
+ *
+ * @param ctx Context given to walk_tree()
+ * @param dir_fd Descriptor of the directory holding the file
+ * @param name File name within that directory
+ * @param path File path relative to the root of the walk, NULL for a
+ *             hidden file (TREE_WALK_HIDDEN), which may not be regular
+ * @param file_stat Stat of the file with TREE_WALK_STAT, NULL otherwise
+ *                  and for hidden files
+ * @return 0 to continue, -1 to stop the walk
+ */
+typedef int (*tree_visit_fn)(void *ctx, int dir_fd, const char *name, const char *path,
+                             const struct stat *file_stat);
+
+/**
+ * @brief Visit every regular file in a directory, or the tree below it
+ * @param root_fd Open descriptor of the root directory (not closed)
+ * @param flags TREE_WALK_* flags
+ * @param threads Walker threads to use at most (1 to TREE_WALK_THREADS)
+ * @param visit Called for every regular file
+ * @param ctx Passed to visit
+ * @return 0 once the whole tree was visited, -1 if visit stopped the walk
+ *
+ * Directories that cannot be opened, and files whose relative path does
+ * not fit in MAX_FILENAME, are reported on stderr and skipped.
+ */
+int walk_tree(int root_fd, int flags, int threads, tree_visit_fn visit, void *ctx);
+
+#endif // TREE_WALK_H
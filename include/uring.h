@@ -0,0 +1,145 @@
+/**
+ * @file uring.h
+ * @brief Minimal io_uring ring with registered buffers
+ *
+ * A thin wrapper over the raw io_uring system calls (no liburing), just
+ * big enough for the nfs_client uring engine: one ring per connection
+ * worker, URING_BUFFER_COUNT buffers of URING_BUFFER_SIZE bytes
+ * registered with the kernel, and helpers to queue reads, writes, sends
+ * and receives and to collect their completions. A batch of queued
+ * operations goes to the kernel with one io_uring_enter() call.
+ *
+ * Where the kernel or the build lacks io_uring, uring_init() fails and
+ * the caller keeps using plain system calls.
+ */
+
+#ifndef URING_H
+#define URING_H
+
+#include "common.h"
+
+#define URING_BUFFER_SIZE (128 * 1024)      ///< Bytes per registered buffer
+#define URING_BUFFER_COUNT 8                ///< Registered buffers per ring
+#define URING_ENTRIES 32                    ///< Submission queue entries
+
+/**
+ * @brief One io_uring instance and its mapped queues
+ */
+typedef struct {
+    int fd;                          ///< Ring descriptor, -1 if not set up
+    unsigned *sq_head;               ///< Kernel side of the submission queue
+    unsigned *sq_tail;               ///< Our side of the submission queue
+    unsigned sq_mask;                ///< Submission queue index mask
+    unsigned *sq_array;              ///< Submission queue slots (indexes into sqes)
+    void *sqes;                      ///< Submission queue entries
+    unsigned *cq_head;               ///< Our side of the completion queue
+    unsigned *cq_tail;               ///< Kernel side of the completion queue
+    unsigned cq_mask;                ///< Completion queue index mask
+    void *cqes;                      ///< Completion queue entries
+    void *sq_map;                    ///< Mapping of the submission ring
+    size_t sq_map_size;              ///< Size of sq_map
+    void *cq_map;                    ///< Mapping of the completion ring, may equal sq_map
+    size_t cq_map_size;              ///< Size of cq_map
+    size_t sqes_size;                ///< Size of the sqes mapping
+    unsigned queued;                 ///< Entries queued since the last submit
+    char *buffers;                   ///< URING_BUFFER_COUNT registered buffers
+} uring_t;
+
+/**
+ * @brief Set up a ring and register its buffers
+ * @param ring Ring to initialize
+ * @return 0 on success, -1 if io_uring is unavailable (errno set)
+ */
+int uring_init(uring_t *ring);
+
+/**
+ * @brief Tear down a ring set up with uring_init()
+ * @param ring Ring to release (a ring that failed to set up is ignored)
+ */
+void uring_exit(uring_t *ring);
+
+/**
+ * @brief Start address of a registered buffer
+ * @param ring Ring
+ * @param index Buffer index (0 to URING_BUFFER_COUNT - 1)
+ * @return Buffer of URING_BUFFER_SIZE bytes
+ */
+char* uring_buffer(uring_t *ring, int index);
+
+/**
+ * @brief Queue a read of a file into a registered buffer
+ * @param ring Ring
+ * @param fd File to read
+ * @param index Registered buffer to read into
+ * @param len Bytes to read (at most URING_BUFFER_SIZE)
+ * @param offset File offset
+ * @param user_data Returned with the completion
+ * @param link Chain the next queued operation behind this one
+ * @return 0 on success, -1 if the submission queue is full
+ */
+int uring_queue_read(uring_t *ring, int fd, int index, size_t len, off_t offset,
+                     uint64_t user_data, int link);
+
+/**
+ * @brief Queue a write of a registered buffer to a file
+ * @param ring Ring
+ * @param fd File to write
+ * @param index Registered buffer holding the data
+ * @param len Bytes to write (at most URING_BUFFER_SIZE)
+ * @param offset File offset
+ * @param user_data Returned with the completion
+ * @param link Chain the next queued operation behind this one
+ * @return 0 on success, -1 if the submission queue is full
+ */
+int uring_queue_write(uring_t *ring, int fd, int index, size_t len, off_t offset,
+                      uint64_t user_data, int link);
+
+/**
+ * @brief Queue a send of a registered buffer on a socket
+ *
+ * Sent with MSG_WAITALL, so a short result means the socket failed.
+ *
+ * @param ring Ring
+ * @param sockfd Connected socket
+ * @param index Registered buffer holding the data
+ * @param len Bytes to send
+ * @param user_data Returned with the completion
+ * @param link Chain the next queued operation behind this one
+ * @return 0 on success, -1 if the submission queue is full
+ */
+int uring_queue_send(uring_t *ring, int sockfd, int index, size_t len, uint64_t user_data, int link);
+
+/**
+ * @brief Queue a receive from a socket into a registered buffer
+ *
+ * Received with MSG_WAITALL, so a short result means the peer closed
+ * the connection or it failed.
+ *
+ * @param ring Ring
+ * @param sockfd Connected socket
+ * @param index Registered buffer to receive into
+ * @param len Bytes to receive
+ * @param user_data Returned with the completion
+ * @param link Chain the next queued operation behind this one
+ * @return 0 on success, -1 if the submission queue is full
+ */
+int uring_queue_recv(uring_t *ring, int sockfd, int index, size_t len, uint64_t user_data, int link);
+
+/**
+ * @brief Submit the queued operations and wait for completions
+ * @param ring Ring
+ * @param wait_nr Completions to wait for
+ * @return 0 on success, -1 on error
+ */
+int uring_submit_and_wait(uring_t *ring, unsigned wait_nr);
+
+/**
+ * @brief Take the next completion
+ * @param ring Ring
+ * @param user_data Output: user_data of the operation
+ * @param result Output: its result (bytes moved or -errno)
+ * @return 1 if a completion was taken, 0 if none is ready
+ */
+int uring_next_completion(uring_t *ring, uint64_t *user_data, int *result);
+
+#endif // URING_H
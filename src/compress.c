@@ -0,0 +1,79 @@
+#include "../include/compress.h"
+#include "../include/protocol.h"
+#include <zlib.h>
+
+size_t compress_frame_bound(size_t len) {
+    return compressBound(len);
+}
+
+long compress_frame(const void *in, size_t len, void *out, size_t out_size, int level) {
+    if (!in || !out || level < 1 || level > COMPRESS_MAX_LEVEL) return -1;
+    
+    uLongf packed = out_size;
+    if (compress2(out, &packed, in, len, level) != Z_OK) {
+        return -1;
+    }
+    if (packed * 100 > len * (100 - COMPRESS_MIN_SAVING)) {
+        return 0;
+    }
+    return (long)packed;
+}
+
+int frame_inflate_begin(frame_inflater_t *inflater) {
+    z_stream *stream = calloc(1, sizeof(z_stream));
+    if (!stream) return -1;
+    
+    if (inflateInit(stream) != Z_OK) {
+        free(stream);
+        return -1;
+    }
+    inflater->stream = stream;
+    inflater->produced = 0;
+    inflater->finished = 0;
+    return 0;
+}
+
+int frame_inflate_feed(frame_inflater_t *inflater, const void *in, size_t len,
+                       inflate_emit_fn emit, void *ctx) {
+    z_stream *stream = inflater->stream;
+    unsigned char out[MAX_BUFFER_SIZE];
+    
+    stream->next_in = (Bytef*)in;
+    stream->avail_in = len;
+    do {
+        stream->next_out = out;
+        stream->avail_out = sizeof(out);
+        int result = inflate(stream, Z_NO_FLUSH);
+        if (result == Z_BUF_ERROR && stream->avail_in == 0) {
+            break; // Output drained exactly, nothing left to do
+        }
+        if (result != Z_OK && result != Z_STREAM_END) {
+            return -1;
+        }
+        if (result == Z_STREAM_END) {
+            inflater->finished = 1;
+        }
+        
+        size_t produced = sizeof(out) - stream->avail_out;
+        inflater->produced += produced;
+        if (inflater->produced > FRAME_DATA_MAX) {
+            return -1;
+        }
+        if (produced > 0 && emit(ctx, out, produced) != 0) {
+            return -1;
+        }
+    } while (!inflater->finished && (stream->avail_in > 0 || stream->avail_out == 0));
+    
+    // Bytes after the end of the zlib stream mean the frame is corrupt
+    return stream->avail_in > 0 ? -1 : 0;
+}
+
+int frame_inflate_end(frame_inflater_t *inflater) {
+    z_stream *stream = inflater->stream;
+    if (!stream) return -1;
+    
+    inflateEnd(stream);
+    free(stream);
+    inflater->stream = NULL;
+    return inflater->finished ? 0 : -1;
+}
@@ -0,0 +1,218 @@
+#include "../include/connection_pool.h"
+#include "../include/protocol.h"
+#include "../include/metrics.h"
+#include <poll.h>
+
+connection_pool_t* create_connection_pool(int max_idle_per_host, int idle_timeout) {
+    connection_pool_t *pool = malloc(sizeof(connection_pool_t));
+    if (!pool) {
+        fprintf(stderr, "Failed to allocate memory for connection pool\n");
+        return NULL;
+    }
+    
+    pool->endpoints = NULL;
+    pool->max_idle_per_host = max_idle_per_host > 0 ? max_idle_per_host : 0;
+    pool->idle_timeout = idle_timeout;
+    pool->connects = 0;
+    pool->reuses = 0;
+    
+    if (pthread_mutex_init(&pool->mutex, NULL) != 0) {
+        fprintf(stderr, "Failed to initialize connection pool mutex: %s\n", strerror(errno));
+        free(pool);
+        return NULL;
+    }
+    
+    return pool;
+}
+
+void destroy_connection_pool(connection_pool_t *pool) {
+    if (!pool) return;
+    
+    pthread_mutex_lock(&pool->mutex);
+    
+    pool_endpoint_t *endpoint = pool->endpoints;
+    while (endpoint) {
+        pool_endpoint_t *next_endpoint = endpoint->next;
+        pooled_conn_t *conn = endpoint->idle;
+        while (conn) {
+            pooled_conn_t *next = conn->next;
+            close(conn->fd);
+            free(conn);
+            conn = next;
+        }
+        free(endpoint);
+        endpoint = next_endpoint;
+    }
+    
+    pthread_mutex_unlock(&pool->mutex);
+    pthread_mutex_destroy(&pool->mutex);
+    free(pool);
+}
+
+int connection_is_healthy(int fd) {
+    struct pollfd pfd = { fd, POLLIN, 0 };
+    
+    // An idle session has nothing to read: readable means EOF or garbage
+    int ready = poll(&pfd, 1, 0);
+    if (ready < 0) {
+        return 0;
+    }
+    return ready == 0;
+}
+
+// Must be called with pool mutex held
+static pool_endpoint_t* find_endpoint(connection_pool_t *pool, const char *host, int port, int create) {
+    for (pool_endpoint_t *endpoint = pool->endpoints; endpoint; endpoint = endpoint->next) {
+        if (endpoint->port == port && strcmp(endpoint->host, host) == 0) {
+            return endpoint;
+        }
+    }
+    if (!create) return NULL;
+    
+    pool_endpoint_t *endpoint = calloc(1, sizeof(pool_endpoint_t));
+    if (!endpoint) return NULL;
+    
+    strncpy(endpoint->host, host, MAX_HOST_SIZE - 1);
+    endpoint->port = port;
+    endpoint->next = pool->endpoints;
+    pool->endpoints = endpoint;
+    return endpoint;
+}
+
+// Close sessions that sat idle too long. Must be called with pool mutex held
+static void expire_idle_connections(connection_pool_t *pool, time_t now) {
+    for (pool_endpoint_t *endpoint = pool->endpoints; endpoint; endpoint = endpoint->next) {
+        pooled_conn_t **link = &endpoint->idle;
+        while (*link) {
+            pooled_conn_t *conn = *link;
+            if (now - conn->last_used > pool->idle_timeout) {
+                *link = conn->next;
+                close(conn->fd);
+                free(conn);
+                endpoint->idle_count--;
+            } else {
+                link = &conn->next;
+            }
+        }
+    }
+}
+
+int acquire_connection(connection_pool_t *pool, const char *host, int port, client_conn_t *conn) {
+    if (!host || !conn) return -1;
+    
+    strncpy(conn->host, host, MAX_HOST_SIZE - 1);
+    conn->host[MAX_HOST_SIZE - 1] = '\0';
+    conn->port = port;
+    conn->fd = -1;
+    conn->features = 0;
+    
+    int legacy = 0;
+    
+    if (pool) {
+        pthread_mutex_lock(&pool->mutex);
+        expire_idle_connections(pool, time(NULL));
+        
+        pool_endpoint_t *endpoint = find_endpoint(pool, host, port, 0);
+        while (endpoint && endpoint->idle) {
+            pooled_conn_t *idle = endpoint->idle;
+            endpoint->idle = idle->next;
+            endpoint->idle_count--;
+            
+            int fd = idle->fd;
+            int version = idle->version;
+            uint32_t features = idle->features;
+            free(idle);
+            
+            if (connection_is_healthy(fd)) {
+                pool->reuses++;
+                pthread_mutex_unlock(&pool->mutex);
+                conn->fd = fd;
+                conn->version = version;
+                conn->features = features;
+                return 0;
+            }
+            close(fd);
+        }
+        
+        // Skip HELLO for clients that just answered it as version 1
+        if (endpoint && endpoint->legacy_until > time(NULL)) {
+            legacy = 1;
+        }
+        pool->connects++;
+        pthread_mutex_unlock(&pool->mutex);
+    }
+    
+    uint64_t started = metrics_now_us();
+    int fd = connect_to_server(host, port);
+    if (fd < 0) {
+        __atomic_add_fetch(&g_metrics.connect_errors, 1, __ATOMIC_RELAXED);
+        return -1;
+    }
+    
+    // Clients that answer HELLO with anything but "OK 2" are driven as version 1
+    uint32_t features = 0;
+    int version = legacy ? 1 : negotiate_protocol(fd, &features);
+    if (version == 1 && !legacy) {
+        // The refused HELLO is still half read: start over on a clean connection
+        close(fd);
+        fd = connect_to_server(host, port);
+    }
+    if (version < 0 || fd < 0) {
+        __atomic_add_fetch(&g_metrics.connect_errors, 1, __ATOMIC_RELAXED);
+        if (fd >= 0) close(fd);
+        return -1;
+    }
+    histogram_observe(&g_metrics.connect, metrics_now_us() - started);
+    
+    // Only a real version 1 answer gets here: failures and silence returned above
+    if (pool && version == 1 && !legacy) {
+        pthread_mutex_lock(&pool->mutex);
+        pool_endpoint_t *endpoint = find_endpoint(pool, host, port, 1);
+        if (endpoint) {
+            endpoint->legacy_until = time(NULL) + pool->idle_timeout;
+        }
+        pthread_mutex_unlock(&pool->mutex);
+    }
+    
+    conn->fd = fd;
+    conn->version = version;
+    conn->features = features;
+    return 0;
+}
+
+void release_connection(connection_pool_t *pool, client_conn_t *conn, int reusable) {
+    if (!conn || conn->fd < 0) return;
+    
+    int fd = conn->fd;
+    conn->fd = -1;
+    
+    // Legacy clients serve one connection at a time: never hold one idle
+    if (!pool || !reusable || pool->max_idle_per_host == 0 || conn->version < 2) {
+        close(fd);
+        return;
+    }
+    
+    pthread_mutex_lock(&pool->mutex);
+    
+    time_t now = time(NULL);
+    expire_idle_connections(pool, now);
+    
+    pool_endpoint_t *endpoint = find_endpoint(pool, conn->host, conn->port, 1);
+    pooled_conn_t *idle = endpoint && endpoint->idle_count < pool->max_idle_per_host ?
+                          malloc(sizeof(pooled_conn_t)) : NULL;
+    if (!idle) {
+        pthread_mutex_unlock(&pool->mutex);
+        close(fd);
+        return;
+    }
+    
+    idle->fd = fd;
+    idle->version = conn->version;
+    idle->features = conn->features;
+    idle->last_used = now;
+    idle->next = endpoint->idle;
+    endpoint->idle = idle;
+    endpoint->idle_count++;
+    
+    pthread_mutex_unlock(&pool->mutex);
+}
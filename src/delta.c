@@ -0,0 +1,394 @@
+#include "../include/delta.h"
+#include "../include/protocol.h"
+
+#define COPY_HEADER_SIZE 13
+#define LITERAL_HEADER_SIZE 5
+#define STREAM_HEADER_SIZE 4
+#define PATCH_COPY_BUFFER (64 * 1024)
+
+void rolling_init(rolling_sum_t *sum, const unsigned char *data, size_t len) {
+    sum->a = 0;
+    sum->b = 0;
+    sum->len = len;
+    for (size_t i = 0; i < len; i++) {
+        sum->a += data[i];
+        sum->b += sum->a;
+    }
+}
+
+void rolling_roll(rolling_sum_t *sum, unsigned char out, unsigned char in) {
+    sum->a += (uint32_t)in - out;
+    sum->b += sum->a - (uint32_t)sum->len * out;
+}
+
+uint32_t rolling_digest(const rolling_sum_t *sum) {
+    return (sum->a & 0xffff) | (sum->b << 16);
+}
+
+uint32_t delta_block_size(int64_t file_size) {
+    uint32_t block_size = DELTA_MIN_BLOCK;
+    while (block_size < DELTA_MAX_BLOCK && (int64_t)block_size * block_size < file_size) {
+        block_size <<= 1;
+    }
+    return block_size;
+}
+
+long delta_write_signatures(int fd, uint32_t block_size, delta_emit_fn emit, void *ctx) {
+    if (block_size == 0) return -1;
+    
+    unsigned char *block = malloc(block_size);
+    if (!block) {
+        fprintf(stderr, "Failed to allocate memory for signature block\n");
+        return -1;
+    }
+    
+    long blocks = 0;
+    while (1) {
+        size_t filled = 0;
+        while (filled < block_size) {
+            ssize_t got = read(fd, block + filled, block_size - filled);
+            if (got < 0 && errno == EINTR) continue;
+            if (got < 0) {
+                free(block);
+                return -1;
+            }
+            if (got == 0) break;
+            filled += got;
+        }
+        // The short tail is never matched, it always travels as a literal
+        if (filled < block_size) break;
+        
+        rolling_sum_t sum;
+        rolling_init(&sum, block, block_size);
+        
+        unsigned char sig[DELTA_SIG_SIZE];
+        put_u32(sig, rolling_digest(&sum));
+        put_u64(sig + 4, fnv1a_update(FNV1A_INIT, block, block_size));
+        if (emit(ctx, sig, sizeof(sig)) != 0) {
+            free(block);
+            return -1;
+        }
+        blocks++;
+    }
+    
+    free(block);
+    return blocks;
+}
+
+// Encoder
+
+/**
+ * Signatures chained by weak sum bucket. Chains are in ascending block
+ * order, so the first match found is the earliest block.
+ */
+typedef struct {
+    const unsigned char *sigs;       ///< Signature records
+    int32_t *heads;                  ///< First block of each bucket, -1 if empty
+    int32_t *next;                   ///< Next block in the same bucket
+    uint32_t mask;                   ///< Bucket count - 1
+} delta_index_t;
+
+typedef struct {
+    delta_emit_fn emit;              ///< Output callback
+    void *ctx;                       ///< Callback context
+    uint64_t copy_start;             ///< First block of the pending COPY
+    uint32_t copy_count;             ///< Blocks in the pending COPY, 0 if none
+} delta_encoder_t;
+
+static uint32_t weak_bucket(const delta_index_t *index, uint32_t weak) {
+    return (weak ^ (weak >> 15)) & index->mask;
+}
+
+static int build_index(delta_index_t *index, const unsigned char *sigs, size_t sig_count) {
+    uint32_t buckets = 16;
+    while (buckets < sig_count && buckets < (1u << 30)) {
+        buckets <<= 1;
+    }
+    
+    index->sigs = sigs;
+    index->mask = buckets - 1;
+    index->heads = malloc(buckets * sizeof(int32_t));
+    index->next = malloc((sig_count ? sig_count : 1) * sizeof(int32_t));
+    if (!index->heads || !index->next) {
+        free(index->heads);
+        free(index->next);
+        return -1;
+    }
+    
+    memset(index->heads, 0xff, buckets * sizeof(int32_t));
+    for (size_t i = sig_count; i-- > 0; ) {
+        uint32_t bucket = weak_bucket(index, get_u32(sigs + i * DELTA_SIG_SIZE));
+        index->next[i] = index->heads[bucket];
+        index->heads[bucket] = (int32_t)i;
+    }
+    return 0;
+}
+
+// Find a basis block equal to window, preferring the one that would extend the pending COPY
+static long find_block(const delta_index_t *index, uint32_t weak, const unsigned char *window,
+                       uint32_t block_size, long preferred) {
+    uint64_t strong = 0;
+    int have_strong = 0;
+    long found = -1;
+    
+    for (int32_t i = index->heads[weak_bucket(index, weak)]; i >= 0; i = index->next[i]) {
+        const unsigned char *sig = index->sigs + (size_t)i * DELTA_SIG_SIZE;
+        if (get_u32(sig) != weak) continue;
+        
+        // Only hash the window once a weak sum matched
+        if (!have_strong) {
+            strong = fnv1a_update(FNV1A_INIT, window, block_size);
+            have_strong = 1;
+        }
+        if (get_u64(sig + 4) != strong) continue;
+        
+        if (i == preferred) return i;
+        if (found < 0) found = i;
+    }
+    return found;
+}
+
+static int flush_copy(delta_encoder_t *encoder) {
+    if (encoder->copy_count == 0) return 0;
+    
+    unsigned char op[COPY_HEADER_SIZE];
+    op[0] = DELTA_OP_COPY;
+    put_u64(op + 1, encoder->copy_start);
+    put_u32(op + 9, encoder->copy_count);
+    encoder->copy_count = 0;
+    return encoder->emit(encoder->ctx, op, sizeof(op));
+}
+
+static int add_copy(delta_encoder_t *encoder, uint64_t block) {
+    if (encoder->copy_count > 0 && encoder->copy_count < UINT32_MAX &&
+        block == encoder->copy_start + encoder->copy_count) {
+        encoder->copy_count++;
+        return 0;
+    }
+    if (flush_copy(encoder) != 0) return -1;
+    
+    encoder->copy_start = block;
+    encoder->copy_count = 1;
+    return 0;
+}
+
+static int add_literal(delta_encoder_t *encoder, const unsigned char *data, size_t len) {
+    if (len > 0 && flush_copy(encoder) != 0) return -1;
+    
+    while (len > 0) {
+        size_t piece = len < DELTA_LITERAL_MAX ? len : DELTA_LITERAL_MAX;
+        unsigned char op[LITERAL_HEADER_SIZE];
+        op[0] = DELTA_OP_LITERAL;
+        put_u32(op + 1, (uint32_t)piece);
+        if (encoder->emit(encoder->ctx, op, sizeof(op)) != 0 ||
+            encoder->emit(encoder->ctx, data, piece) != 0) {
+            return -1;
+        }
+        data += piece;
+        len -= piece;
+    }
+    return 0;
+}
+
+int64_t delta_encode(int fd, uint32_t block_size, const unsigned char *sigs, size_t sig_count,
+                     delta_emit_fn emit, void *ctx) {
+    if (block_size == 0 || block_size > DELTA_MAX_BLOCK || !emit) return -1;
+    
+    unsigned char header[STREAM_HEADER_SIZE];
+    put_u32(header, block_size);
+    if (emit(ctx, header, sizeof(header)) != 0) return -1;
+    
+    delta_index_t index = { sigs, NULL, NULL, 0 };
+    if (sig_count > 0 && build_index(&index, sigs, sig_count) != 0) {
+        fprintf(stderr, "Failed to allocate memory for signature index\n");
+        return -1;
+    }
+    
+    size_t capacity = 2 * (size_t)block_size + DELTA_READ_SIZE;
+    unsigned char *buf = malloc(capacity);
+    if (!buf) {
+        fprintf(stderr, "Failed to allocate memory for delta window\n");
+        free(index.heads);
+        free(index.next);
+        return -1;
+    }
+    
+    delta_encoder_t encoder = { emit, ctx, 0, 0 };
+    int result = 0;
+    int eof = 0;
+    int have_sum = 0;
+    int64_t total = 0;
+    size_t fill = 0;
+    size_t pos = 0;
+    size_t literal_start = 0;
+    rolling_sum_t sum;
+    
+    while (result == 0) {
+        if (pos + block_size > fill && !eof) {
+            // Emit the literal run so far and slide the window to the front
+            result = add_literal(&encoder, buf + literal_start, pos - literal_start);
+            memmove(buf, buf + pos, fill - pos);
+            fill -= pos;
+            pos = 0;
+            literal_start = 0;
+            
+            ssize_t got = read(fd, buf + fill, capacity - fill);
+            if (got < 0 && errno == EINTR) continue;
+            if (got < 0) {
+                result = -1;
+                break;
+            }
+            if (got == 0) eof = 1;
+            fill += got;
+            total += got;
+            continue;
+        }
+        if (pos + block_size > fill) break; // Only a short tail is left
+        
+        if (sig_count == 0) {
+            pos = fill - block_size + 1; // Nothing can match, skip to the next read
+            continue;
+        }
+        
+        if (!have_sum) {
+            rolling_init(&sum, buf + pos, block_size);
+            have_sum = 1;
+        }
+        
+        long preferred = encoder.copy_count ? (long)(encoder.copy_start + encoder.copy_count) : -1;
+        long block = find_block(&index, rolling_digest(&sum), buf + pos, block_size, preferred);
+        if (block >= 0) {
+            result = add_literal(&encoder, buf + literal_start, pos - literal_start);
+            if (result == 0) result = add_copy(&encoder, block);
+            pos += block_size;
+            literal_start = pos;
+            have_sum = 0;
+        } else {
+            if (pos + block_size < fill) {
+                rolling_roll(&sum, buf[pos], buf[pos + block_size]);
+            } else {
+                have_sum = 0; // The window moves to new data after the next read
+            }
+            pos++;
+        }
+    }
+    
+    if (result == 0) result = add_literal(&encoder, buf + literal_start, fill - literal_start);
+    if (result == 0) result = flush_copy(&encoder);
+    
+    free(buf);
+    free(index.heads);
+    free(index.next);
+    return result == 0 ? total : -1;
+}
+
+// Decoder
+
+void delta_patch_init(delta_patch_t *patch, int basis_fd, int out_fd) {
+    patch->basis_fd = basis_fd;
+    patch->out_fd = out_fd;
+    patch->block_size = 0;
+    patch->header_len = 0;
+    patch->literal_left = 0;
+    patch->written = 0;
+    patch->error = 0;
+}
+
+static int write_all(delta_patch_t *patch, const unsigned char *data, size_t len) {
+    while (len > 0) {
+        ssize_t written = write(patch->out_fd, data, len);
+        if (written < 0 && errno == EINTR) continue;
+        if (written <= 0) {
+            patch->error = written < 0 ? errno : ENOSPC;
+            return -1;
+        }
+        patch->written += written;
+        data += written;
+        len -= written;
+    }
+    return 0;
+}
+
+static int copy_blocks(delta_patch_t *patch, uint64_t first, uint32_t count) {
+    unsigned char buffer[PATCH_COPY_BUFFER];
+    off_t offset = (off_t)(first * patch->block_size);
+    uint64_t remaining = (uint64_t)count * patch->block_size;
+    
+    while (remaining > 0) {
+        size_t want = remaining < sizeof(buffer) ? (size_t)remaining : sizeof(buffer);
+        ssize_t got = pread(patch->basis_fd, buffer, want, offset);
+        if (got < 0 && errno == EINTR) continue;
+        if (got <= 0) {
+            // The basis shrank since its signatures were taken
+            patch->error = got < 0 ? errno : EINVAL;
+            return -1;
+        }
+        if (write_all(patch, buffer, got) != 0) return -1;
+        offset += got;
+        remaining -= got;
+    }
+    return 0;
+}
+
+// Bytes the instruction header being collected needs in total
+static size_t header_needed(const delta_patch_t *patch) {
+    if (patch->block_size == 0) return STREAM_HEADER_SIZE;
+    if (patch->header_len == 0) return 1;
+    return patch->header[0] == DELTA_OP_COPY ? COPY_HEADER_SIZE : LITERAL_HEADER_SIZE;
+}
+
+static int run_header(delta_patch_t *patch) {
+    if (patch->block_size == 0) {
+        uint32_t block_size = get_u32(patch->header);
+        if (block_size == 0 || block_size > DELTA_MAX_BLOCK) {
+            patch->error = EINVAL;
+            return -1;
+        }
+        patch->block_size = block_size;
+        return 0;
+    }
+    if (patch->header[0] == DELTA_OP_COPY) {
+        return copy_blocks(patch, get_u64(patch->header + 1), get_u32(patch->header + 9));
+    }
+    patch->literal_left = get_u32(patch->header + 1);
+    return 0;
+}
+
+int delta_patch_feed(delta_patch_t *patch, const unsigned char *data, size_t len) {
+    while (len > 0) {
+        if (patch->error) return -1;
+        
+        if (patch->literal_left > 0) {
+            size_t piece = len < patch->literal_left ? len : patch->literal_left;
+            if (write_all(patch, data, piece) != 0) return -1;
+            patch->literal_left -= piece;
+            data += piece;
+            len -= piece;
+            continue;
+        }
+        
+        patch->header[patch->header_len++] = *data++;
+        len--;
+        
+        if (patch->block_size != 0 && patch->header_len == 1 &&
+            patch->header[0] != DELTA_OP_COPY && patch->header[0] != DELTA_OP_LITERAL) {
+            patch->error = EINVAL;
+            return -1;
+        }
+        if (patch->header_len == header_needed(patch)) {
+            int result = run_header(patch);
+            patch->header_len = 0;
+            if (result != 0) return -1;
+        }
+    }
+    return patch->error ? -1 : 0;
+}
+
+int delta_patch_finish(delta_patch_t *patch) {
+    if (patch->error) return -1;
+    if (patch->block_size == 0 || patch->header_len != 0 || patch->literal_left != 0) {
+        patch->error = EINVAL;
+        return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,159 @@
+#include "../include/durability.h"
+#include <limits.h>
+
+// Set once at startup, read on every landed file
+static durability_mode_t g_mode = DURABILITY_NONE;
+static int g_group_files = DURABILITY_GROUP_FILES;
+static int g_group_ms = DURABILITY_GROUP_MS;
+
+// Group sync state, shared by all connection workers
+static pthread_mutex_t g_group_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t g_group_wake = PTHREAD_COND_INITIALIZER;
+static pthread_once_t g_group_once = PTHREAD_ONCE_INIT;
+static int g_group_running = 0;      ///< The sync thread is up
+static int g_pending = 0;            ///< Files landed since the last sync
+static struct timespec g_deadline;   ///< When the oldest pending file must be synced
+
+void set_durability(durability_mode_t mode, int group_files, int group_ms) {
+    g_mode = mode;
+    if (group_files > 0) g_group_files = group_files;
+    if (group_ms > 0) g_group_ms = group_ms;
+}
+
+durability_mode_t durability_mode(void) {
+    return g_mode;
+}
+
+// Parse a positive decimal count of the group spec
+static int parse_group_count(const char *text, int *value) {
+    char *end;
+    long parsed = strtol(text, &end, 10);
+    if (text[0] == '\0' || (*end != '\0' && *end != ':') || parsed <= 0 || parsed > INT_MAX) return -1;
+    *value = (int)parsed;
+    return 0;
+}
+
+int parse_durability(const char *text) {
+    if (!text) return -1;
+    if (strcmp(text, "none") == 0) {
+        set_durability(DURABILITY_NONE, 0, 0);
+        return 0;
+    }
+    if (strcmp(text, "file") == 0) {
+        set_durability(DURABILITY_FILE, 0, 0);
+        return 0;
+    }
+    if (strncmp(text, "group", 5) != 0 || (text[5] != '\0' && text[5] != ':')) return -1;
+    
+    int files = DURABILITY_GROUP_FILES, ms = DURABILITY_GROUP_MS;
+    const char *spec = text + 5;
+    if (*spec == ':') {
+        if (parse_group_count(spec + 1, &files) != 0) return -1;
+        spec = strchr(spec + 1, ':');
+        if (spec && (parse_group_count(spec + 1, &ms) != 0 || strchr(spec + 1, ':'))) return -1;
+    }
+    set_durability(DURABILITY_GROUP, files, ms);
+    return 0;
+}
+
+/**
+ * Sync the filesystem of the working directory whenever a group is full
+ * or its oldest file has waited group_ms. Files that land during a sync
+ * count towards the next one.
+ */
+static void* group_sync_thread(void *arg) {
+    (void)arg;
+    int dir_fd = open(".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    
+    pthread_mutex_lock(&g_group_lock);
+    while (1) {
+        while (g_pending == 0) {
+            pthread_cond_wait(&g_group_wake, &g_group_lock);
+        }
+        while (g_pending > 0 && g_pending < g_group_files &&
+               pthread_cond_timedwait(&g_group_wake, &g_group_lock, &g_deadline) != ETIMEDOUT) {
+        }
+        if (g_pending == 0) continue;
+        g_pending = 0;
+        pthread_mutex_unlock(&g_group_lock);
+        
+        if (dir_fd < 0) {
+            sync();
+        } else if (syncfs(dir_fd) != 0) {
+            fprintf(stderr, "Error syncing received files: %s\n", strerror(errno));
+        }
+        pthread_mutex_lock(&g_group_lock);
+    }
+    return NULL;
+}
+
+static void start_group_sync(void) {
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, group_sync_thread, NULL) != 0) {
+        fprintf(stderr, "Failed to start group sync thread, syncing every file instead\n");
+        return;
+    }
+    pthread_detach(thread);
+    g_group_running = 1;
+}
+
+// Count a landed file towards the next group sync
+static void note_group_file(void) {
+    pthread_mutex_lock(&g_group_lock);
+    if (g_pending++ == 0) {
+        clock_gettime(CLOCK_REALTIME, &g_deadline);
+        g_deadline.tv_sec += g_group_ms / 1000;
+        g_deadline.tv_nsec += (long)(g_group_ms % 1000) * 1000000;
+        if (g_deadline.tv_nsec >= 1000000000) {
+            g_deadline.tv_sec++;
+            g_deadline.tv_nsec -= 1000000000;
+        }
+    }
+    if (g_pending == 1 || g_pending >= g_group_files) {
+        pthread_cond_signal(&g_group_wake);
+    }
+    pthread_mutex_unlock(&g_group_lock);
+}
+
+// Make a rename in the directory of path durable. Filesystems that cannot sync directories are let be
+static int sync_parent_dir(const char *path) {
+    char dir[MAX_PATH + 16];
+    const char *slash = strrchr(path, '/');
+    snprintf(dir, sizeof(dir), "%.*s", slash ? (int)(slash - path) : 1, slash ? path : ".");
+    if (dir[0] == '\0') strcpy(dir, "/");
+    
+    int dir_fd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dir_fd < 0) return errno;
+    int error = fsync(dir_fd) != 0 && errno != EINVAL ? errno : 0;
+    close(dir_fd);
+    return error;
+}
+
+int durability_land(int fd, const char *part_path, const char *path) {
+    // A group mode without its sync thread falls back to syncing each file
+    int sync_file = g_mode == DURABILITY_FILE;
+    if (g_mode == DURABILITY_GROUP) {
+        pthread_once(&g_group_once, start_group_sync);
+        sync_file = !g_group_running;
+    }
+    
+    int error = 0;
+    if (sync_file && fsync(fd) != 0) error = errno;
+    if (close(fd) != 0 && !error) error = errno;
+    if (!error && rename(part_path, path) != 0) error = errno;
+    if (!error && sync_file) error = sync_parent_dir(path);
+    if (!error && !sync_file && g_mode == DURABILITY_GROUP) note_group_file();
+    
+    if (error) {
+        errno = error;
+        return -1;
+    }
+    return 0;
+}
+
+int durability_pending(void) {
+    pthread_mutex_lock(&g_group_lock);
+    int pending = g_pending;
+    pthread_mutex_unlock(&g_group_lock);
+    return pending;
+}
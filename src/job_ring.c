@@ -0,0 +1,109 @@
+#include "../include/job_ring.h"
+
+job_ring_t* create_job_ring(int capacity) {
+    if (capacity <= 0) return NULL;
+    
+    size_t cells = 2;
+    while (cells < (size_t)capacity) {
+        cells <<= 1;
+    }
+    
+    job_ring_t *ring = malloc(sizeof(job_ring_t));
+    if (!ring) {
+        fprintf(stderr, "Failed to allocate memory for job ring\n");
+        return NULL;
+    }
+    
+    ring->cells = malloc(cells * sizeof(job_ring_cell_t));
+    if (!ring->cells) {
+        fprintf(stderr, "Failed to allocate memory for job ring cells\n");
+        free(ring);
+        return NULL;
+    }
+    
+    // Cell i is first ready for the push at position i
+    for (size_t i = 0; i < cells; i++) {
+        ring->cells[i].sequence = i;
+        ring->cells[i].job = NULL;
+    }
+    ring->mask = cells - 1;
+    ring->enqueue_pos = 0;
+    ring->dequeue_pos = 0;
+    return ring;
+}
+
+void destroy_job_ring(job_ring_t *ring) {
+    if (!ring) return;
+    
+    free(ring->cells);
+    free(ring);
+}
+
+size_t job_ring_capacity(const job_ring_t *ring) {
+    return ring->mask + 1;
+}
+
+size_t job_ring_size(const job_ring_t *ring) {
+    size_t dequeued = __atomic_load_n(&ring->dequeue_pos, __ATOMIC_RELAXED);
+    size_t enqueued = __atomic_load_n(&ring->enqueue_pos, __ATOMIC_RELAXED);
+    return enqueued > dequeued ? enqueued - dequeued : 0;
+}
+
+int job_ring_push(job_ring_t *ring, sync_job_t *job) {
+    size_t pos = __atomic_load_n(&ring->enqueue_pos, __ATOMIC_RELAXED);
+    job_ring_cell_t *cell;
+    
+    for (;;) {
+        cell = &ring->cells[pos & ring->mask];
+        size_t sequence = __atomic_load_n(&cell->sequence, __ATOMIC_ACQUIRE);
+        intptr_t diff = (intptr_t)sequence - (intptr_t)pos;
+        
+        if (diff == 0) {
+            // Cell is free for this position: claim it
+            if (__atomic_compare_exchange_n(&ring->enqueue_pos, &pos, pos + 1, 1,
+                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                break;
+            }
+        } else if (diff < 0) {
+            // Cell still holds the job from one lap ago
+            return -1;
+        } else {
+            // Another producer took this position
+            pos = __atomic_load_n(&ring->enqueue_pos, __ATOMIC_RELAXED);
+        }
+    }
+    
+    cell->job = job;
+    __atomic_store_n(&cell->sequence, pos + 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+sync_job_t* job_ring_pop(job_ring_t *ring) {
+    size_t pos = __atomic_load_n(&ring->dequeue_pos, __ATOMIC_RELAXED);
+    job_ring_cell_t *cell;
+    
+    for (;;) {
+        cell = &ring->cells[pos & ring->mask];
+        size_t sequence = __atomic_load_n(&cell->sequence, __ATOMIC_ACQUIRE);
+        intptr_t diff = (intptr_t)sequence - (intptr_t)(pos + 1);
+        
+        if (diff == 0) {
+            if (__atomic_compare_exchange_n(&ring->dequeue_pos, &pos, pos + 1, 1,
+                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                break;
+            }
+        } else if (diff < 0) {
+            // Nothing published at this position yet
+            return NULL;
+        } else {
+            pos = __atomic_load_n(&ring->dequeue_pos, __ATOMIC_RELAXED);
+        }
+    }
+    
+    sync_job_t *job = cell->job;
+    cell->job = NULL;
+    
+    // Hand the cell to the push one lap ahead
+    __atomic_store_n(&cell->sequence, pos + ring->mask + 1, __ATOMIC_RELEASE);
+    return job;
+}
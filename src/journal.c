@@ -0,0 +1,669 @@
+#include "../include/journal.h"
+#include <sys/mman.h>
+
+#define JOURNAL_VERSION 3
+#define JOURNAL_HEADER_SIZE 16           // Magic, version, reserved
+#define JOURNAL_LIVE_BUCKETS 256         // Hash buckets of the open jobs
+
+// Record types
+enum {
+    RECORD_PAIR = 1,                     // id: pair key, payload: config line
+    RECORD_PAIR_DROP,                    // id: pair key
+    RECORD_JOB,                          // id: job id, payload: job_record_t and the name
+    RECORD_PROGRESS,                     // id: job id, payload: committed offset, rewritten in place
+    RECORD_DONE                          // id: job id
+};
+
+// Every record starts with this, and is padded to 8 bytes
+typedef struct {
+    uint32_t checksum;                   // Of the rest of the header and the payload (but a progress one)
+    uint16_t type;
+    uint16_t length;                     // Payload bytes
+    uint64_t id;
+} record_header_t;
+
+// Payload of RECORD_JOB, the file name follows
+typedef struct {
+    uint64_t pair_key;
+    int64_t size;
+    int64_t mtime;
+    int64_t offset;
+    int64_t length;
+    int64_t committed;
+    uint64_t group;
+    uint32_t name_len;
+    uint32_t reserved;
+} job_record_t;
+
+typedef struct journal_pair {
+    uint64_t key;
+    char *line;
+    struct journal_pair *next;
+} journal_pair_t;
+
+// A job recorded and not ended, resume entries included
+typedef struct live_job {
+    uint64_t id;
+    size_t record;                       // Offset of its RECORD_JOB in the map
+    size_t slot;                         // Offset of the payload of its RECORD_PROGRESS
+    size_t moved;                        // Offset of its RECORD_JOB in a file being rewritten
+    struct live_job *next;
+} live_job_t;
+
+struct journal {
+    pthread_mutex_t lock;                // Protects everything below
+    int fd;                              // Journal file
+    char *map;                           // Mapping of the whole file
+    size_t capacity;                     // Bytes mapped (file size)
+    size_t tail;                         // End of the last record
+    size_t compacted;                    // Tail when the file was last rewritten
+    uint64_t next_id;                    // Id of the next job
+    live_job_t *live[JOURNAL_LIVE_BUCKETS]; // Open jobs by id
+    journal_pair_t *pairs;               // Console pairs
+    journal_entry_t *resume;             // Unfinished jobs not taken yet
+    char path[MAX_PATH];
+};
+
+static size_t record_size(size_t length) {
+    return (sizeof(record_header_t) + length + 7) & ~(size_t)7;
+}
+
+static uint32_t record_checksum(const record_header_t *header, const void *payload) {
+    uint64_t hash = fnv1a_update(FNV1A_INIT, &header->type, sizeof(*header) - sizeof(header->checksum));
+    if (header->type != RECORD_PROGRESS) hash = fnv1a_update(hash, payload, header->length);
+    return (uint32_t)(hash ^ (hash >> 32));
+}
+
+// Write a record at out, which has record_size(length) bytes. Returns the bytes used
+static size_t encode_record(char *out, uint16_t type, uint64_t id, const void *payload, size_t length) {
+    record_header_t header = { 0, type, (uint16_t)length, id };
+    header.checksum = record_checksum(&header, payload);
+    size_t size = record_size(length);
+    memset(out, 0, size);
+    memcpy(out, &header, sizeof(header));
+    if (length > 0) memcpy(out + sizeof(header), payload, length);
+    return size;
+}
+
+static size_t job_payload(const journal_entry_t *entry, char *out) {
+    job_record_t record = { entry->pair_key, entry->size, entry->mtime, entry->offset, entry->length,
+                            entry->committed, entry->group, (uint32_t)strlen(entry->name), 0 };
+    memcpy(out, &record, sizeof(record));
+    memcpy(out + sizeof(record), entry->name, record.name_len);
+    return sizeof(record) + record.name_len;
+}
+
+static journal_pair_t* find_pair(journal_t *journal, uint64_t key) {
+    for (journal_pair_t *pair = journal->pairs; pair; pair = pair->next) {
+        if (pair->key == key) return pair;
+    }
+    return NULL;
+}
+
+static void remove_pair(journal_t *journal, uint64_t key) {
+    for (journal_pair_t **link = &journal->pairs; *link; link = &(*link)->next) {
+        if ((*link)->key == key) {
+            journal_pair_t *pair = *link;
+            *link = pair->next;
+            free(pair->line);
+            free(pair);
+            return;
+        }
+    }
+}
+
+static live_job_t** find_live(journal_t *journal, uint64_t id) {
+    live_job_t **link = &journal->live[id % JOURNAL_LIVE_BUCKETS];
+    while (*link && (*link)->id != id) link = &(*link)->next;
+    return link;
+}
+
+static int add_live(journal_t *journal, uint64_t id, size_t record, size_t slot) {
+    live_job_t *job = malloc(sizeof(live_job_t));
+    if (!job) return -1;
+    job->id = id;
+    job->record = record;
+    job->slot = slot;
+    live_job_t **bucket = &journal->live[id % JOURNAL_LIVE_BUCKETS];
+    job->next = *bucket;
+    *bucket = job;
+    return 0;
+}
+
+static void remove_live(journal_t *journal, uint64_t id) {
+    live_job_t **link = find_live(journal, id);
+    if (*link) {
+        live_job_t *job = *link;
+        *link = job->next;
+        free(job);
+    }
+}
+
+static journal_entry_t* find_entry(journal_t *journal, uint64_t id) {
+    for (journal_entry_t *entry = journal->resume; entry; entry = entry->next) {
+        if (entry->id == id) return entry;
+    }
+    return NULL;
+}
+
+// Unlink the resume entries of a pair (of one file, or all with name NULL) and return them
+static journal_entry_t* unlink_entries(journal_t *journal, uint64_t key, const char *name) {
+    journal_entry_t *taken = NULL;
+    journal_entry_t **link = &journal->resume;
+    while (*link) {
+        journal_entry_t *entry = *link;
+        if (entry->pair_key == key && (!name || strcmp(entry->name, name) == 0)) {
+            *link = entry->next;
+            entry->next = taken;
+            taken = entry;
+        } else {
+            link = &entry->next;
+        }
+    }
+    return taken;
+}
+
+static void free_entries(journal_entry_t *entries) {
+    while (entries) {
+        journal_entry_t *next = entries->next;
+        free(entries);
+        entries = next;
+    }
+}
+
+// Apply one record found on replay to the state in memory
+static void replay_record(journal_t *journal, const record_header_t *header, const char *payload) {
+    switch (header->type) {
+    case RECORD_PAIR: {
+        char *line = strndup(payload, header->length);
+        if (!line) return;
+        journal_pair_t *pair = find_pair(journal, header->id);
+        if (!pair) {
+            pair = malloc(sizeof(journal_pair_t));
+            if (!pair) {
+                free(line);
+                return;
+            }
+            pair->key = header->id;
+            pair->next = journal->pairs;
+            journal->pairs = pair;
+        } else {
+            free(pair->line);
+        }
+        pair->line = line;
+        break;
+    }
+    case RECORD_PAIR_DROP:
+        remove_pair(journal, header->id);
+        free_entries(unlink_entries(journal, header->id, NULL));
+        break;
+    case RECORD_JOB: {
+        job_record_t record;
+        if (header->length < sizeof(record)) return;
+        memcpy(&record, payload, sizeof(record));
+        if (record.name_len == 0 || record.name_len >= MAX_FILENAME ||
+            sizeof(record) + record.name_len > header->length) {
+            return;
+        }
+        journal_entry_t *entry = calloc(1, sizeof(journal_entry_t));
+        if (!entry) return;
+        entry->id = header->id;
+        entry->pair_key = record.pair_key;
+        entry->size = record.size;
+        entry->mtime = record.mtime;
+        entry->offset = record.offset;
+        entry->length = record.length;
+        entry->committed = record.committed;
+        entry->group = record.group;
+        memcpy(entry->name, payload + sizeof(record), record.name_len);
+        entry->next = journal->resume;
+        journal->resume = entry;
+        if (header->id >= journal->next_id) journal->next_id = header->id + 1;
+        break;
+    }
+    case RECORD_PROGRESS: {
+        journal_entry_t *entry = find_entry(journal, header->id);
+        if (entry && header->length == sizeof(int64_t)) {
+            memcpy(&entry->committed, payload, sizeof(int64_t));
+        }
+        break;
+    }
+    case RECORD_DONE:
+        for (journal_entry_t **link = &journal->resume; *link; link = &(*link)->next) {
+            if ((*link)->id == header->id) {
+                journal_entry_t *entry = *link;
+                *link = entry->next;
+                free(entry);
+                break;
+            }
+        }
+        break;
+    }
+}
+
+// Read the records of an existing journal file. Returns -1 if it is not one
+static int replay_file(journal_t *journal, int fd, size_t size) {
+    if (size == 0) return 0;
+    if (size < JOURNAL_HEADER_SIZE) return -1;
+    
+    char *data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED) return -1;
+    uint32_t version;
+    memcpy(&version, data + strlen(JOURNAL_MAGIC), sizeof(version));
+    if (memcmp(data, JOURNAL_MAGIC, strlen(JOURNAL_MAGIC)) != 0 || version != JOURNAL_VERSION) {
+        munmap(data, size);
+        return -1;
+    }
+    
+    // The first torn or unused record ends the journal
+    size_t offset = JOURNAL_HEADER_SIZE;
+    while (offset + sizeof(record_header_t) <= size) {
+        record_header_t header;
+        memcpy(&header, data + offset, sizeof(header));
+        if (header.type == 0 || offset + record_size(header.length) > size ||
+            record_checksum(&header, data + offset + sizeof(header)) != header.checksum) {
+            break;
+        }
+        replay_record(journal, &header, data + offset + sizeof(header));
+        offset += record_size(header.length);
+    }
+    munmap(data, size);
+    return 0;
+}
+
+/**
+ * Replace the journal file with one holding just the pairs and the open
+ * jobs, and map it. Written aside and renamed, so a crash leaves the old
+ * file or the new one. Open jobs are copied from the old mapping with
+ * their progress; the first rewrite, on open, writes the resume entries
+ * and starts tracking them. Lock held (or not yet shared).
+ */
+static int rewrite_journal(journal_t *journal) {
+    size_t slot_size = record_size(sizeof(int64_t));
+    size_t size = JOURNAL_HEADER_SIZE;
+    for (journal_pair_t *pair = journal->pairs; pair; pair = pair->next) {
+        size += record_size(strlen(pair->line));
+    }
+    if (journal->map) {
+        for (int i = 0; i < JOURNAL_LIVE_BUCKETS; i++) {
+            for (live_job_t *job = journal->live[i]; job; job = job->next) {
+                size += job->slot + sizeof(int64_t) - job->record;
+            }
+        }
+    } else {
+        for (journal_entry_t *entry = journal->resume; entry; entry = entry->next) {
+            size += record_size(sizeof(job_record_t) + strlen(entry->name)) + slot_size;
+        }
+    }
+    size_t capacity = (size + JOURNAL_GROW) / JOURNAL_GROW * JOURNAL_GROW;
+    
+    char *buffer = calloc(1, size);
+    if (!buffer) return -1;
+    memcpy(buffer, JOURNAL_MAGIC, strlen(JOURNAL_MAGIC));
+    uint32_t version = JOURNAL_VERSION;
+    memcpy(buffer + strlen(JOURNAL_MAGIC), &version, sizeof(version));
+    size_t used = JOURNAL_HEADER_SIZE;
+    for (journal_pair_t *pair = journal->pairs; pair; pair = pair->next) {
+        used += encode_record(buffer + used, RECORD_PAIR, pair->key, pair->line, strlen(pair->line));
+    }
+    if (journal->map) {
+        for (int i = 0; i < JOURNAL_LIVE_BUCKETS; i++) {
+            for (live_job_t *job = journal->live[i]; job; job = job->next) {
+                size_t job_size = job->slot - sizeof(record_header_t) - job->record;
+                int64_t committed = __atomic_load_n((int64_t*)(journal->map + job->slot), __ATOMIC_RELAXED);
+                job->moved = used;
+                memcpy(buffer + used, journal->map + job->record, job_size);
+                used += job_size;
+                used += encode_record(buffer + used, RECORD_PROGRESS, job->id, &committed, sizeof(committed));
+            }
+        }
+    } else {
+        for (journal_entry_t *entry = journal->resume; entry; entry = entry->next) {
+            char payload[sizeof(job_record_t) + MAX_FILENAME];
+            size_t length = job_payload(entry, payload);
+            size_t record = used;
+            used += encode_record(buffer + used, RECORD_JOB, entry->id, payload, length);
+            if (add_live(journal, entry->id, record, used + sizeof(record_header_t)) != 0) {
+                free(buffer);
+                return -1;
+            }
+            used += encode_record(buffer + used, RECORD_PROGRESS, entry->id, &entry->committed,
+                                  sizeof(entry->committed));
+        }
+    }
+    
+    char temp_path[MAX_PATH + 8];
+    snprintf(temp_path, sizeof(temp_path), "%s.tmp", journal->path);
+    int fd = open(temp_path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    int result = fd >= 0 ? 0 : -1;
+    for (size_t written = 0; result == 0 && written < used; ) {
+        ssize_t n = write(fd, buffer + written, used - written);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) result = -1;
+        else written += (size_t)n;
+    }
+    free(buffer);
+    if (result == 0 && (ftruncate(fd, (off_t)capacity) != 0 || fsync(fd) != 0 ||
+                        rename(temp_path, journal->path) != 0)) {
+        result = -1;
+    }
+    
+    char *map = MAP_FAILED;
+    if (result == 0) {
+        map = mmap(NULL, capacity, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (map == MAP_FAILED) result = -1;
+    }
+    if (result != 0) {
+        fprintf(stderr, "Error rewriting journal %s: %s\n", journal->path, strerror(errno));
+        if (fd >= 0) {
+            close(fd);
+            unlink(temp_path);
+        }
+        return -1;
+    }
+    
+    if (journal->map) {
+        for (int i = 0; i < JOURNAL_LIVE_BUCKETS; i++) {
+            for (live_job_t *job = journal->live[i]; job; job = job->next) {
+                job->slot = job->moved + (job->slot - job->record);
+                job->record = job->moved;
+            }
+        }
+        munmap(journal->map, journal->capacity);
+    }
+    if (journal->fd >= 0) close(journal->fd);
+    journal->fd = fd;
+    journal->map = map;
+    journal->capacity = capacity;
+    journal->tail = used;
+    journal->compacted = used;
+    return 0;
+}
+
+// Make room for size more bytes of records, growing the file as needed. Lock held
+static int reserve_records(journal_t *journal, size_t size) {
+    if (journal->tail + size <= journal->capacity) return 0;
+    
+    size_t capacity = (journal->tail + size + JOURNAL_GROW) / JOURNAL_GROW * JOURNAL_GROW;
+    if (ftruncate(journal->fd, (off_t)capacity) != 0) {
+        fprintf(stderr, "Error growing journal %s: %s\n", journal->path, strerror(errno));
+        return -1;
+    }
+    char *map = mremap(journal->map, journal->capacity, capacity, MREMAP_MAYMOVE);
+    if (map == MAP_FAILED) {
+        fprintf(stderr, "Error growing journal %s: %s\n", journal->path, strerror(errno));
+        return -1;
+    }
+    journal->map = map;
+    journal->capacity = capacity;
+    return 0;
+}
+
+// Append a record. Lock held
+static int append_record(journal_t *journal, uint16_t type, uint64_t id, const void *payload, size_t length) {
+    if (reserve_records(journal, record_size(length)) != 0) return -1;
+    journal->tail += encode_record(journal->map + journal->tail, type, id, payload, length);
+    return 0;
+}
+
+/**
+ * Append a job record and the progress record after it, which
+ * journal_progress() overwrites in place from then on. Lock held
+ */
+static int append_job(journal_t *journal, uint64_t id, const void *payload, size_t length, int64_t committed) {
+    size_t record = journal->tail;
+    size_t slot = record + record_size(length) + sizeof(record_header_t);
+    if (reserve_records(journal, record_size(length) + record_size(sizeof(committed))) != 0 ||
+        add_live(journal, id, record, slot) != 0) {
+        return -1;
+    }
+    journal->tail += encode_record(journal->map + journal->tail, RECORD_JOB, id, payload, length);
+    journal->tail += encode_record(journal->map + journal->tail, RECORD_PROGRESS, id, &committed, sizeof(committed));
+    return 0;
+}
+
+// One job ended: a journal whose ended records add up is rewritten. Lock held
+static void end_job(journal_t *journal, uint64_t id) {
+    remove_live(journal, id);
+    if (journal->tail - journal->compacted > JOURNAL_COMPACT_SIZE) {
+        rewrite_journal(journal);
+    }
+}
+
+journal_t* journal_open(const char *path) {
+    if (!path || strlen(path) >= MAX_PATH) return NULL;
+    
+    journal_t *journal = calloc(1, sizeof(journal_t));
+    if (!journal) {
+        fprintf(stderr, "Failed to allocate memory for journal\n");
+        return NULL;
+    }
+    strcpy(journal->path, path);
+    journal->fd = -1;
+    journal->next_id = 1;
+    if (pthread_mutex_init(&journal->lock, NULL) != 0) {
+        free(journal);
+        return NULL;
+    }
+    
+    int fd = open(path, O_RDONLY | O_CREAT | O_CLOEXEC, 0644);
+    struct stat file_stat;
+    if (fd < 0 || fstat(fd, &file_stat) != 0) {
+        fprintf(stderr, "Error opening journal %s: %s\n", path, strerror(errno));
+        if (fd >= 0) close(fd);
+        journal_close(journal);
+        return NULL;
+    }
+    int replayed = replay_file(journal, fd, (size_t)file_stat.st_size);
+    close(fd);
+    if (replayed != 0) {
+        fprintf(stderr, "Error opening journal %s: not a journal file of this version\n", path);
+        journal_close(journal);
+        return NULL;
+    }
+    
+    if (rewrite_journal(journal) != 0) {
+        journal_close(journal);
+        return NULL;
+    }
+    return journal;
+}
+
+void journal_close(journal_t *journal) {
+    if (!journal) return;
+    
+    if (journal->map) {
+        msync(journal->map, journal->capacity, MS_SYNC);
+        munmap(journal->map, journal->capacity);
+    }
+    if (journal->fd >= 0) close(journal->fd);
+    pthread_mutex_destroy(&journal->lock);
+    while (journal->pairs) {
+        journal_pair_t *next = journal->pairs->next;
+        free(journal->pairs->line);
+        free(journal->pairs);
+        journal->pairs = next;
+    }
+    free_entries(journal->resume);
+    for (int i = 0; i < JOURNAL_LIVE_BUCKETS; i++) {
+        while (journal->live[i]) {
+            live_job_t *next = journal->live[i]->next;
+            free(journal->live[i]);
+            journal->live[i] = next;
+        }
+    }
+    free(journal);
+}
+
+uint64_t journal_pair_key(const sync_info_t *info) {
+    uint64_t key = fnv1a_update(FNV1A_INIT, info->source_host, strlen(info->source_host) + 1);
+    key = fnv1a_update(key, &info->source_port, sizeof(info->source_port));
+    key = fnv1a_update(key, info->source_dir, strlen(info->source_dir) + 1);
+    key = fnv1a_update(key, info->target_host, strlen(info->target_host) + 1);
+    key = fnv1a_update(key, &info->target_port, sizeof(info->target_port));
+    return fnv1a_update(key, info->target_dir, strlen(info->target_dir) + 1);
+}
+
+void journal_add_pair(journal_t *journal, uint64_t key, const char *line) {
+    if (!journal || !line) return;
+    
+    size_t length = strcspn(line, "\r\n");
+    char *copy = strndup(line, length);
+    if (!copy) return;
+    
+    pthread_mutex_lock(&journal->lock);
+    journal_pair_t *pair = find_pair(journal, key);
+    if (!pair && (pair = malloc(sizeof(journal_pair_t))) != NULL) {
+        pair->key = key;
+        pair->line = NULL;
+        pair->next = journal->pairs;
+        journal->pairs = pair;
+    }
+    if (pair && append_record(journal, RECORD_PAIR, key, copy, length) == 0) {
+        free(pair->line);
+        pair->line = copy;
+        copy = NULL;
+    }
+    pthread_mutex_unlock(&journal->lock);
+    free(copy);
+}
+
+void journal_drop_pair(journal_t *journal, uint64_t key) {
+    if (!journal) return;
+    
+    pthread_mutex_lock(&journal->lock);
+    append_record(journal, RECORD_PAIR_DROP, key, NULL, 0);
+    remove_pair(journal, key);
+    journal_entry_t *entries = unlink_entries(journal, key, NULL);
+    for (journal_entry_t *entry = entries; entry; entry = entry->next) {
+        end_job(journal, entry->id);
+    }
+    pthread_mutex_unlock(&journal->lock);
+    free_entries(entries);
+}
+
+char** journal_pair_lines(journal_t *journal, int *count) {
+    *count = 0;
+    if (!journal) return NULL;
+    
+    pthread_mutex_lock(&journal->lock);
+    int pairs = 0;
+    for (journal_pair_t *pair = journal->pairs; pair; pair = pair->next) {
+        pairs++;
+    }
+    char **lines = pairs > 0 ? calloc(pairs, sizeof(char*)) : NULL;
+    for (journal_pair_t *pair = journal->pairs; lines && pair; pair = pair->next) {
+        char *line = strdup(pair->line);
+        if (line) lines[(*count)++] = line;
+    }
+    pthread_mutex_unlock(&journal->lock);
+    return lines;
+}
+
+uint64_t journal_add_job(journal_t *journal, const sync_info_t *info, const char *name, int64_t size,
+                         int64_t mtime, int64_t offset, int64_t length, uint64_t group) {
+    if (!journal || !info || !name || strlen(name) >= MAX_FILENAME) return 0;
+    
+    journal_entry_t entry;
+    memset(&entry, 0, sizeof(entry));
+    entry.pair_key = journal_pair_key(info);
+    entry.size = size;
+    entry.mtime = mtime;
+    entry.offset = offset;
+    entry.length = length;
+    entry.committed = offset;
+    entry.group = group;
+    strcpy(entry.name, name);
+    char payload[sizeof(job_record_t) + MAX_FILENAME];
+    size_t payload_len = job_payload(&entry, payload);
+    
+    pthread_mutex_lock(&journal->lock);
+    uint64_t id = journal->next_id;
+    if (append_job(journal, id, payload, payload_len, offset) == 0) {
+        journal->next_id++;
+    } else {
+        id = 0;
+    }
+    pthread_mutex_unlock(&journal->lock);
+    return id;
+}
+
+void journal_progress(journal_t *journal, uint64_t id, int64_t committed) {
+    if (!journal || id == 0) return;
+    
+    // An aligned 8-byte store cannot be torn, so the slot needs no checksum
+    pthread_mutex_lock(&journal->lock);
+    live_job_t *job = *find_live(journal, id);
+    if (job) __atomic_store_n((int64_t*)(journal->map + job->slot), committed, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&journal->lock);
+}
+
+void journal_done(journal_t *journal, uint64_t id) {
+    if (!journal || id == 0) return;
+    
+    pthread_mutex_lock(&journal->lock);
+    if (append_record(journal, RECORD_DONE, id, NULL, 0) == 0) {
+        end_job(journal, id);
+    }
+    pthread_mutex_unlock(&journal->lock);
+}
+
+// Record the end of entries handed back without being resumed. Lock held
+static int end_entries(journal_t *journal, journal_entry_t *entries) {
+    int ended = 0;
+    for (journal_entry_t *entry = entries; entry; entry = entry->next) {
+        if (append_record(journal, RECORD_DONE, entry->id, NULL, 0) == 0) {
+            end_job(journal, entry->id);
+        }
+        ended++;
+    }
+    return ended;
+}
+
+int journal_take_resume(journal_t *journal, const sync_info_t *info, const char *name,
+                        int64_t size, int64_t mtime, journal_entry_t **entries) {
+    *entries = NULL;
+    if (!journal || !info || !name) return 0;
+    
+    pthread_mutex_lock(&journal->lock);
+    if (!journal->resume) {
+        pthread_mutex_unlock(&journal->lock);
+        return 0;
+    }
+    journal_entry_t *taken = unlink_entries(journal, journal_pair_key(info), name);
+    
+    // A changed file is copied from scratch; so is one split differently than before
+    int count = 0;
+    for (journal_entry_t *entry = taken; entry; entry = entry->next) {
+        if (entry->size != size || entry->mtime != mtime || entry->group != taken->group ||
+            (!entry->group && count > 0)) {
+            count = -1;
+            break;
+        }
+        count++;
+    }
+    if (count <= 0) {
+        end_entries(journal, taken);
+        pthread_mutex_unlock(&journal->lock);
+        free_entries(taken);
+        return 0;
+    }
+    pthread_mutex_unlock(&journal->lock);
+    *entries = taken;
+    return count;
+}
+
+int journal_drop_resume(journal_t *journal, const sync_info_t *info) {
+    if (!journal || !info) return 0;
+    
+    pthread_mutex_lock(&journal->lock);
+    if (!journal->resume) {
+        pthread_mutex_unlock(&journal->lock);
+        return 0;
+    }
+    journal_entry_t *left = unlink_entries(journal, journal_pair_key(info), NULL);
+    int ended = end_entries(journal, left);
+    pthread_mutex_unlock(&journal->lock);
+    free_entries(left);
+    return ended;
+}
@@ -0,0 +1,508 @@
+#include "../include/log.h"
+#include <sched.h>
+
+/**
+ * One buffered record. The body is formatted by the logging thread in
+ * the format chosen at that time; the flusher only adds time and level.
+ */
+typedef struct {
+    struct timespec time;            ///< When the record was made (CLOCK_REALTIME)
+    log_level_t level;               ///< Record level
+    log_format_t format;             ///< Layout of body
+    int echo;                        ///< Also print to stdout
+    int to_file;                     ///< Write to the flushed log file (not for log_write())
+    int len;                         ///< Bytes in body
+    char body[LOG_LINE_MAX];         ///< Message, or JSON fields without braces
+} log_record_t;
+
+/**
+ * Records of one thread. Only the owner advances head and only the
+ * flusher advances tail, so neither side needs a lock.
+ */
+typedef struct log_ring {
+    log_record_t slots[LOG_RING_SLOTS];
+    size_t head;                     ///< Next slot the owner fills
+    size_t tail;                     ///< Next slot the flusher writes out
+    int writing;                     ///< Owner is stamping and filling the head slot
+    int orphaned;                    ///< Owner exited, freed once drained
+    struct log_ring *next;           ///< Next registered ring
+} log_ring_t;
+
+static log_level_t g_log_level = LOG_LEVEL_INFO;
+static log_format_t g_log_format = LOG_FORMAT_TEXT;
+
+// Flusher state, g_log_rings and the wakeup are protected by g_log_mutex
+static FILE *g_log_file = NULL;
+static int g_log_running = 0;
+static int g_log_stop = 0;
+static int g_log_wake_pending = 0;
+static log_ring_t *g_log_rings = NULL;
+static pthread_t g_log_flusher;
+static pthread_mutex_t g_log_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t g_log_wake = PTHREAD_COND_INITIALIZER;
+
+static pthread_key_t g_ring_key;
+static pthread_once_t g_ring_key_once = PTHREAD_ONCE_INIT;
+static __thread log_ring_t *t_ring = NULL;
+
+static const char *const LEVEL_NAMES[] = { "error", "warn", "info", "debug" };
+
+void set_log_level(log_level_t level) {
+    g_log_level = level;
+}
+
+void set_log_format(log_format_t format) {
+    g_log_format = format;
+}
+
+int parse_log_level(const char *name, log_level_t *level) {
+    if (!name || !level) return -1;
+    
+    for (int i = LOG_LEVEL_ERROR; i <= LOG_LEVEL_DEBUG; i++) {
+        if (strcmp(name, LEVEL_NAMES[i]) == 0) {
+            *level = (log_level_t)i;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+int parse_log_format(const char *name, log_format_t *format) {
+    if (!name || !format) return -1;
+    
+    if (strcmp(name, "text") == 0) {
+        *format = LOG_FORMAT_TEXT;
+    } else if (strcmp(name, "json") == 0) {
+        *format = LOG_FORMAT_JSON;
+    } else {
+        return -1;
+    }
+    return 0;
+}
+
+int log_enabled(log_level_t level) {
+    return level <= g_log_level;
+}
+
+// Record Formatting
+
+/**
+ * Append s to out as the inside of a JSON string. Never splits an
+ * escape sequence. Returns the new length of out.
+ */
+static int json_escape(char *out, int len, int size, const char *s) {
+    for (; *s; s++) {
+        unsigned char c = (unsigned char)*s;
+        char escaped[8];
+        int n;
+        if (c == '"' || c == '\\') {
+            n = snprintf(escaped, sizeof(escaped), "\\%c", c);
+        } else if (c == '\n') {
+            n = snprintf(escaped, sizeof(escaped), "\\n");
+        } else if (c < 0x20) {
+            n = snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+        } else {
+            escaped[0] = (char)c;
+            n = 1;
+        }
+        if (len + n >= size) break;
+        memcpy(out + len, escaped, n);
+        len += n;
+    }
+    out[len] = '\0';
+    return len;
+}
+
+// Append "key":"value" (with a leading comma unless first) to a JSON body
+static int json_field(char *out, int len, int size, const char *key, const char *value) {
+    int n = snprintf(out + len, size - len, "%s\"%s\":\"", len > 0 ? "," : "", key);
+    if (n < 0 || len + n >= size) return len;
+    len = json_escape(out, len + n, size - 1, value);
+    out[len++] = '"';
+    out[len] = '\0';
+    return len;
+}
+
+static void format_message(log_record_t *record, const char *format, va_list args) {
+    if (record->format == LOG_FORMAT_JSON) {
+        char message[LOG_LINE_MAX];
+        vsnprintf(message, sizeof(message), format, args);
+        record->len = json_field(record->body, 0, sizeof(record->body), "msg", message);
+    } else {
+        int len = vsnprintf(record->body, sizeof(record->body), format, args);
+        record->len = len < 0 ? 0 : len >= (int)sizeof(record->body) ? (int)sizeof(record->body) - 1 : len;
+    }
+}
+
+static void format_event(log_record_t *record, const char *source, const char *target,
+                         const char *op, const char *result, const char *format, va_list args) {
+    char details[LOG_LINE_MAX];
+    vsnprintf(details, sizeof(details), format, args);
+    
+    char *body = record->body;
+    int size = sizeof(record->body);
+    int len;
+    if (record->format == LOG_FORMAT_JSON) {
+        len = json_field(body, 0, size, "source", source);
+        len = json_field(body, len, size, "target", target);
+        int n = snprintf(body + len, size - len, ",\"thread\":%d", (int)pthread_self());
+        if (n > 0 && len + n < size) len += n;
+        len = json_field(body, len, size, "op", op);
+        len = json_field(body, len, size, "result", result);
+        len = json_field(body, len, size, "details", details);
+    } else {
+        len = snprintf(body, size, "[%s] [%s] [%d] [%s] [%s] [%s]",
+                       source, target, (int)pthread_self(), op, result, details);
+        if (len < 0) len = 0;
+        if (len >= size) len = size - 1;
+    }
+    record->len = len;
+}
+
+static void write_record(FILE *out, const log_record_t *record) {
+    struct tm tm_info;
+    char timestamp[32];
+    localtime_r(&record->time.tv_sec, &tm_info);
+    strftime(timestamp, sizeof(timestamp), TIMESTAMP_FORMAT, &tm_info);
+    
+    if (record->format == LOG_FORMAT_JSON) {
+        fprintf(out, "{\"time\":\"%s.%03ld\",\"level\":\"%s\",%.*s}\n", timestamp,
+                record->time.tv_nsec / 1000000, LEVEL_NAMES[record->level], record->len, record->body);
+    } else {
+        fprintf(out, "[%s] %.*s\n", timestamp, record->len, record->body);
+    }
+}
+
+// Write a record right away, as logging did before the flusher existed
+static void write_now(FILE *file, const log_record_t *record) {
+    if (record->echo) {
+        write_record(stdout, record);
+    }
+    if (file) {
+        write_record(file, record);
+        fflush(file);
+    }
+}
+
+// Flusher
+
+static void wake_flusher(void) {
+    if (__atomic_exchange_n(&g_log_wake_pending, 1, __ATOMIC_ACQ_REL)) return;
+    
+    pthread_mutex_lock(&g_log_mutex);
+    pthread_cond_signal(&g_log_wake);
+    pthread_mutex_unlock(&g_log_mutex);
+}
+
+static void orphan_ring(void *ring) {
+    __atomic_store_n(&((log_ring_t*)ring)->orphaned, 1, __ATOMIC_RELEASE);
+}
+
+static void create_ring_key(void) {
+    pthread_key_create(&g_ring_key, orphan_ring);
+}
+
+/**
+ * Ring of the calling thread, registered on first use. A ring stays
+ * registered across log_stop() and log_start() as long as its thread
+ * lives, so the next flusher takes it over. NULL if not running.
+ */
+static log_ring_t* thread_ring(void) {
+    if (t_ring) return t_ring;
+    
+    pthread_once(&g_ring_key_once, create_ring_key);
+    log_ring_t *ring = calloc(1, sizeof(log_ring_t));
+    if (!ring) return NULL;
+    
+    pthread_mutex_lock(&g_log_mutex);
+    if (!g_log_running) {
+        pthread_mutex_unlock(&g_log_mutex);
+        free(ring);
+        return NULL;
+    }
+    ring->next = g_log_rings;
+    g_log_rings = ring;
+    pthread_mutex_unlock(&g_log_mutex);
+    
+    pthread_setspecific(g_ring_key, ring);
+    t_ring = ring;
+    return ring;
+}
+
+/**
+ * Free slot in the calling thread's ring, or NULL if the record has to
+ * be written synchronously. Waits for the flusher when the ring is full.
+ * The slot is marked as being written; stamp it right away and publish
+ * it.
+ */
+static log_record_t* claim_record(log_ring_t **ring_out) {
+    if (!__atomic_load_n(&g_log_running, __ATOMIC_ACQUIRE)) return NULL;
+    
+    log_ring_t *ring = thread_ring();
+    if (!ring) return NULL;
+    
+    while (ring->head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) >= LOG_RING_SLOTS) {
+        wake_flusher();
+        sched_yield();
+        if (!__atomic_load_n(&g_log_running, __ATOMIC_ACQUIRE)) return NULL;
+    }
+    
+    // Set before the record is stamped, see flush_rings()
+    __atomic_store_n(&ring->writing, 1, __ATOMIC_SEQ_CST);
+    *ring_out = ring;
+    return &ring->slots[ring->head & (LOG_RING_SLOTS - 1)];
+}
+
+static void publish_record(log_ring_t *ring) {
+    size_t head = ring->head + 1;
+    __atomic_store_n(&ring->head, head, __ATOMIC_RELEASE);
+    __atomic_store_n(&ring->writing, 0, __ATOMIC_RELEASE);
+    
+    // Half full: do not wait for the next timed pass
+    if (head - __atomic_load_n(&ring->tail, __ATOMIC_RELAXED) == LOG_RING_SLOTS / 2) {
+        wake_flusher();
+    }
+}
+
+static int earlier(const struct timespec *a, const struct timespec *b) {
+    return a->tv_sec < b->tv_sec || (a->tv_sec == b->tv_sec && a->tv_nsec < b->tv_nsec);
+}
+
+/**
+ * Write out everything stamped before the pass began, oldest record
+ * first across all rings, then free rings whose thread has exited.
+ * Later records, and rings registered meanwhile, are left to the next
+ * pass. A record stamped before the cutoff but not yet published would
+ * come out of order, so the pass first waits for records being written:
+ * a thread that has not marked its ring yet stamps after the cutoff.
+ */
+static void flush_rings(void) {
+    struct timespec cutoff;
+    clock_gettime(CLOCK_REALTIME, &cutoff);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    
+    pthread_mutex_lock(&g_log_mutex);
+    log_ring_t *rings = g_log_rings;
+    pthread_mutex_unlock(&g_log_mutex);
+    
+    for (log_ring_t *ring = rings; ring; ring = ring->next) {
+        while (__atomic_load_n(&ring->writing, __ATOMIC_SEQ_CST)) {
+            sched_yield();
+        }
+    }
+    
+    int written = 0;
+    while (1) {
+        log_ring_t *oldest = NULL;
+        const log_record_t *first = NULL;
+        for (log_ring_t *ring = rings; ring; ring = ring->next) {
+            if (ring->tail == __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE)) continue;
+            
+            const log_record_t *record = &ring->slots[ring->tail & (LOG_RING_SLOTS - 1)];
+            if (!earlier(&record->time, &cutoff)) continue;
+            if (!first || earlier(&record->time, &first->time)) {
+                first = record;
+                oldest = ring;
+            }
+        }
+        if (!first) break;
+        
+        if (first->echo) write_record(stdout, first);
+        if (first->to_file) write_record(g_log_file, first);
+        __atomic_store_n(&oldest->tail, oldest->tail + 1, __ATOMIC_RELEASE);
+        written++;
+    }
+    if (written > 0) {
+        fflush(g_log_file);
+        fflush(stdout);
+    }
+    
+    pthread_mutex_lock(&g_log_mutex);
+    log_ring_t **link = &g_log_rings;
+    while (*link) {
+        log_ring_t *ring = *link;
+        if (__atomic_load_n(&ring->orphaned, __ATOMIC_ACQUIRE) &&
+            ring->tail == __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE)) {
+            *link = ring->next;
+            free(ring);
+        } else {
+            link = &ring->next;
+        }
+    }
+    pthread_mutex_unlock(&g_log_mutex);
+}
+
+static void* flusher_thread(void *arg) {
+    (void)arg;
+    
+    while (1) {
+        pthread_mutex_lock(&g_log_mutex);
+        if (!g_log_stop && !g_log_wake_pending) {
+            struct timespec deadline;
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_nsec += LOG_FLUSH_MS * 1000000L;
+            deadline.tv_sec += deadline.tv_nsec / 1000000000L;
+            deadline.tv_nsec %= 1000000000L;
+            pthread_cond_timedwait(&g_log_wake, &g_log_mutex, &deadline);
+        }
+        int stopping = g_log_stop;
+        __atomic_store_n(&g_log_wake_pending, 0, __ATOMIC_RELEASE);
+        pthread_mutex_unlock(&g_log_mutex);
+        
+        flush_rings();
+        if (stopping) break;
+    }
+    return NULL;
+}
+
+int log_start(FILE *file) {
+    if (!file) return -1;
+    
+    pthread_mutex_lock(&g_log_mutex);
+    if (g_log_running) {
+        pthread_mutex_unlock(&g_log_mutex);
+        return -1;
+    }
+    g_log_file = file;
+    g_log_stop = 0;
+    
+    if (pthread_create(&g_log_flusher, NULL, flusher_thread, NULL) != 0) {
+        fprintf(stderr, "Failed to create log flusher thread\n");
+        g_log_file = NULL;
+        pthread_mutex_unlock(&g_log_mutex);
+        return -1;
+    }
+    __atomic_store_n(&g_log_running, 1, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&g_log_mutex);
+    return 0;
+}
+
+void log_stop(void) {
+    pthread_mutex_lock(&g_log_mutex);
+    if (!g_log_running) {
+        pthread_mutex_unlock(&g_log_mutex);
+        return;
+    }
+    __atomic_store_n(&g_log_running, 0, __ATOMIC_RELEASE);
+    g_log_stop = 1;
+    pthread_cond_signal(&g_log_wake);
+    pthread_mutex_unlock(&g_log_mutex);
+    
+    // The last pass writes out whatever was published before the flag dropped
+    pthread_join(g_log_flusher, NULL);
+    
+    // Exited threads are gone; a ring of a thread still alive stays
+    // registered for the next log_start(), except the caller's, which is
+    // released here
+    pthread_mutex_lock(&g_log_mutex);
+    log_ring_t **link = &g_log_rings;
+    while (*link) {
+        log_ring_t *ring = *link;
+        if (ring == t_ring || __atomic_load_n(&ring->orphaned, __ATOMIC_ACQUIRE)) {
+            *link = ring->next;
+            free(ring);
+        } else {
+            link = &ring->next;
+        }
+    }
+    g_log_file = NULL;
+    pthread_mutex_unlock(&g_log_mutex);
+    
+    if (t_ring) {
+        pthread_setspecific(g_ring_key, NULL);
+        t_ring = NULL;
+    }
+}
+
+// Records
+
+void log_write(log_level_t level, const char *format, ...) {
+    if (!format || !log_enabled(level)) return;
+    
+    log_ring_t *ring = NULL;
+    log_record_t local;
+    log_record_t *record = claim_record(&ring);
+    if (!record) record = &local;
+    
+    clock_gettime(CLOCK_REALTIME, &record->time);
+    record->level = level;
+    record->format = g_log_format;
+    record->echo = 1;
+    record->to_file = 0;
+    
+    va_list args;
+    va_start(args, format);
+    format_message(record, format, args);
+    va_end(args);
+    
+    if (ring) {
+        publish_record(ring);
+    } else {
+        write_now(NULL, record);
+    }
+}
+
+void log_event(FILE *file, const char *source, const char *target, const char *op,
+               const char *result, const char *format, ...) {
+    log_level_t level = strcmp(result, "ERROR") == 0 ? LOG_LEVEL_ERROR : LOG_LEVEL_INFO;
+    if (!file || !format || !log_enabled(level)) return;
+    
+    log_ring_t *ring = NULL;
+    log_record_t local;
+    log_record_t *record = NULL;
+    if (file == __atomic_load_n(&g_log_file, __ATOMIC_ACQUIRE)) {
+        record = claim_record(&ring);
+    }
+    if (!record) record = &local;
+    
+    clock_gettime(CLOCK_REALTIME, &record->time);
+    record->level = level;
+    record->format = ring ? g_log_format : LOG_FORMAT_TEXT;
+    record->echo = 0;
+    record->to_file = 1;
+    
+    va_list args;
+    va_start(args, format);
+    format_event(record, source, target, op, result, format, args);
+    va_end(args);
+    
+    if (ring) {
+        publish_record(ring);
+    } else {
+        write_now(file, record);
+    }
+}
+
+void log_message(FILE *logfile, const char *format, ...) {
+    if (!format) {
+        fprintf(stderr, "Warning: log_message called with NULL format\n");
+        return;
+    }
+    if (!log_enabled(LOG_LEVEL_INFO)) return;
+    
+    // Records for the flushed file are queued, anything else is written now
+    log_ring_t *ring = NULL;
+    log_record_t local;
+    log_record_t *record = NULL;
+    if (logfile && logfile == __atomic_load_n(&g_log_file, __ATOMIC_ACQUIRE)) {
+        record = claim_record(&ring);
+    }
+    if (!record) record = &local;
+    
+    clock_gettime(CLOCK_REALTIME, &record->time);
+    record->level = LOG_LEVEL_INFO;
+    record->format = ring ? g_log_format : LOG_FORMAT_TEXT;
+    record->echo = 1;
+    record->to_file = 1;
+    
+    va_list args;
+    va_start(args, format);
+    format_message(record, format, args);
+    va_end(args);
+    
+    if (ring) {
+        publish_record(ring);
+    } else {
+        write_now(logfile, record);
+    }
+}
@@ -0,0 +1,193 @@
+#include "../include/manifest.h"
+#include <inttypes.h>
+
+static size_t bucket_of(const manifest_t *manifest, const char *name) {
+    return fnv1a_update(FNV1A_INIT, name, strlen(name)) & (manifest->bucket_count - 1);
+}
+
+manifest_t* create_manifest(void) {
+    manifest_t *manifest = malloc(sizeof(manifest_t));
+    if (!manifest) {
+        fprintf(stderr, "Failed to allocate memory for manifest\n");
+        return NULL;
+    }
+    
+    manifest->bucket_count = MANIFEST_BUCKETS;
+    manifest->count = 0;
+    manifest->buckets = calloc(manifest->bucket_count, sizeof(manifest_entry_t*));
+    if (!manifest->buckets) {
+        fprintf(stderr, "Failed to allocate memory for manifest buckets\n");
+        free(manifest);
+        return NULL;
+    }
+    
+    if (pthread_mutex_init(&manifest->mutex, NULL) != 0) {
+        fprintf(stderr, "Failed to initialize manifest mutex: %s\n", strerror(errno));
+        free(manifest->buckets);
+        free(manifest);
+        return NULL;
+    }
+    
+    return manifest;
+}
+
+// Must be called with manifest mutex held
+static void clear_entries(manifest_t *manifest) {
+    for (size_t i = 0; i < manifest->bucket_count; i++) {
+        manifest_entry_t *entry = manifest->buckets[i];
+        while (entry) {
+            manifest_entry_t *next = entry->next;
+            free(entry);
+            entry = next;
+        }
+        manifest->buckets[i] = NULL;
+    }
+    manifest->count = 0;
+}
+
+void destroy_manifest(manifest_t *manifest) {
+    if (!manifest) return;
+    
+    pthread_mutex_lock(&manifest->mutex);
+    clear_entries(manifest);
+    pthread_mutex_unlock(&manifest->mutex);
+    
+    pthread_mutex_destroy(&manifest->mutex);
+    free(manifest->buckets);
+    free(manifest);
+}
+
+void manifest_clear(manifest_t *manifest) {
+    if (!manifest) return;
+    
+    pthread_mutex_lock(&manifest->mutex);
+    clear_entries(manifest);
+    pthread_mutex_unlock(&manifest->mutex);
+}
+
+// Double the bucket array once entries outnumber buckets. Mutex held
+static void grow_buckets(manifest_t *manifest) {
+    size_t bucket_count = manifest->bucket_count * 2;
+    manifest_entry_t **buckets = calloc(bucket_count, sizeof(manifest_entry_t*));
+    if (!buckets) return; // Keep the longer chains
+    
+    size_t old_count = manifest->bucket_count;
+    manifest_entry_t **old = manifest->buckets;
+    manifest->buckets = buckets;
+    manifest->bucket_count = bucket_count;
+    
+    for (size_t i = 0; i < old_count; i++) {
+        manifest_entry_t *entry = old[i];
+        while (entry) {
+            manifest_entry_t *next = entry->next;
+            size_t bucket = bucket_of(manifest, entry->meta.name);
+            entry->next = buckets[bucket];
+            buckets[bucket] = entry;
+            entry = next;
+        }
+    }
+    free(old);
+}
+
+int manifest_put(manifest_t *manifest, const file_meta_t *meta) {
+    if (!manifest || !meta) return -1;
+    
+    pthread_mutex_lock(&manifest->mutex);
+    
+    size_t bucket = bucket_of(manifest, meta->name);
+    for (manifest_entry_t *entry = manifest->buckets[bucket]; entry; entry = entry->next) {
+        if (strcmp(entry->meta.name, meta->name) == 0) {
+            entry->meta = *meta;
+            pthread_mutex_unlock(&manifest->mutex);
+            return 0;
+        }
+    }
+    
+    manifest_entry_t *entry = malloc(sizeof(manifest_entry_t));
+    if (!entry) {
+        pthread_mutex_unlock(&manifest->mutex);
+        return -1;
+    }
+    entry->meta = *meta;
+    entry->next = manifest->buckets[bucket];
+    manifest->buckets[bucket] = entry;
+    
+    if (++manifest->count > manifest->bucket_count) {
+        grow_buckets(manifest);
+    }
+    
+    pthread_mutex_unlock(&manifest->mutex);
+    return 0;
+}
+
+int manifest_get(manifest_t *manifest, const char *name, file_meta_t *meta) {
+    if (!manifest || !name) return 0;
+    
+    pthread_mutex_lock(&manifest->mutex);
+    
+    for (manifest_entry_t *entry = manifest->buckets[bucket_of(manifest, name)]; entry; entry = entry->next) {
+        if (strcmp(entry->meta.name, name) == 0) {
+            if (meta) *meta = entry->meta;
+            pthread_mutex_unlock(&manifest->mutex);
+            return 1;
+        }
+    }
+    
+    pthread_mutex_unlock(&manifest->mutex);
+    return 0;
+}
+
+int manifest_needs_sync(manifest_t *manifest, const file_meta_t *source, sync_check_t check) {
+    if (check == SYNC_CHECK_NONE || source->size < 0) return 1;
+    
+    file_meta_t target;
+    if (!manifest_get(manifest, source->name, &target)) return 1;
+    if (target.size != source->size) return 1;
+    
+    if (check == SYNC_CHECK_HASH && source->has_hash && target.has_hash) {
+        return source->hash != target.hash;
+    }
+    return source->mtime != target.mtime;
+}
+
+int parse_list_entry(const char *line, file_meta_t *meta) {
+    if (!line || !meta) return -1;
+    
+    long long size, mtime;
+    char hash[32];
+    int name_offset = 0;
+    if (sscanf(line, "%lld %lld %31s%n", &size, &mtime, hash, &name_offset) != 3 ||
+        line[name_offset] != ' ') {
+        return -1;
+    }
+    
+    // Exactly one separator: the name itself may start with a space
+    const char *name = line + name_offset + 1;
+    size_t name_len = strlen(name);
+    if (name_len == 0 || name_len >= sizeof(meta->name)) {
+        return -1;
+    }
+    
+    memcpy(meta->name, name, name_len + 1);
+    meta->size = size;
+    meta->mtime = mtime;
+    meta->has_hash = strcmp(hash, "-") != 0;
+    meta->hash = meta->has_hash ? strtoull(hash, NULL, 16) : 0;
+    return 0;
+}
+
+int format_list_entry(const file_meta_t *meta, char *out, size_t size) {
+    char hash[32];
+    if (meta->has_hash) {
+        snprintf(hash, sizeof(hash), "%016" PRIx64, meta->hash);
+    } else {
+        strcpy(hash, "-");
+    }
+    
+    int len = snprintf(out, size, "%lld %lld %s %s\n", (long long)meta->size,
+                       (long long)meta->mtime, hash, meta->name);
+    if (len < 0 || (size_t)len >= size) {
+        return -1;
+    }
+    return len;
+}
@@ -0,0 +1,300 @@
+#include "../include/metrics.h"
+#include "../include/sync_info.h"
+#include "../include/job_ring.h"
+#include <inttypes.h>
+#include <poll.h>
+
+metrics_t g_metrics;
+
+static uint64_t load(const uint64_t *counter) {
+    return __atomic_load_n(counter, __ATOMIC_RELAXED);
+}
+
+uint64_t metrics_now_us(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+void histogram_observe(histogram_t *histogram, uint64_t value_us) {
+    int bucket = 0;
+    uint64_t bound = METRICS_FIRST_BOUND_US;
+    while (bucket < METRICS_BUCKETS && value_us > bound) {
+        bucket++;
+        bound *= 2;
+    }
+    __atomic_add_fetch(&histogram->buckets[bucket], 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&histogram->sum_us, value_us, __ATOMIC_RELAXED);
+}
+
+static uint64_t histogram_count(const histogram_t *histogram) {
+    uint64_t count = 0;
+    for (int i = 0; i <= METRICS_BUCKETS; i++) {
+        count += load(&histogram->buckets[i]);
+    }
+    return count;
+}
+
+uint64_t histogram_quantile(const histogram_t *histogram, double quantile) {
+    uint64_t count = histogram_count(histogram);
+    if (count == 0) return 0;
+    
+    // Rank of the observation the quantile falls on, counting from 1
+    uint64_t rank = (uint64_t)(quantile * count + 0.999999);
+    if (rank < 1) rank = 1;
+    
+    uint64_t seen = 0;
+    uint64_t bound = METRICS_FIRST_BOUND_US;
+    for (int i = 0; i < METRICS_BUCKETS; i++, bound *= 2) {
+        seen += load(&histogram->buckets[i]);
+        if (seen >= rank) return bound;
+    }
+    return UINT64_MAX;
+}
+
+// Prometheus Format
+
+// Write s as a label value: backslash, quote and newline are escaped
+static void write_label(FILE *out, const char *s) {
+    for (; *s; s++) {
+        if (*s == '\\' || *s == '"') {
+            fputc('\\', out);
+            fputc(*s, out);
+        } else if (*s == '\n') {
+            fputs("\\n", out);
+        } else {
+            fputc(*s, out);
+        }
+    }
+}
+
+static void write_family(FILE *out, const char *name, const char *type, const char *help) {
+    fprintf(out, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
+
+static void write_histogram(FILE *out, const char *name, const char *help, const histogram_t *histogram) {
+    write_family(out, name, "histogram", help);
+    
+    uint64_t cumulative = 0;
+    uint64_t bound = METRICS_FIRST_BOUND_US;
+    for (int i = 0; i < METRICS_BUCKETS; i++, bound *= 2) {
+        cumulative += load(&histogram->buckets[i]);
+        fprintf(out, "%s_bucket{le=\"%g\"} %" PRIu64 "\n", name, bound / 1e6, cumulative);
+    }
+    cumulative += load(&histogram->buckets[METRICS_BUCKETS]);
+    fprintf(out, "%s_bucket{le=\"+Inf\"} %" PRIu64 "\n", name, cumulative);
+    fprintf(out, "%s_sum %.6f\n", name, load(&histogram->sum_us) / 1e6);
+    fprintf(out, "%s_count %" PRIu64 "\n", name, cumulative);
+}
+
+/**
+ * One per-pair metric family, written by visiting every pair
+ */
+typedef struct {
+    FILE *out;
+    const char *name;
+    int field;
+} pair_family_t;
+
+enum { PAIR_BYTES, PAIR_FILES, PAIR_ERRORS, PAIR_ACTIVE };
+
+static void write_pair_sample(const sync_info_t *info, void *ctx) {
+    pair_family_t *family = ctx;
+    FILE *out = family->out;
+    char spec[MAX_PATH + MAX_HOST_SIZE + 16];
+    
+    fprintf(out, "%s{pair=\"%d\",source=\"", family->name, info->id);
+    snprintf(spec, sizeof(spec), "%s@%s:%d", info->source_dir, info->source_host, info->source_port);
+    write_label(out, spec);
+    fputs("\",target=\"", out);
+    snprintf(spec, sizeof(spec), "%s@%s:%d", info->target_dir, info->target_host, info->target_port);
+    write_label(out, spec);
+    
+    uint64_t value = 0;
+    switch (family->field) {
+        case PAIR_BYTES: value = load(&info->bytes_synced); break;
+        case PAIR_FILES: value = load(&info->files_synced); break;
+        case PAIR_ERRORS: value = (uint64_t)__atomic_load_n(&info->error_count, __ATOMIC_RELAXED); break;
+        case PAIR_ACTIVE: value = (uint64_t)__atomic_load_n(&info->active, __ATOMIC_RELAXED); break;
+    }
+    fprintf(out, "\"} %" PRIu64 "\n", value);
+}
+
+static int queue_depth(const thread_pool_t *pool) {
+    if (pool->ring) return (int)job_ring_size(pool->ring);
+    return __atomic_load_n(&pool->queue_size, __ATOMIC_RELAXED);
+}
+
+static int queue_capacity(const thread_pool_t *pool) {
+    return pool->ring ? (int)job_ring_capacity(pool->ring) : pool->buffer_size;
+}
+
+void write_metrics(FILE *out, thread_pool_t *pool, struct sync_info_store *store) {
+    static const struct {
+        const char *name;
+        const char *type;
+        const char *help;
+        int field;
+    } pair_families[] = {
+        { "nfs_pair_bytes_total", "counter", "Bytes pushed to the target of a sync pair.", PAIR_BYTES },
+        { "nfs_pair_files_total", "counter", "Files of a sync pair brought up to date.", PAIR_FILES },
+        { "nfs_pair_errors_total", "counter", "Failed jobs of a sync pair.", PAIR_ERRORS },
+        { "nfs_pair_active", "gauge", "Whether a sync pair is being synchronized.", PAIR_ACTIVE },
+    };
+    
+    if (store) {
+        for (size_t i = 0; i < sizeof(pair_families) / sizeof(pair_families[0]); i++) {
+            write_family(out, pair_families[i].name, pair_families[i].type, pair_families[i].help);
+            pair_family_t family = { out, pair_families[i].name, pair_families[i].field };
+            for_each_sync_info(store, write_pair_sample, &family);
+        }
+    }
+    
+    if (pool) {
+        write_family(out, "nfs_workers", "gauge", "Worker threads.");
+        fprintf(out, "nfs_workers %d\n", pool->thread_count);
+        write_family(out, "nfs_queue_depth", "gauge", "Jobs waiting for a worker.");
+        fprintf(out, "nfs_queue_depth %d\n", queue_depth(pool));
+        write_family(out, "nfs_queue_capacity", "gauge", "Jobs the queue holds before producers block.");
+        fprintf(out, "nfs_queue_capacity %d\n", queue_capacity(pool));
+        
+        write_family(out, "nfs_worker_jobs_total", "counter", "Jobs finished by a worker.");
+        for (int i = 0; i < pool->thread_count; i++) {
+            fprintf(out, "nfs_worker_jobs_total{worker=\"%d\"} %" PRIu64 "\n", i, load(&pool->stats[i].jobs));
+        }
+        write_family(out, "nfs_worker_errors_total", "counter", "Jobs of a worker that failed.");
+        for (int i = 0; i < pool->thread_count; i++) {
+            fprintf(out, "nfs_worker_errors_total{worker=\"%d\"} %" PRIu64 "\n", i, load(&pool->stats[i].errors));
+        }
+        write_family(out, "nfs_worker_bytes_total", "counter", "Bytes pushed by a worker.");
+        for (int i = 0; i < pool->thread_count; i++) {
+            fprintf(out, "nfs_worker_bytes_total{worker=\"%d\"} %" PRIu64 "\n", i, load(&pool->stats[i].bytes));
+        }
+        write_family(out, "nfs_worker_busy_seconds_total", "counter", "Time a worker spent running jobs.");
+        for (int i = 0; i < pool->thread_count; i++) {
+            fprintf(out, "nfs_worker_busy_seconds_total{worker=\"%d\"} %.6f\n", i,
+                    load(&pool->stats[i].busy_us) / 1e6);
+        }
+    }
+    
+    write_histogram(out, "nfs_transfer_seconds", "Time to run a successful job.", &g_metrics.transfer);
+    write_histogram(out, "nfs_queue_wait_seconds", "Time jobs waited in the queue.", &g_metrics.queue_wait);
+    write_histogram(out, "nfs_connect_seconds", "Time to open and negotiate a client connection.",
+                    &g_metrics.connect);
+    write_family(out, "nfs_connect_errors_total", "counter", "Client connections that could not be opened.");
+    fprintf(out, "nfs_connect_errors_total %" PRIu64 "\n", load(&g_metrics.connect_errors));
+}
+
+// Console Summary
+
+static void format_duration(char *out, size_t size, uint64_t us) {
+    if (us == UINT64_MAX) {
+        uint64_t last = (uint64_t)METRICS_FIRST_BOUND_US << (METRICS_BUCKETS - 1);
+        snprintf(out, size, ">%.0fs", last / 1e6);
+    } else if (us < 1000) {
+        snprintf(out, size, "%" PRIu64 "us", us);
+    } else if (us < 1000000) {
+        snprintf(out, size, "%.1fms", us / 1e3);
+    } else {
+        snprintf(out, size, "%.2fs", us / 1e6);
+    }
+}
+
+static void write_latency_line(FILE *out, const char *label, const histogram_t *histogram) {
+    uint64_t count = histogram_count(histogram);
+    if (count == 0) {
+        fprintf(out, "%s: none yet\n", label);
+        return;
+    }
+    
+    char p50[16], p90[16], p99[16];
+    format_duration(p50, sizeof(p50), histogram_quantile(histogram, 0.50));
+    format_duration(p90, sizeof(p90), histogram_quantile(histogram, 0.90));
+    format_duration(p99, sizeof(p99), histogram_quantile(histogram, 0.99));
+    fprintf(out, "%s: %" PRIu64 " samples, p50 <= %s, p90 <= %s, p99 <= %s\n", label, count, p50, p90, p99);
+}
+
+static void write_pair_summary(const sync_info_t *info, void *ctx) {
+    FILE *out = ctx;
+    fprintf(out, "Pair %d %s@%s:%d -> %s@%s:%d: %" PRIu64 " files, %.1f MiB, %d errors%s\n",
+            info->id, info->source_dir, info->source_host, info->source_port,
+            info->target_dir, info->target_host, info->target_port,
+            load(&info->files_synced), load(&info->bytes_synced) / (1024.0 * 1024.0),
+            __atomic_load_n(&info->error_count, __ATOMIC_RELAXED),
+            __atomic_load_n(&info->active, __ATOMIC_RELAXED) ? "" : " (cancelled)");
+}
+
+void write_stats_summary(FILE *out, thread_pool_t *pool, struct sync_info_store *store) {
+    if (pool) {
+        fprintf(out, "Workers: %d, queued jobs: %d of %d\n", pool->thread_count,
+                queue_depth(pool), queue_capacity(pool));
+    }
+    write_latency_line(out, "Transfer", &g_metrics.transfer);
+    write_latency_line(out, "Queue wait", &g_metrics.queue_wait);
+    write_latency_line(out, "Connect", &g_metrics.connect);
+    fprintf(out, "Connect errors: %" PRIu64 "\n", load(&g_metrics.connect_errors));
+    
+    if (store) {
+        for_each_sync_info(store, write_pair_summary, out);
+    }
+    if (pool) {
+        for (int i = 0; i < pool->thread_count; i++) {
+            const worker_stats_t *stats = &pool->stats[i];
+            fprintf(out, "Worker %d: %" PRIu64 " jobs, %" PRIu64 " errors, %.1f MiB, %.2fs busy\n", i,
+                    load(&stats->jobs), load(&stats->errors), load(&stats->bytes) / (1024.0 * 1024.0),
+                    load(&stats->busy_us) / 1e6);
+        }
+    }
+}
+
+// HTTP Endpoint
+
+static int send_all(int fd, const char *data, size_t len) {
+    while (len > 0) {
+        ssize_t sent = send(fd, data, len, MSG_NOSIGNAL);
+        if (sent < 0 && errno == EINTR) continue;
+        if (sent <= 0) return -1;
+        data += sent;
+        len -= sent;
+    }
+    return 0;
+}
+
+int serve_metrics_request(int client_fd, thread_pool_t *pool, struct sync_info_store *store) {
+    // Read up to the end of the headers; scrapers send nothing after them
+    char request[METRICS_MAX_REQUEST];
+    size_t len = 0;
+    while (len < sizeof(request) - 1) {
+        struct pollfd pfd = { client_fd, POLLIN, 0 };
+        if (poll(&pfd, 1, 1000) <= 0) return -1;
+        
+        ssize_t received = recv(client_fd, request + len, sizeof(request) - 1 - len, 0);
+        if (received < 0 && errno == EINTR) continue;
+        if (received <= 0) return -1;
+        len += received;
+        request[len] = '\0';
+        if (strstr(request, "\r\n\r\n") || strstr(request, "\n\n")) break;
+    }
+    
+    if (strncmp(request, "GET ", 4) != 0) {
+        const char *reply = "HTTP/1.0 405 Method Not Allowed\r\nAllow: GET\r\nContent-Length: 0\r\n"
+                            "Connection: close\r\n\r\n";
+        return send_all(client_fd, reply, strlen(reply));
+    }
+    
+    char *body = NULL;
+    size_t body_len = 0;
+    FILE *out = open_memstream(&body, &body_len);
+    if (!out) return -1;
+    write_metrics(out, pool, store);
+    fclose(out);
+    
+    char header[256];
+    int header_len = snprintf(header, sizeof(header),
+                              "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\n"
+                              "Content-Length: %zu\r\nConnection: close\r\n\r\n", body_len);
+    int result = send_all(client_fd, header, header_len) == 0 &&
+                 send_all(client_fd, body, body_len) == 0 ? 0 : -1;
+    free(body);
+    return result;
+}
@@ -1,18 +1,58 @@
 #include "../include/common.h"
 #include "../include/nfs_client_logic.h"
 
+static void print_usage(const char *prog) {
+    fprintf(stderr, "Usage: %s -p <port_number> [-w <worker_threads>] [-e sendfile|buffered|uring] [-f none|file|group[:<files>[:<ms>]]]\n", prog);
+}
+
 int main(int argc, char *argv[]) {
-    if (argc != 3 || strcmp(argv[1], "-p") != 0) {
-        fprintf(stderr, "Usage: %s -p <port_number>\n", argv[0]);
-        return 1;
+    int port = 0;
+    int workers = DEFAULT_CLIENT_WORKERS;
+    
+    for (int i = 1; i < argc; i += 2) {
+        if (i + 1 >= argc) {
+            print_usage(argv[0]);
+            return 1;
+        }
+        
+        if (strcmp(argv[i], "-p") == 0) {
+            port = atoi(argv[i + 1]);
+            if (port <= 0) {
+                fprintf(stderr, "Invalid port number: %s\n", argv[i + 1]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "-w") == 0) {
+            workers = atoi(argv[i + 1]);
+            if (workers <= 0) {
+                fprintf(stderr, "Invalid worker count: %s\n", argv[i + 1]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "-e") == 0) {
+            client_io_engine_t engine;
+            if (parse_client_io_engine(argv[i + 1], &engine) != 0) {
+                fprintf(stderr, "Unknown I/O engine: %s\n", argv[i + 1]);
+                return 1;
+            }
+            set_client_io_engine(engine);
+        } else if (strcmp(argv[i], "-f") == 0) {
+            if (parse_durability(argv[i + 1]) != 0) {
+                fprintf(stderr, "Invalid durability mode: %s\n", argv[i + 1]);
+                return 1;
+            }
+        } else {
+            print_usage(argv[0]);
+            return 1;
+        }
     }
     
-    int port = atoi(argv[2]);
-    if (port <= 0) {
-        fprintf(stderr, "Invalid port number: %s\n", argv[2]);
+    if (port == 0) {
+        print_usage(argv[0]);
         return 1;
     }
     
+    // A worker whose peer disconnects mid-send must not take the process down
+    signal(SIGPIPE, SIG_IGN);
+    
     printf("Starting nfs_client on port %d\n", port);
     
     int server_fd = create_server_socket(port);
@@ -22,26 +62,8 @@ int main(int argc, char *argv[]) {
     
     printf("nfs_client listening on port %d\n", port);
     
-    while (1) {
-        struct sockaddr_in client_addr;
-        socklen_t client_len = sizeof(client_addr);
-        
-        int client_fd = accept(server_fd, (struct sockaddr*)&client_addr, &client_len);
-        if (client_fd < 0) {
-            fprintf(stderr, "Error accepting connection: %s\n", strerror(errno));
-            continue;
-        }
-        
-        printf("Client connected from %s:%d\n", 
-               inet_ntoa(client_addr.sin_addr), ntohs(client_addr.sin_port));
-        
-        // Handle client in the same thread for simplicity
-        // In a production system, you might want to use separate threads
-        handle_client_connection(client_fd);
-        
-        printf("Client disconnected\n");
-    }
+    int result = run_client_workers(server_fd, workers);
     
     close(server_fd);
-    return 0;
-}
\ No newline at end of file
+    return result == 0 ? 0 : 1;
+}
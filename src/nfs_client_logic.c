@@ -1,5 +1,311 @@
 #include "../include/common.h"
 #include "../include/nfs_client_logic.h"
+#include "../include/manifest.h"
+#include "../include/compress.h"
+#include "../include/uring.h"
+#include "../include/tree_walk.h"
+
+#include <poll.h>
+#include <sys/file.h>
+
+#ifdef __linux__
+#include <sys/sendfile.h>
+#include <sys/inotify.h>
+#endif
+
+// Largest count Linux transfers in a single sendfile() call
+#define SENDFILE_MAX_CHUNK 0x7ffff000L
+
+// Files whose content hash a client remembers (a power of two)
+#define HASH_CACHE_SLOTS 4096
+
+static client_io_engine_t g_io_engine = CLIENT_IO_SENDFILE;
+
+void set_client_io_engine(client_io_engine_t engine) {
+    g_io_engine = engine;
+}
+
+int parse_client_io_engine(const char *name, client_io_engine_t *engine) {
+    if (!name || !engine) return -1;
+    
+    if (strcmp(name, "sendfile") == 0) {
+        *engine = CLIENT_IO_SENDFILE;
+    } else if (strcmp(name, "buffered") == 0) {
+        *engine = CLIENT_IO_BUFFERED;
+    } else if (strcmp(name, "uring") == 0) {
+        *engine = CLIENT_IO_URING;
+    } else {
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Output of one reply: bytes are collected and sent in batches of up to
+ * MAX_BUFFER_SIZE bytes instead of one send() per line. Framed replies
+ * (protocol version 2) go out as DATA frames, plain ones as raw text.
+ */
+typedef struct {
+    int fd;                          ///< Connection to reply on
+    uint32_t stream_id;              ///< Stream the reply belongs to
+    int framed;                      ///< Wrap batches in DATA frames
+    size_t len;                      ///< Bytes waiting in buf
+    uint64_t total;                  ///< Bytes sent so far
+    char buf[MAX_BUFFER_SIZE];       ///< Pending reply bytes
+} reply_buffer_t;
+
+static void reply_init(reply_buffer_t *reply, int fd, uint32_t stream_id, int framed) {
+    reply->fd = fd;
+    reply->stream_id = stream_id;
+    reply->framed = framed;
+    reply->len = 0;
+    reply->total = 0;
+}
+
+static int reply_send(reply_buffer_t *reply, const char *data, size_t len) {
+    if (reply->framed) {
+        if (send_frame(reply->fd, FRAME_DATA, reply->stream_id, data, len) != 0) {
+            return -1;
+        }
+    } else {
+        size_t sent_total = 0;
+        while (sent_total < len) {
+            ssize_t sent = send(reply->fd, data + sent_total, len - sent_total, 0);
+            if (sent < 0) {
+                if (errno == EINTR) continue;
+                fprintf(stderr, "Error sending reply: %s\n", strerror(errno));
+                return -1;
+            }
+            sent_total += sent;
+        }
+    }
+    
+    reply->total += len;
+    return 0;
+}
+
+static int reply_flush(reply_buffer_t *reply) {
+    if (reply->len == 0) return 0;
+    
+    if (reply_send(reply, reply->buf, reply->len) != 0) {
+        return -1;
+    }
+    reply->len = 0;
+    return 0;
+}
+
+static int reply_append(reply_buffer_t *reply, const char *data, size_t len) {
+    if (reply->len + len > sizeof(reply->buf) && reply_flush(reply) != 0) {
+        return -1;
+    }
+    if (len > sizeof(reply->buf)) {
+        // Too large to batch, send it from the caller's memory
+        return reply_send(reply, data, len);
+    }
+    memcpy(reply->buf + reply->len, data, len);
+    reply->len += len;
+    return 0;
+}
+
+static int reply_emit(void *ctx, const void *data, size_t len) {
+    return reply_append((reply_buffer_t*)ctx, data, len);
+}
+
+/**
+ * Content hashes of files listed with LIST_FLAG_HASH, so pairs with
+ * check=hash do not reread unchanged files on every listing. A slot is
+ * picked by inode and holds one file; its hash is used while the file
+ * keeps its size, mtime and ctime.
+ */
+typedef struct {
+    dev_t dev;
+    ino_t ino;
+    off_t size;
+    struct timespec mtime;
+    struct timespec ctime;
+    uint64_t hash;
+} hash_cache_slot_t;
+
+static hash_cache_slot_t g_hash_cache[HASH_CACHE_SLOTS];
+static pthread_mutex_t g_hash_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static hash_cache_slot_t* hash_cache_slot(const struct stat *file_stat) {
+    uint64_t key = fnv1a_update(FNV1A_INIT, &file_stat->st_dev, sizeof(file_stat->st_dev));
+    key = fnv1a_update(key, &file_stat->st_ino, sizeof(file_stat->st_ino));
+    return &g_hash_cache[key & (HASH_CACHE_SLOTS - 1)];
+}
+
+static int same_file_version(const hash_cache_slot_t *slot, const struct stat *file_stat) {
+    return slot->ino == file_stat->st_ino && slot->dev == file_stat->st_dev &&
+           slot->size == file_stat->st_size &&
+           slot->mtime.tv_sec == file_stat->st_mtim.tv_sec && slot->mtime.tv_nsec == file_stat->st_mtim.tv_nsec &&
+           slot->ctime.tv_sec == file_stat->st_ctim.tv_sec && slot->ctime.tv_nsec == file_stat->st_ctim.tv_nsec;
+}
+
+/**
+ * FNV-1a hash of a whole file, read with plain read() calls unless the
+ * cache has it for this version (file_stat) of the file. A file that
+ * changed while it was read is hashed but not cached.
+ */
+static int hash_file(int dir_fd, const char *name, const struct stat *file_stat, uint64_t *hash) {
+    hash_cache_slot_t *slot = hash_cache_slot(file_stat);
+    pthread_mutex_lock(&g_hash_cache_lock);
+    int cached = same_file_version(slot, file_stat);
+    if (cached) *hash = slot->hash;
+    pthread_mutex_unlock(&g_hash_cache_lock);
+    if (cached) return 0;
+    
+    int fd = openat(dir_fd, name, O_RDONLY);
+    if (fd < 0) return -1;
+    
+    char buffer[MAX_BUFFER_SIZE * 8];
+    uint64_t h = FNV1A_INIT;
+    ssize_t bytes_read;
+    while ((bytes_read = read(fd, buffer, sizeof(buffer))) != 0) {
+        if (bytes_read < 0) {
+            if (errno == EINTR) continue;
+            close(fd);
+            return -1;
+        }
+        h = fnv1a_update(h, buffer, bytes_read);
+    }
+    
+    hash_cache_slot_t read_version;
+    struct stat after;
+    if (fstat(fd, &after) == 0) {
+        read_version.dev = after.st_dev;
+        read_version.ino = after.st_ino;
+        read_version.size = after.st_size;
+        read_version.mtime = after.st_mtim;
+        read_version.ctime = after.st_ctim;
+        read_version.hash = h;
+        if (same_file_version(&read_version, file_stat)) {
+            pthread_mutex_lock(&g_hash_cache_lock);
+            *slot = read_version;
+            pthread_mutex_unlock(&g_hash_cache_lock);
+        }
+    }
+    close(fd);
+    *hash = h;
+    return 0;
+}
+
+/**
+ * Format the LIST line of one regular file: the listed name, or a
+ * metadata line (see manifest.h) when LIST_FLAG_META is set. name is
+ * the file within dir_fd, listed its name in the reply (a relative path
+ * in recursive listings). Returns the line length, or 0 if it does not
+ * fit and the file is skipped.
+ */
+static int format_list_line(char *line, size_t size, int dir_fd, const char *name, const char *listed,
+                            const struct stat *file_stat, uint16_t flags) {
+    int len;
+    if (flags & LIST_FLAG_META) {
+        file_meta_t meta;
+        strncpy(meta.name, listed, sizeof(meta.name) - 1);
+        meta.name[sizeof(meta.name) - 1] = '\0';
+        meta.size = file_stat->st_size;
+        meta.mtime = file_stat->st_mtime;
+        meta.has_hash = (flags & LIST_FLAG_HASH) && hash_file(dir_fd, name, file_stat, &meta.hash) == 0;
+        len = format_list_entry(&meta, line, size);
+    } else {
+        len = snprintf(line, size, "%s\n", listed);
+    }
+    return len > 0 && (size_t)len < size ? len : 0;
+}
+
+/**
+ * Append the LIST line of one regular file to the reply.
+ * Returns 0 on success, -1 if the reply could not be sent.
+ */
+static int append_list_line(reply_buffer_t *reply, int dir_fd, const char *name,
+                            const struct stat *file_stat, uint16_t flags) {
+    char line[MAX_FILENAME + 64];
+    int len = format_list_line(line, sizeof(line), dir_fd, name, name, file_stat, flags);
+    return len > 0 ? reply_append(reply, line, len) : 0;
+}
+
+/**
+ * A LIST being walked. In recursive listings several walker threads
+ * format lines at once, stat'ing and hashing in parallel, and only
+ * take turns on the reply.
+ */
+typedef struct {
+    reply_buffer_t *reply;           ///< Reply the lines go to
+    uint16_t flags;                  ///< LIST_FLAG_* of the request
+    pthread_mutex_t lock;            ///< Serializes appends to reply
+} list_walk_t;
+
+/**
+ * Remove a part file (".<name>.part" and the like) left by a transfer
+ * that nobody came back for, such as a range group of a manager that
+ * never committed it or a delta rebuild that was cut off. One written
+ * within PART_STALE_SEC, or locked by a stream, is left alone.
+ */
+static void sweep_part_file(int dir_fd, const char *name) {
+    // Delta streams of earlier builds rebuilt into a fixed ".<name>.delta"
+    static const char *suffixes[] = { ".part", ".delta" };
+    size_t len = strlen(name);
+    int matched = 0;
+    for (size_t i = 0; i < sizeof(suffixes) / sizeof(suffixes[0]); i++) {
+        size_t suffix_len = strlen(suffixes[i]);
+        if (len > suffix_len + 1 && strcmp(name + len - suffix_len, suffixes[i]) == 0) matched = 1;
+    }
+    if (!matched) return;
+    
+    struct stat file_stat;
+    if (fstatat(dir_fd, name, &file_stat, AT_SYMLINK_NOFOLLOW) != 0 || !S_ISREG(file_stat.st_mode) ||
+        time(NULL) - file_stat.st_mtime < PART_STALE_SEC) {
+        return;
+    }
+    int fd = openat(dir_fd, name, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+    if (fd < 0) return;
+    if (flock(fd, LOCK_EX | LOCK_NB) == 0 && unlinkat(dir_fd, name, 0) == 0) {
+        printf("Removed stale part file %s\n", name);
+    }
+    close(fd);
+}
+
+static int list_visit(void *ctx, int dir_fd, const char *name, const char *path,
+                      const struct stat *file_stat) {
+    list_walk_t *walk = ctx;
+    if (!path) {
+        // Hidden files are never listed, but old part files among them are removed
+        sweep_part_file(dir_fd, name);
+        return 0;
+    }
+    char line[MAX_FILENAME + 64];
+    int len = format_list_line(line, sizeof(line), dir_fd, name, path, file_stat, walk->flags);
+    if (len == 0) return 0;
+    
+    pthread_mutex_lock(&walk->lock);
+    int result = reply_append(walk->reply, line, len);
+    pthread_mutex_unlock(&walk->lock);
+    return result;
+}
+
+/**
+ * Append one line per regular file in the directory to the reply, or
+ * per regular file of the whole tree with LIST_FLAG_RECURSIVE (see
+ * tree_walk.h). Files are only stat'ed when the lines carry metadata.
+ * Returns 0 on success, -1 if the reply could not be sent.
+ */
+static int list_directory_entries(int dir_fd, reply_buffer_t *reply, uint16_t flags) {
+    list_walk_t walk;
+    walk.reply = reply;
+    walk.flags = flags;
+    pthread_mutex_init(&walk.lock, NULL);
+    
+    int walk_flags = TREE_WALK_HIDDEN | ((flags & LIST_FLAG_META) ? TREE_WALK_STAT : 0);
+    int threads = 1;
+    if (flags & LIST_FLAG_RECURSIVE) {
+        walk_flags |= TREE_WALK_RECURSIVE;
+        threads = TREE_WALK_THREADS;
+    }
+    int result = walk_tree(dir_fd, walk_flags, threads, list_visit, &walk);
+    pthread_mutex_destroy(&walk.lock);
+    return result;
+}
 
 void handle_list_command(int client_fd, const char *dir_path) {
     // Strip leading '/' to make path relative
@@ -8,159 +314,1637 @@ void handle_list_command(int client_fd, const char *dir_path) {
         relative_path = dir_path + 1;  // Skip the leading '/'
     }
     
-    DIR *dir = opendir(relative_path);
-    if (!dir) {
-        fprintf(stderr, "Error opening directory %s: %s\n", relative_path, strerror(errno));
-        return;
+    reply_buffer_t reply;
+    reply_init(&reply, client_fd, 0, 0);
+    
+    int dir_fd = open(relative_path, O_RDONLY | O_DIRECTORY);
+    if (dir_fd < 0) {
+        fprintf(stderr, "Error opening directory %s: %s\n", relative_path, strerror(errno));
+    } else {
+        list_directory_entries(dir_fd, &reply, 0);
+        close(dir_fd);
+    }
+    
+    // Send end marker, also after errors so the reader never waits forever
+    reply_append(&reply, ".\n", 2);
+    reply_flush(&reply);
+}
+
+/**
+ * Stream up to remaining bytes of fd to the socket through a user-space
+ * buffer. Never sends more than was advertised in the size header.
+ * Returns 0 on success, -1 on error.
+ */
+static int send_file_buffered(int client_fd, int fd, off_t remaining) {
+    char buffer[MAX_BUFFER_SIZE];
+    ssize_t bytes_read = 0;
+    while (remaining > 0) {
+        size_t to_read = remaining < (off_t)sizeof(buffer) ? (size_t)remaining : sizeof(buffer);
+        bytes_read = read(fd, buffer, to_read);
+        if (bytes_read < 0 && errno == EINTR) continue;
+        if (bytes_read <= 0) break;
+        remaining -= bytes_read;
+        
+        ssize_t bytes_sent = 0;
+        while (bytes_sent < bytes_read) {
+            ssize_t sent = send(client_fd, buffer + bytes_sent, bytes_read - bytes_sent, 0);
+            if (sent < 0) {
+                if (errno == EINTR) continue;
+                fprintf(stderr, "Error sending file data: %s\n", strerror(errno));
+                return -1;
+            }
+            bytes_sent += sent;
+        }
+    }
+    if (remaining > 0) {
+        fprintf(stderr, "Warning: file truncated during transfer\n");
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Send size bytes of fd, starting at *offset, with sendfile().
+ * Returns 0 when done, -1 on error, and 1 if sendfile() is not supported
+ * for these descriptors; *offset then tells how far it got.
+ */
+static int send_file_zero_copy(int client_fd, int fd, off_t *offset, off_t size) {
+#ifdef __linux__
+    while (*offset < size) {
+        off_t remaining = size - *offset;
+        size_t count = remaining > SENDFILE_MAX_CHUNK ? SENDFILE_MAX_CHUNK : (size_t)remaining;
+        
+        ssize_t sent = sendfile(client_fd, fd, offset, count);
+        if (sent < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EINVAL || errno == ENOSYS || errno == EOPNOTSUPP) {
+                return 1;
+            }
+            fprintf(stderr, "Error sending file data: %s\n", strerror(errno));
+            return -1;
+        }
+        if (sent == 0) {
+            // File shrank while being sent
+            fprintf(stderr, "Warning: file truncated during transfer\n");
+            return -1;
+        }
+    }
+    return 0;
+#else
+    (void)client_fd; (void)fd; (void)offset; (void)size;
+    return 1;
+#endif
+}
+
+/**
+ * Per-worker io_uring of the uring engine, set up on first use. A worker
+ * whose ring cannot be set up (old kernel, io_uring disabled) remembers
+ * that and stays on the system call path.
+ */
+static __thread uring_t t_uring;
+static __thread int t_uring_state = 0;   // 0 = not tried, 1 = ready, -1 = unavailable
+
+static uring_t* worker_uring(void) {
+    if (t_uring_state == 0) {
+        if (uring_init(&t_uring) == 0) {
+            t_uring_state = 1;
+        } else {
+            t_uring_state = -1;
+            fprintf(stderr, "io_uring unavailable (%s), using system calls\n", strerror(errno));
+        }
+    }
+    return t_uring_state == 1 ? &t_uring : NULL;
+}
+
+static void release_worker_uring(void) {
+    if (t_uring_state == 1) {
+        uring_exit(&t_uring);
+    }
+    t_uring_state = 0;
+}
+
+// Operations of a round, tagged into user_data above the buffer index
+enum { URING_READ, URING_SEND, URING_RECV, URING_WRITE, URING_KINDS };
+
+#define URING_TAG(kind, index) (((uint64_t)(kind) << 8) | (uint64_t)(index))
+#define URING_HALF (URING_BUFFER_COUNT / 2)
+#define URING_SHORT -1                   // Operation moved fewer bytes than asked
+
+/**
+ * Submit the queued operations of a round and wait for all count of
+ * them. Every operation must move lengths[buffer] bytes; the first
+ * failure of each kind is left in errors[kind] (an errno value, or
+ * URING_SHORT), 0 if all of that kind succeeded. A ring that fails to
+ * submit is torn down and the worker falls back to system calls.
+ * Returns 0 once every completion is collected, -1 on submit failure.
+ */
+static int uring_round(uring_t *ring, unsigned count, const size_t *lengths, int *errors) {
+    for (int kind = 0; kind < URING_KINDS; kind++) {
+        errors[kind] = 0;
+    }
+    
+    unsigned done = 0;
+    int result = uring_submit_and_wait(ring, count);
+    while (result == 0 && done < count) {
+        uint64_t user_data;
+        int moved;
+        if (!uring_next_completion(ring, &user_data, &moved)) {
+            result = uring_submit_and_wait(ring, count - done);
+            continue;
+        }
+        int kind = (int)(user_data >> 8);
+        int index = (int)(user_data & 0xff);
+        if (moved != (int)lengths[index] && (errors[kind] == 0 || errors[kind] == ECANCELED)) {
+            // Operations linked behind a failure complete with ECANCELED; keep the cause
+            errors[kind] = moved < 0 ? -moved : URING_SHORT;
+        }
+        done++;
+    }
+    if (result != 0) {
+        fprintf(stderr, "Error submitting to io_uring: %s\n", strerror(errno));
+        release_worker_uring();
+        t_uring_state = -1;
+        return -1;
+    }
+    return 0;
+}
+
+// Queue reads of fd into the buffers of a half, returns how many were queued
+static int queue_file_reads(uring_t *ring, int fd, int base, off_t *read_at, off_t end, size_t *lengths) {
+    int count = 0;
+    while (count < URING_HALF && *read_at < end) {
+        off_t remaining = end - *read_at;
+        size_t len = remaining < URING_BUFFER_SIZE ? (size_t)remaining : URING_BUFFER_SIZE;
+        int index = base + count;
+        
+        lengths[index] = len;
+        uring_queue_read(ring, fd, index, len, *read_at, URING_TAG(URING_READ, index), 0);
+        *read_at += len;
+        count++;
+    }
+    return count;
+}
+
+/**
+ * Send the bytes from *offset to end of fd through the worker's io_uring.
+ * The buffers are used as two halves: while one half is sent, in order
+ * through a linked chain of sends, the next is read from the file, and
+ * both go to the kernel with a single io_uring_enter(). Advances *offset
+ * by the bytes sent. Returns 0 on success, -1 on error.
+ */
+static int send_file_uring(uring_t *ring, int client_fd, int fd, off_t *offset, off_t end) {
+    size_t lengths[URING_BUFFER_COUNT];
+    int errors[URING_KINDS];
+    off_t read_at = *offset;
+    int half = 0;
+    
+    int pending = queue_file_reads(ring, fd, 0, &read_at, end, lengths);
+    if (pending > 0 && uring_round(ring, pending, lengths, errors) != 0) {
+        return -1;
+    }
+    while (pending > 0) {
+        if (errors[URING_READ] != 0) {
+            if (errors[URING_READ] == URING_SHORT) {
+                fprintf(stderr, "Warning: file truncated during transfer\n");
+            } else {
+                fprintf(stderr, "Error reading file: %s\n", strerror(errors[URING_READ]));
+            }
+            return -1;
+        }
+        
+        int base = half * URING_HALF;
+        for (int i = 0; i < pending; i++) {
+            uring_queue_send(ring, client_fd, base + i, lengths[base + i],
+                             URING_TAG(URING_SEND, base + i), i + 1 < pending);
+        }
+        int next = queue_file_reads(ring, fd, (1 - half) * URING_HALF, &read_at, end, lengths);
+        if (uring_round(ring, pending + next, lengths, errors) != 0) {
+            return -1;
+        }
+        if (errors[URING_SEND] != 0) {
+            fprintf(stderr, "Error sending file data: %s\n",
+                    errors[URING_SEND] == URING_SHORT ? "connection closed" : strerror(errors[URING_SEND]));
+            return -1;
+        }
+        for (int i = 0; i < pending; i++) {
+            *offset += lengths[base + i];
+        }
+        
+        half = 1 - half;
+        pending = next;
+    }
+    return 0;
+}
+
+/**
+ * Send count bytes of fd starting at *offset with the configured engine,
+ * falling back to the buffered path when sendfile() is unsupported.
+ * Advances *offset. Returns 0 on success, -1 on error.
+ */
+static int send_file_range(int client_fd, int fd, off_t *offset, off_t count) {
+    off_t end = *offset + count;
+    
+    if (g_io_engine == CLIENT_IO_SENDFILE) {
+        int result = send_file_zero_copy(client_fd, fd, offset, end);
+        if (result <= 0) {
+            return result;
+        }
+        // sendfile() unsupported here: continue with the buffered path
+    } else if (g_io_engine == CLIENT_IO_URING) {
+        uring_t *ring = worker_uring();
+        if (ring) {
+            return send_file_uring(ring, client_fd, fd, offset, end);
+        }
+        // io_uring unavailable: continue with the buffered path
+    }
+    
+    if (lseek(fd, *offset, SEEK_SET) < 0) {
+        fprintf(stderr, "Error seeking: %s\n", strerror(errno));
+        return -1;
+    }
+    if (send_file_buffered(client_fd, fd, end - *offset) != 0) {
+        return -1;
+    }
+    *offset = end;
+    return 0;
+}
+
+int handle_pull_command(int client_fd, const char *file_path) {
+    const char *relative_path = file_path;
+    if (file_path[0] == '/') {
+        relative_path = file_path + 1;  // Skip the leading '/'
+    }
+    
+    int fd = open(relative_path, O_RDONLY);  // Use relative_path here
+    if (fd < 0) {
+        // Send error response
+        char error_response[64];
+        snprintf(error_response, sizeof(error_response), "-1 %s", strerror(errno));
+        send(client_fd, error_response, strlen(error_response), 0);
+        return 0;
+    }
+    
+    // Get file size
+    struct stat file_stat;
+    if (fstat(fd, &file_stat) < 0) {
+        char error_response[64];
+        snprintf(error_response, sizeof(error_response), "-1 %s", strerror(errno));
+        send(client_fd, error_response, strlen(error_response), 0);
+        close(fd);
+        return 0;
+    }
+    
+    // Send file size first
+    char size_header[32];
+    snprintf(size_header, sizeof(size_header), "%ld ", file_stat.st_size);
+    
+    // The reader waits for every advertised byte, so a short send leaves the connection unusable
+    off_t offset = 0;
+    int result = send_command(client_fd, size_header) == 0 &&
+                 send_file_range(client_fd, fd, &offset, file_stat.st_size) == 0 ? 0 : -1;
+    close(fd);
+    return result;
+}
+
+/**
+ * Name a hidden file next to path ("dir/.name<suffix>"), so that renaming
+ * it to path never crosses filesystems and LIST does not show it.
+ */
+static void hidden_sibling_path(const char *path, const char *suffix, char *out, size_t size) {
+    const char *slash = strrchr(path, '/');
+    int dir_len = slash ? (int)(slash - path + 1) : 0;
+    snprintf(out, size, "%.*s.%s%s", dir_len, path, path + dir_len, suffix);
+}
+
+// Part file of one range group of path: ".name.<group>.part"
+static void range_part_path(const char *path, uint64_t group_id, char *out, size_t size) {
+    char suffix[32];
+    snprintf(suffix, sizeof(suffix), ".%016llx.part", (unsigned long long)group_id);
+    hidden_sibling_path(path, suffix, out, size);
+}
+
+/**
+ * Open a part file and lock it, shared for the ranges of a group and
+ * exclusive otherwise. A part file some other stream holds locked is not
+ * opened (-1 with errno EWOULDBLOCK), so two transfers never write one.
+ * The lock is checked against the path: a file renamed into place
+ * between open() and flock() is never written. The lock goes with the
+ * descriptor.
+ */
+static int open_part_file(const char *part_path, int open_flags, int shared) {
+    for (int attempt = 0; attempt < 3; attempt++) {
+        int fd = open(part_path, open_flags, 0644);
+        if (fd < 0) return -1;
+        if (flock(fd, (shared ? LOCK_SH : LOCK_EX) | LOCK_NB) != 0) {
+            int error = errno;
+            close(fd);
+            errno = error;
+            return -1;
+        }
+        
+        struct stat fd_stat, path_stat;
+        if (fstat(fd, &fd_stat) == 0 && stat(part_path, &path_stat) == 0 &&
+            fd_stat.st_dev == path_stat.st_dev && fd_stat.st_ino == path_stat.st_ino) {
+            return fd;
+        }
+        close(fd);  // Landed by its writer meanwhile: open what the path names now
+    }
+    errno = EWOULDBLOCK;
+    return -1;
+}
+
+/**
+ * Create a part file of path that no other transfer can name
+ * (".name.<pid>-<n>.part") and lock it; its name goes to part_path. Used
+ * by every transfer that does not continue a shared part file: a second
+ * writer of a path, a version 1 PUSH and a delta rebuild.
+ */
+static int open_private_part_file(const char *path, char *part_path, size_t size) {
+    static unsigned int counter = 0;
+    char suffix[32];
+    snprintf(suffix, sizeof(suffix), ".%d-%u.part", (int)getpid(),
+             __atomic_add_fetch(&counter, 1, __ATOMIC_RELAXED));
+    hidden_sibling_path(path, suffix, part_path, size);
+    return open_part_file(part_path, O_WRONLY | O_CREAT | O_EXCL, 0);
+}
+
+static void reset_transfer(push_transfer_t *transfer) {
+    transfer->fd = -1;
+    transfer->offset = 0;
+    transfer->path[0] = '\0';
+    transfer->stream_id = 0;
+    transfer->in_use = 0;
+    transfer->error = 0;
+    transfer->patch = NULL;
+    transfer->basis_fd = -1;
+    transfer->temp_path[0] = '\0';
+    transfer->resumable = 0;
+}
+
+// Release the rebuild state of a delta stream. A part file still named is removed
+static void close_delta(push_transfer_t *transfer) {
+    if (transfer->basis_fd >= 0) {
+        close(transfer->basis_fd);
+        transfer->basis_fd = -1;
+    }
+    if (transfer->temp_path[0] != '\0') {
+        unlink(transfer->temp_path);
+        transfer->temp_path[0] = '\0';
+    }
+    free(transfer->patch);
+    transfer->patch = NULL;
+}
+
+static void discard_transfer(push_transfer_t *transfer) {
+    if (transfer->fd >= 0) {
+        fprintf(stderr, "Discarding unfinished transfer of %s (%ld bytes received)\n",
+                transfer->path, (long)transfer->offset);
+    }
+    // A plain stream cut off with its session keeps its part file, to be continued at an offset
+    if (transfer->resumable) {
+        transfer->temp_path[0] = '\0';
+    }
+    // Removed before the lock goes, so a stream taking the part file over keeps it
+    close_delta(transfer);
+    if (transfer->fd >= 0) {
+        close(transfer->fd);
+    }
+    reset_transfer(transfer);
+}
+
+void init_client_session(client_session_t *session, int client_fd) {
+    reader_init(&session->reader, client_fd);
+    session->version = 1;
+    reset_transfer(&session->push);
+    for (int i = 0; i < MAX_SESSION_STREAMS; i++) {
+        reset_transfer(&session->streams[i]);
+    }
+}
+
+void close_client_session(client_session_t *session) {
+    discard_transfer(&session->push);
+    for (int i = 0; i < MAX_SESSION_STREAMS; i++) {
+        if (session->streams[i].in_use) {
+            discard_transfer(&session->streams[i]);
+        }
+    }
+}
+
+/**
+ * Append received file bytes to a transfer, rebuilding through the
+ * delta patcher for delta streams. On failure the error is kept in the
+ * transfer and 0 is still returned, so the caller keeps draining the
+ * chunk; only writable transfers may be passed.
+ */
+static int store_chunk_data(void *ctx, const void *data, size_t len) {
+    push_transfer_t *transfer = ctx;
+    if (transfer->error) return 0;
+    
+    if (transfer->patch) {
+        if (delta_patch_feed(transfer->patch, (const unsigned char*)data, len) != 0) {
+            transfer->error = transfer->patch->error;
+            fprintf(stderr, "Error applying delta to %s: %s\n", transfer->path, strerror(transfer->error));
+        } else {
+            transfer->offset = transfer->patch->written;
+        }
+        return 0;
+    }
+    
+    ssize_t written = pwrite(transfer->fd, data, len, transfer->offset);
+    if (written != (ssize_t)len) {
+        transfer->error = written < 0 ? errno : ENOSPC;
+        fprintf(stderr, "Error writing to file %s: %s\n", transfer->path, strerror(transfer->error));
+    } else {
+        transfer->offset += written;
+    }
+    return 0;
+}
+
+/**
+ * receive_chunk() for a plain writable transfer on the uring engine.
+ * Bytes the session already buffered are stored first; the rest of the
+ * chunk is received straight into registered buffers. Each round
+ * receives one half of the buffers, in order through a linked chain,
+ * while the other half is written to the file, with a single
+ * io_uring_enter(). A write error is kept in the transfer and the chunk
+ * still drained, as in store_chunk_data().
+ */
+static int receive_chunk_uring(uring_t *ring, client_session_t *session, push_transfer_t *transfer, uint64_t len) {
+    buffered_reader_t *reader = &session->reader;
+    size_t buffered = reader->end - reader->start;
+    if (buffered > 0) {
+        size_t taken = buffered < len ? buffered : (size_t)len;
+        store_chunk_data(transfer, reader->data + reader->start, taken);
+        reader->start += taken;
+        len -= taken;
+    }
+    
+    size_t lengths[URING_BUFFER_COUNT];
+    int errors[URING_KINDS];
+    off_t write_at = transfer->offset;
+    int half = 0;
+    int received = 0; // Buffers of the other half waiting to be written
+    
+    while (len > 0 || received > 0) {
+        int base = half * URING_HALF;
+        int count = 0;
+        while (count < URING_HALF && len > 0) {
+            size_t piece = len < URING_BUFFER_SIZE ? (size_t)len : URING_BUFFER_SIZE;
+            len -= piece;
+            lengths[base + count] = piece;
+            uring_queue_recv(ring, reader->fd, base + count, piece, URING_TAG(URING_RECV, base + count),
+                             count + 1 < URING_HALF && len > 0);
+            count++;
+        }
+        
+        int write_base = (1 - half) * URING_HALF;
+        int writes = transfer->error ? 0 : received;
+        for (int i = 0; i < writes; i++) {
+            uring_queue_write(ring, transfer->fd, write_base + i, lengths[write_base + i], write_at,
+                              URING_TAG(URING_WRITE, write_base + i), 0);
+            write_at += lengths[write_base + i];
+        }
+        
+        if (uring_round(ring, count + writes, lengths, errors) != 0) {
+            return -1;
+        }
+        if (errors[URING_RECV] != 0) {
+            fprintf(stderr, "Error receiving chunk data: %s\n",
+                    errors[URING_RECV] == URING_SHORT ? "connection closed" : strerror(errors[URING_RECV]));
+            return -1;
+        }
+        if (errors[URING_WRITE] != 0) {
+            transfer->error = errors[URING_WRITE] == URING_SHORT ? ENOSPC : errors[URING_WRITE];
+            fprintf(stderr, "Error writing to file %s: %s\n", transfer->path, strerror(transfer->error));
+        } else if (!transfer->error) {
+            transfer->offset = write_at;
+        }
+        
+        half = 1 - half;
+        received = count;
+    }
+    return 0;
+}
+
+/**
+ * Read len bytes of chunk data from the session and append them to the
+ * transfer. With a NULL transfer, or one that already failed, the bytes
+ * are read and dropped so the stream stays in sync. Returns 0 on success,
+ * -1 if the connection failed.
+ */
+static int receive_chunk(client_session_t *session, push_transfer_t *transfer, uint64_t len) {
+    char buffer[MAX_BUFFER_SIZE];
+    int writable = transfer && transfer->fd >= 0 && transfer->error == 0;
+    
+    if (writable && !transfer->patch && g_io_engine == CLIENT_IO_URING && len > 0) {
+        uring_t *ring = worker_uring();
+        if (ring) {
+            return receive_chunk_uring(ring, session, transfer, len);
+        }
+    }
+    
+    while (len > 0) {
+        size_t to_receive = len < sizeof(buffer) ? (size_t)len : sizeof(buffer);
+        
+        ssize_t received = reader_read(&session->reader, buffer, to_receive);
+        if (received <= 0) {
+            fprintf(stderr, "Error receiving chunk data: %s\n", 
+                    received == 0 ? "connection closed" : strerror(errno));
+            return -1;
+        }
+        
+        if (writable) {
+            // Keep draining the chunk after an error so the next command is parsed correctly
+            store_chunk_data(transfer, buffer, received);
+        }
+        
+        len -= received;
+    }
+    
+    return 0;
+}
+
+/**
+ * Like receive_chunk() for a DATA frame whose payload is one zlib stream
+ * (DATA_FLAG_ZLIB): the payload is inflated as it arrives, so only one
+ * read buffer and zlib's window are held whatever the frame size.
+ */
+static int receive_compressed_chunk(client_session_t *session, push_transfer_t *transfer, uint64_t len) {
+    if (!transfer || transfer->fd < 0 || transfer->error != 0) {
+        return receive_chunk(session, NULL, len);
+    }
+    
+    frame_inflater_t inflater;
+    if (frame_inflate_begin(&inflater) != 0) {
+        transfer->error = ENOMEM;
+        return receive_chunk(session, NULL, len);
+    }
+    
+    char buffer[MAX_BUFFER_SIZE];
+    int corrupt = 0;
+    while (len > 0) {
+        size_t to_receive = len < sizeof(buffer) ? (size_t)len : sizeof(buffer);
+        
+        ssize_t received = reader_read(&session->reader, buffer, to_receive);
+        if (received <= 0) {
+            fprintf(stderr, "Error receiving chunk data: %s\n",
+                    received == 0 ? "connection closed" : strerror(errno));
+            frame_inflate_end(&inflater);
+            return -1;
+        }
+        if (!corrupt && frame_inflate_feed(&inflater, buffer, received, store_chunk_data, transfer) != 0) {
+            corrupt = 1;
+        }
+        len -= received;
+    }
+    
+    if (frame_inflate_end(&inflater) != 0) {
+        corrupt = 1;
+    }
+    if (corrupt && !transfer->error) {
+        fprintf(stderr, "Corrupt compressed data for %s\n", transfer->path);
+        transfer->error = EIO;
+    }
+    return 0;
+}
+
+int handle_push_command(client_session_t *session, const char *file_path, int chunk_size) {
+    push_transfer_t *push = &session->push;
+    
+    // Strip leading '/' to make path relative  
+    const char *relative_path = file_path;
+    if (file_path[0] == '/') {
+        relative_path = file_path + 1;  // Skip the leading '/'
+    }
+    
+    if (chunk_size == -1) {
+        // Start new file in its part file; the old copy stays until the end marker
+        discard_transfer(push);
+        strncpy(push->path, file_path, MAX_PATH - 1);
+        push->path[MAX_PATH - 1] = '\0';
+        push->fd = open_private_part_file(relative_path, push->temp_path, sizeof(push->temp_path));
+        if (push->fd < 0) {
+            fprintf(stderr, "Error opening file %s for writing: %s\n", file_path, strerror(errno));
+            push->temp_path[0] = '\0';
+        }
+        return 0;
+    }
+    
+    if (chunk_size == 0) {
+        // End of file
+        if (push->fd >= 0) {
+            if (durability_land(push->fd, push->temp_path, relative_path) != 0) {
+                fprintf(stderr, "Error storing %s: %s\n", file_path, strerror(errno));
+            } else {
+                push->temp_path[0] = '\0';
+            }
+            push->fd = -1;
+            close_delta(push);
+        }
+        return 0;
+    }
+    
+    if (chunk_size < 0) {
+        fprintf(stderr, "Invalid PUSH chunk size %d for %s\n", chunk_size, file_path);
+        return -1;
+    }
+    
+    int writable = push->fd >= 0 && strcmp(push->path, file_path) == 0;
+    if (!writable) {
+        fprintf(stderr, "Error: No file open for writing %s\n", file_path);
+    }
+    
+    // Read chunk data from socket and write to file
+    return receive_chunk(session, writable ? push : NULL, chunk_size);
+}
+
+/**
+ * Wait for the next request on a session. Persistent sessions from the
+ * manager's pool hold a connection worker, so idle ones are dropped.
+ * Returns 1 when a request (or EOF) is ready, 0 on idle timeout.
+ */
+static int wait_for_request(client_session_t *session) {
+    int ready = reader_wait(&session->reader, CLIENT_IDLE_TIMEOUT_MS);
+    if (ready == 0) {
+        printf("Closing idle session\n");
+    }
+    return ready > 0;
+}
+
+/**
+ * Read one command header from the session.
+ *
+ * Commands end at a newline, except data-carrying "PUSH <path> <size> "
+ * headers, which end at the space after a positive size and are followed
+ * directly by the chunk bytes.
+ */
+static int read_client_command(client_session_t *session, char *buffer, size_t size) {
+    size_t len = 0;
+    int spaces = 0;
+    
+    while (1) {
+        int c = reader_getc(&session->reader);
+        if (c < 0) {
+            return -1;
+        }
+        if (c == '\n') {
+            break;
+        }
+        if (len + 1 >= size) {
+            fprintf(stderr, "Command too long, dropping connection\n");
+            return -1;
+        }
+        buffer[len++] = (char)c;
+        
+        if (c == ' ' && ++spaces == 3 && strncmp(buffer, CMD_PUSH " ", strlen(CMD_PUSH) + 1) == 0) {
+            buffer[len] = '\0';
+            char *size_token = strrchr(buffer, ' ');
+            while (size_token > buffer && *(size_token - 1) != ' ') size_token--;
+            if (atoi(size_token) > 0) {
+                break;
+            }
+        }
+    }
+    
+    if (len > 0 && buffer[len - 1] == '\r') len--;
+    buffer[len] = '\0';
+    return len;
+}
+
+// Protocol version 2 (binary framing)
+
+static const char* relative_to_cwd(const char *path) {
+    return path[0] == '/' ? path + 1 : path;
+}
+
+static int list_directory_frames(int client_fd, uint32_t stream_id, uint16_t flags, const char *dir_path) {
+    int dir_fd = open(relative_to_cwd(dir_path), O_RDONLY | O_DIRECTORY);
+    if (dir_fd < 0) {
+        return send_error_frame(client_fd, stream_id, "%s", strerror(errno));
+    }
+    
+    reply_buffer_t reply;
+    reply_init(&reply, client_fd, stream_id, 1);
+    
+    int result = list_directory_entries(dir_fd, &reply, flags);
+    close(dir_fd);
+    
+    if (result != 0 || reply_flush(&reply) != 0) {
+        return -1;
+    }
+    return send_end_frame(client_fd, stream_id, reply.total, 0);
+}
+
+/**
+ * Send the file from *offset towards end as DATA frames of compressed
+ * COMPRESS_CHUNK_SIZE chunks (see compress.h), advancing *offset. Stops
+ * early, returning 0, when the first chunk shows the file does not
+ * compress or no memory is free; the caller sends the rest raw. Returns
+ * -1 on error, which leaves the connection unusable.
+ */
+static int send_compressed_frames(int client_fd, uint32_t stream_id, int fd, off_t *offset, off_t end,
+                                  int level) {
+    size_t bound = compress_frame_bound(COMPRESS_CHUNK_SIZE);
+    char *raw = malloc(COMPRESS_CHUNK_SIZE);
+    char *packed = malloc(bound);
+    if (!raw || !packed) {
+        free(raw);
+        free(packed);
+        return 0;
+    }
+    
+    int result = 0;
+    int sampled = 0;
+    while (*offset < end) {
+        off_t remaining = end - *offset;
+        size_t chunk = remaining < COMPRESS_CHUNK_SIZE ? (size_t)remaining : COMPRESS_CHUNK_SIZE;
+        
+        size_t filled = 0;
+        while (filled < chunk) {
+            ssize_t bytes_read = pread(fd, raw + filled, chunk - filled, *offset + filled);
+            if (bytes_read < 0 && errno == EINTR) continue;
+            if (bytes_read <= 0) break;
+            filled += bytes_read;
+        }
+        if (filled < chunk) {
+            fprintf(stderr, "Warning: file truncated during transfer\n");
+            result = -1;
+            break;
+        }
+        
+        long packed_len = compress_frame(raw, chunk, packed, bound, level);
+        if (packed_len <= 0) {
+            if (!sampled) break; // Already compressed: leave the file to the raw path
+            if (send_frame(client_fd, FRAME_DATA, stream_id, raw, chunk) != 0) {
+                result = -1;
+                break;
+            }
+        } else if (send_frame_flags(client_fd, FRAME_DATA, DATA_FLAG_ZLIB, stream_id, packed, packed_len) != 0) {
+            result = -1;
+            break;
+        }
+        sampled = 1;
+        *offset += chunk;
+    }
+    
+    free(raw);
+    free(packed);
+    return result;
+}
+
+/**
+ * Send length bytes of a file from offset as DATA frames, closed by END
+ * with the number of bytes sent and the file mtime. A negative length
+ * sends everything up to the end of the file; a range past the end is
+ * cut short. A non-zero level compresses the frames with zlib.
+ */
+static int pull_file_frames(int client_fd, uint32_t stream_id, const char *file_path,
+                            off_t start, off_t length, int level) {
+    int fd = open(relative_to_cwd(file_path), O_RDONLY);
+    if (fd < 0) {
+        return send_error_frame(client_fd, stream_id, "%s", strerror(errno));
+    }
+    
+    struct stat file_stat;
+    if (fstat(fd, &file_stat) < 0) {
+        int saved_errno = errno;
+        close(fd);
+        return send_error_frame(client_fd, stream_id, "%s", strerror(saved_errno));
+    }
+    
+    off_t end = file_stat.st_size;
+    if (start > end) start = end;
+    if (length >= 0 && length < end - start) end = start + length;
+    
+    off_t offset = start;
+    if (level > 0) {
+        if (send_compressed_frames(client_fd, stream_id, fd, &offset, end, level) != 0) {
+            close(fd);
+            return -1;
+        }
+    }
+    
+    while (offset < end) {
+        off_t remaining = end - offset;
+        off_t chunk = remaining < FRAME_DATA_MAX ? remaining : FRAME_DATA_MAX;
+        
+        // Once a DATA header is out its payload must follow in full, so a
+        // failure here leaves the connection unusable
+        if (send_frame_header(client_fd, FRAME_DATA, stream_id, chunk) != 0 ||
+            send_file_range(client_fd, fd, &offset, chunk) != 0) {
+            close(fd);
+            return -1;
+        }
+    }
+    
+    close(fd);
+    return send_end_frame(client_fd, stream_id, end - start, file_stat.st_mtime);
+}
+
+static int range_file_frames(int client_fd, const frame_header_t *header, const char *args) {
+    uint32_t stream_id = header->stream_id;
+    long long offset, length;
+    int path_offset = 0;
+    if (sscanf(args, "%lld %lld %n", &offset, &length, &path_offset) != 2 || path_offset == 0 ||
+        offset < 0 || length < 0 || args[path_offset] == '\0') {
+        return send_error_frame(client_fd, stream_id, "Invalid RANGE request");
+    }
+    return pull_file_frames(client_fd, stream_id, args + path_offset, (off_t)offset, (off_t)length,
+                            header->flags & PULL_FLAG_LEVEL_MASK);
+}
+
+static int commit_file_frames(int client_fd, const frame_header_t *header, const char *args) {
+    uint32_t stream_id = header->stream_id;
+    long long size, mtime;
+    unsigned long long group_id;
+    int path_offset = 0;
+    if (sscanf(args, "%lld %lld %llu %n", &size, &mtime, &group_id, &path_offset) != 3 || path_offset == 0 ||
+        size < 0 || args[path_offset] == '\0') {
+        return send_error_frame(client_fd, stream_id, "Invalid COMMIT request");
+    }
+    
+    const char *path = relative_to_cwd(args + path_offset);
+    char part_path[MAX_PATH + 32];
+    range_part_path(path, group_id, part_path, sizeof(part_path));
+    
+    if (header->flags & COMMIT_FLAG_DISCARD) {
+        unlink(part_path);
+        return send_end_frame(client_fd, stream_id, 0, 0);
+    }
+    
+    // Locked while it lands, so a LIST sweeping old part files leaves it alone
+    int fd = open_part_file(part_path, O_WRONLY, 0);
+    int error = fd < 0 ? errno : 0;
+    
+    // Drop whatever an earlier, longer attempt left past the end
+    if (!error && ftruncate(fd, (off_t)size) != 0) {
+        error = errno;
+    }
+    if (!error && mtime > 0) {
+        struct timespec times[2] = { { 0, UTIME_OMIT }, { (time_t)mtime, 0 } };
+        futimens(fd, times);
+    }
+    if (!error && durability_land(fd, part_path, path) != 0) {
+        error = errno;
+    } else if (error && fd >= 0) {
+        close(fd);
+    }
+    
+    if (error) {
+        fprintf(stderr, "Error committing %s: %s\n", path, strerror(error));
+        return send_error_frame(client_fd, stream_id, "%s", strerror(error));
+    }
+    return send_end_frame(client_fd, stream_id, (uint64_t)size, mtime);
+}
+
+// Split "<block_size> <path>" as sent with SIGS and DELTA
+static const char* parse_block_request(const char *args, uint32_t *block_size) {
+    unsigned long value;
+    int path_offset = 0;
+    if (sscanf(args, "%lu %n", &value, &path_offset) != 1 || path_offset == 0 ||
+        value == 0 || value > DELTA_MAX_BLOCK || args[path_offset] == '\0') {
+        return NULL;
+    }
+    *block_size = (uint32_t)value;
+    return args + path_offset;
+}
+
+static int sigs_file_frames(int client_fd, uint32_t stream_id, const char *args) {
+    uint32_t block_size;
+    const char *file_path = parse_block_request(args, &block_size);
+    if (!file_path) {
+        return send_error_frame(client_fd, stream_id, "Invalid SIGS request");
+    }
+    
+    int fd = open(relative_to_cwd(file_path), O_RDONLY);
+    if (fd < 0) {
+        return send_error_frame(client_fd, stream_id, "%s", strerror(errno));
     }
     
-    struct dirent *entry;
-    while ((entry = readdir(dir)) != NULL) {
-        if (entry->d_name[0] != '.') {  // Skip hidden files and . .. entries
-            char full_path[MAX_PATH];
-            snprintf(full_path, sizeof(full_path), "%s/%s", relative_path, entry->d_name);  // Use relative_path here
-            
-            struct stat file_stat;
-            if (stat(full_path, &file_stat) == 0 && S_ISREG(file_stat.st_mode)) {
-                char response[MAX_FILENAME + 2];
-                snprintf(response, sizeof(response), "%s\n", entry->d_name);
-                send(client_fd, response, strlen(response), 0);
+    reply_buffer_t reply;
+    reply_init(&reply, client_fd, stream_id, 1);
+    
+    long blocks = delta_write_signatures(fd, block_size, reply_emit, &reply);
+    int saved_errno = errno;
+    close(fd);
+    
+    if (blocks < 0) {
+        // Frames already sent are self-contained, so ERROR can still follow
+        reply.len = 0;
+        return send_error_frame(client_fd, stream_id, "%s", strerror(saved_errno));
+    }
+    if (reply_flush(&reply) != 0) {
+        return -1;
+    }
+    return send_end_frame(client_fd, stream_id, reply.total, 0);
+}
+
+/**
+ * Collect the body of a request, the DATA frames that follow its CMD up
+ * to END, into a buffer of at most max bytes. The body is always read in
+ * full to keep the session in sync; *error is set (EFBIG, ENOMEM) when
+ * it could not be kept. Returns 0 once END arrived, 1 if the manager
+ * sent ABORT instead, -1 if the session is broken. *body must be freed
+ * in every case.
+ */
+static int read_request_body(client_session_t *session, uint32_t stream_id, size_t max,
+                             unsigned char **body, size_t *len, int *error) {
+    *body = NULL;
+    *len = 0;
+    *error = 0;
+    
+    while (1) {
+        frame_header_t header;
+        if (read_frame_header(&session->reader, &header) != 0 || header.stream_id != stream_id) {
+            return -1;
+        }
+        if (header.opcode == FRAME_END || header.opcode == FRAME_ABORT) {
+            if (receive_chunk(session, NULL, header.length) != 0) {
+                return -1;
+            }
+            return header.opcode == FRAME_ABORT ? 1 : 0;
+        }
+        if (header.opcode != FRAME_DATA) {
+            return -1;
+        }
+        
+        if (!*error && *len + header.length > max) {
+            *error = EFBIG;
+        }
+        if (!*error) {
+            unsigned char *grown = realloc(*body, *len + header.length);
+            if (grown) {
+                *body = grown;
+            } else {
+                *error = ENOMEM;
+            }
+        }
+        if (*error) {
+            if (receive_chunk(session, NULL, header.length) != 0) {
+                return -1;
             }
+            continue;
+        }
+        if (reader_read_exact(&session->reader, *body + *len, header.length) != 0) {
+            return -1;
         }
+        *len += header.length;
     }
-    
-    // Send end marker
-    send(client_fd, ".\n", 2, 0);
-    closedir(dir);
 }
 
-void handle_pull_command(int client_fd, const char *file_path) {
-    const char *relative_path = file_path;
-    if (file_path[0] == '/') {
-        relative_path = file_path + 1;  // Skip the leading '/'
+/**
+ * Serve DELTA: collect the signatures that follow, then stream the
+ * encoded file back. Returns 0 if the session can continue, -1 otherwise.
+ */
+static int delta_file_frames(client_session_t *session, uint32_t stream_id, const char *args) {
+    int client_fd = session->reader.fd;
+    unsigned char *sigs;
+    size_t sig_len;
+    int error;
+    
+    int result = read_request_body(session, stream_id, DELTA_MAX_SIGNATURES, &sigs, &sig_len, &error);
+    if (result != 0) {
+        free(sigs);
+        return result < 0 ? -1 : 0; // After ABORT the manager gave up, nothing is sent back
     }
     
-    int fd = open(relative_path, O_RDONLY);  // Use relative_path here
-    if (fd < 0) {
-        // Send error response
-        char error_response[64];
-        snprintf(error_response, sizeof(error_response), "-1 %s", strerror(errno));
-        send(client_fd, error_response, strlen(error_response), 0);
-        return;
+    uint32_t block_size = 0;
+    const char *file_path = parse_block_request(args, &block_size);
+    if (!error && (!file_path || sig_len % DELTA_SIG_SIZE != 0)) {
+        error = EINVAL;
     }
     
-    // Get file size
+    int fd = -1;
     struct stat file_stat;
-    if (fstat(fd, &file_stat) < 0) {
-        char error_response[64];
-        snprintf(error_response, sizeof(error_response), "-1 %s", strerror(errno));
-        send(client_fd, error_response, strlen(error_response), 0);
-        close(fd);
-        return;
+    if (!error) {
+        fd = open(relative_to_cwd(file_path), O_RDONLY);
+        if (fd < 0 || fstat(fd, &file_stat) != 0) {
+            error = errno;
+        }
+    }
+    if (error) {
+        if (fd >= 0) close(fd);
+        free(sigs);
+        return send_error_frame(client_fd, stream_id, "%s", strerror(error));
     }
     
-    // Send file size first
-    char size_header[32];
-    snprintf(size_header, sizeof(size_header), "%ld ", file_stat.st_size);
-    send(client_fd, size_header, strlen(size_header), 0);
+    reply_buffer_t reply;
+    reply_init(&reply, client_fd, stream_id, 1);
     
-    // Send file content
-    char buffer[MAX_BUFFER_SIZE];
-    ssize_t bytes_read;
-    while ((bytes_read = read(fd, buffer, sizeof(buffer))) > 0) {
-        ssize_t bytes_sent = 0;
-        while (bytes_sent < bytes_read) {
-            ssize_t sent = send(client_fd, buffer + bytes_sent, bytes_read - bytes_sent, 0);
-            if (sent < 0) {
-                fprintf(stderr, "Error sending file data: %s\n", strerror(errno));
-                close(fd);
-                return;
+    int64_t size = delta_encode(fd, block_size, sigs, sig_len / DELTA_SIG_SIZE, reply_emit, &reply);
+    close(fd);
+    free(sigs);
+    
+    if (size < 0) {
+        reply.len = 0;
+        return send_error_frame(client_fd, stream_id, "Delta encoding failed");
+    }
+    if (reply_flush(&reply) != 0) {
+        return -1;
+    }
+    printf("Delta of %s: %lld bytes sent for %lld byte file\n", file_path,
+           (long long)reply.total, (long long)size);
+    return send_end_frame(client_fd, stream_id, size, file_stat.st_mtime);
+}
+
+/**
+ * Serve "BATCH <dir>": collect the names that follow, then answer each
+ * of them in order like a PULL of <dir>/<name> on the BATCH stream. A
+ * body that cannot be kept gets one ERROR and ends the session, as the
+ * manager would wait for the replies of names it never sees. Returns 0
+ * if the session can continue, -1 otherwise.
+ */
+static int batch_file_frames(client_session_t *session, const frame_header_t *header, const char *dir_path) {
+    int client_fd = session->reader.fd;
+    uint32_t stream_id = header->stream_id;
+    unsigned char *names;
+    size_t names_len;
+    int error;
+    
+    int result = read_request_body(session, stream_id, (size_t)BATCH_MAX_FILES * MAX_FILENAME,
+                                   &names, &names_len, &error);
+    if (result != 0) {
+        free(names);
+        return result < 0 ? -1 : 0;
+    }
+    if (error) {
+        free(names);
+        send_error_frame(client_fd, stream_id, "%s", strerror(error));
+        return -1;
+    }
+    
+    int files = 0;
+    const char *cursor = (const char*)names;
+    const char *end = cursor + names_len;
+    while (result == 0 && cursor < end) {
+        const char *newline = memchr(cursor, '\n', end - cursor);
+        int name_len = (int)((newline ? newline : end) - cursor);
+        
+        char file_path[MAX_PATH * 2];
+        if (name_len == 0 || snprintf(file_path, sizeof(file_path), "%s/%.*s", dir_path,
+                                      name_len, cursor) >= (int)sizeof(file_path)) {
+            result = send_error_frame(client_fd, stream_id, "Invalid file name in BATCH");
+        } else {
+            result = pull_file_frames(client_fd, stream_id, file_path, 0, -1,
+                                      header->flags & PULL_FLAG_LEVEL_MASK);
+        }
+        files++;
+        cursor += name_len + 1;
+    }
+    free(names);
+    
+    if (result == 0) {
+        printf("Batch of %d files from %s sent\n", files, dir_path);
+    }
+    return result;
+}
+
+#ifdef __linux__
+
+/**
+ * Names changed since a WATCH session last reported. A name is kept once
+ * however many events it gets, and is only stat'ed when the batch goes
+ * out, so its line describes the file after the last write.
+ */
+typedef struct {
+    char names[WATCH_BATCH_MAX][MAX_FILENAME];
+    int count;                       ///< Names collected
+    int rescan;                      ///< Events were lost, the whole directory must be listed
+    long long first_ms;              ///< When the oldest pending change arrived
+    long long last_ms;               ///< When the newest pending change arrived
+} watch_batch_t;
+
+// Writes that completed and files renamed in (rename is how PUSH lands); touch and chmod
+#define WATCH_EVENTS (IN_CLOSE_WRITE | IN_MOVED_TO | IN_ATTRIB)
+
+static long long monotonic_ms(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (long long)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+static int watch_pending(const watch_batch_t *batch) {
+    return batch->count > 0 || batch->rescan;
+}
+
+static void watch_note(watch_batch_t *batch, const char *name) {
+    long long now = monotonic_ms();
+    if (!watch_pending(batch)) batch->first_ms = now;
+    batch->last_ms = now;
+    
+    if (!name) {
+        batch->rescan = 1;
+        return;
+    }
+    for (int i = 0; i < batch->count; i++) {
+        if (strcmp(batch->names[i], name) == 0) return;
+    }
+    strncpy(batch->names[batch->count], name, MAX_FILENAME - 1);
+    batch->names[batch->count][MAX_FILENAME - 1] = '\0';
+    batch->count++;
+}
+
+/**
+ * Send the pending changes as one DATA frame. Names that are gone again
+ * or are no regular file any more are left out. Returns 0 on success, -1
+ * if the reply could not be sent.
+ */
+static int send_watch_batch(reply_buffer_t *reply, int dir_fd, watch_batch_t *batch, uint16_t flags) {
+    int result = 0;
+    if (batch->rescan) {
+        result = reply_append(reply, WATCH_RESCAN "\n", strlen(WATCH_RESCAN) + 1);
+    } else {
+        for (int i = 0; i < batch->count && result == 0; i++) {
+            struct stat file_stat;
+            if (fstatat(dir_fd, batch->names[i], &file_stat, 0) == 0 && S_ISREG(file_stat.st_mode)) {
+                result = append_list_line(reply, dir_fd, batch->names[i], &file_stat, flags | LIST_FLAG_META);
             }
-            bytes_sent += sent;
         }
     }
     
-    close(fd);
+    batch->count = 0;
+    batch->rescan = 0;
+    return result == 0 ? reply_flush(reply) : -1;
 }
 
-void handle_push_command(int client_fd, const char *file_path, int chunk_size) {
-    static int current_fd = -1;
+/**
+ * Serve WATCH: report changes to dir_path until the manager sends ABORT
+ * for the stream (answered with END) or disconnects. The session, and
+ * with it a connection worker, stays with the watch the whole time.
+ * Returns 0 if the session can continue, -1 otherwise.
+ */
+static int watch_directory_frames(client_session_t *session, uint32_t stream_id, uint16_t flags,
+                                  const char *dir_path) {
+    int client_fd = session->reader.fd;
+    const char *path = relative_to_cwd(dir_path);
     
-    // Strip leading '/' to make path relative  
-    const char *relative_path = file_path;
-    if (file_path[0] == '/') {
-        relative_path = file_path + 1;  // Skip the leading '/'
+    int dir_fd = open(path, O_RDONLY | O_DIRECTORY);
+    if (dir_fd < 0) {
+        return send_error_frame(client_fd, stream_id, "%s", strerror(errno));
+    }
+    
+    int notify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    watch_batch_t *batch = malloc(sizeof(watch_batch_t));
+    if (notify_fd < 0 || !batch || inotify_add_watch(notify_fd, path, WATCH_EVENTS) < 0) {
+        int error = batch ? errno : ENOMEM;
+        if (notify_fd >= 0) close(notify_fd);
+        free(batch);
+        close(dir_fd);
+        return send_error_frame(client_fd, stream_id, "%s", strerror(error));
+    }
+    batch->count = 0;
+    batch->rescan = 0;
+    printf("Watching %s\n", path);
+    
+    reply_buffer_t reply;
+    reply_init(&reply, client_fd, stream_id, 1);
+    
+    char events[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    const char *failure = NULL;
+    int result = 0;
+    int aborted = 0;
+    
+    while (!aborted && !failure && result == 0) {
+        int timeout = -1;
+        if (watch_pending(batch)) {
+            long long due = batch->last_ms + WATCH_QUIET_MS;
+            if (due > batch->first_ms + WATCH_MAX_DELAY_MS) {
+                due = batch->first_ms + WATCH_MAX_DELAY_MS;
+            }
+            long long now = monotonic_ms();
+            timeout = due > now ? (int)(due - now) : 0;
+        }
+        
+        // The reader may already hold the next frame from the manager
+        struct pollfd fds[2] = { { client_fd, POLLIN, 0 }, { notify_fd, POLLIN, 0 } };
+        int ready;
+        if (session->reader.start < session->reader.end) {
+            fds[0].revents = POLLIN;
+            ready = 1;
+        } else {
+            ready = poll(fds, 2, timeout);
+        }
+        if (ready < 0) {
+            if (errno == EINTR) continue;
+            failure = strerror(errno);
+            break;
+        }
+        
+        if (fds[0].revents) {
+            // ABORT of this stream is the only frame a watch expects
+            frame_header_t header;
+            if (read_frame_header(&session->reader, &header) != 0 || header.opcode != FRAME_ABORT ||
+                header.stream_id != stream_id || receive_chunk(session, NULL, header.length) != 0) {
+                result = -1;
+            }
+            aborted = 1;
+            break;
+        }
+        
+        if (fds[1].revents) {
+            ssize_t len = read(notify_fd, events, sizeof(events));
+            if (len < 0 && errno != EAGAIN && errno != EINTR) {
+                failure = strerror(errno);
+                break;
+            }
+            for (char *p = events; len > 0 && p < events + len; ) {
+                struct inotify_event *event = (struct inotify_event*)p;
+                p += sizeof(struct inotify_event) + event->len;
+                
+                if (event->mask & IN_Q_OVERFLOW) {
+                    watch_note(batch, NULL);
+                } else if (event->mask & IN_IGNORED) {
+                    failure = "Watched directory was removed";
+                } else if (event->len > 0 && event->name[0] != '.' && !batch->rescan) {
+                    // Hidden names are skipped like in LIST, among them our own part files
+                    if (batch->count == WATCH_BATCH_MAX &&
+                        send_watch_batch(&reply, dir_fd, batch, flags) != 0) {
+                        result = -1;
+                        break;
+                    }
+                    watch_note(batch, event->name);
+                }
+            }
+        }
+        
+        if (result == 0 && watch_pending(batch) && (ready == 0 || timeout == 0)) {
+            result = send_watch_batch(&reply, dir_fd, batch, flags);
+        }
+    }
+    
+    close(notify_fd);
+    close(dir_fd);
+    free(batch);
+    printf("Stopped watching %s\n", path);
+    
+    if (result != 0) {
+        return -1;
     }
+    if (failure) {
+        return send_error_frame(client_fd, stream_id, "%s", failure);
+    }
+    return send_end_frame(client_fd, stream_id, reply.total, 0);
+}
 
-    if (chunk_size == -1) {
-        // Start new file - truncate if exists
-        if (current_fd >= 0) {
-            close(current_fd);
+#else
+
+static int watch_directory_frames(client_session_t *session, uint32_t stream_id, uint16_t flags,
+                                  const char *dir_path) {
+    (void)flags;
+    (void)dir_path;
+    return send_error_frame(session->reader.fd, stream_id, "WATCH needs inotify");
+}
+
+#endif
+
+static push_transfer_t* find_stream(client_session_t *session, uint32_t stream_id) {
+    for (int i = 0; i < MAX_SESSION_STREAMS; i++) {
+        if (session->streams[i].in_use && session->streams[i].stream_id == stream_id) {
+            return &session->streams[i];
         }
-        current_fd = open(relative_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
-        if (current_fd < 0) {
-            fprintf(stderr, "Error opening file %s for writing: %s\n", file_path, strerror(errno));
-            return;
+    }
+    return NULL;
+}
+
+/**
+ * Prepare a stream that carries a delta against the existing file. The
+ * file is rebuilt in a private part file next to it.
+ */
+static void open_delta_stream(push_transfer_t *transfer) {
+    const char *path = relative_to_cwd(transfer->path);
+    struct stat basis_stat;
+    
+    transfer->basis_fd = open(path, O_RDONLY);
+    if (transfer->basis_fd < 0 || fstat(transfer->basis_fd, &basis_stat) != 0) {
+        transfer->error = errno;
+        fprintf(stderr, "Error opening delta basis %s: %s\n", transfer->path, strerror(errno));
+        return;
+    }
+    
+    // Each delta stream rebuilds into its own locked part file, like a second writer of a path
+    transfer->fd = open_private_part_file(path, transfer->temp_path, sizeof(transfer->temp_path));
+    if (transfer->fd < 0 || fchmod(transfer->fd, basis_stat.st_mode & 0777) != 0) {
+        transfer->error = errno;
+        fprintf(stderr, "Error creating %s: %s\n", transfer->temp_path, strerror(errno));
+        if (transfer->fd >= 0) {
+            unlink(transfer->temp_path);
+            close(transfer->fd);
+            transfer->fd = -1;
         }
+        transfer->temp_path[0] = '\0';
         return;
     }
     
-    if (chunk_size == 0) {
-        // End of file
-        if (current_fd >= 0) {
-            close(current_fd);
-            current_fd = -1;
+    transfer->patch = malloc(sizeof(delta_patch_t));
+    if (!transfer->patch) {
+        transfer->error = ENOMEM;
+        return;
+    }
+    delta_patch_init(transfer->patch, transfer->basis_fd, transfer->fd);
+}
+
+/**
+ * Create the missing parent directories of a path relative to the
+ * working directory, as asked by OPEN_FLAG_MKDIRS. Paths that climb out
+ * with ".." are refused. Returns 0 on success, -1 with errno set.
+ */
+static int make_parent_dirs(const char *path) {
+    char dir[MAX_PATH + 16];
+    size_t len = strlen(path);
+    if (len >= sizeof(dir)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    memcpy(dir, path, len + 1);
+    
+    for (char *slash = strchr(dir + 1, '/'); slash; slash = strchr(slash + 1, '/')) {
+        *slash = '\0';
+        const char *component = strrchr(dir, '/');
+        component = component ? component + 1 : dir;
+        if (strcmp(component, "..") == 0) {
+            errno = EINVAL;
+            return -1;
+        }
+        if (mkdir(dir, 0755) != 0 && errno != EEXIST) {
+            return -1;
+        }
+        *slash = '/';
+    }
+    return 0;
+}
+
+static void open_stream(client_session_t *session, uint32_t stream_id,
+                        uint32_t flags, uint64_t offset, uint64_t group_id, const char *path) {
+    push_transfer_t *transfer = find_stream(session, stream_id);
+    if (transfer) {
+        // Re-opening a stream id drops whatever it was doing before
+        discard_transfer(transfer);
+    }
+    for (int i = 0; !transfer && i < MAX_SESSION_STREAMS; i++) {
+        if (!session->streams[i].in_use) {
+            transfer = &session->streams[i];
         }
+    }
+    if (!transfer) {
+        // No slot: DATA is dropped and END reports the stream as unknown
+        fprintf(stderr, "Too many open streams, refusing %s\n", path);
         return;
     }
     
-    if (current_fd < 0) {
-        fprintf(stderr, "Error: No file open for writing\n");
+    reset_transfer(transfer);
+    transfer->in_use = 1;
+    transfer->stream_id = stream_id;
+    strncpy(transfer->path, path, MAX_PATH - 1);
+    transfer->path[MAX_PATH - 1] = '\0';
+    
+    if (flags & OPEN_FLAG_DELTA) {
+        open_delta_stream(transfer);
         return;
     }
     
-    // Read chunk data from socket and write to file
-    char buffer[MAX_BUFFER_SIZE];
-    int total_received = 0;
+    // Ranges of one file arrive on several sessions and share the part file of
+    // their group, which COMMIT renames; a whole file has it to itself and END renames it
+    int range = (flags & OPEN_FLAG_RANGE) != 0;
+    char part_path[MAX_PATH + 32];
+    if (range) {
+        range_part_path(relative_to_cwd(path), group_id, part_path, sizeof(part_path));
+    } else {
+        hidden_sibling_path(relative_to_cwd(path), ".part", part_path, sizeof(part_path));
+    }
     
-    while (total_received < chunk_size) {
-        int to_receive = (chunk_size - total_received < MAX_BUFFER_SIZE) ? 
-                        chunk_size - total_received : MAX_BUFFER_SIZE;
-        
-        ssize_t received = recv(client_fd, buffer, to_receive, 0);
-        if (received <= 0) {
-            fprintf(stderr, "Error receiving chunk data: %s\n", strerror(errno));
-            return;
+    transfer->fd = open_part_file(part_path, O_WRONLY | O_CREAT, range);
+    if (transfer->fd < 0 && errno == ENOENT && (flags & OPEN_FLAG_MKDIRS)) {
+        // First file of a subdirectory the target does not have yet
+        if (make_parent_dirs(part_path) == 0) {
+            transfer->fd = open_part_file(part_path, O_WRONLY | O_CREAT, range);
         }
-        
-        ssize_t written = write(current_fd, buffer, received);
-        if (written != received) {
-            fprintf(stderr, "Error writing to file: %s\n", strerror(errno));
+    }
+    int resumable = !range;
+    if (transfer->fd < 0 && errno == EWOULDBLOCK && !range && offset == 0) {
+        // Another stream is writing this path: start over in a part file nobody continues
+        transfer->fd = open_private_part_file(relative_to_cwd(path), part_path, sizeof(part_path));
+        resumable = 0;
+    }
+    if (transfer->fd < 0) {
+        transfer->error = errno == EWOULDBLOCK ? EBUSY : errno;
+        fprintf(stderr, "Error opening file %s for writing: %s\n", part_path,
+                errno == EWOULDBLOCK ? "another transfer is writing it" : strerror(errno));
+        return;
+    }
+    if (!range) {
+        memcpy(transfer->temp_path, part_path, sizeof(part_path));
+        transfer->resumable = resumable;
+        if (offset == 0 && ftruncate(transfer->fd, 0) != 0) transfer->error = errno;
+    }
+    transfer->offset = offset;
+    
+    // Continuing a whole file needs what the earlier stream left
+    struct stat part_stat;
+    if (offset > 0 && !(flags & OPEN_FLAG_RANGE) &&
+        (fstat(transfer->fd, &part_stat) != 0 || (uint64_t)part_stat.st_size < offset)) {
+        transfer->error = ENODATA;
+        fprintf(stderr, "Cannot continue %s at offset %llu: its part file is shorter\n", path,
+                (unsigned long long)offset);
+    }
+}
+
+static int finish_stream(client_session_t *session, uint32_t stream_id, uint64_t expected_size, int64_t mtime) {
+    int client_fd = session->reader.fd;
+    push_transfer_t *transfer = find_stream(session, stream_id);
+    if (!transfer) {
+        return send_error_frame(client_fd, stream_id, "Unknown stream %u", stream_id);
+    }
+    
+    int error = transfer->error;
+    if (!error && transfer->patch && delta_patch_finish(transfer->patch) != 0) {
+        error = transfer->patch->error;
+    }
+    if (!error && (uint64_t)transfer->offset != expected_size) {
+        fprintf(stderr, "Size mismatch for %s: got %ld of %llu bytes\n", transfer->path,
+                (long)transfer->offset, (unsigned long long)expected_size);
+        error = EIO;
+    }
+    
+    // Keep the source mtime so the next metadata LIST sees the file as current
+    if (!error && mtime > 0 && transfer->fd >= 0) {
+        struct timespec times[2] = { { 0, UTIME_OMIT }, { (time_t)mtime, 0 } };
+        futimens(transfer->fd, times);
+    }
+    
+    // The complete file replaces the old copy in one rename; a failed one leaves the old copy alone
+    if (!error && transfer->fd >= 0 && transfer->temp_path[0] != '\0') {
+        if (durability_land(transfer->fd, transfer->temp_path, relative_to_cwd(transfer->path)) != 0) {
+            error = errno;
+        } else {
+            transfer->temp_path[0] = '\0';
+        }
+    } else if (transfer->fd >= 0) {
+        close_delta(transfer);  // The part file goes while still locked
+        if (close(transfer->fd) != 0 && !error) error = errno;
+    }
+    transfer->fd = -1;
+    close_delta(transfer);
+    
+    off_t written = transfer->offset;
+    reset_transfer(transfer);
+    
+    if (error) {
+        return send_error_frame(client_fd, stream_id, "%s", strerror(error));
+    }
+    return send_end_frame(client_fd, stream_id, written, 0);
+}
+
+static int handle_command_frame(client_session_t *session, const frame_header_t *header, char *command) {
+    uint32_t stream_id = header->stream_id;
+    int client_fd = session->reader.fd;
+    printf("Received command: %s\n", command);
+    
+    if (strncmp(command, CMD_LIST, strlen(CMD_LIST)) == 0) {
+        char *dir_path = command + strlen(CMD_LIST);
+        while (*dir_path == ' ') dir_path++;
+        return list_directory_frames(client_fd, stream_id, header->flags, dir_path);
+    }
+    if (strncmp(command, CMD_PULL, strlen(CMD_PULL)) == 0) {
+        char *file_path = command + strlen(CMD_PULL);
+        while (*file_path == ' ') file_path++;
+        return pull_file_frames(client_fd, stream_id, file_path, 0, -1, header->flags & PULL_FLAG_LEVEL_MASK);
+    }
+    if (strncmp(command, CMD_RANGE " ", strlen(CMD_RANGE) + 1) == 0) {
+        return range_file_frames(client_fd, header, command + strlen(CMD_RANGE) + 1);
+    }
+    if (strncmp(command, CMD_COMMIT " ", strlen(CMD_COMMIT) + 1) == 0) {
+        return commit_file_frames(client_fd, header, command + strlen(CMD_COMMIT) + 1);
+    }
+    if (strncmp(command, CMD_SIGS " ", strlen(CMD_SIGS) + 1) == 0) {
+        return sigs_file_frames(client_fd, stream_id, command + strlen(CMD_SIGS) + 1);
+    }
+    if (strncmp(command, CMD_DELTA " ", strlen(CMD_DELTA) + 1) == 0) {
+        return delta_file_frames(session, stream_id, command + strlen(CMD_DELTA) + 1);
+    }
+    if (strncmp(command, CMD_BATCH " ", strlen(CMD_BATCH) + 1) == 0) {
+        return batch_file_frames(session, header, command + strlen(CMD_BATCH) + 1);
+    }
+    if (strncmp(command, CMD_WATCH " ", strlen(CMD_WATCH) + 1) == 0) {
+        return watch_directory_frames(session, stream_id, header->flags, command + strlen(CMD_WATCH) + 1);
+    }
+    
+    return send_error_frame(client_fd, stream_id, "Unknown command: %s", command);
+}
+
+/**
+ * Serve a connection that negotiated protocol version 2 until the peer
+ * disconnects or violates the framing.
+ */
+static void serve_frames(client_session_t *session) {
+    frame_header_t header;
+    
+    while (wait_for_request(session) && read_frame_header(&session->reader, &header) == 0) {
+        switch (header.opcode) {
+        case FRAME_CMD: {
+            char command[MAX_COMMAND_SIZE];
+            if (header.length >= sizeof(command) ||
+                reader_read_exact(&session->reader, command, header.length) != 0) {
+                return;
+            }
+            command[header.length] = '\0';
+            if (handle_command_frame(session, &header, command) != 0) {
+                return;
+            }
+            break;
+        }
+        case FRAME_OPEN: {
+            unsigned char payload[OPEN_PAYLOAD_FIXED + OPEN_PAYLOAD_GROUP + MAX_PATH];
+            if (header.length <= OPEN_PAYLOAD_FIXED || header.length >= sizeof(payload) ||
+                reader_read_exact(&session->reader, payload, header.length) != 0) {
+                return;
+            }
+            payload[header.length] = '\0';
+            uint32_t flags = get_u32(payload);
+            size_t fixed = OPEN_PAYLOAD_FIXED + ((flags & OPEN_FLAG_RANGE) ? OPEN_PAYLOAD_GROUP : 0);
+            if (header.length <= fixed) {
+                return;
+            }
+            open_stream(session, header.stream_id, flags, get_u64(payload + 4),
+                        fixed > OPEN_PAYLOAD_FIXED ? get_u64(payload + OPEN_PAYLOAD_FIXED) : 0,
+                        (const char*)payload + fixed);
+            break;
+        }
+        case FRAME_DATA: {
+            push_transfer_t *transfer = find_stream(session, header.stream_id);
+            int result = (header.flags & DATA_FLAG_ZLIB)
+                ? receive_compressed_chunk(session, transfer, header.length)
+                : receive_chunk(session, transfer, header.length);
+            if (result != 0) {
+                return;
+            }
+            break;
+        }
+        case FRAME_END: {
+            unsigned char payload[END_PAYLOAD_SIZE];
+            if (header.length != END_PAYLOAD_SIZE ||
+                reader_read_exact(&session->reader, payload, sizeof(payload)) != 0) {
+                return;
+            }
+            if (finish_stream(session, header.stream_id, get_u64(payload), (int64_t)get_u64(payload + 8)) != 0) {
+                return;
+            }
+            break;
+        }
+        case FRAME_ABORT: {
+            push_transfer_t *transfer = find_stream(session, header.stream_id);
+            if (transfer) {
+                // Given up by the manager: nothing will continue the part file
+                transfer->resumable = 0;
+                discard_transfer(transfer);
+            }
+            if (receive_chunk(session, NULL, header.length) != 0) {
+                return;
+            }
+            break;
+        }
+        default:
+            fprintf(stderr, "Unexpected frame opcode %d, dropping connection\n", header.opcode);
             return;
         }
-        
-        total_received += received;
     }
 }
 
 void handle_client_connection(int client_fd) {
     char buffer[MAX_COMMAND_SIZE];
+    client_session_t session;
+    init_client_session(&session, client_fd);
     
     while (1) {
-        ssize_t received = recv(client_fd, buffer, sizeof(buffer) - 1, 0);
-        if (received <= 0) {
+        if (!wait_for_request(&session) || read_client_command(&session, buffer, sizeof(buffer)) < 0) {
             break; // Client disconnected or error
         }
         
-        buffer[received] = '\0';
-        
-        // Remove trailing newline
-        char *newline = strchr(buffer, '\n');
-        if (newline) *newline = '\0';
-        
         printf("Received command: %s\n", buffer);
         
-        if (strncmp(buffer, CMD_LIST, strlen(CMD_LIST)) == 0) {
+        // Managers send HELLO as a PULL that version 1 clients refuse
+        const char *hello = strncmp(buffer, CMD_HELLO_PULL " ", strlen(CMD_HELLO_PULL) + 1) == 0 ?
+                            CMD_HELLO_PULL : CMD_HELLO;
+        if (strncmp(buffer, hello, strlen(hello)) == 0 && buffer[strlen(hello)] == ' ') {
+            char *args = buffer + strlen(hello) + 1;
+            int requested = atoi(args);
+            int version = requested >= PROTOCOL_VERSION ? PROTOCOL_VERSION : 1;
+            
+            // Accept the offered features this build supports
+            char *offered = strchr(args, ' ');
+            uint32_t features = parse_feature_list(offered) & FEATURES_SUPPORTED;
+            
+            char reply[32];
+            format_hello_reply(version, features, reply, sizeof(reply));
+            if (send_command(client_fd, reply) != 0) {
+                break;
+            }
+            if (version >= 2) {
+                session.version = version;
+                serve_frames(&session);
+                break;
+            }
+            
+        } else if (strncmp(buffer, CMD_LIST, strlen(CMD_LIST)) == 0) {
             char *dir_path = buffer + strlen(CMD_LIST);
             while (*dir_path == ' ') dir_path++; // Skip spaces
             handle_list_command(client_fd, dir_path);
@@ -168,14 +1952,18 @@ void handle_client_connection(int client_fd) {
         } else if (strncmp(buffer, CMD_PULL, strlen(CMD_PULL)) == 0) {
             char *file_path = buffer + strlen(CMD_PULL);
             while (*file_path == ' ') file_path++; // Skip spaces
-            handle_pull_command(client_fd, file_path);
+            if (handle_pull_command(client_fd, file_path) != 0) {
+                break;
+            }
             
         } else if (strncmp(buffer, CMD_PUSH, strlen(CMD_PUSH)) == 0) {
             char file_path[MAX_PATH];
             int chunk_size;
             
-            if (sscanf(buffer, "PUSH %s %d", file_path, &chunk_size) >= 2) {
-                handle_push_command(client_fd, file_path, chunk_size);
+            if (sscanf(buffer, "PUSH %1023s %d", file_path, &chunk_size) >= 2) {
+                if (handle_push_command(&session, file_path, chunk_size) != 0) {
+                    break;
+                }
             } else {
                 fprintf(stderr, "Invalid PUSH command format: %s\n", buffer);
             }
@@ -184,5 +1972,69 @@ void handle_client_connection(int client_fd) {
         }
     }
     
+    close_client_session(&session);
     close(client_fd);
-}
\ No newline at end of file
+}
+
+static void* client_worker_thread(void *arg) {
+    int server_fd = (int)(long)arg;
+    
+    while (1) {
+        struct sockaddr_in client_addr;
+        socklen_t client_len = sizeof(client_addr);
+        
+        int client_fd = accept(server_fd, (struct sockaddr*)&client_addr, &client_len);
+        if (client_fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            if (errno == EBADF || errno == EINVAL) break; // Listening socket closed
+            fprintf(stderr, "Error accepting connection: %s\n", strerror(errno));
+            continue;
+        }
+        
+        char address[INET_ADDRSTRLEN];
+        inet_ntop(AF_INET, &client_addr.sin_addr, address, sizeof(address));
+        printf("Client connected from %s:%d\n", address, ntohs(client_addr.sin_port));
+        
+        handle_client_connection(client_fd);
+        
+        printf("Client disconnected\n");
+    }
+    
+    release_worker_uring();
+    return NULL;
+}
+
+int run_client_workers(int server_fd, int worker_count) {
+    if (server_fd < 0 || worker_count <= 0) {
+        return -1;
+    }
+    
+    pthread_t *threads = malloc(sizeof(pthread_t) * worker_count);
+    if (!threads) {
+        fprintf(stderr, "Failed to allocate memory for client workers\n");
+        return -1;
+    }
+    
+    int started = 0;
+    for (int i = 0; i < worker_count; i++) {
+        if (pthread_create(&threads[i], NULL, client_worker_thread, (void*)(long)server_fd) != 0) {
+            fprintf(stderr, "Failed to create client worker %d\n", i);
+            break;
+        }
+        started++;
+    }
+    
+    if (started == 0) {
+        free(threads);
+        return -1;
+    }
+    
+    printf("nfs_client serving with %d connection workers\n", started);
+    
+    for (int i = 0; i < started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    
+    free(threads);
+    return 0;
+}
@@ -43,11 +43,11 @@ int process_user_command(const char *input, char *command, char *args) {
             fprintf(stderr, "Invalid cancel command format. Use: cancel <source>\n");
             return -1;
         }
-    } else if (strcmp(command, CMD_SHUTDOWN) == 0) {
+    } else if (strcmp(command, CMD_SHUTDOWN) == 0 || strcmp(command, CMD_STATS) == 0) {
         // No arguments needed
     } else {
         fprintf(stderr, "Unknown command: %s\n", command);
-        fprintf(stderr, "Available commands: add, cancel, shutdown\n");
+        fprintf(stderr, "Available commands: add, cancel, stats, shutdown\n");
         return -1;
     }
     
@@ -148,8 +148,14 @@ int main(int argc, char *argv[]) {
         // Handle help command locally
         if (strncmp(input, "help", 4) == 0) {
             printf("Available commands:\n");
-            printf("  add <source> <target>  - Add directory pair for synchronization\n");
+            printf("  add <source> <target> [key=value ...]\n");
+            printf("                         - Add directory pair for synchronization\n");
+            printf("                           options: check=none|mtime|hash delta=on|off\n");
+            printf("                                    split=<MiB>|off priority=1-100 watch=on|off\n");
+            printf("                                    compress=on|off|1-9 batch=on|off\n");
+            printf("                                    recursive=on|off rate=<KiB/s>|off\n");
             printf("  cancel <source>        - Cancel synchronization for source directory\n");
+            printf("  stats                  - Show throughput, latency and queue metrics\n");
             printf("  shutdown               - Shutdown the manager\n");
             printf("  help                   - Show this help message\n");
             printf("> ");
@@ -5,19 +5,19 @@ extern volatile sig_atomic_t shutdown_flag;
 int main(int argc, char *argv[]) {
     nfs_manager_t manager;
     
-    printf("DEBUG: Manager starting...\n");
+    LOG_DEBUG("Manager starting...");
     
     if (argc < 9) {
-        fprintf(stderr, "Usage: %s -l <manager_logfile> -c <config_file> -n <worker_limit> -p <port_number> -b <bufferSize>\n", argv[0]);
+        fprintf(stderr, "Usage: %s -l <manager_logfile> -c <config_file> -n <worker_limit> -p <port_number> -b <bufferSize> [-e splice|copy|pipeline] [-B <relay_buffer_KiB>] [-D <relay_depth>] [-k <idle_sessions_per_client>] [-q list|ring|steal] [-H [host:port=]<max_sessions>] [-R [host=]<KiB_per_sec>] [-j <journal_file>] [-v error|warn|info|debug] [-F text|json] [-m <metrics_port>]\n", argv[0]);
         return 1;
     }
     
-    printf("DEBUG: Parsing arguments...\n");
+    LOG_DEBUG("Parsing arguments...");
     if (parse_arguments(argc, argv, &manager) != 0) {
-        printf("DEBUG: Argument parsing failed\n");
+        LOG_DEBUG("Argument parsing failed");
         return 1;
     }
-    printf("DEBUG: Arguments parsed successfully\n");
+    LOG_DEBUG("Arguments parsed successfully");
     
     global_manager = &manager;
     
@@ -28,47 +28,50 @@ int main(int argc, char *argv[]) {
     sa.sa_flags = 0;
     sigaction(SIGINT, &sa, NULL);
     sigaction(SIGTERM, &sa, NULL);
-    printf("DEBUG: Signal handlers set up\n");
     
-    printf("DEBUG: Initializing manager...\n");
+    // Pooled sessions may be closed by the client at any time
+    signal(SIGPIPE, SIG_IGN);
+    LOG_DEBUG("Signal handlers set up");
+    
+    LOG_DEBUG("Initializing manager...");
     if (initialize_manager(&manager) != 0) {
-        printf("DEBUG: Manager initialization failed\n");
+        LOG_DEBUG("Manager initialization failed");
         cleanup_manager(&manager);
         return 1;
     }
-    printf("DEBUG: Manager initialized successfully\n");
+    LOG_DEBUG("Manager initialized successfully");
     
-    printf("DEBUG: Loading config file: %s\n", manager.config_file_path);
+    LOG_DEBUG("Loading config file: %s", manager.config_file_path);
     if (load_config_file(&manager) != 0) {
-        printf("DEBUG: Config file loading failed\n");
+        LOG_DEBUG("Config file loading failed");
         cleanup_manager(&manager);
         return 1;
     }
-    printf("DEBUG: Config file loaded successfully\n");
+    LOG_DEBUG("Config file loaded successfully");
     
     printf("nfs_manager started on port %d\n", manager.port);
-    printf("DEBUG: Entering main server loop...\n");
+    LOG_DEBUG("Entering main server loop...");
     
     // Main server loop
     while (!manager.shutdown_requested && !shutdown_flag) {
         struct sockaddr_in client_addr;
         socklen_t client_len = sizeof(client_addr);
         
-        printf("DEBUG: Waiting for connection on port %d...\n", manager.port);
+        LOG_DEBUG("Waiting for connection on port %d...", manager.port);
         
         // Use select to timeout and check shutdown flag
         fd_set read_fds;
         struct timeval timeout;
         FD_ZERO(&read_fds);
         FD_SET(manager.server_sockfd, &read_fds);
-        timeout.tv_sec = 5;  // 5 second timeout for easier debugging
+        timeout.tv_sec = 1;  // Console threads may request shutdown at any time
         timeout.tv_usec = 0;
         
         int select_result = select(manager.server_sockfd + 1, &read_fds, NULL, NULL, &timeout);
         if (select_result < 0) {
             if (errno == EINTR) {
                 // Interrupted by signal, check shutdown flag
-                printf("DEBUG: Select interrupted by signal\n");
+                LOG_DEBUG("Select interrupted by signal");
                 continue;
             }
             if (!manager.shutdown_requested && !shutdown_flag) {
@@ -79,11 +82,11 @@ int main(int argc, char *argv[]) {
         
         if (select_result == 0) {
             // Timeout, just continue to check shutdown flag
-            printf("DEBUG: Select timeout, checking for shutdown...\n");
+            LOG_DEBUG("Select timeout, checking for shutdown...");
             continue;
         }
         
-        printf("DEBUG: Connection available, accepting...\n");
+        LOG_DEBUG("Connection available, accepting...");
         int client_fd = accept(manager.server_sockfd, (struct sockaddr*)&client_addr, &client_len);
         if (client_fd < 0) {
             if (!manager.shutdown_requested && !shutdown_flag) {
@@ -92,12 +95,13 @@ int main(int argc, char *argv[]) {
             continue;
         }
         
-        printf("Console connected from %s:%d\n", 
-               inet_ntoa(client_addr.sin_addr), ntohs(client_addr.sin_port));
-        printf("DEBUG: Starting console connection handler...\n");
+        char address[INET_ADDRSTRLEN];
+        inet_ntop(AF_INET, &client_addr.sin_addr, address, sizeof(address));
+        printf("Console connected from %s:%d\n", address, ntohs(client_addr.sin_port));
+        LOG_DEBUG("Starting console connection thread...");
         
-        handle_console_connection(&manager, client_fd);
-        printf("DEBUG: Console connection handler finished\n");
+        // Each console is served on its own thread, the loop keeps accepting
+        start_console_thread(&manager, client_fd);
     }
     
     printf("Manager shutting down...\n");
@@ -1,4 +1,5 @@
 #include "../include/nfs_manager_logic.h"
+#include <poll.h>
 
 // Global manager instance for signal handling
 nfs_manager_t *global_manager = NULL;
@@ -6,6 +7,12 @@ nfs_manager_t *global_manager = NULL;
 // Global log file for worker threads
 FILE *g_worker_logfile = NULL;
 
+// Sessions to nfs_client instances shared by workers and LIST
+connection_pool_t *g_connection_pool = NULL;
+
+// Job journal shared by workers and LIST, NULL without -j
+journal_t *g_journal = NULL;
+
 // Signal handling flag
 volatile sig_atomic_t shutdown_flag = 0;
 
@@ -23,6 +30,10 @@ void signal_handler(int sig) {
 int parse_arguments(int argc, char *argv[], nfs_manager_t *manager) {
     memset(manager, 0, sizeof(nfs_manager_t));
     manager->worker_limit = DEFAULT_WORKERS;
+    manager->pool_idle_limit = POOL_MAX_IDLE_PER_HOST;
+    manager->relay_buffer_kib = RELAY_BUFFER_DEFAULT / 1024;
+    manager->relay_depth = RELAY_DEPTH_DEFAULT;
+    job_queue_type_t queue_type = JOB_QUEUE_LIST;
     
     for (int i = 1; i < argc; i += 2) {
         if (i + 1 >= argc) {
@@ -34,6 +45,8 @@ int parse_arguments(int argc, char *argv[], nfs_manager_t *manager) {
             manager->logfile_path = strdup(argv[i + 1]);
         } else if (strcmp(argv[i], "-c") == 0) {
             manager->config_file_path = strdup(argv[i + 1]);
+        } else if (strcmp(argv[i], "-j") == 0) {
+            manager->journal_path = strdup(argv[i + 1]);
         } else if (strcmp(argv[i], "-n") == 0) {
             manager->worker_limit = atoi(argv[i + 1]);
             if (manager->worker_limit <= 0) {
@@ -52,6 +65,69 @@ int parse_arguments(int argc, char *argv[], nfs_manager_t *manager) {
                 fprintf(stderr, "Invalid buffer size: %s\n", argv[i + 1]);
                 return -1;
             }
+        } else if (strcmp(argv[i], "-e") == 0) {
+            transfer_engine_t engine;
+            if (parse_transfer_engine(argv[i + 1], &engine) != 0) {
+                fprintf(stderr, "Unknown transfer engine: %s\n", argv[i + 1]);
+                return -1;
+            }
+            set_transfer_engine(engine);
+        } else if (strcmp(argv[i], "-B") == 0) {
+            manager->relay_buffer_kib = atoi(argv[i + 1]);
+            if (manager->relay_buffer_kib <= 0) {
+                fprintf(stderr, "Invalid relay buffer size: %s\n", argv[i + 1]);
+                return -1;
+            }
+        } else if (strcmp(argv[i], "-D") == 0) {
+            manager->relay_depth = atoi(argv[i + 1]);
+            if (manager->relay_depth <= 0) {
+                fprintf(stderr, "Invalid relay depth: %s\n", argv[i + 1]);
+                return -1;
+            }
+        } else if (strcmp(argv[i], "-q") == 0) {
+            job_queue_type_t type;
+            if (parse_job_queue_type(argv[i + 1], &type) != 0) {
+                fprintf(stderr, "Unknown job queue: %s\n", argv[i + 1]);
+                return -1;
+            }
+            set_job_queue_type(type);
+            queue_type = type;
+        } else if (strcmp(argv[i], "-H") == 0) {
+            if (parse_throttle_sessions(argv[i + 1]) != 0) {
+                fprintf(stderr, "Invalid session limit ([host:port=]N): %s\n", argv[i + 1]);
+                return -1;
+            }
+        } else if (strcmp(argv[i], "-R") == 0) {
+            if (parse_throttle_rate(argv[i + 1]) != 0) {
+                fprintf(stderr, "Invalid host rate ([host=]KiB/s): %s\n", argv[i + 1]);
+                return -1;
+            }
+        } else if (strcmp(argv[i], "-v") == 0) {
+            log_level_t level;
+            if (parse_log_level(argv[i + 1], &level) != 0) {
+                fprintf(stderr, "Unknown log level: %s\n", argv[i + 1]);
+                return -1;
+            }
+            set_log_level(level);
+        } else if (strcmp(argv[i], "-F") == 0) {
+            log_format_t format;
+            if (parse_log_format(argv[i + 1], &format) != 0) {
+                fprintf(stderr, "Unknown log format: %s\n", argv[i + 1]);
+                return -1;
+            }
+            set_log_format(format);
+        } else if (strcmp(argv[i], "-m") == 0) {
+            manager->metrics_port = atoi(argv[i + 1]);
+            if (manager->metrics_port <= 0) {
+                fprintf(stderr, "Invalid metrics port: %s\n", argv[i + 1]);
+                return -1;
+            }
+        } else if (strcmp(argv[i], "-k") == 0) {
+            manager->pool_idle_limit = atoi(argv[i + 1]);
+            if (manager->pool_idle_limit < 0) {
+                fprintf(stderr, "Invalid idle session limit: %s\n", argv[i + 1]);
+                return -1;
+            }
         } else {
             fprintf(stderr, "Unknown option: %s\n", argv[i]);
             return -1;
@@ -64,10 +140,32 @@ int parse_arguments(int argc, char *argv[], nfs_manager_t *manager) {
         return -1;
     }
     
+    if (set_relay_buffers((size_t)manager->relay_buffer_kib * 1024, manager->relay_depth) != 0) {
+        fprintf(stderr, "Relay buffers must be %d-%d KiB, 2-%d deep\n",
+                RELAY_BUFFER_MIN / 1024, RELAY_BUFFER_MAX / 1024, RELAY_DEPTH_MAX);
+        return -1;
+    }
+    
+    // The ring hands out jobs strictly in order, so it cannot pass over a capped client
+    if (queue_type == JOB_QUEUE_RING && throttle_caps_sessions()) {
+        fprintf(stderr, "Session limits (-H) need -q list or -q steal\n");
+        return -1;
+    }
+    
     return 0;
 }
 
 int initialize_manager(nfs_manager_t *manager) {
+    // First, cleanup_manager() waits on these whatever fails below
+    pthread_mutex_init(&manager->console_mutex, NULL);
+    pthread_cond_init(&manager->consoles_done, NULL);
+    manager->consoles = 0;
+    pthread_mutex_init(&manager->watch_mutex, NULL);
+    pthread_cond_init(&manager->watches_done, NULL);
+    manager->watches = 0;
+    manager->metrics_sockfd = -1;
+    manager->metrics_started = 0;
+    
     // Open log file
     manager->logfile = fopen(manager->logfile_path, "w");
     if (!manager->logfile) {
@@ -78,6 +176,10 @@ int initialize_manager(nfs_manager_t *manager) {
     // Set global log file for worker threads
     g_worker_logfile = manager->logfile;
     
+    // Records for it are written by the flusher from here on; if it does
+    // not start they are just written synchronously
+    log_start(manager->logfile);
+    
     // Create server socket
     manager->server_sockfd = create_server_socket(manager->port);
     if (manager->server_sockfd < 0) {
@@ -91,11 +193,43 @@ int initialize_manager(nfs_manager_t *manager) {
         return -1;
     }
     
+    // Replay the journal before anything records into it
+    if (manager->journal_path) {
+        g_journal = journal_open(manager->journal_path);
+        if (!g_journal) {
+            destroy_sync_info_store(manager->sync_store);
+            manager->sync_store = NULL;
+            return -1;
+        }
+    }
+    
+    // Create connection pool before the workers that borrow from it
+    manager->connection_pool = create_connection_pool(manager->pool_idle_limit, POOL_IDLE_TIMEOUT_SEC);
+    if (!manager->connection_pool) {
+        fprintf(stderr, "Failed to create connection pool\n");
+        destroy_sync_info_store(manager->sync_store);
+        return -1;
+    }
+    g_connection_pool = manager->connection_pool;
+    
     // Create thread pool
     manager->thread_pool = create_thread_pool(manager->worker_limit, manager->buffer_size);
     if (!manager->thread_pool) {
         fprintf(stderr, "Failed to create thread pool\n");
         destroy_sync_info_store(manager->sync_store);
+        g_connection_pool = NULL;
+        destroy_connection_pool(manager->connection_pool);
+        manager->connection_pool = NULL;
+        return -1;
+    }
+    
+    if (start_enumerator(manager) != 0) {
+        fprintf(stderr, "Failed to start enumerator\n");
+        return -1;
+    }
+    
+    if (manager->metrics_port > 0 && start_metrics_endpoint(manager) != 0) {
+        fprintf(stderr, "Failed to start metrics endpoint on port %d\n", manager->metrics_port);
         return -1;
     }
     
@@ -105,6 +239,515 @@ int initialize_manager(nfs_manager_t *manager) {
     return 0;
 }
 
+/**
+ * Incremental parser for LIST replies. Bytes are fed as they arrive and
+ * each complete line becomes a sync job right away, so transfers of a
+ * large directory start before the listing has finished. A target
+ * listing fills the pair manifest instead.
+ */
+typedef struct {
+    nfs_manager_t *manager;          ///< Manager owning the thread pool
+    sync_info_t *sync_info;          ///< Pair being listed
+    int meta;                        ///< Lines are metadata lines (LIST_FLAG_META)
+    manifest_t *fill;                ///< Record entries here instead of enqueueing
+    int skipped;                     ///< Unchanged files not enqueued
+    char line[MAX_FILENAME + 64];    ///< Partial line carried between reads
+    size_t len;                      ///< Bytes in line
+    int overflow;                    ///< Current line too long, being skipped
+    int done;                        ///< End marker "." seen
+    int files;                       ///< Jobs created so far
+    int ranges;                      ///< Both clients can move large files as parallel ranges
+    int batch;                       ///< The source serves BATCH, small files can share a job
+    int part;                        ///< The target continues whole files in their part file (FEATURE_PART)
+    sync_job_t *batch_job;           ///< Batch job being filled, not enqueued yet
+    int defer;                       ///< Collect names, enqueue after the session is released
+    int stop;                        ///< Pair cancelled or pool shutting down, abandon the listing
+    int watch;                       ///< Lines come from a WATCH feed, WATCH_RESCAN may appear
+    char **pending;                  ///< Names collected in defer mode
+    int pending_count;               ///< Number of pending names
+    int pending_capacity;            ///< Allocated pending slots
+} list_parser_t;
+
+/**
+ * Enqueue a large file as range jobs of split_size bytes that share one
+ * range group. Returns 0 if the file was handed to the pool this way, -1
+ * if it should be enqueued as a single job instead.
+ */
+static int enqueue_file_ranges(list_parser_t *parser, const file_meta_t *source) {
+    nfs_manager_t *manager = parser->manager;
+    sync_info_t *sync_info = parser->sync_info;
+    int64_t split_size = sync_info->options.split_size;
+    int ranges = (int)((source->size + split_size - 1) / split_size);
+    
+    range_group_t *group = create_range_group(source->size, source->mtime, ranges);
+    if (!group) return -1;
+    
+    // Every range holds a group reference; free_sync_job() settles those that never run
+    for (int i = 0; i < ranges; i++) {
+        sync_job_t *job = create_sync_job(sync_info, source->name);
+        if (!job) {
+            if (finish_range(group, 0)) free_range_group(group);
+            continue;
+        }
+        
+        job->range_offset = (int64_t)i * split_size;
+        job->range_length = source->size - job->range_offset < split_size ?
+                            source->size - job->range_offset : split_size;
+        job->group = group;
+        job->journal_id = journal_add_job(g_journal, sync_info, source->name, source->size, source->mtime,
+                                          job->range_offset, job->range_length, group->id);
+        
+        if (enqueue_sync_job(manager->thread_pool, job) != 0) {
+            if (manager->logfile) {
+                log_message(manager->logfile, "Failed to enqueue range job for file: %s", source->name);
+            }
+            free_sync_job(job);
+            parser->stop = 1;
+        }
+    }
+    
+    parser->files++;
+    if (manager->logfile) {
+        log_message(manager->logfile, "Added file: %s/%s@%s:%d -> %s/%s@%s:%d (%d ranges)",
+                   sync_info->source_dir, source->name, sync_info->source_host, sync_info->source_port,
+                   sync_info->target_dir, source->name, sync_info->target_host, sync_info->target_port,
+                   ranges);
+    }
+    return 0;
+}
+
+/**
+ * Enqueue the batch job being filled, if any. A batch of one file goes
+ * out as a plain job; after the listing stopped the batch is dropped.
+ */
+static void flush_batch(list_parser_t *parser) {
+    sync_job_t *job = parser->batch_job;
+    if (!job) return;
+    parser->batch_job = NULL;
+    
+    nfs_manager_t *manager = parser->manager;
+    sync_info_t *sync_info = parser->sync_info;
+    if (parser->stop || !sync_info->active) {
+        free_sync_job(job);
+        return;
+    }
+    
+    int count = job->batch->count;
+    dissolve_batch(job);
+    if (enqueue_sync_job(manager->thread_pool, job) != 0) {
+        if (manager->logfile) {
+            log_message(manager->logfile, "Failed to enqueue batch job of %d files from: %s", count, job->filename);
+        }
+        free_sync_job(job);
+        parser->stop = 1;
+        return;
+    }
+    
+    parser->files += count;
+    if (manager->logfile && count == 1) {
+        log_message(manager->logfile, "Added file: %s/%s@%s:%d -> %s/%s@%s:%d",
+                   sync_info->source_dir, job->filename, sync_info->source_host, sync_info->source_port,
+                   sync_info->target_dir, job->filename, sync_info->target_host, sync_info->target_port);
+    } else if (manager->logfile) {
+        log_message(manager->logfile, "Added %d files from %s@%s:%d -> %s@%s:%d (one batch)", count,
+                   sync_info->source_dir, sync_info->source_host, sync_info->source_port,
+                   sync_info->target_dir, sync_info->target_host, sync_info->target_port);
+    }
+}
+
+/**
+ * Add a small file to the batch job being filled, starting one if
+ * needed, and enqueue the job once it is full. Returns 0 on success, -1
+ * if the file should get a job of its own.
+ */
+static int batch_listed_file(list_parser_t *parser, const file_meta_t *source) {
+    if (!parser->batch_job) {
+        parser->batch_job = create_sync_job(parser->sync_info, source->name);
+        if (!parser->batch_job) return -1;
+    }
+    if (add_batch_file(parser->batch_job, source->name, source->size) != 0) {
+        if (!parser->batch_job->batch) {
+            free_sync_job(parser->batch_job);
+            parser->batch_job = NULL;
+        }
+        return -1;
+    }
+    if (batch_full(parser->batch_job)) {
+        flush_batch(parser);
+    }
+    return 0;
+}
+
+/**
+ * Enqueue what is left of a file whose journalled jobs did not end before
+ * the last shutdown or crash. Ranges keep their part file and go on from
+ * their last offset. A whole file goes on from its offset in its part file
+ * on the target, or, with a target that writes in place, when the target
+ * copy is that long. Returns 0 if the file was handed to the pool this
+ * way, -1 if it has nothing to resume and should be enqueued as usual.
+ */
+static int resume_listed_file(list_parser_t *parser, const file_meta_t *source) {
+    nfs_manager_t *manager = parser->manager;
+    sync_info_t *sync_info = parser->sync_info;
+    journal_entry_t *entries = NULL;
+    int count = journal_take_resume(g_journal, sync_info, source->name, source->size, source->mtime, &entries);
+    if (count == 0) return -1;
+    
+    range_group_t *group = NULL;
+    if (entries->group) {
+        // The resumed ranges write into the part file the first ones left
+        group = create_range_group(source->size, source->mtime, count);
+        if (group) group->id = entries->group;
+        if (!group) {
+            while (entries) {
+                journal_entry_t *next = entries->next;
+                journal_done(g_journal, entries->id);
+                free(entries);
+                entries = next;
+            }
+            return -1;
+        }
+    }
+    
+    // A whole file restarts from byte 0 when an in-place target lost what was sent
+    file_meta_t target;
+    int64_t left = 0;
+    while (entries) {
+        journal_entry_t *e = entries;
+        entries = e->next;
+        
+        sync_job_t *job = create_sync_job(sync_info, source->name);
+        if (!job) {
+            journal_done(g_journal, e->id);
+            if (group && finish_range(group, 0)) free_range_group(group);
+            free(e);
+            continue;
+        }
+        job->journal_id = e->id;
+        
+        int64_t end = e->offset + e->length;
+        if (group) {
+            int64_t from = e->committed > e->offset && e->committed < end ? e->committed : e->offset;
+            job->range_offset = from;
+            job->range_length = end - from;
+            job->group = group;
+        } else if (e->committed > 0 && e->committed < end &&
+                   (parser->part || (manifest_get(sync_info->manifest, source->name, &target) &&
+                                     target.size >= e->committed))) {
+            job->range_offset = e->committed;
+            job->range_length = end - e->committed;
+            job->mtime = source->mtime;
+        }
+        left += group || job->range_length > 0 ? job->range_length : source->size;
+        
+        if (enqueue_sync_job(manager->thread_pool, job) != 0) {
+            if (manager->logfile) {
+                log_message(manager->logfile, "Failed to enqueue resumed job for file: %s", source->name);
+            }
+            free_sync_job(job);
+            parser->stop = 1;
+        }
+        free(e);
+    }
+    
+    parser->files++;
+    if (manager->logfile) {
+        log_message(manager->logfile, "Resumed file: %s/%s@%s:%d -> %s/%s@%s:%d (%lld of %lld bytes left)",
+                   sync_info->source_dir, source->name, sync_info->source_host, sync_info->source_port,
+                   sync_info->target_dir, source->name, sync_info->target_host, sync_info->target_port,
+                   (long long)left, (long long)source->size);
+    }
+    return 0;
+}
+
+/**
+ * Create and enqueue the job for one listed file. source is the metadata
+ * of the source file when the listing carried it, NULL otherwise.
+ */
+static void enqueue_listed_file(list_parser_t *parser, const char *filename, const file_meta_t *source) {
+    if (parser->defer) {
+        if (parser->pending_count == parser->pending_capacity) {
+            int capacity = parser->pending_capacity ? parser->pending_capacity * 2 : 64;
+            char **grown = realloc(parser->pending, capacity * sizeof(char*));
+            if (!grown) return;
+            parser->pending = grown;
+            parser->pending_capacity = capacity;
+        }
+        char *name = strdup(filename);
+        if (name) parser->pending[parser->pending_count++] = name;
+        return;
+    }
+    
+    nfs_manager_t *manager = parser->manager;
+    sync_info_t *sync_info = parser->sync_info;
+    
+    // A cancelled pair gets no more jobs
+    if (!sync_info->active) {
+        parser->stop = 1;
+        return;
+    }
+    
+    // A file cut off by a restart carries on where it stopped
+    if (source && parser->ranges && resume_listed_file(parser, source) == 0) {
+        return;
+    }
+    
+    // Large files that already exist on the target are updated with a delta
+    file_meta_t target;
+    uint32_t delta_block = 0;
+    if (source && sync_info->options.delta && source->size >= DELTA_MIN_FILE_SIZE &&
+        manifest_get(sync_info->manifest, filename, &target) && target.size >= DELTA_MIN_FILE_SIZE) {
+        delta_block = delta_block_size(target.size);
+    }
+    
+    // Small files travel together, many to a job
+    if (source && !delta_block && parser->batch && sync_info->options.batch &&
+        source->size <= BATCH_MAX_FILE_SIZE && batch_listed_file(parser, source) == 0) {
+        return;
+    }
+    
+    // Other large files are spread over several workers
+    if (source && !delta_block && parser->ranges && sync_info->options.split_size > 0 &&
+        source->size > sync_info->options.split_size && enqueue_file_ranges(parser, source) == 0) {
+        return;
+    }
+    
+    // Create sync job for this file
+    sync_job_t *job = create_sync_job(sync_info, filename);
+    if (!job) return;
+    job->delta_block_size = delta_block;
+    
+    // Only plain pushes of large files are worth resuming; others are just copied again
+    if (source && !delta_block && parser->ranges && source->size >= JOURNAL_MIN_FILE_SIZE) {
+        job->journal_id = journal_add_job(g_journal, sync_info, filename, source->size, source->mtime,
+                                          0, source->size, 0);
+    }
+    
+    if (enqueue_sync_job(manager->thread_pool, job) == 0) {
+        parser->files++;
+        if (manager->logfile) {
+            log_message(manager->logfile, "Added file: %s/%s@%s:%d -> %s/%s@%s:%d",
+                       sync_info->source_dir, filename, sync_info->source_host, sync_info->source_port,
+                       sync_info->target_dir, filename, sync_info->target_host, sync_info->target_port);
+        }
+    } else {
+        if (manager->logfile) {
+            log_message(manager->logfile, "Failed to enqueue job for file: %s", filename);
+        }
+        free_sync_job(job);
+        parser->stop = 1;
+    }
+}
+
+static void handle_list_entry(list_parser_t *parser, const char *line) {
+    if (parser->watch && strcmp(line, WATCH_RESCAN) == 0) {
+        request_enumeration(parser->manager, parser->sync_info);
+        return;
+    }
+    if (!parser->meta) {
+        enqueue_listed_file(parser, line, NULL);
+        return;
+    }
+    
+    file_meta_t meta;
+    if (parse_list_entry(line, &meta) != 0) {
+        if (parser->manager->logfile) {
+            log_message(parser->manager->logfile, "Skipping malformed LIST entry: %s", line);
+        }
+        return;
+    }
+    
+    if (parser->fill) {
+        manifest_put(parser->fill, &meta);
+    } else if (!manifest_needs_sync(parser->sync_info->manifest, &meta, parser->sync_info->options.check)) {
+        parser->skipped++;
+    } else {
+        enqueue_listed_file(parser, meta.name, &meta);
+    }
+}
+
+static void list_parser_end_line(list_parser_t *parser) {
+    parser->line[parser->len] = '\0';
+    if (parser->len > 0 && parser->line[parser->len - 1] == '\r') {
+        parser->line[--parser->len] = '\0';
+    }
+    
+    if (parser->overflow) {
+        if (parser->manager->logfile) {
+            log_message(parser->manager->logfile, "Skipping overlong LIST entry in %s",
+                        parser->sync_info->source_dir);
+        }
+    } else if (strcmp(parser->line, ".") == 0) {
+        parser->done = 1;
+    } else if (parser->len > 0) {
+        handle_list_entry(parser, parser->line);
+    }
+    
+    parser->len = 0;
+    parser->overflow = 0;
+}
+
+/**
+ * Feed reply bytes to the parser. Returns the number of bytes consumed,
+ * which is less than len only if the end marker was reached or the
+ * listing was abandoned.
+ */
+static size_t list_parser_feed(list_parser_t *parser, const char *data, size_t len) {
+    size_t i = 0;
+    while (i < len && !parser->done && !parser->stop) {
+        char c = data[i++];
+        if (c == '\n') {
+            list_parser_end_line(parser);
+        } else if (parser->len + 1 < sizeof(parser->line)) {
+            parser->line[parser->len++] = c;
+        } else {
+            parser->overflow = 1;
+        }
+    }
+    return i;
+}
+
+/**
+ * Send LIST for dir over a borrowed session and feed the reply to the
+ * parser as it streams in. flags (LIST_FLAG_*) only apply to version 2
+ * sessions. Returns 0 on success, -1 on error or when the parser stops
+ * the listing. *reusable is set when the whole reply was consumed and
+ * the session can go back to the pool.
+ */
+static int stream_file_list(list_parser_t *parser, client_conn_t *conn, const char *dir,
+                            uint16_t flags, int *reusable) {
+    char command[MAX_COMMAND_SIZE];
+    char buffer[MAX_BUFFER_SIZE];
+    *reusable = 0;
+    
+    if (conn->version < 2) {
+        // Send LIST command
+        snprintf(command, sizeof(command), "%s %s\n", CMD_LIST, dir);
+        if (send_command(conn->fd, command) != 0) {
+            return -1;
+        }
+        
+        // Read file list until the "." end marker
+        while (!parser->done) {
+            ssize_t received = recv(conn->fd, buffer, sizeof(buffer), 0);
+            if (received < 0 && errno == EINTR) continue;
+            if (received <= 0) return -1;
+            
+            // Nothing may follow the end marker on a clean session
+            if (list_parser_feed(parser, buffer, received) != (size_t)received) {
+                return parser->stop ? -1 : 0;
+            }
+        }
+        *reusable = 1;
+        return 0;
+    }
+    
+    uint32_t stream_id = next_stream_id();
+    int len = snprintf(command, sizeof(command), "%s %s", CMD_LIST, dir);
+    if (send_frame_flags(conn->fd, FRAME_CMD, flags, stream_id, command, len) != 0) {
+        return -1;
+    }
+    
+    // DATA frames carry the lines, END closes the listing
+    frame_header_t header;
+    while (recv_frame_header(conn->fd, &header) == 0 && header.stream_id == stream_id) {
+        switch (header.opcode) {
+        case FRAME_DATA: {
+            uint64_t remaining = header.length;
+            while (remaining > 0) {
+                size_t want = remaining < sizeof(buffer) ? remaining : sizeof(buffer);
+                if (recv_exact(conn->fd, buffer, want) != 0) return -1;
+                list_parser_feed(parser, buffer, want);
+                if (parser->stop) return -1; // Rest of the reply is dropped with the session
+                remaining -= want;
+            }
+            break;
+        }
+        case FRAME_END: {
+            unsigned char payload[END_PAYLOAD_SIZE];
+            if (header.length != END_PAYLOAD_SIZE || recv_exact(conn->fd, payload, sizeof(payload)) != 0) {
+                return -1;
+            }
+            if (parser->len > 0) list_parser_end_line(parser);
+            *reusable = 1;
+            return 0;
+        }
+        case FRAME_ERROR: {
+            if (header.length >= sizeof(buffer) || recv_exact(conn->fd, buffer, header.length) != 0) {
+                return -1;
+            }
+            buffer[header.length] = '\0';
+            if (parser->manager->logfile) {
+                log_message(parser->manager->logfile, "LIST %s failed: %s", dir, buffer);
+            }
+            *reusable = 1;
+            return -1;
+        }
+        default:
+            return -1;
+        }
+    }
+    return -1;
+}
+
+/**
+ * Fill the pair manifest from a metadata LIST of the target directory.
+ * Returns the LIST flags to use for the source listing, or 0 if the
+ * target cannot report metadata and every file has to be copied.
+ * *target_version is set to the protocol version of the target, or 0 if
+ * it could not be reached, and *target_features to the features it
+ * accepted. Recursive pairs list the whole target tree when it can.
+ */
+static uint16_t load_target_manifest(nfs_manager_t *manager, sync_info_t *sync_info, int *target_version,
+                                     uint32_t *target_features) {
+    sync_check_t check = sync_info->options.check;
+    *target_version = 0;
+    *target_features = 0;
+    
+    if (sync_info->manifest) {
+        manifest_clear(sync_info->manifest);
+    }
+    
+    client_conn_t target;
+    if (acquire_connection(manager->connection_pool, sync_info->target_host,
+                           sync_info->target_port, &target) != 0) {
+        return 0;
+    }
+    *target_version = target.version;
+    *target_features = target.features;
+    
+    // Legacy targets can neither list metadata nor keep the source mtime.
+    // Delta updates need the target sizes even when every file is copied
+    if (target.version < 2 || (check == SYNC_CHECK_NONE && !sync_info->options.delta)) {
+        release_connection(manager->connection_pool, &target, 1);
+        return 0;
+    }
+    
+    if (!sync_info->manifest) {
+        sync_info->manifest = create_manifest();
+        if (!sync_info->manifest) {
+            release_connection(manager->connection_pool, &target, 1);
+            return 0;
+        }
+    }
+    
+    uint16_t flags = LIST_FLAG_META | (check == SYNC_CHECK_HASH ? LIST_FLAG_HASH : 0);
+    
+    list_parser_t parser;
+    memset(&parser, 0, sizeof(parser));
+    parser.manager = manager;
+    parser.sync_info = sync_info;
+    parser.meta = 1;
+    parser.fill = sync_info->manifest;
+    
+    // A missing or partial listing only means more files get copied
+    uint16_t walk = sync_info->options.recursive && (target.features & FEATURE_TREE) ? LIST_FLAG_RECURSIVE : 0;
+    int reusable = 0;
+    stream_file_list(&parser, &target, sync_info->target_dir, flags | walk, &reusable);
+    release_connection(manager->connection_pool, &target, reusable);
+    return flags;
+}
+
 int start_directory_sync(nfs_manager_t *manager, sync_info_t *sync_info) {
     // Validate inputs
     if (!manager || !sync_info) {
@@ -119,9 +762,16 @@ int start_directory_sync(nfs_manager_t *manager, sync_info_t *sync_info) {
         return -1;
     }
     
-    // Connect to source to get file list
-    int source_fd = connect_to_server(sync_info->source_host, sync_info->source_port);
-    if (source_fd < 0) {
+    // Learn what the target already has so unchanged files can be skipped
+    int target_version;
+    uint32_t target_features;
+    uint16_t list_flags = load_target_manifest(manager, sync_info, &target_version, &target_features);
+    
+    // Borrow a session to the source to get the file list
+    client_conn_t source;
+    if (acquire_connection(manager->connection_pool, sync_info->source_host,
+                           sync_info->source_port, &source) != 0) {
+        __atomic_add_fetch(&sync_info->error_count, 1, __ATOMIC_RELAXED);
         // Safe logging with validated strings
         if (manager->logfile) {
             log_message(manager->logfile, "Failed to connect to source %s:%d", 
@@ -130,101 +780,115 @@ int start_directory_sync(nfs_manager_t *manager, sync_info_t *sync_info) {
         return -1;
     }
     
-    // Send LIST command
-    char command[MAX_COMMAND_SIZE];
-    snprintf(command, sizeof(command), "LIST %s\n", sync_info->source_dir);
+    list_parser_t parser;
+    memset(&parser, 0, sizeof(parser));
+    parser.manager = manager;
+    parser.sync_info = sync_info;
     
-    if (send_command(source_fd, command) != 0) {
-        close(source_fd);
-        return -1;
-    }
+    // A legacy client serves one connection at a time: the workers could
+    // not reach it while enqueue blocks on a full queue with LIST still open
+    parser.defer = source.version < 2;
+    parser.meta = source.version >= 2;
+    parser.ranges = source.version >= 2 && target_version >= 2;
+    parser.batch = parser.ranges && (source.features & FEATURE_BATCH);
+    parser.part = parser.ranges && (target_features & FEATURE_PART);
     
-    // Read file list
-    char buffer[MAX_BUFFER_SIZE];
-    ssize_t received = recv(source_fd, buffer, sizeof(buffer) - 1, 0);
-    if (received <= 0) {
-        close(source_fd);
-        return -1;
+    // Source sizes are wanted even without a target manifest, to split large files
+    list_flags |= LIST_FLAG_META;
+    
+    // Subdirectories need a source that walks them and a target that creates them
+    if (sync_info->options.recursive) {
+        if ((source.features & FEATURE_TREE) && (target_features & FEATURE_TREE)) {
+            list_flags |= LIST_FLAG_RECURSIVE;
+        } else if (manager->logfile) {
+            log_message(manager->logfile, "Pair %s@%s:%d: recursive=on needs tree support on both clients, "
+                        "syncing the top directory only",
+                        sync_info->source_dir, sync_info->source_host, sync_info->source_port);
+        }
     }
     
-    buffer[received] = '\0';
+    int reusable = 0;
+    int result = stream_file_list(&parser, &source, sync_info->source_dir, list_flags, &reusable);
+    release_connection(manager->connection_pool, &source, reusable);
+    flush_batch(&parser);
     
-    // Parse filenames (one per line, ending with ".")
-    char *line = strtok(buffer, "\n");
-    while (line && strcmp(line, ".") != 0) {
-        // Create sync job for this file
-        sync_job_t *job = create_sync_job(
-            sync_info->source_host, sync_info->source_port, sync_info->source_dir,
-            sync_info->target_host, sync_info->target_port, sync_info->target_dir,
-            line
-        );
-        
-        if (job) {
-            if (enqueue_sync_job(manager->thread_pool, job) == 0) {
-                if (manager->logfile) {
-                    log_message(manager->logfile, "Added file: %s/%s@%s:%d -> %s/%s@%s:%d",
-                               sync_info->source_dir, line, sync_info->source_host, sync_info->source_port,
-                               sync_info->target_dir, line, sync_info->target_host, sync_info->target_port);
-                }
-            } else {
-                if (manager->logfile) {
-                    log_message(manager->logfile, "Failed to enqueue job for file: %s", line);
-                }
-                free_sync_job(job);
-            }
-        }
-        
-        line = strtok(NULL, "\n");
+    parser.defer = 0;
+    for (int i = 0; i < parser.pending_count; i++) {
+        if (!parser.stop) enqueue_listed_file(&parser, parser.pending[i], NULL);
+        free(parser.pending[i]);
     }
+    free(parser.pending);
     
-    close(source_fd);
-    return 0;
+    // Journalled jobs of files the full listing did not show are gone for good
+    if (result == 0 && !parser.stop) {
+        journal_drop_resume(g_journal, sync_info);
+    }
+    
+    // Jobs already enqueued keep running even if the listing broke off
+    if (!parser.stop && result != 0) {
+        __atomic_add_fetch(&sync_info->error_count, 1, __ATOMIC_RELAXED);
+    }
+    if (parser.stop && manager->logfile) {
+        log_message(manager->logfile, "LIST of %s@%s:%d abandoned after %d files",
+                    sync_info->source_dir, sync_info->source_host, sync_info->source_port, parser.files);
+    } else if (result != 0 && manager->logfile) {
+        log_message(manager->logfile, "LIST of %s@%s:%d ended early after %d files",
+                    sync_info->source_dir, sync_info->source_host, sync_info->source_port, parser.files);
+    }
+    if (parser.skipped > 0 && manager->logfile) {
+        log_message(manager->logfile, "Sync of %s@%s:%d: %d files queued, %d unchanged",
+                    sync_info->source_dir, sync_info->source_host, sync_info->source_port,
+                    parser.files, parser.skipped);
+    }
+    return result;
 }
 
 int load_config_file(nfs_manager_t *manager) {
-    printf("DEBUG: load_config_file called\n");
+    LOG_DEBUG("load_config_file called");
     
     if (!manager || !manager->config_file_path) {
-        fprintf(stderr, "DEBUG: Invalid manager or config file path\n");
+        LOG_ERROR("Invalid manager or config file path");
         return -1;
     }
     
-    printf("DEBUG: Opening config file: %s\n", manager->config_file_path);
+    LOG_DEBUG("Opening config file: %s", manager->config_file_path);
     FILE *config_file = fopen(manager->config_file_path, "r");
     if (!config_file) {
         fprintf(stderr, "Error opening config file %s: %s\n", manager->config_file_path, strerror(errno));
         return -1;
     }
-    printf("DEBUG: Config file opened successfully\n");
+    LOG_DEBUG("Config file opened successfully");
     
     char line[MAX_COMMAND_SIZE];
     int line_number = 0;
     
     while (fgets(line, sizeof(line), config_file)) {
         line_number++;
-        printf("DEBUG: Read line %d: %s", line_number, line);
+        LOG_DEBUG("Read line %d: %.*s", line_number, (int)strcspn(line, "\n"), line);
         
         // Skip empty lines and comments
         if (line[0] == '\n' || line[0] == '#') {
-            printf("DEBUG: Skipping empty/comment line\n");
+            LOG_DEBUG("Skipping empty/comment line");
             continue;
         }
         
         char source_spec[MAX_PATH * 2], target_spec[MAX_PATH * 2];
-        int scan_result = sscanf(line, "%s %s", source_spec, target_spec);
-        printf("DEBUG: Parsed line - source='%s' target='%s' scan_result=%d\n", 
-               source_spec, target_spec, scan_result);
+        int options_offset = 0;
+        int scan_result = sscanf(line, "%s %s %n", source_spec, target_spec, &options_offset);
+        LOG_DEBUG("Parsed line - source='%s' target='%s' scan_result=%d",
+                  source_spec, target_spec, scan_result);
         
         if (scan_result != 2) {
             fprintf(stderr, "Error parsing config line %d: %s", line_number, line);
             continue;
         }
         
-        printf("DEBUG: Calling handle_add_command for: %s -> %s\n", source_spec, target_spec);
+        LOG_DEBUG("Calling handle_add_command for: %s -> %s", source_spec, target_spec);
         
         // Add this sync pair
-        int result = handle_add_command(manager, source_spec, target_spec);
-        printf("DEBUG: handle_add_command returned: %d\n", result);
+        int result = handle_add_command(manager, source_spec, target_spec,
+                                        options_offset > 0 ? line + options_offset : NULL, NULL);
+        LOG_DEBUG("handle_add_command returned: %d", result);
         
         if (result == 0) {
             printf("Loaded and started sync: %s -> %s\n", source_spec, target_spec);
@@ -236,22 +900,39 @@ int load_config_file(nfs_manager_t *manager) {
     }
     
     fclose(config_file);
-    printf("DEBUG: Config file processing complete\n");
+    LOG_DEBUG("Config file processing complete");
+    
+    // Pairs added from the console before a restart come back after the config ones
+    int journal_count = 0;
+    char **journal_lines = journal_pair_lines(g_journal, &journal_count);
+    for (int i = 0; i < journal_count; i++) {
+        char source_spec[MAX_PATH * 2], target_spec[MAX_PATH * 2];
+        int options_offset = 0;
+        if (sscanf(journal_lines[i], "%s %s %n", source_spec, target_spec, &options_offset) == 2) {
+            const char *options = options_offset > 0 ? journal_lines[i] + options_offset : NULL;
+            if (handle_add_command(manager, source_spec, target_spec, options, NULL) == 0) {
+                printf("Restored sync from journal: %s -> %s\n", source_spec, target_spec);
+            }
+        }
+        free(journal_lines[i]);
+    }
+    free(journal_lines);
     
     // Show current sync configuration only if we have a store
     if (manager->sync_store) {
         printf("\nCurrent sync configuration:\n");
         print_sync_info_store(manager->sync_store);
     } else {
-        printf("DEBUG: No sync store available\n");
+        LOG_DEBUG("No sync store available");
     }
     
     return 0;
 }
 
-int handle_add_command(nfs_manager_t *manager, const char *source_spec, const char *target_spec) {
-    printf("DEBUG: handle_add_command called with source='%s' target='%s'\n", 
-           source_spec ? source_spec : "NULL", target_spec ? target_spec : "NULL");
+int handle_add_command(nfs_manager_t *manager, const char *source_spec, const char *target_spec,
+                       const char *options, int *pair_id) {
+    LOG_DEBUG("handle_add_command called with source='%s' target='%s'",
+              source_spec ? source_spec : "NULL", target_spec ? target_spec : "NULL");
     
     if (!manager || !source_spec || !target_spec) {
         fprintf(stderr, "Invalid parameters to handle_add_command\n");
@@ -262,31 +943,37 @@ int handle_add_command(nfs_manager_t *manager, const char *source_spec, const ch
     char source_dir[MAX_PATH], target_dir[MAX_PATH];
     int source_port, target_port;
     
-    printf("DEBUG: Parsing source spec: %s\n", source_spec);
+    LOG_DEBUG("Parsing source spec: %s", source_spec);
     if (parse_directory_spec(source_spec, source_host, &source_port, source_dir) != 0) {
-        printf("DEBUG: Failed to parse source spec\n");
+        LOG_DEBUG("Failed to parse source spec");
         return -1;
     }
-    printf("DEBUG: Source parsed - host=%s port=%d dir=%s\n", source_host, source_port, source_dir);
+    LOG_DEBUG("Source parsed - host=%s port=%d dir=%s", source_host, source_port, source_dir);
     
-    printf("DEBUG: Parsing target spec: %s\n", target_spec);
+    LOG_DEBUG("Parsing target spec: %s", target_spec);
     if (parse_directory_spec(target_spec, target_host, &target_port, target_dir) != 0) {
-        printf("DEBUG: Failed to parse target spec\n");
+        LOG_DEBUG("Failed to parse target spec");
+        return -1;
+    }
+    LOG_DEBUG("Target parsed - host=%s port=%d dir=%s", target_host, target_port, target_dir);
+    
+    sync_options_t pair_options;
+    init_sync_options(&pair_options);
+    if (parse_sync_options(options, &pair_options) != 0) {
         return -1;
     }
-    printf("DEBUG: Target parsed - host=%s port=%d dir=%s\n", target_host, target_port, target_dir);
     
     // Check if already exists
-    printf("DEBUG: Checking if sync info already exists...\n");
+    LOG_DEBUG("Checking if sync info already exists...");
     if (find_sync_info(manager->sync_store, source_host, source_port, source_dir)) {
-        printf("DEBUG: Sync info already exists\n");
+        LOG_DEBUG("Sync info already exists");
         if (manager->logfile) {
             log_message(manager->logfile, "Already in queue: %s@%s:%d", 
                        source_dir, source_host, source_port);
         }
         return 1;
     }
-    printf("DEBUG: Sync info doesn't exist, creating new one...\n");
+    LOG_DEBUG("Sync info doesn't exist, creating new one...");
     
     // Create and add sync info
     sync_info_t *info = create_sync_info(source_host, source_port, source_dir,
@@ -295,27 +982,28 @@ int handle_add_command(nfs_manager_t *manager, const char *source_spec, const ch
         fprintf(stderr, "Failed to create sync info\n");
         return -1;
     }
-    printf("DEBUG: Created sync info successfully\n");
+    info->options = pair_options;
+    LOG_DEBUG("Created sync info successfully");
     
-    printf("DEBUG: Adding sync info to store...\n");
+    LOG_DEBUG("Adding sync info to store...");
     if (add_sync_info(manager->sync_store, info) != 0) {
-        printf("DEBUG: Failed to add sync info to store\n");
+        LOG_DEBUG("Failed to add sync info to store");
         free_sync_info(info);
         return -1;
     }
-    printf("DEBUG: Added sync info to store successfully\n");
+    LOG_DEBUG("Added sync info to store successfully");
     
-    // Start synchronization
-    printf("DEBUG: Starting directory sync...\n");
-    if (start_directory_sync(manager, info) != 0) {
-        printf("DEBUG: Failed to start directory sync\n");
+    // Listing happens in the background, the caller does not wait for it
+    LOG_DEBUG("Queueing directory listing...");
+    if (request_enumeration(manager, info) != 0) {
+        LOG_DEBUG("Failed to queue directory listing");
         if (manager->logfile) {
             log_message(manager->logfile, "Failed to start sync for %s@%s:%d", 
                        source_dir, source_host, source_port);
         }
         return -1;
     }
-    printf("DEBUG: Directory sync started successfully\n");
+    if (pair_id) *pair_id = info->id;
     
     if (manager->logfile) {
         log_message(manager->logfile, "Started sync: %s@%s:%d -> %s@%s:%d",
@@ -339,9 +1027,13 @@ int handle_cancel_command(nfs_manager_t *manager, const char *source_spec) {
     }
     
     if (deactivate_sync_info(manager->sync_store, source_host, source_port, source_dir) == 0) {
+        // Queued jobs go now; running ones stop before their next chunk
+        sync_info_t *info = find_sync_info(manager->sync_store, source_host, source_port, source_dir);
+        int purged = info ? purge_sync_jobs(manager->thread_pool, info) : 0;
+        if (info) journal_drop_pair(g_journal, journal_pair_key(info));
         if (manager->logfile) {
-            log_message(manager->logfile, "Synchronization stopped for %s@%s:%d",
-                       source_dir, source_host, source_port);
+            log_message(manager->logfile, "Synchronization stopped for %s@%s:%d, %d queued jobs dropped",
+                       source_dir, source_host, source_port, purged);
         }
         return 0;
     } else {
@@ -376,6 +1068,37 @@ int handle_shutdown_command(nfs_manager_t *manager) {
     return 0;
 }
 
+int handle_stats_command(nfs_manager_t *manager, char *response, size_t size) {
+    if (!manager || !response || size == 0) return -1;
+    
+    // Leave room for the terminator fmemopen() may not write when full
+    FILE *out = fmemopen(response, size - 1, "w");
+    if (!out) return -1;
+    write_stats_summary(out, manager->thread_pool, manager->sync_store);
+    long len = ftell(out);
+    fclose(out);
+    response[len < 0 ? 0 : len] = '\0';
+    return 0;
+}
+
+/**
+ * Record a pair added from the console in the journal, so that a
+ * restarted manager adds it again.
+ */
+static void journal_console_pair(nfs_manager_t *manager, const char *source_spec, const char *target_spec,
+                                 const char *options) {
+    char host[MAX_HOST_SIZE], dir[MAX_PATH];
+    int port;
+    if (!g_journal || parse_directory_spec(source_spec, host, &port, dir) != 0) return;
+    
+    sync_info_t *info = find_sync_info(manager->sync_store, host, port, dir);
+    if (!info) return;
+    
+    char line[MAX_COMMAND_SIZE];
+    snprintf(line, sizeof(line), "%s %s %s", source_spec, target_spec, options ? options : "");
+    journal_add_pair(g_journal, journal_pair_key(info), line);
+}
+
 void handle_console_connection(nfs_manager_t *manager, int client_fd) {
     if (!manager || client_fd < 0) {
         return;
@@ -408,14 +1131,18 @@ void handle_console_connection(nfs_manager_t *manager, int client_fd) {
         
         // Parse command
         char command[64], arg1[MAX_PATH], arg2[MAX_PATH];
-        int args = sscanf(buffer, "%s %s %s", command, arg1, arg2);
+        int options_offset = 0;
+        int args = sscanf(buffer, "%63s %1023s %1023s %n", command, arg1, arg2, &options_offset);
         
         char response[MAX_BUFFER_SIZE];
         
         if (strcmp(command, CMD_ADD) == 0 && args == 3) {
-            int result = handle_add_command(manager, arg1, arg2);
+            int pair_id = 0;
+            int result = handle_add_command(manager, arg1, arg2,
+                                            options_offset > 0 ? buffer + options_offset : NULL, &pair_id);
             if (result == 0) {
-                snprintf(response, sizeof(response), "Added sync pair successfully\n");
+                journal_console_pair(manager, arg1, arg2, options_offset > 0 ? buffer + options_offset : NULL);
+                snprintf(response, sizeof(response), "Added sync pair %d successfully\n", pair_id);
             } else if (result == 1) {
                 snprintf(response, sizeof(response), "Already in queue: %s\n", arg1);
             } else {
@@ -430,6 +1157,10 @@ void handle_console_connection(nfs_manager_t *manager, int client_fd) {
             } else {
                 snprintf(response, sizeof(response), "Error canceling synchronization\n");
             }
+        } else if (strcmp(command, CMD_STATS) == 0) {
+            if (handle_stats_command(manager, response, sizeof(response)) != 0) {
+                snprintf(response, sizeof(response), "Error collecting stats\n");
+            }
         } else if (strcmp(command, CMD_SHUTDOWN) == 0) {
             handle_shutdown_command(manager);
             snprintf(response, sizeof(response), "Shutting down manager...\n");
@@ -445,23 +1176,457 @@ void handle_console_connection(nfs_manager_t *manager, int client_fd) {
     close(client_fd);
 }
 
+/**
+ * Console connection handed to its thread
+ */
+typedef struct {
+    nfs_manager_t *manager;
+    int fd;
+} console_arg_t;
+
+static void* console_thread(void *arg) {
+    console_arg_t *console = arg;
+    nfs_manager_t *manager = console->manager;
+    
+    handle_console_connection(manager, console->fd);
+    free(console);
+    
+    pthread_mutex_lock(&manager->console_mutex);
+    manager->consoles--;
+    pthread_cond_broadcast(&manager->consoles_done);
+    pthread_mutex_unlock(&manager->console_mutex);
+    return NULL;
+}
+
+int start_console_thread(nfs_manager_t *manager, int client_fd) {
+    console_arg_t *console = malloc(sizeof(console_arg_t));
+    if (!console) {
+        fprintf(stderr, "Failed to allocate memory for console connection\n");
+        close(client_fd);
+        return -1;
+    }
+    console->manager = manager;
+    console->fd = client_fd;
+    
+    pthread_mutex_lock(&manager->console_mutex);
+    manager->consoles++;
+    pthread_mutex_unlock(&manager->console_mutex);
+    
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    pthread_t thread;
+    int result = pthread_create(&thread, &attr, console_thread, console);
+    pthread_attr_destroy(&attr);
+    
+    if (result != 0) {
+        fprintf(stderr, "Failed to create console thread: %s\n", strerror(result));
+        pthread_mutex_lock(&manager->console_mutex);
+        manager->consoles--;
+        pthread_mutex_unlock(&manager->console_mutex);
+        close(client_fd);
+        free(console);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Pair handed to its watch thread
+ */
+typedef struct {
+    nfs_manager_t *manager;
+    sync_info_t *info;               ///< Watched pair (one reference held)
+} watch_arg_t;
+
+static int watch_stopped(nfs_manager_t *manager, sync_info_t *info) {
+    return !info->active || manager->shutdown_requested || shutdown_flag;
+}
+
+/**
+ * Follow the WATCH feed of one pair. Each batch of changed files goes
+ * through the same parser as a metadata listing, so the manifest, delta
+ * and range rules apply to it; WATCH_RESCAN queues a full listing.
+ */
+static void run_pair_watch(nfs_manager_t *manager, sync_info_t *info) {
+    // Ranges need a target that speaks version 2, as in start_directory_sync()
+    int target_version = 0;
+    uint32_t target_features = 0;
+    client_conn_t target;
+    if (acquire_connection(manager->connection_pool, info->target_host, info->target_port, &target) == 0) {
+        target_version = target.version;
+        target_features = target.features;
+        release_connection(manager->connection_pool, &target, 1);
+    }
+    
+    client_conn_t source;
+    if (acquire_connection(manager->connection_pool, info->source_host, info->source_port, &source) != 0) {
+        if (manager->logfile) {
+            log_message(manager->logfile, "Failed to connect to source %s:%d for watching",
+                       info->source_host, info->source_port);
+        }
+        return;
+    }
+    if (source.version < 2) {
+        if (manager->logfile) {
+            log_message(manager->logfile, "Source %s:%d cannot watch %s (protocol %d)",
+                       info->source_host, info->source_port, info->source_dir, source.version);
+        }
+        release_connection(manager->connection_pool, &source, 1);
+        return;
+    }
+    
+    char command[MAX_COMMAND_SIZE];
+    uint32_t stream_id = next_stream_id();
+    uint16_t flags = info->options.check == SYNC_CHECK_HASH ? LIST_FLAG_HASH : 0;
+    int len = snprintf(command, sizeof(command), "%s %s", CMD_WATCH, info->source_dir);
+    if (send_frame_flags(source.fd, FRAME_CMD, flags, stream_id, command, len) != 0) {
+        release_connection(manager->connection_pool, &source, 0);
+        return;
+    }
+    if (manager->logfile) {
+        log_message(manager->logfile, "Watching %s@%s:%d", info->source_dir, info->source_host, info->source_port);
+    }
+    
+    list_parser_t parser;
+    memset(&parser, 0, sizeof(parser));
+    parser.manager = manager;
+    parser.sync_info = info;
+    parser.meta = 1;
+    parser.watch = 1;
+    parser.ranges = target_version >= 2;
+    parser.batch = parser.ranges && (source.features & FEATURE_BATCH);
+    parser.part = parser.ranges && (target_features & FEATURE_PART);
+    
+    char buffer[MAX_BUFFER_SIZE];
+    while (!watch_stopped(manager, info) && !parser.stop) {
+        struct pollfd pfd = { source.fd, POLLIN, 0 };
+        int ready = poll(&pfd, 1, WATCH_POLL_MS);
+        if (ready < 0 && errno == EINTR) continue;
+        if (ready < 0) break;
+        if (ready == 0) continue;
+        
+        frame_header_t header;
+        if (recv_frame_header(source.fd, &header) != 0 || header.stream_id != stream_id) break;
+        
+        if (header.opcode == FRAME_DATA) {
+            uint64_t remaining = header.length;
+            while (remaining > 0 && !parser.stop) {
+                size_t want = remaining < sizeof(buffer) ? remaining : sizeof(buffer);
+                if (recv_exact(source.fd, buffer, want) != 0) {
+                    parser.stop = 1;
+                    break;
+                }
+                list_parser_feed(&parser, buffer, want);
+                remaining -= want;
+            }
+            // A report is complete in one frame, its small files go out together
+            flush_batch(&parser);
+            continue;
+        }
+        if (header.opcode == FRAME_ERROR && header.length < sizeof(buffer) &&
+            recv_exact(source.fd, buffer, header.length) == 0) {
+            buffer[header.length] = '\0';
+            if (manager->logfile) {
+                log_message(manager->logfile, "WATCH %s failed: %s", info->source_dir, buffer);
+            }
+        }
+        break; // END, ERROR or a broken frame: the watch is over
+    }
+    
+    // Closing the session ends the watch on the client
+    release_connection(manager->connection_pool, &source, 0);
+    flush_batch(&parser);
+    if (manager->logfile) {
+        log_message(manager->logfile, "Stopped watching %s@%s:%d, %d files queued",
+                   info->source_dir, info->source_host, info->source_port, parser.files);
+    }
+}
+
+static void* watch_thread(void *arg) {
+    watch_arg_t *watch = arg;
+    nfs_manager_t *manager = watch->manager;
+    sync_info_t *info = watch->info;
+    free(watch);
+    
+    run_pair_watch(manager, info);
+    __atomic_store_n(&info->watching, 0, __ATOMIC_RELEASE);
+    release_sync_info(info);
+    
+    pthread_mutex_lock(&manager->watch_mutex);
+    manager->watches--;
+    pthread_cond_broadcast(&manager->watches_done);
+    pthread_mutex_unlock(&manager->watch_mutex);
+    return NULL;
+}
+
+/**
+ * Start the watch thread of a pair unless one is already running (a
+ * rescan lists the pair again). cleanup_manager() waits for it.
+ */
+static void start_pair_watch(nfs_manager_t *manager, sync_info_t *info) {
+    if (__atomic_exchange_n(&info->watching, 1, __ATOMIC_ACQ_REL)) return;
+    
+    watch_arg_t *watch = malloc(sizeof(watch_arg_t));
+    if (!watch) {
+        fprintf(stderr, "Failed to allocate memory for pair watch\n");
+        __atomic_store_n(&info->watching, 0, __ATOMIC_RELEASE);
+        return;
+    }
+    watch->manager = manager;
+    watch->info = retain_sync_info(info);
+    
+    pthread_mutex_lock(&manager->watch_mutex);
+    manager->watches++;
+    pthread_mutex_unlock(&manager->watch_mutex);
+    
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    pthread_t thread;
+    int result = pthread_create(&thread, &attr, watch_thread, watch);
+    pthread_attr_destroy(&attr);
+    
+    if (result != 0) {
+        fprintf(stderr, "Failed to create watch thread: %s\n", strerror(result));
+        pthread_mutex_lock(&manager->watch_mutex);
+        manager->watches--;
+        pthread_mutex_unlock(&manager->watch_mutex);
+        __atomic_store_n(&info->watching, 0, __ATOMIC_RELEASE);
+        release_sync_info(info);
+        free(watch);
+    }
+}
+
+static void* enumerator_thread(void *arg) {
+    nfs_manager_t *manager = arg;
+    enumerator_t *enumerator = &manager->enumerator;
+    
+    while (1) {
+        pthread_mutex_lock(&enumerator->mutex);
+        while (!enumerator->head && !enumerator->shutdown) {
+            pthread_cond_wait(&enumerator->not_empty, &enumerator->mutex);
+        }
+        if (enumerator->shutdown) {
+            pthread_mutex_unlock(&enumerator->mutex);
+            break;
+        }
+        
+        enum_request_t *request = enumerator->head;
+        enumerator->head = request->next;
+        if (!enumerator->head) {
+            enumerator->tail = NULL;
+        }
+        pthread_mutex_unlock(&enumerator->mutex);
+        
+        sync_info_t *info = request->info;
+        free(request);
+        
+        // Cancelled while waiting: nothing to list
+        if (info->active) {
+            // Watch first, so that nothing changed during the listing is missed
+            if (info->options.watch) {
+                start_pair_watch(manager, info);
+            }
+            if (start_directory_sync(manager, info) != 0 && manager->logfile) {
+                log_message(manager->logfile, "Failed to start sync for %s@%s:%d",
+                           info->source_dir, info->source_host, info->source_port);
+            }
+        }
+        release_sync_info(info);
+    }
+    return NULL;
+}
+
+int start_enumerator(nfs_manager_t *manager) {
+    enumerator_t *enumerator = &manager->enumerator;
+    enumerator->thread_count = 0;
+    enumerator->head = NULL;
+    enumerator->tail = NULL;
+    enumerator->shutdown = 0;
+    
+    if (pthread_mutex_init(&enumerator->mutex, NULL) != 0) {
+        fprintf(stderr, "Failed to initialize enumerator mutex\n");
+        return -1;
+    }
+    if (pthread_cond_init(&enumerator->not_empty, NULL) != 0) {
+        fprintf(stderr, "Failed to initialize enumerator condition\n");
+        pthread_mutex_destroy(&enumerator->mutex);
+        return -1;
+    }
+    
+    for (int i = 0; i < ENUMERATOR_THREADS; i++) {
+        if (pthread_create(&enumerator->threads[i], NULL, enumerator_thread, manager) != 0) {
+            fprintf(stderr, "Failed to create enumerator thread %d\n", i);
+            break;
+        }
+        enumerator->thread_count++;
+    }
+    
+    if (enumerator->thread_count == 0) {
+        pthread_cond_destroy(&enumerator->not_empty);
+        pthread_mutex_destroy(&enumerator->mutex);
+        return -1;
+    }
+    return 0;
+}
+
+int request_enumeration(nfs_manager_t *manager, sync_info_t *info) {
+    enumerator_t *enumerator = &manager->enumerator;
+    if (enumerator->thread_count == 0) return -1;
+    
+    enum_request_t *request = malloc(sizeof(enum_request_t));
+    if (!request) {
+        fprintf(stderr, "Failed to allocate memory for enumeration request\n");
+        return -1;
+    }
+    request->info = retain_sync_info(info);
+    request->next = NULL;
+    
+    pthread_mutex_lock(&enumerator->mutex);
+    if (enumerator->shutdown) {
+        pthread_mutex_unlock(&enumerator->mutex);
+        release_sync_info(info);
+        free(request);
+        return -1;
+    }
+    if (enumerator->tail) {
+        enumerator->tail->next = request;
+    } else {
+        enumerator->head = request;
+    }
+    enumerator->tail = request;
+    pthread_cond_signal(&enumerator->not_empty);
+    pthread_mutex_unlock(&enumerator->mutex);
+    return 0;
+}
+
+void stop_enumerator(nfs_manager_t *manager) {
+    enumerator_t *enumerator = &manager->enumerator;
+    if (enumerator->thread_count == 0) return;
+    
+    pthread_mutex_lock(&enumerator->mutex);
+    enumerator->shutdown = 1;
+    pthread_cond_broadcast(&enumerator->not_empty);
+    pthread_mutex_unlock(&enumerator->mutex);
+    
+    for (int i = 0; i < enumerator->thread_count; i++) {
+        pthread_join(enumerator->threads[i], NULL);
+    }
+    enumerator->thread_count = 0;
+    
+    // Pairs never listed
+    while (enumerator->head) {
+        enum_request_t *request = enumerator->head;
+        enumerator->head = request->next;
+        release_sync_info(request->info);
+        free(request);
+    }
+    enumerator->tail = NULL;
+    
+    pthread_cond_destroy(&enumerator->not_empty);
+    pthread_mutex_destroy(&enumerator->mutex);
+}
+
+static void* metrics_thread(void *arg) {
+    nfs_manager_t *manager = arg;
+    
+    while (!manager->shutdown_requested && !shutdown_flag) {
+        struct pollfd pfd = { manager->metrics_sockfd, POLLIN, 0 };
+        int ready = poll(&pfd, 1, METRICS_POLL_MS);
+        if (ready < 0 && errno != EINTR) break;
+        if (ready <= 0) continue;
+        
+        int client_fd = accept(manager->metrics_sockfd, NULL, NULL);
+        if (client_fd < 0) continue;
+        serve_metrics_request(client_fd, manager->thread_pool, manager->sync_store);
+        close(client_fd);
+    }
+    return NULL;
+}
+
+int start_metrics_endpoint(nfs_manager_t *manager) {
+    manager->metrics_sockfd = create_server_socket(manager->metrics_port);
+    if (manager->metrics_sockfd < 0) {
+        return -1;
+    }
+    
+    if (pthread_create(&manager->metrics_thread, NULL, metrics_thread, manager) != 0) {
+        fprintf(stderr, "Failed to create metrics thread\n");
+        close(manager->metrics_sockfd);
+        manager->metrics_sockfd = -1;
+        return -1;
+    }
+    manager->metrics_started = 1;
+    
+    log_message(manager->logfile, "Serving metrics on port %d", manager->metrics_port);
+    return 0;
+}
+
+void stop_metrics_endpoint(nfs_manager_t *manager) {
+    if (manager->metrics_started) {
+        pthread_join(manager->metrics_thread, NULL);
+        manager->metrics_started = 0;
+    }
+    if (manager->metrics_sockfd >= 0) {
+        close(manager->metrics_sockfd);
+        manager->metrics_sockfd = -1;
+    }
+}
+
 void cleanup_manager(nfs_manager_t *manager) {
     if (!manager) return;
     
     printf("Cleaning up manager...\n");
     
+    // Console threads notice this within a second
+    manager->shutdown_requested = 1;
+    pthread_mutex_lock(&manager->console_mutex);
+    while (manager->consoles > 0) {
+        pthread_cond_wait(&manager->consoles_done, &manager->console_mutex);
+    }
+    pthread_mutex_unlock(&manager->console_mutex);
+    
+    // Scrapes read the pool and the store, which go away below
+    stop_metrics_endpoint(manager);
+    
+    // Enumerators blocked on a full queue return once the pool shuts down
+    if (manager->thread_pool) {
+        signal_shutdown(manager->thread_pool);
+    }
+    stop_enumerator(manager);
+    
+    // Watch threads notice shutdown within WATCH_POLL_MS, or at once when blocked on the queue
+    pthread_mutex_lock(&manager->watch_mutex);
+    while (manager->watches > 0) {
+        pthread_cond_wait(&manager->watches_done, &manager->watch_mutex);
+    }
+    pthread_mutex_unlock(&manager->watch_mutex);
+    
     if (manager->thread_pool) {
         printf("Shutting down thread pool...\n");
         destroy_thread_pool(manager->thread_pool);
         manager->thread_pool = NULL;
     }
     
+    // Jobs still queued were freed above and stay open for the next start
+    journal_close(g_journal);
+    g_journal = NULL;
+    
     if (manager->sync_store) {
         destroy_sync_info_store(manager->sync_store);
         manager->sync_store = NULL;
     }
     
+    // Workers are gone, nobody borrows sessions any more
+    if (manager->connection_pool) {
+        g_connection_pool = NULL;
+        destroy_connection_pool(manager->connection_pool);
+        manager->connection_pool = NULL;
+    }
+    
     if (manager->logfile) {
+        log_stop();  // Everything that logs has stopped by now
         fclose(manager->logfile);
         manager->logfile = NULL;
         g_worker_logfile = NULL;  // Clear global reference
@@ -482,5 +1647,8 @@ void cleanup_manager(nfs_manager_t *manager) {
         manager->config_file_path = NULL;
     }
     
+    free(manager->journal_path);
+    manager->journal_path = NULL;
+    
     printf("Manager cleanup complete.\n");
 }
\ No newline at end of file
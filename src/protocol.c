@@ -0,0 +1,258 @@
+#include "../include/protocol.h"
+#include <poll.h>
+#include <sys/uio.h>
+
+void put_u32(unsigned char *out, uint32_t value) {
+    out[0] = (unsigned char)(value >> 24);
+    out[1] = (unsigned char)(value >> 16);
+    out[2] = (unsigned char)(value >> 8);
+    out[3] = (unsigned char)value;
+}
+
+void put_u64(unsigned char *out, uint64_t value) {
+    put_u32(out, (uint32_t)(value >> 32));
+    put_u32(out + 4, (uint32_t)value);
+}
+
+uint32_t get_u32(const unsigned char *in) {
+    return ((uint32_t)in[0] << 24) | ((uint32_t)in[1] << 16) |
+           ((uint32_t)in[2] << 8) | (uint32_t)in[3];
+}
+
+uint64_t get_u64(const unsigned char *in) {
+    return ((uint64_t)get_u32(in) << 32) | get_u32(in + 4);
+}
+
+void encode_frame_header(const frame_header_t *header, unsigned char *out) {
+    out[0] = FRAME_MAGIC;
+    out[1] = header->opcode;
+    out[2] = (unsigned char)(header->flags >> 8);
+    out[3] = (unsigned char)header->flags;
+    put_u32(out + 4, header->stream_id);
+    put_u64(out + 8, header->length);
+}
+
+int decode_frame_header(const unsigned char *in, frame_header_t *header) {
+    if (in[0] != FRAME_MAGIC) {
+        return -1;
+    }
+    
+    header->opcode = in[1];
+    header->flags = (uint16_t)((in[2] << 8) | in[3]);
+    header->stream_id = get_u32(in + 4);
+    header->length = get_u64(in + 8);
+    return 0;
+}
+
+uint32_t next_stream_id(void) {
+    static uint32_t counter = 0;
+    return __sync_add_and_fetch(&counter, 1);
+}
+
+int send_frame(int sockfd, uint8_t opcode, uint32_t stream_id, const void *payload, size_t len) {
+    return send_frame_flags(sockfd, opcode, 0, stream_id, payload, len);
+}
+
+int send_frame_flags(int sockfd, uint8_t opcode, uint16_t flags, uint32_t stream_id,
+                     const void *payload, size_t len) {
+    frame_header_t header = { opcode, flags, stream_id, len };
+    unsigned char encoded[FRAME_HEADER_SIZE];
+    encode_frame_header(&header, encoded);
+    
+    struct iovec iov[2];
+    iov[0].iov_base = encoded;
+    iov[0].iov_len = sizeof(encoded);
+    iov[1].iov_base = (void*)payload;
+    iov[1].iov_len = payload ? len : 0;
+    
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iov;
+    msg.msg_iovlen = 2;
+    
+    size_t remaining = iov[0].iov_len + iov[1].iov_len;
+    while (remaining > 0) {
+        ssize_t sent = sendmsg(sockfd, &msg, 0);
+        if (sent < 0) {
+            if (errno == EINTR) continue;
+            fprintf(stderr, "Error sending frame: %s\n", strerror(errno));
+            return -1;
+        }
+        remaining -= sent;
+        
+        // Advance past what was sent after a partial write
+        while (sent > 0 && msg.msg_iovlen > 0) {
+            if ((size_t)sent >= msg.msg_iov[0].iov_len) {
+                sent -= msg.msg_iov[0].iov_len;
+                msg.msg_iov++;
+                msg.msg_iovlen--;
+            } else {
+                msg.msg_iov[0].iov_base = (char*)msg.msg_iov[0].iov_base + sent;
+                msg.msg_iov[0].iov_len -= sent;
+                sent = 0;
+            }
+        }
+    }
+    return 0;
+}
+
+int send_frame_header(int sockfd, uint8_t opcode, uint32_t stream_id, uint64_t len) {
+    return send_frame_header_flags(sockfd, opcode, 0, stream_id, len);
+}
+
+int send_frame_header_flags(int sockfd, uint8_t opcode, uint16_t flags, uint32_t stream_id, uint64_t len) {
+    frame_header_t header = { opcode, flags, stream_id, len };
+    unsigned char encoded[FRAME_HEADER_SIZE];
+    encode_frame_header(&header, encoded);
+    
+    size_t sent_total = 0;
+    while (sent_total < sizeof(encoded)) {
+        // MSG_MORE: the payload follows right away, let it share the segment
+        ssize_t sent = send(sockfd, encoded + sent_total, sizeof(encoded) - sent_total, MSG_MORE);
+        if (sent < 0) {
+            if (errno == EINTR) continue;
+            fprintf(stderr, "Error sending frame header: %s\n", strerror(errno));
+            return -1;
+        }
+        sent_total += sent;
+    }
+    return 0;
+}
+
+int read_frame_header(buffered_reader_t *reader, frame_header_t *header) {
+    unsigned char encoded[FRAME_HEADER_SIZE];
+    if (reader_read_exact(reader, encoded, sizeof(encoded)) != 0) {
+        return -1;
+    }
+    if (decode_frame_header(encoded, header) != 0) {
+        fprintf(stderr, "Invalid frame magic 0x%02x\n", encoded[0]);
+        return -1;
+    }
+    return 0;
+}
+
+int recv_frame_header(int sockfd, frame_header_t *header) {
+    unsigned char encoded[FRAME_HEADER_SIZE];
+    if (recv_exact(sockfd, encoded, sizeof(encoded)) != 0) {
+        return -1;
+    }
+    if (decode_frame_header(encoded, header) != 0) {
+        fprintf(stderr, "Invalid frame magic 0x%02x\n", encoded[0]);
+        return -1;
+    }
+    return 0;
+}
+
+int send_end_frame(int sockfd, uint32_t stream_id, uint64_t size, int64_t mtime) {
+    unsigned char payload[END_PAYLOAD_SIZE];
+    put_u64(payload, size);
+    put_u64(payload + 8, (uint64_t)mtime);
+    return send_frame(sockfd, FRAME_END, stream_id, payload, sizeof(payload));
+}
+
+int send_error_frame(int sockfd, uint32_t stream_id, const char *format, ...) {
+    char message[MAX_COMMAND_SIZE];
+    va_list args;
+    va_start(args, format);
+    int len = vsnprintf(message, sizeof(message), format, args);
+    va_end(args);
+    
+    if (len < 0) len = 0;
+    if ((size_t)len >= sizeof(message)) len = sizeof(message) - 1;
+    return send_frame(sockfd, FRAME_ERROR, stream_id, message, len);
+}
+
+// Names of the optional features, in the order HELLO and its reply list them
+static const struct {
+    uint32_t flag;
+    const char *name;
+} g_features[] = {
+    { FEATURE_ZLIB, FEATURE_ZLIB_NAME },
+    { FEATURE_BATCH, FEATURE_BATCH_NAME },
+    { FEATURE_TREE, FEATURE_TREE_NAME },
+    { FEATURE_PART, FEATURE_PART_NAME },
+};
+
+// Append " <name>" for every feature in features
+static void format_feature_list(uint32_t features, char *buffer, size_t size) {
+    size_t len = strlen(buffer);
+    for (size_t i = 0; i < sizeof(g_features) / sizeof(g_features[0]) && len < size; i++) {
+        if (features & g_features[i].flag) {
+            len += snprintf(buffer + len, size - len, " %s", g_features[i].name);
+        }
+    }
+}
+
+int negotiate_protocol(int sockfd, uint32_t *features) {
+    if (features) *features = 0;
+    
+    // Offered as a PULL so a version 1 client answers it with an error
+    char hello[96];
+    snprintf(hello, sizeof(hello), "%s %d", CMD_HELLO_PULL, PROTOCOL_VERSION);
+    format_feature_list(FEATURES_SUPPORTED, hello, sizeof(hello) - 1);
+    strcat(hello, "\n");
+    if (send_command(sockfd, hello) != 0) {
+        return -1;
+    }
+    
+    struct pollfd pfd = { sockfd, POLLIN, 0 };
+    int ready;
+    do {
+        ready = poll(&pfd, 1, NEGOTIATE_TIMEOUT_MS);
+    } while (ready < 0 && errno == EINTR);
+    
+    if (ready < 0) return -1;
+    if (ready == 0) {
+        // Every client answers the probe: silence is a busy or stuck one
+        errno = ETIMEDOUT;
+        return -1;
+    }
+    
+    // Read the reply line byte by byte, stopping as soon as it is not "OK "
+    const char *ok = "OK ";
+    char reply[64];
+    size_t len = 0;
+    while (len < sizeof(reply) - 1) {
+        char c;
+        ssize_t received = recv(sockfd, &c, 1, 0);
+        if (received < 0 && errno == EINTR) continue;
+        if (received <= 0) return -1;
+        if (c == '\n') break;
+        if (len < strlen(ok) && c != ok[len]) return 1; // Rest of a v1 reply unread
+        reply[len++] = c;
+    }
+    reply[len] = '\0';
+    
+    int version, consumed = 0;
+    if (sscanf(reply, "OK %d%n", &version, &consumed) != 1 || version < 1) {
+        return 1;
+    }
+    if (features) *features = parse_feature_list(reply + consumed) & FEATURES_SUPPORTED;
+    return version > PROTOCOL_VERSION ? PROTOCOL_VERSION : version;
+}
+
+uint32_t parse_feature_list(const char *text) {
+    uint32_t features = 0;
+    if (!text) return 0;
+    
+    char copy[MAX_COMMAND_SIZE];
+    strncpy(copy, text, sizeof(copy) - 1);
+    copy[sizeof(copy) - 1] = '\0';
+    
+    char *saveptr = NULL;
+    for (char *word = strtok_r(copy, " \t\r\n", &saveptr); word;
+         word = strtok_r(NULL, " \t\r\n", &saveptr)) {
+        for (size_t i = 0; i < sizeof(g_features) / sizeof(g_features[0]); i++) {
+            if (strcmp(word, g_features[i].name) == 0) features |= g_features[i].flag;
+        }
+    }
+    return features;
+}
+
+void format_hello_reply(int version, uint32_t features, char *buffer, size_t size) {
+    snprintf(buffer, size, "OK %d", version);
+    if (version >= 2) {
+        format_feature_list(features, buffer, size - 1);
+    }
+    strcat(buffer, "\n");
+}
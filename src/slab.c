@@ -0,0 +1,101 @@
+#include "../include/slab.h"
+
+// Slab header size, keeps the first object aligned
+#define SLAB_HEADER SLAB_ALIGN
+
+static size_t stride_of(const slab_pool_t *pool) {
+    size_t size = pool->object_size < sizeof(void*) ? sizeof(void*) : pool->object_size;
+    return (size + SLAB_ALIGN - 1) & ~(size_t)(SLAB_ALIGN - 1);
+}
+
+// Free every slab. Mutex held
+static void free_slabs(slab_pool_t *pool) {
+    void *slab = pool->slabs;
+    while (slab) {
+        void *next = *(void**)slab;
+        free(slab);
+        slab = next;
+    }
+    pool->slabs = NULL;
+    pool->free_list = NULL;
+    pool->slab_count = 0;
+}
+
+int slab_pool_init(slab_pool_t *pool, size_t object_size) {
+    if (!pool || object_size == 0) return -1;
+    
+    pool->object_size = object_size;
+    pool->free_list = NULL;
+    pool->slabs = NULL;
+    pool->slab_count = 0;
+    pool->in_use = 0;
+    
+    if (pthread_mutex_init(&pool->mutex, NULL) != 0) {
+        fprintf(stderr, "Failed to initialize slab pool mutex: %s\n", strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+void slab_pool_destroy(slab_pool_t *pool) {
+    if (!pool) return;
+    
+    pthread_mutex_lock(&pool->mutex);
+    free_slabs(pool);
+    pthread_mutex_unlock(&pool->mutex);
+    pthread_mutex_destroy(&pool->mutex);
+}
+
+int slab_pool_release(slab_pool_t *pool) {
+    if (!pool) return -1;
+    
+    pthread_mutex_lock(&pool->mutex);
+    int result = -1;
+    if (pool->in_use == 0) {
+        free_slabs(pool);
+        result = 0;
+    }
+    pthread_mutex_unlock(&pool->mutex);
+    return result;
+}
+
+void* slab_alloc(slab_pool_t *pool) {
+    pthread_mutex_lock(&pool->mutex);
+    
+    if (!pool->free_list) {
+        size_t stride = stride_of(pool);
+        char *slab = malloc(SLAB_HEADER + stride * SLAB_OBJECTS);
+        if (!slab) {
+            pthread_mutex_unlock(&pool->mutex);
+            fprintf(stderr, "Failed to allocate memory for slab\n");
+            return NULL;
+        }
+        *(void**)slab = pool->slabs;
+        pool->slabs = slab;
+        pool->slab_count++;
+        
+        // Thread the new objects onto the free list, first one on top
+        for (size_t i = SLAB_OBJECTS; i-- > 0; ) {
+            void *object = slab + SLAB_HEADER + i * stride;
+            *(void**)object = pool->free_list;
+            pool->free_list = object;
+        }
+    }
+    
+    void *object = pool->free_list;
+    pool->free_list = *(void**)object;
+    pool->in_use++;
+    
+    pthread_mutex_unlock(&pool->mutex);
+    return object;
+}
+
+void slab_free(slab_pool_t *pool, void *object) {
+    if (!object) return;
+    
+    pthread_mutex_lock(&pool->mutex);
+    *(void**)object = pool->free_list;
+    pool->free_list = object;
+    pool->in_use--;
+    pthread_mutex_unlock(&pool->mutex);
+}
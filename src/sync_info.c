@@ -1,4 +1,54 @@
 #include "../include/sync_info.h"
+#include "../include/manifest.h"
+
+// Bucket index of a source, mask with bucket_count - 1
+static size_t hash_source(const char *source_host, int source_port, const char *source_dir) {
+    unsigned char port[4];
+    port[0] = (unsigned char)(source_port >> 24);
+    port[1] = (unsigned char)(source_port >> 16);
+    port[2] = (unsigned char)(source_port >> 8);
+    port[3] = (unsigned char)source_port;
+    
+    // Separators keep "ab"+"c" and "a"+"bc" apart
+    uint64_t hash = fnv1a_update(FNV1A_INIT, source_host, strlen(source_host) + 1);
+    hash = fnv1a_update(hash, port, sizeof(port));
+    hash = fnv1a_update(hash, source_dir, strlen(source_dir));
+    return (size_t)hash;
+}
+
+static int same_source(const sync_info_t *info, const char *source_host, int source_port, const char *source_dir) {
+    return info->source_port == source_port &&
+           strcmp(info->source_host, source_host) == 0 &&
+           strcmp(info->source_dir, source_dir) == 0;
+}
+
+// Must be called with the store lock held
+static sync_info_t** find_slot(sync_info_store_t *store, const char *source_host, int source_port,
+                               const char *source_dir) {
+    size_t bucket = hash_source(source_host, source_port, source_dir) & (store->bucket_count - 1);
+    sync_info_t **slot = &store->buckets[bucket];
+    while (*slot && !same_source(*slot, source_host, source_port, source_dir)) {
+        slot = &(*slot)->hash_next;
+    }
+    return slot;
+}
+
+// Double the bucket array once pairs outnumber buckets. Write lock held
+static void grow_buckets(sync_info_store_t *store) {
+    size_t bucket_count = store->bucket_count * 2;
+    sync_info_t **buckets = calloc(bucket_count, sizeof(sync_info_t*));
+    if (!buckets) return; // Keep the longer chains
+    
+    // Rehash in list order, the chains do not need to keep theirs
+    for (sync_info_t *info = store->head; info; info = info->next) {
+        size_t bucket = hash_source(info->source_host, info->source_port, info->source_dir) & (bucket_count - 1);
+        info->hash_next = buckets[bucket];
+        buckets[bucket] = info;
+    }
+    free(store->buckets);
+    store->buckets = buckets;
+    store->bucket_count = bucket_count;
+}
 
 sync_info_store_t* create_sync_info_store(void) {
     sync_info_store_t *store = malloc(sizeof(sync_info_store_t));
@@ -9,9 +59,18 @@ sync_info_store_t* create_sync_info_store(void) {
     
     store->head = NULL;
     store->count = 0;
+    store->next_id = 1;
+    store->bucket_count = SYNC_STORE_BUCKETS;
+    store->buckets = calloc(store->bucket_count, sizeof(sync_info_t*));
+    if (!store->buckets) {
+        fprintf(stderr, "Failed to allocate memory for sync info store buckets\n");
+        free(store);
+        return NULL;
+    }
     
-    if (pthread_mutex_init(&store->mutex, NULL) != 0) {
-        fprintf(stderr, "Failed to initialize sync info store mutex: %s\n", strerror(errno));
+    if (pthread_rwlock_init(&store->lock, NULL) != 0) {
+        fprintf(stderr, "Failed to initialize sync info store lock: %s\n", strerror(errno));
+        free(store->buckets);
         free(store);
         return NULL;
     }
@@ -22,18 +81,19 @@ sync_info_store_t* create_sync_info_store(void) {
 void destroy_sync_info_store(sync_info_store_t *store) {
     if (!store) return;
     
-    pthread_mutex_lock(&store->mutex);
+    pthread_rwlock_wrlock(&store->lock);
     
     // Free all sync info entries
     sync_info_t *current = store->head;
     while (current) {
         sync_info_t *next = current->next;
-        free_sync_info(current);
+        release_sync_info(current);
         current = next;
     }
     
-    pthread_mutex_unlock(&store->mutex);
-    pthread_mutex_destroy(&store->mutex);
+    pthread_rwlock_unlock(&store->lock);
+    pthread_rwlock_destroy(&store->lock);
+    free(store->buckets);
     free(store);
 }
 
@@ -68,43 +128,73 @@ sync_info_t* create_sync_info(const char *source_host, int source_port, const ch
     info->active = 1;
     info->last_sync_time = time(NULL);
     info->error_count = 0;
+    info->bytes_synced = 0;
+    info->files_synced = 0;
+    init_sync_options(&info->options);
+    memset(&info->bucket, 0, sizeof(info->bucket));
+    info->capped[0] = info->capped[1] = NULL;
+    info->limited[0] = info->limited[1] = NULL;
+    info->throttle_generation = 0;
+    info->manifest = NULL;  // Created on first incremental sync
+    info->id = 0;
+    info->refcount = 1;
+    info->watching = 0;
+    info->queue = NULL;
     info->next = NULL;
+    info->prev = NULL;
+    info->hash_next = NULL;
     
     return info;
 }
 
 void free_sync_info(sync_info_t *info) {
     if (info) {
+        destroy_manifest(info->manifest);
         free(info);
     }
 }
 
+sync_info_t* retain_sync_info(sync_info_t *info) {
+    __atomic_add_fetch(&info->refcount, 1, __ATOMIC_RELAXED);
+    return info;
+}
+
+void release_sync_info(sync_info_t *info) {
+    if (info && __atomic_sub_fetch(&info->refcount, 1, __ATOMIC_ACQ_REL) == 0) {
+        free_sync_info(info);
+    }
+}
+
 int add_sync_info(sync_info_store_t *store, sync_info_t *info) {
     if (!store || !info) {
         return -1;
     }
     
-    pthread_mutex_lock(&store->mutex);
+    pthread_rwlock_wrlock(&store->lock);
     
     // Check if entry already exists
-    sync_info_t *current = store->head;
-    while (current) {
-        if (strcmp(current->source_host, info->source_host) == 0 &&
-            current->source_port == info->source_port &&
-            strcmp(current->source_dir, info->source_dir) == 0) {
-            // Already exists
-            pthread_mutex_unlock(&store->mutex);
-            return 1;
-        }
-        current = current->next;
+    sync_info_t **slot = find_slot(store, info->source_host, info->source_port, info->source_dir);
+    if (*slot) {
+        pthread_rwlock_unlock(&store->lock);
+        return 1;
     }
     
-    // Add to front of list
+    // Append to the bucket, add to front of list
+    info->id = store->next_id++;
+    info->hash_next = NULL;
+    *slot = info;
+    info->prev = NULL;
     info->next = store->head;
+    if (store->head) {
+        store->head->prev = info;
+    }
     store->head = info;
-    store->count++;
     
-    pthread_mutex_unlock(&store->mutex);
+    if ((size_t)++store->count > store->bucket_count) {
+        grow_buckets(store);
+    }
+    
+    pthread_rwlock_unlock(&store->lock);
     return 0;
 }
 
@@ -113,21 +203,10 @@ sync_info_t* find_sync_info(sync_info_store_t *store, const char *source_host, i
         return NULL;
     }
     
-    pthread_mutex_lock(&store->mutex);
-    
-    sync_info_t *current = store->head;
-    while (current) {
-        if (strcmp(current->source_host, source_host) == 0 &&
-            current->source_port == source_port &&
-            strcmp(current->source_dir, source_dir) == 0) {
-            pthread_mutex_unlock(&store->mutex);
-            return current;
-        }
-        current = current->next;
-    }
-    
-    pthread_mutex_unlock(&store->mutex);
-    return NULL;
+    pthread_rwlock_rdlock(&store->lock);
+    sync_info_t *info = *find_slot(store, source_host, source_port, source_dir);
+    pthread_rwlock_unlock(&store->lock);
+    return info;
 }
 
 int remove_sync_info(sync_info_store_t *store, const char *source_host, int source_port, const char *source_dir) {
@@ -135,36 +214,31 @@ int remove_sync_info(sync_info_store_t *store, const char *source_host, int sour
         return -1;
     }
     
-    pthread_mutex_lock(&store->mutex);
+    pthread_rwlock_wrlock(&store->lock);
     
-    sync_info_t *current = store->head;
-    sync_info_t *prev = NULL;
+    sync_info_t **slot = find_slot(store, source_host, source_port, source_dir);
+    sync_info_t *info = *slot;
+    if (!info) {
+        pthread_rwlock_unlock(&store->lock);
+        return 1; // Not found
+    }
     
-    while (current) {
-        if (strcmp(current->source_host, source_host) == 0 &&
-            current->source_port == source_port &&
-            strcmp(current->source_dir, source_dir) == 0) {
-            
-            // Remove from list
-            if (prev) {
-                prev->next = current->next;
-            } else {
-                store->head = current->next;
-            }
-            
-            store->count--;
-            free_sync_info(current);
-            
-            pthread_mutex_unlock(&store->mutex);
-            return 0;
-        }
-        
-        prev = current;
-        current = current->next;
+    // Remove from bucket and list
+    *slot = info->hash_next;
+    if (info->prev) {
+        info->prev->next = info->next;
+    } else {
+        store->head = info->next;
     }
+    if (info->next) {
+        info->next->prev = info->prev;
+    }
+    
+    store->count--;
+    release_sync_info(info);
     
-    pthread_mutex_unlock(&store->mutex);
-    return 1; // Not found
+    pthread_rwlock_unlock(&store->lock);
+    return 0;
 }
 
 int deactivate_sync_info(sync_info_store_t *store, const char *source_host, int source_port, const char *source_dir) {
@@ -172,16 +246,15 @@ int deactivate_sync_info(sync_info_store_t *store, const char *source_host, int
         return -1;
     }
     
-    sync_info_t *info = find_sync_info(store, source_host, source_port, source_dir);
-    if (!info) {
-        return 1; // Not found
+    // One lookup; readers of active do not take the store lock anyway
+    pthread_rwlock_rdlock(&store->lock);
+    sync_info_t *info = *find_slot(store, source_host, source_port, source_dir);
+    if (info) {
+        __atomic_store_n(&info->active, 0, __ATOMIC_RELEASE);
     }
+    pthread_rwlock_unlock(&store->lock);
     
-    pthread_mutex_lock(&store->mutex);
-    info->active = 0;
-    pthread_mutex_unlock(&store->mutex);
-    
-    return 0;
+    return info ? 0 : 1;
 }
 
 void print_sync_info_store(sync_info_store_t *store) {
@@ -190,7 +263,7 @@ void print_sync_info_store(sync_info_store_t *store) {
         return;
     }
     
-    pthread_mutex_lock(&store->mutex);
+    pthread_rwlock_rdlock(&store->lock);
     
     printf("=== Sync Info Store (Count: %d) ===\n", store->count);
     
@@ -220,15 +293,25 @@ void print_sync_info_store(sync_info_store_t *store) {
     
     printf("=====================================\n");
     
-    pthread_mutex_unlock(&store->mutex);
+    pthread_rwlock_unlock(&store->lock);
 }
 
 int get_sync_info_count(sync_info_store_t *store) {
     if (!store) return 0;
     
-    pthread_mutex_lock(&store->mutex);
+    pthread_rwlock_rdlock(&store->lock);
     int count = store->count;
-    pthread_mutex_unlock(&store->mutex);
+    pthread_rwlock_unlock(&store->lock);
     
     return count;
-}
\ No newline at end of file
+}
+
+void for_each_sync_info(sync_info_store_t *store, sync_info_visit_fn visit, void *ctx) {
+    if (!store || !visit) return;
+    
+    pthread_rwlock_rdlock(&store->lock);
+    for (sync_info_t *info = store->head; info; info = info->next) {
+        visit(info, ctx);
+    }
+    pthread_rwlock_unlock(&store->lock);
+}
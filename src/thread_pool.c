@@ -1,8 +1,86 @@
 #include "../include/thread_pool.h"
 #include "../include/common.h"
+#include "../include/protocol.h"
+#include "../include/connection_pool.h"
+#include "../include/sync_info.h"
+#include "../include/slab.h"
+#include "../include/log.h"
+#include "../include/metrics.h"
+#include "../include/throttle.h"
+#include "../include/journal.h"
+#include <limits.h>
+#include <poll.h>
 
 // Global log file for worker threads to use
 extern FILE *g_worker_logfile;
+extern connection_pool_t *g_connection_pool;
+extern journal_t *g_journal;
+
+static transfer_engine_t g_transfer_engine = TRANSFER_ENGINE_SPLICE;
+static job_queue_type_t g_job_queue_type = JOB_QUEUE_LIST;
+
+// Jobs are recycled through one slab pool shared by all thread pools
+static slab_pool_t g_job_slab = SLAB_POOL_INITIALIZER(sizeof(sync_job_t));
+
+// Index of the calling thread in pool->workers, -1 outside workers
+static __thread int t_worker_index = -1;
+static __thread worker_stats_t *t_worker_stats = NULL;
+
+// Buffer ring of the pipeline engine, see set_relay_buffers()
+static size_t g_relay_buffer_size = RELAY_BUFFER_DEFAULT;
+static int g_relay_depth = RELAY_DEPTH_DEFAULT;
+static __thread char *t_relay_ring = NULL;
+static __thread size_t t_relay_ring_size = 0;
+
+static worker_queue_t* create_worker_queues(int count) {
+    worker_queue_t *queues = calloc(count, sizeof(worker_queue_t));
+    if (!queues) {
+        fprintf(stderr, "Failed to allocate memory for worker queues\n");
+        return NULL;
+    }
+    
+    for (int i = 0; i < count; i++) {
+        if (pthread_mutex_init(&queues[i].mutex, NULL) != 0 ||
+            pthread_cond_init(&queues[i].wake, NULL) != 0) {
+            fprintf(stderr, "Failed to initialize worker queue %d\n", i);
+            // The failed slot may hold an initialized mutex
+            pthread_mutex_destroy(&queues[i].mutex);
+            for (int j = 0; j < i; j++) {
+                pthread_cond_destroy(&queues[j].wake);
+                pthread_mutex_destroy(&queues[j].mutex);
+            }
+            free(queues);
+            return NULL;
+        }
+    }
+    return queues;
+}
+
+// Free ring or worker queues; queued jobs must be gone already
+static void destroy_job_buffers(thread_pool_t *pool) {
+    destroy_job_ring(pool->ring);
+    pool->ring = NULL;
+    
+    if (pool->workers) {
+        for (int i = 0; i < pool->thread_count; i++) {
+            pthread_cond_destroy(&pool->workers[i].wake);
+            pthread_mutex_destroy(&pool->workers[i].mutex);
+        }
+        free(pool->workers);
+        pool->workers = NULL;
+    }
+}
+
+// Wake every worker for shutdown. Caller holds queue_mutex
+static void wake_all_workers(thread_pool_t *pool) {
+    pthread_cond_broadcast(&pool->queue_not_empty);
+    pthread_cond_broadcast(&pool->queue_not_full);
+    if (pool->workers) {
+        for (int i = 0; i < pool->thread_count; i++) {
+            pthread_cond_broadcast(&pool->workers[i].wake);
+        }
+    }
+}
 
 thread_pool_t* create_thread_pool(int thread_count, int buffer_size) {
     thread_pool_t *pool = malloc(sizeof(thread_pool_t));
@@ -12,22 +90,49 @@ thread_pool_t* create_thread_pool(int thread_count, int buffer_size) {
     }
     
     pool->threads = malloc(sizeof(pthread_t) * thread_count);
-    if (!pool->threads) {
+    pool->stats = calloc(thread_count, sizeof(worker_stats_t));
+    if (!pool->threads || !pool->stats) {
         fprintf(stderr, "Failed to allocate memory for threads\n");
+        free(pool->stats);
+        free(pool->threads);
         free(pool);
         return NULL;
     }
     
     pool->thread_count = thread_count;
     pool->buffer_size = buffer_size;
-    pool->job_queue_head = NULL;
-    pool->job_queue_tail = NULL;
+    pool->current_pair = NULL;
     pool->queue_size = 0;
+    pool->ring = NULL;
+    pool->workers = NULL;
+    pool->next_worker = 0;
+    pool->waiting_consumers = 0;
+    pool->waiting_producers = 0;
     pool->shutdown = 0;
     
+    if (g_job_queue_type == JOB_QUEUE_RING) {
+        pool->ring = create_job_ring(buffer_size);
+        if (!pool->ring) {
+            free(pool->stats);
+            free(pool->threads);
+            free(pool);
+            return NULL;
+        }
+    } else if (g_job_queue_type == JOB_QUEUE_STEAL) {
+        pool->workers = create_worker_queues(thread_count);
+        if (!pool->workers) {
+            free(pool->stats);
+            free(pool->threads);
+            free(pool);
+            return NULL;
+        }
+    }
+    
     // Initialize synchronization primitives
     if (pthread_mutex_init(&pool->queue_mutex, NULL) != 0) {
         fprintf(stderr, "Failed to initialize queue mutex\n");
+        destroy_job_buffers(pool);
+        free(pool->stats);
         free(pool->threads);
         free(pool);
         return NULL;
@@ -36,6 +141,8 @@ thread_pool_t* create_thread_pool(int thread_count, int buffer_size) {
     if (pthread_cond_init(&pool->queue_not_empty, NULL) != 0) {
         fprintf(stderr, "Failed to initialize queue_not_empty condition\n");
         pthread_mutex_destroy(&pool->queue_mutex);
+        destroy_job_buffers(pool);
+        free(pool->stats);
         free(pool->threads);
         free(pool);
         return NULL;
@@ -45,6 +152,8 @@ thread_pool_t* create_thread_pool(int thread_count, int buffer_size) {
         fprintf(stderr, "Failed to initialize queue_not_full condition\n");
         pthread_cond_destroy(&pool->queue_not_empty);
         pthread_mutex_destroy(&pool->queue_mutex);
+        destroy_job_buffers(pool);
+        free(pool->stats);
         free(pool->threads);
         free(pool);
         return NULL;
@@ -55,32 +164,53 @@ thread_pool_t* create_thread_pool(int thread_count, int buffer_size) {
         if (pthread_create(&pool->threads[i], NULL, worker_thread, pool) != 0) {
             fprintf(stderr, "Failed to create worker thread %d\n", i);
             // Signal shutdown and wait for created threads to finish
+            pthread_mutex_lock(&pool->queue_mutex);
             pool->shutdown = 1;
-            pthread_cond_broadcast(&pool->queue_not_empty);
+            wake_all_workers(pool);
+            pthread_mutex_unlock(&pool->queue_mutex);
             for (int j = 0; j < i; j++) {
                 pthread_join(pool->threads[j], NULL);
             }
             pthread_cond_destroy(&pool->queue_not_full);
             pthread_cond_destroy(&pool->queue_not_empty);
             pthread_mutex_destroy(&pool->queue_mutex);
+            destroy_job_buffers(pool);
+            free(pool->stats);
             free(pool->threads);
             free(pool);
             return NULL;
         }
     }
     
-    printf("Created thread pool with %d workers\n", thread_count);
+    if (pool->ring) {
+        printf("Created thread pool with %d workers and a %zu-job ring\n",
+               thread_count, job_ring_capacity(pool->ring));
+    } else if (pool->workers) {
+        printf("Created thread pool with %d work-stealing workers\n", thread_count);
+    } else {
+        printf("Created thread pool with %d workers\n", thread_count);
+    }
     return pool;
 }
 
+// Take an empty pair queue out of the round and free it. Mutex held
+static void leave_round(thread_pool_t *pool, pair_queue_t *queue) {
+    if (pool->current_pair == queue) {
+        pool->current_pair = queue->next != queue ? queue->next : NULL;
+    }
+    queue->prev->next = queue->next;
+    queue->next->prev = queue->prev;
+    queue->info->queue = NULL;
+    free(queue);
+}
+
 void destroy_thread_pool(thread_pool_t *pool) {
     if (!pool) return;
     
     // Signal shutdown first
     pthread_mutex_lock(&pool->queue_mutex);
     pool->shutdown = 1;
-    pthread_cond_broadcast(&pool->queue_not_empty);
-    pthread_cond_broadcast(&pool->queue_not_full);
+    wake_all_workers(pool);
     pthread_mutex_unlock(&pool->queue_mutex);
     
     // Wait for all workers to finish
@@ -90,11 +220,29 @@ void destroy_thread_pool(thread_pool_t *pool) {
     
     // Clean up remaining jobs in queue
     pthread_mutex_lock(&pool->queue_mutex);
-    while (pool->job_queue_head) {
-        sync_job_t *job = pool->job_queue_head;
-        pool->job_queue_head = job->next;
-        free_sync_job(job);
+    while (pool->current_pair) {
+        pair_queue_t *queue = pool->current_pair;
+        while (queue->head) {
+            sync_job_t *job = queue->head;
+            queue->head = job->next;
+            free_sync_job(job);
+        }
+        leave_round(pool, queue);
+    }
+    if (pool->ring) {
+        sync_job_t *job;
+        while ((job = job_ring_pop(pool->ring)) != NULL) {
+            free_sync_job(job);
+        }
+    }
+    for (int i = 0; pool->workers && i < pool->thread_count; i++) {
+        while (pool->workers[i].head) {
+            sync_job_t *job = pool->workers[i].head;
+            pool->workers[i].head = job->next;
+            free_sync_job(job);
+        }
     }
+    destroy_job_buffers(pool);
     pthread_mutex_unlock(&pool->queue_mutex);
     
     // Destroy synchronization primitives
@@ -104,298 +252,1837 @@ void destroy_thread_pool(thread_pool_t *pool) {
     
     free(pool->threads);
     free(pool);
+    
+    // Hand job slabs back unless jobs outlive the pool
+    slab_pool_release(&g_job_slab);
 }
 
-sync_job_t* create_sync_job(const char *source_host, int source_port, const char *source_dir,
-                           const char *target_host, int target_port, const char *target_dir,
-                           const char *filename) {
-    sync_job_t *job = malloc(sizeof(sync_job_t));
+sync_job_t* create_sync_job(sync_info_t *info, const char *filename) {
+    if (!info || !filename) return NULL;
+    
+    sync_job_t *job = slab_alloc(&g_job_slab);
     if (!job) {
         fprintf(stderr, "Failed to allocate memory for sync job\n");
         return NULL;
     }
     
-    strncpy(job->source_host, source_host, MAX_HOST_SIZE - 1);
-    job->source_host[MAX_HOST_SIZE - 1] = '\0';
-    job->source_port = source_port;
-    strncpy(job->source_dir, source_dir, MAX_PATH - 1);
-    job->source_dir[MAX_PATH - 1] = '\0';
-    
-    strncpy(job->target_host, target_host, MAX_HOST_SIZE - 1);
-    job->target_host[MAX_HOST_SIZE - 1] = '\0';
-    job->target_port = target_port;
-    strncpy(job->target_dir, target_dir, MAX_PATH - 1);
-    job->target_dir[MAX_PATH - 1] = '\0';
-    
-    strncpy(job->filename, filename, MAX_FILENAME - 1);
-    job->filename[MAX_FILENAME - 1] = '\0';
+    // Short names live in the job, longer ones get their own allocation
+    size_t name_len = strnlen(filename, MAX_FILENAME - 1);
+    if (name_len < sizeof(job->name_inline)) {
+        job->filename = job->name_inline;
+    } else {
+        job->filename = malloc(name_len + 1);
+        if (!job->filename) {
+            fprintf(stderr, "Failed to allocate memory for sync job\n");
+            slab_free(&g_job_slab, job);
+            return NULL;
+        }
+    }
+    memcpy(job->filename, filename, name_len);
+    job->filename[name_len] = '\0';
     
+    job->info = retain_sync_info(info);
+    job->delta_block_size = 0;
+    job->range_offset = 0;
+    job->range_length = 0;
+    job->group = NULL;
+    job->batch = NULL;
+    job->enqueued_us = 0;
+    job->journal_id = 0;
+    job->mtime = 0;
     job->next = NULL;
     
     return job;
 }
 
+static void free_file_batch(file_batch_t *batch) {
+    if (batch) {
+        free(batch->names);
+        free(batch);
+    }
+}
+
 void free_sync_job(sync_job_t *job) {
     if (job) {
-        free(job);
+        // Nobody will commit a file whose ranges are dropped unprocessed
+        if (job->group && finish_range(job->group, 0)) {
+            free_range_group(job->group);
+        }
+        // Dropped with its cancelled pair; left open at shutdown, to resume on restart
+        if (job->journal_id && !__atomic_load_n(&job->info->active, __ATOMIC_RELAXED)) {
+            journal_done(g_journal, job->journal_id);
+        }
+        free_file_batch(job->batch);
+        if (job->filename != job->name_inline) {
+            free(job->filename);
+        }
+        release_sync_info(job->info);
+        slab_free(&g_job_slab, job);
     }
 }
 
-int enqueue_sync_job(thread_pool_t *pool, sync_job_t *job) {
-    if (!pool || !job) return -1;
+// Group ids only need to differ between transfers of one file that may overlap; 0 means none
+static uint64_t next_range_group_id(void) {
+    static uint64_t counter = 0;
+    uint64_t sequence = __atomic_add_fetch(&counter, 1, __ATOMIC_RELAXED);
+    uint64_t id = ((uint64_t)time(NULL) << 32) ^ ((uint64_t)getpid() << 16) ^ sequence;
+    return id ? id : 1;
+}
+
+range_group_t* create_range_group(int64_t size, int64_t mtime, int ranges) {
+    range_group_t *group = malloc(sizeof(range_group_t));
+    if (!group) {
+        fprintf(stderr, "Failed to allocate memory for range group\n");
+        return NULL;
+    }
     
-    pthread_mutex_lock(&pool->queue_mutex);
+    group->pending = ranges;
+    group->ranges = ranges;
+    group->failed = 0;
+    group->size = size;
+    group->mtime = mtime;
+    group->id = next_range_group_id();
     
-    // Check if shutting down
-    if (pool->shutdown) {
-        pthread_mutex_unlock(&pool->queue_mutex);
-        return -1;
+    if (pthread_mutex_init(&group->mutex, NULL) != 0) {
+        fprintf(stderr, "Failed to initialize range group mutex\n");
+        free(group);
+        return NULL;
     }
+    return group;
+}
+
+int finish_range(range_group_t *group, int success) {
+    pthread_mutex_lock(&group->mutex);
+    if (!success) group->failed = 1;
+    int last = --group->pending == 0;
+    pthread_mutex_unlock(&group->mutex);
+    return last;
+}
+
+void free_range_group(range_group_t *group) {
+    if (!group) return;
     
-    // Wait if queue is full
-    while (pool->queue_size >= pool->buffer_size && !pool->shutdown) {
-        pthread_cond_wait(&pool->queue_not_full, &pool->queue_mutex);
-    }
+    pthread_mutex_destroy(&group->mutex);
+    free(group);
+}
+
+int add_batch_file(sync_job_t *job, const char *filename, int64_t size) {
+    if (!job || !filename) return -1;
     
-    if (pool->shutdown) {
-        pthread_mutex_unlock(&pool->queue_mutex);
-        return -1;
+    file_batch_t *batch = job->batch;
+    if (!batch) {
+        batch = calloc(1, sizeof(file_batch_t));
+        if (!batch) {
+            fprintf(stderr, "Failed to allocate memory for file batch\n");
+            return -1;
+        }
+        job->batch = batch;
     }
     
-    // Add job to queue
-    if (pool->job_queue_tail) {
-        pool->job_queue_tail->next = job;
-    } else {
-        pool->job_queue_head = job;
+    size_t name_len = strnlen(filename, MAX_FILENAME - 1);
+    if (batch->length + name_len + 1 > batch->capacity) {
+        size_t capacity = batch->capacity ? batch->capacity * 2 : 4096;
+        while (capacity < batch->length + name_len + 1) capacity *= 2;
+        char *grown = realloc(batch->names, capacity);
+        if (!grown) {
+            fprintf(stderr, "Failed to allocate memory for file batch\n");
+            return -1;
+        }
+        batch->names = grown;
+        batch->capacity = capacity;
     }
-    pool->job_queue_tail = job;
-    pool->queue_size++;
-    
-    // Signal that queue is not empty
-    pthread_cond_signal(&pool->queue_not_empty);
-    
-    pthread_mutex_unlock(&pool->queue_mutex);
+    memcpy(batch->names + batch->length, filename, name_len);
+    batch->length += name_len;
+    batch->names[batch->length++] = '\n';
+    batch->count++;
+    batch->bytes += size;
     return 0;
 }
 
-sync_job_t* dequeue_sync_job(thread_pool_t *pool) {
-    if (!pool) return NULL;
+int batch_full(const sync_job_t *job) {
+    const file_batch_t *batch = job->batch;
+    return batch && (batch->count >= BATCH_MAX_FILES || batch->bytes >= BATCH_MAX_BYTES);
+}
+
+void dissolve_batch(sync_job_t *job) {
+    if (job && job->batch && job->batch->count <= 1) {
+        free_file_batch(job->batch);
+        job->batch = NULL;
+    }
+}
+
+/**
+ * Wake one thread sleeping on a full or empty buffer, if there is one.
+ * The fence orders the buffer update before the waiter count is read;
+ * waiters bump the count before retrying the buffer, so one side always
+ * sees the other and no wakeup is lost.
+ */
+static void wake_waiter(thread_pool_t *pool, int *waiting, pthread_cond_t *cond) {
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(waiting, __ATOMIC_RELAXED) == 0) return;
     
     pthread_mutex_lock(&pool->queue_mutex);
-    
-    // Wait if queue is empty and not shutting down
-    while (pool->queue_size == 0 && !pool->shutdown) {
-        pthread_cond_wait(&pool->queue_not_empty, &pool->queue_mutex);
+    pthread_cond_signal(cond);
+    pthread_mutex_unlock(&pool->queue_mutex);
+}
+
+/**
+ * Sleep on cond until signaled or, when queued jobs are held back by
+ * their limits (retry_us > 0), until they may pass. Mutex held.
+ */
+static void wait_for_jobs(pthread_cond_t *cond, pthread_mutex_t *mutex, uint64_t retry_us) {
+    if (retry_us == 0) {
+        pthread_cond_wait(cond, mutex);
+        return;
     }
     
-    if (pool->shutdown && pool->queue_size == 0) {
-        pthread_mutex_unlock(&pool->queue_mutex);
-        return NULL;
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += (time_t)(retry_us / 1000000);
+    deadline.tv_nsec += (long)(retry_us % 1000000) * 1000L;
+    deadline.tv_sec += deadline.tv_nsec / 1000000000L;
+    deadline.tv_nsec %= 1000000000L;
+    pthread_cond_timedwait(cond, mutex, &deadline);
+}
+
+/**
+ * A job gave back capped sessions: wake every sleeping worker, since any
+ * of them may be waiting for just that client.
+ */
+static void wake_held_back(thread_pool_t *pool) {
+    pthread_mutex_lock(&pool->queue_mutex);
+    pthread_cond_broadcast(&pool->queue_not_empty);
+    for (int i = 0; pool->workers && i < pool->thread_count; i++) {
+        if (pool->workers[i].sleeping) {
+            pool->workers[i].sleeping = 0;
+            pthread_cond_signal(&pool->workers[i].wake);
+        }
     }
+    pthread_mutex_unlock(&pool->queue_mutex);
+}
+
+static int enqueue_ring_job(thread_pool_t *pool, sync_job_t *job) {
+    if (__atomic_load_n(&pool->shutdown, __ATOMIC_ACQUIRE)) return -1;
     
-    // Remove job from queue
-    sync_job_t *job = pool->job_queue_head;
-    if (job) {
-        pool->job_queue_head = job->next;
-        if (!pool->job_queue_head) {
-            pool->job_queue_tail = NULL;
+    if (job_ring_push(pool->ring, job) != 0) {
+        // Full: sleep until a worker frees a cell
+        pthread_mutex_lock(&pool->queue_mutex);
+        __atomic_add_fetch(&pool->waiting_producers, 1, __ATOMIC_SEQ_CST);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        
+        int queued = 0;
+        while (!pool->shutdown && !(queued = job_ring_push(pool->ring, job) == 0)) {
+            pthread_cond_wait(&pool->queue_not_full, &pool->queue_mutex);
         }
-        pool->queue_size--;
-        job->next = NULL;
         
-        // Signal that queue is not full
-        pthread_cond_signal(&pool->queue_not_full);
+        __atomic_sub_fetch(&pool->waiting_producers, 1, __ATOMIC_SEQ_CST);
+        pthread_mutex_unlock(&pool->queue_mutex);
+        if (!queued) return -1;
     }
     
-    pthread_mutex_unlock(&pool->queue_mutex);
-    return job;
+    wake_waiter(pool, &pool->waiting_consumers, &pool->queue_not_empty);
+    return 0;
 }
 
-int sync_single_file(sync_job_t *job) {
-    if (!job) return -1;
-    
-    char source_path[MAX_PATH * 2];
-    char target_path[MAX_PATH * 2];
-    char command[MAX_COMMAND_SIZE];
-    char response[MAX_BUFFER_SIZE];
-    
-    // Build full paths
-    snprintf(source_path, sizeof(source_path), "%s/%s", job->source_dir, job->filename);
-    snprintf(target_path, sizeof(target_path), "%s/%s", job->target_dir, job->filename);
+static sync_job_t* dequeue_ring_job(thread_pool_t *pool) {
+    sync_job_t *job = job_ring_pop(pool->ring);
     
-    // Connect to source client
-    int source_fd = connect_to_server(job->source_host, job->source_port);
-    if (source_fd < 0) {
-        if (g_worker_logfile) {
-            char timestamp[32];
-            get_timestamp(timestamp, sizeof(timestamp));
-            fprintf(g_worker_logfile, "[%s] [%s@%s:%d] [%s@%s:%d] [%d] [PULL] [ERROR] [Connection failed to source: %s]\n",
-                   timestamp, job->source_dir, job->source_host, job->source_port,
-                   job->target_dir, job->target_host, job->target_port,
-                   (int)pthread_self(), strerror(errno));
-            fflush(g_worker_logfile);
+    if (!job) {
+        // Empty: sleep until a producer fills a cell or shutdown
+        pthread_mutex_lock(&pool->queue_mutex);
+        __atomic_add_fetch(&pool->waiting_consumers, 1, __ATOMIC_SEQ_CST);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        
+        while (!(job = job_ring_pop(pool->ring)) && !pool->shutdown) {
+            pthread_cond_wait(&pool->queue_not_empty, &pool->queue_mutex);
         }
-        return -1;
+        
+        __atomic_sub_fetch(&pool->waiting_consumers, 1, __ATOMIC_SEQ_CST);
+        pthread_mutex_unlock(&pool->queue_mutex);
+        if (!job) return NULL; // Shut down with nothing left to run
     }
     
-    // Connect to target client
-    int target_fd = connect_to_server(job->target_host, job->target_port);
-    if (target_fd < 0) {
-        if (g_worker_logfile) {
-            char timestamp[32];
-            get_timestamp(timestamp, sizeof(timestamp));
-            fprintf(g_worker_logfile, "[%s] [%s@%s:%d] [%s@%s:%d] [%d] [PUSH] [ERROR] [Connection failed to target: %s]\n",
-                   timestamp, job->source_dir, job->source_host, job->source_port,
-                   job->target_dir, job->target_host, job->target_port,
-                   (int)pthread_self(), strerror(errno));
-            fflush(g_worker_logfile);
+    wake_waiter(pool, &pool->waiting_producers, &pool->queue_not_full);
+    job->next = NULL;
+    return job;
+}
+
+// Key of the job's source endpoint, never 0
+static uint64_t source_endpoint_key(const sync_job_t *job) {
+    uint64_t key = fnv1a_update(FNV1A_INIT, job->info->source_host, strlen(job->info->source_host));
+    key = fnv1a_update(key, &job->info->source_port, sizeof(job->info->source_port));
+    return key | 1;
+}
+
+// Count a job against buffer_size unless the worker queues are full
+static int reserve_queue_slot(thread_pool_t *pool) {
+    int queued = __atomic_load_n(&pool->queue_size, __ATOMIC_RELAXED);
+    while (queued < pool->buffer_size) {
+        if (__atomic_compare_exchange_n(&pool->queue_size, &queued, queued + 1, 1,
+                                        __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+            return 1;
         }
-        close(source_fd);
-        return -1;
     }
+    return 0;
+}
+
+/**
+ * Choose the worker queue for a job: the shortest queue whose worker
+ * last handled the same source, unless it is more than AFFINITY_SLACK
+ * longer than the shortest queue overall, which then adopts the source.
+ */
+static worker_queue_t* pick_worker_queue(thread_pool_t *pool, uint64_t key) {
+    int shortest = 0, shortest_length = INT_MAX;
+    int home = -1, home_length = INT_MAX;
     
-    // Send PULL command to source
-    snprintf(command, sizeof(command), "PULL %s\n", source_path);
-    if (send_command(source_fd, command) != 0) {
-        close(source_fd);
-        close(target_fd);
-        return -1;
+    for (int i = 0; i < pool->thread_count; i++) {
+        worker_queue_t *queue = &pool->workers[i];
+        int length = __atomic_load_n(&queue->length, __ATOMIC_RELAXED);
+        if (length < shortest_length) {
+            shortest = i;
+            shortest_length = length;
+        }
+        if (__atomic_load_n(&queue->affinity, __ATOMIC_RELAXED) == key && length < home_length) {
+            home = i;
+            home_length = length;
+        }
     }
     
-    // Read file size first
-    ssize_t received = recv(source_fd, response, sizeof(response) - 1, 0);
-    if (received <= 0) {
-        close(source_fd);
-        close(target_fd);
-        return -1;
+    if (home >= 0 && home_length <= shortest_length + AFFINITY_SLACK) {
+        return &pool->workers[home];
     }
-    response[received] = '\0';
-    
-    // Parse file size
-    long file_size;
-    char *space_pos = strchr(response, ' ');
-    if (!space_pos) {
-        close(source_fd);
-        close(target_fd);
-        return -1;
+    __atomic_store_n(&pool->workers[shortest].affinity, key, __ATOMIC_RELAXED);
+    return &pool->workers[shortest];
+}
+
+// Oldest job of a queue that throttle_admit() lets run; held back pairs lower *retry_us
+static sync_job_t* pop_worker_queue(worker_queue_t *queue, uint64_t *retry_us) {
+    pthread_mutex_lock(&queue->mutex);
+    sync_job_t *prev = NULL;
+    sync_job_t *job = queue->head;
+    sync_info_t *held = NULL;
+    while (job && (job->info == held || !throttle_admit(job->info, retry_us))) {
+        held = job->info;
+        prev = job;
+        job = job->next;
     }
-    
-    file_size = atol(response);
-    if (file_size < 0) {
-        // Error from source
-        if (g_worker_logfile) {
-            char timestamp[32];
-            get_timestamp(timestamp, sizeof(timestamp));
-            fprintf(g_worker_logfile, "[%s] [%s@%s:%d] [%s@%s:%d] [%d] [PULL] [ERROR] [File: %s - %s]\n",
-                   timestamp, job->source_dir, job->source_host, job->source_port,
-                   job->target_dir, job->target_host, job->target_port,
-                   (int)pthread_self(), job->filename, space_pos + 1);
-            fflush(g_worker_logfile);
+    if (job) {
+        if (prev) {
+            prev->next = job->next;
+        } else {
+            queue->head = job->next;
         }
-        close(source_fd);
-        close(target_fd);
-        return -1;
+        if (queue->tail == job) {
+            queue->tail = prev;
+        }
+        __atomic_store_n(&queue->length, queue->length - 1, __ATOMIC_RELAXED);
+        job->next = NULL;
     }
-    
-    // Start PUSH to target (send -1 to indicate start of new file)
-    snprintf(command, sizeof(command), "PUSH %s -1\n", target_path);
-    if (send_command(target_fd, command) != 0) {
-        close(source_fd);
-        close(target_fd);
-        return -1;
+    pthread_mutex_unlock(&queue->mutex);
+    return job;
+}
+
+// Next job for worker self (-1 for other threads): own queue, then steal
+static sync_job_t* take_worker_job(thread_pool_t *pool, int self, uint64_t *retry_us) {
+    if (self >= 0) {
+        sync_job_t *job = pop_worker_queue(&pool->workers[self], retry_us);
+        if (job) return job;
     }
     
-    // Transfer file data in chunks
-    long total_transferred = 0;
-    char buffer[MAX_BUFFER_SIZE];
-    
-    // Skip the size header in first read
-    size_t header_len = space_pos - response + 1;
-    if ((size_t)received > header_len) {  // Fix signed/unsigned comparison
-        // We have some file data in the first read
-        size_t data_in_first_read = received - header_len;
-        
-        // Send this chunk to target
-        snprintf(command, sizeof(command), "PUSH %s %zu ", target_path, data_in_first_read);
-        send_command(target_fd, command);
-        send(target_fd, space_pos + 1, data_in_first_read, 0);
+    for (int i = 1; i <= pool->thread_count; i++) {
+        int victim = (self + i) % pool->thread_count;
+        if (victim == self ||
+            __atomic_load_n(&pool->workers[victim].length, __ATOMIC_RELAXED) == 0) {
+            continue;
+        }
         
-        total_transferred += data_in_first_read;
+        sync_job_t *job = pop_worker_queue(&pool->workers[victim], retry_us);
+        if (job) {
+            // The thief now talks to this source too
+            if (self >= 0) {
+                __atomic_store_n(&pool->workers[self].affinity, source_endpoint_key(job),
+                                 __ATOMIC_RELAXED);
+            }
+            return job;
+        }
     }
+    return NULL;
+}
+
+static int enqueue_worker_job(thread_pool_t *pool, sync_job_t *job) {
+    if (__atomic_load_n(&pool->shutdown, __ATOMIC_ACQUIRE)) return -1;
     
-    // Continue reading and transferring
-    while (total_transferred < file_size) {
-        ssize_t chunk_size = recv(source_fd, buffer, sizeof(buffer), 0);
-        if (chunk_size <= 0) break;
+    if (!reserve_queue_slot(pool)) {
+        // Full: sleep until a worker takes a job
+        pthread_mutex_lock(&pool->queue_mutex);
+        __atomic_add_fetch(&pool->waiting_producers, 1, __ATOMIC_SEQ_CST);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
         
-        // Send chunk to target
-        snprintf(command, sizeof(command), "PUSH %s %zd ", target_path, chunk_size);
-        send_command(target_fd, command);
-        send(target_fd, buffer, chunk_size, 0);
+        int reserved = 0;
+        while (!pool->shutdown && !(reserved = reserve_queue_slot(pool))) {
+            pthread_cond_wait(&pool->queue_not_full, &pool->queue_mutex);
+        }
         
-        total_transferred += chunk_size;
+        __atomic_sub_fetch(&pool->waiting_producers, 1, __ATOMIC_SEQ_CST);
+        pthread_mutex_unlock(&pool->queue_mutex);
+        if (!reserved) return -1;
     }
     
-    // Send end-of-file marker to target
-    snprintf(command, sizeof(command), "PUSH %s 0\n", target_path);
-    send_command(target_fd, command);
-    
-    close(source_fd);
-    close(target_fd);
-    
-    // Log successful transfer
-    if (g_worker_logfile) {
-        char timestamp[32];
-        get_timestamp(timestamp, sizeof(timestamp));
-        fprintf(g_worker_logfile, "[%s] [%s@%s:%d] [%s@%s:%d] [%d] [PULL] [SUCCESS] [%ld bytes pulled]\n",
-               timestamp, job->source_dir, job->source_host, job->source_port,
-               job->target_dir, job->target_host, job->target_port,
-               (int)pthread_self(), total_transferred);
-        fprintf(g_worker_logfile, "[%s] [%s@%s:%d] [%s@%s:%d] [%d] [PUSH] [SUCCESS] [%ld bytes pushed]\n",
-               timestamp, job->source_dir, job->source_host, job->source_port,
-               job->target_dir, job->target_host, job->target_port,
-               (int)pthread_self(), total_transferred);
-        fflush(g_worker_logfile);
+    worker_queue_t *queue = pick_worker_queue(pool, source_endpoint_key(job));
+    job->next = NULL;
+    pthread_mutex_lock(&queue->mutex);
+    if (queue->tail) {
+        queue->tail->next = job;
+    } else {
+        queue->head = job;
     }
+    queue->tail = job;
+    __atomic_store_n(&queue->length, queue->length + 1, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&queue->mutex);
+    
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&pool->waiting_consumers, __ATOMIC_RELAXED) == 0) return 0;
     
+    // Prefer waking the owner; any other sleeper can steal the job
+    pthread_mutex_lock(&pool->queue_mutex);
+    worker_queue_t *sleeper = queue->sleeping ? queue : NULL;
+    for (int i = 0; !sleeper && i < pool->thread_count; i++) {
+        if (pool->workers[i].sleeping) sleeper = &pool->workers[i];
+    }
+    if (sleeper) {
+        // Woken workers are skipped, so a second job wakes a second worker
+        sleeper->sleeping = 0;
+        pthread_cond_signal(&sleeper->wake);
+    } else {
+        pthread_cond_signal(&pool->queue_not_empty);
+    }
+    pthread_mutex_unlock(&pool->queue_mutex);
     return 0;
 }
 
-void* worker_thread(void *arg) {
-    thread_pool_t *pool = (thread_pool_t*)arg;
-    
-    printf("Worker thread %d started\n", (int)pthread_self());
+static sync_job_t* dequeue_worker_job(thread_pool_t *pool) {
+    int self = t_worker_index < pool->thread_count ? t_worker_index : -1;
+    uint64_t retry_us = 0;
+    sync_job_t *job = take_worker_job(pool, self, &retry_us);
     
-    while (1) {
-        sync_job_t *job = dequeue_sync_job(pool);
-        if (!job) {
-            // Pool is shutting down
-            break;
-        }
-        
-        printf("Worker %d processing file: %s\n", (int)pthread_self(), job->filename);
+    if (!job) {
+        // Nothing anywhere: sleep until a producer wakes this worker
+        pthread_mutex_lock(&pool->queue_mutex);
+        __atomic_add_fetch(&pool->waiting_consumers, 1, __ATOMIC_SEQ_CST);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        pthread_cond_t *wake = self >= 0 ? &pool->workers[self].wake : &pool->queue_not_empty;
         
-        // Process the sync job
-        if (sync_single_file(job) != 0) {
-            printf("Worker %d failed to sync file: %s\n", (int)pthread_self(), job->filename);
-        } else {
-            printf("Worker %d successfully synced file: %s\n", (int)pthread_self(), job->filename);
+        while (1) {
+            retry_us = 0;
+            if ((job = take_worker_job(pool, self, &retry_us)) != NULL || pool->shutdown) break;
+            if (self >= 0) pool->workers[self].sleeping = 1;
+            wait_for_jobs(wake, &pool->queue_mutex, retry_us);
         }
         
-        free_sync_job(job);
+        if (self >= 0) pool->workers[self].sleeping = 0;
+        __atomic_sub_fetch(&pool->waiting_consumers, 1, __ATOMIC_SEQ_CST);
+        pthread_mutex_unlock(&pool->queue_mutex);
+        if (!job) return NULL; // Shut down with nothing left to run
     }
     
-    printf("Worker thread %d finished\n", (int)pthread_self());
+    __atomic_sub_fetch(&pool->queue_size, 1, __ATOMIC_SEQ_CST);
+    wake_waiter(pool, &pool->waiting_producers, &pool->queue_not_full);
+    return job;
+}
+
+// Queue of a pair, joining the end of the round if it has none. Mutex held
+static pair_queue_t* find_pair_queue(thread_pool_t *pool, sync_info_t *info) {
+    if (info->queue) return info->queue;
+    
+    pair_queue_t *current = pool->current_pair;
+    pair_queue_t *queue = malloc(sizeof(pair_queue_t));
+    if (!queue) {
+        fprintf(stderr, "Failed to allocate memory for pair queue\n");
+        return NULL;
+    }
+    queue->info = info;
+    queue->head = NULL;
+    queue->tail = NULL;
+    queue->weight = info->options.priority > 0 ? info->options.priority : DEFAULT_PRIORITY;
+    queue->credit = queue->weight;
+    
+    if (current) {
+        // Just before the current pair is the end of the round
+        queue->next = current;
+        queue->prev = current->prev;
+        current->prev->next = queue;
+        current->prev = queue;
+    } else {
+        queue->next = queue;
+        queue->prev = queue;
+        pool->current_pair = queue;
+    }
+    info->queue = queue;
+    return queue;
+}
+
+// Take the oldest job of a pair, ending its turn as needed. Mutex held
+static sync_job_t* pop_pair_job(thread_pool_t *pool, pair_queue_t *queue) {
+    sync_job_t *job = queue->head;
+    queue->head = job->next;
+    job->next = NULL;
+    
+    if (!queue->head) {
+        // Drained: leave the round, the next pair's turn starts
+        leave_round(pool, queue);
+    } else if (--queue->credit == 0) {
+        // Turn used up: refill for the next round and move on
+        queue->credit = queue->weight;
+        if (pool->current_pair == queue) {
+            pool->current_pair = queue->next;
+        }
+    }
+    return job;
+}
+
+/**
+ * Next job in round-robin order. A pair held back by its limits keeps
+ * its turn while the pairs after it serve jobs; NULL if every queued
+ * pair is held back, with *retry_us lowered to when one may pass.
+ * Mutex held, some pair has a job.
+ */
+static sync_job_t* take_pair_job(thread_pool_t *pool, uint64_t *retry_us) {
+    pair_queue_t *queue = pool->current_pair;
+    do {
+        if (throttle_admit(queue->info, retry_us)) {
+            return pop_pair_job(pool, queue);
+        }
+        queue = queue->next;
+    } while (queue != pool->current_pair);
     return NULL;
 }
 
-void signal_shutdown(thread_pool_t *pool) {
-    if (!pool) return;
+int enqueue_sync_job(thread_pool_t *pool, sync_job_t *job) {
+    if (!pool || !job) return -1;
+    
+    job->enqueued_us = metrics_now_us();
+    if (pool->ring) {
+        return enqueue_ring_job(pool, job);
+    }
+    if (pool->workers) {
+        return enqueue_worker_job(pool, job);
+    }
     
     pthread_mutex_lock(&pool->queue_mutex);
-    pool->shutdown = 1;
-    pthread_cond_broadcast(&pool->queue_not_empty);
-    pthread_cond_broadcast(&pool->queue_not_full);
+    
+    // Check if shutting down
+    if (pool->shutdown) {
+        pthread_mutex_unlock(&pool->queue_mutex);
+        return -1;
+    }
+    
+    // Wait if queue is full
+    while (pool->queue_size >= pool->buffer_size && !pool->shutdown) {
+        pthread_cond_wait(&pool->queue_not_full, &pool->queue_mutex);
+    }
+    
+    if (pool->shutdown) {
+        pthread_mutex_unlock(&pool->queue_mutex);
+        return -1;
+    }
+    
+    // Add job to the queue of its pair
+    pair_queue_t *queue = find_pair_queue(pool, job->info);
+    if (!queue) {
+        pthread_mutex_unlock(&pool->queue_mutex);
+        return -1;
+    }
+    job->next = NULL;
+    if (queue->tail) {
+        queue->tail->next = job;
+    } else {
+        queue->head = job;
+    }
+    queue->tail = job;
+    pool->queue_size++;
+    
+    // Signal that queue is not empty
+    pthread_cond_signal(&pool->queue_not_empty);
+    
+    pthread_mutex_unlock(&pool->queue_mutex);
+    return 0;
+}
+
+sync_job_t* dequeue_sync_job(thread_pool_t *pool) {
+    if (!pool) return NULL;
+    
+    if (pool->ring) {
+        return dequeue_ring_job(pool);
+    }
+    if (pool->workers) {
+        return dequeue_worker_job(pool);
+    }
+    
+    pthread_mutex_lock(&pool->queue_mutex);
+    
+    sync_job_t *job = NULL;
+    while (1) {
+        // Wait if queue is empty and not shutting down
+        while (pool->queue_size == 0 && !pool->shutdown) {
+            pthread_cond_wait(&pool->queue_not_empty, &pool->queue_mutex);
+        }
+        
+        if (pool->shutdown && pool->queue_size == 0) {
+            pthread_mutex_unlock(&pool->queue_mutex);
+            return NULL;
+        }
+        
+        // Remove job from queue, unless every pair is over its limits
+        uint64_t retry_us = 0;
+        job = pool->current_pair ? take_pair_job(pool, &retry_us) : NULL;
+        if (job || retry_us == 0) break;
+        wait_for_jobs(&pool->queue_not_empty, &pool->queue_mutex, retry_us);
+    }
+    if (job) {
+        pool->queue_size--;
+        
+        // Signal that queue is not full
+        pthread_cond_signal(&pool->queue_not_full);
+    }
+    
+    pthread_mutex_unlock(&pool->queue_mutex);
+    return job;
+}
+
+/**
+ * Move the jobs of info that can be dropped from the list at *head to
+ * *dropped. Range jobs stay. Returns the number moved and leaves *tail
+ * at the new last job.
+ */
+static int unlink_pair_jobs(sync_job_t **head, sync_job_t **tail, sync_info_t *info, sync_job_t **dropped) {
+    int count = 0;
+    sync_job_t **link = head;
+    *tail = NULL;
+    while (*link) {
+        sync_job_t *job = *link;
+        if (job->info == info && !job->group) {
+            *link = job->next;
+            job->next = *dropped;
+            *dropped = job;
+            count++;
+        } else {
+            *tail = job;
+            link = &job->next;
+        }
+    }
+    return count;
+}
+
+// Drop jobs from the round-robin pair queues. Mutex held
+static int purge_pair_queue(thread_pool_t *pool, sync_info_t *info, sync_job_t **dropped) {
+    pair_queue_t *queue = info->queue;
+    if (!queue) return 0;
+    
+    int count = unlink_pair_jobs(&queue->head, &queue->tail, info, dropped);
+    if (!queue->head) {
+        // Leave the round as if drained
+        leave_round(pool, queue);
+    }
+    return count;
+}
+
+int purge_sync_jobs(thread_pool_t *pool, sync_info_t *info) {
+    if (!pool || !info || pool->ring) return 0;
+    
+    sync_job_t *dropped = NULL;
+    int count = 0;
+    
+    if (pool->workers) {
+        for (int i = 0; i < pool->thread_count; i++) {
+            worker_queue_t *queue = &pool->workers[i];
+            pthread_mutex_lock(&queue->mutex);
+            int removed = unlink_pair_jobs(&queue->head, &queue->tail, info, &dropped);
+            __atomic_store_n(&queue->length, queue->length - removed, __ATOMIC_RELAXED);
+            pthread_mutex_unlock(&queue->mutex);
+            count += removed;
+        }
+        __atomic_sub_fetch(&pool->queue_size, count, __ATOMIC_SEQ_CST);
+        pthread_mutex_lock(&pool->queue_mutex);
+    } else {
+        pthread_mutex_lock(&pool->queue_mutex);
+        count = purge_pair_queue(pool, info, &dropped);
+        pool->queue_size -= count;
+    }
+    
+    // Every freed slot can take a job of another pair
+    if (count > 0) {
+        pthread_cond_broadcast(&pool->queue_not_full);
+    }
+    pthread_mutex_unlock(&pool->queue_mutex);
+    
+    while (dropped) {
+        sync_job_t *next = dropped->next;
+        free_sync_job(dropped);
+        dropped = next;
+    }
+    return count;
+}
+
+/**
+ * Append one line to the worker log in the
+ * "[time] [source] [target] [thread] [op] [result] [details]" format,
+ * through the log flusher.
+ */
+static void log_worker_event(const sync_job_t *job, const char *op, const char *result,
+                             const char *format, ...) {
+    if (!g_worker_logfile) return;
+    
+    char details[MAX_BUFFER_SIZE];
+    va_list args;
+    va_start(args, format);
+    vsnprintf(details, sizeof(details), format, args);
+    va_end(args);
+    
+    char source[MAX_PATH + MAX_HOST_SIZE + 16];
+    char target[MAX_PATH + MAX_HOST_SIZE + 16];
+    snprintf(source, sizeof(source), "%s@%s:%d", job->info->source_dir,
+             job->info->source_host, job->info->source_port);
+    snprintf(target, sizeof(target), "%s@%s:%d", job->info->target_dir,
+             job->info->target_host, job->info->target_port);
+    log_event(g_worker_logfile, source, target, op, result, "%s", details);
+}
+
+
+/**
+ * Count bytes pushed and files brought up to date for the job's pair
+ * and the worker running it.
+ */
+static void note_transfer(const sync_job_t *job, int64_t bytes, int files) {
+    __atomic_add_fetch(&job->info->bytes_synced, (uint64_t)bytes, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&job->info->files_synced, (uint64_t)files, __ATOMIC_RELAXED);
+    if (t_worker_stats) {
+        __atomic_add_fetch(&t_worker_stats->bytes, (uint64_t)bytes, __ATOMIC_RELAXED);
+    }
+}
+
+
+void set_transfer_engine(transfer_engine_t engine) {
+    g_transfer_engine = engine;
+}
+
+int set_relay_buffers(size_t buffer_size, int depth) {
+    if (buffer_size < RELAY_BUFFER_MIN || buffer_size > RELAY_BUFFER_MAX ||
+        depth < 2 || depth > RELAY_DEPTH_MAX) {
+        return -1;
+    }
+    g_relay_buffer_size = buffer_size;
+    g_relay_depth = depth;
+    return 0;
+}
+
+int parse_transfer_engine(const char *name, transfer_engine_t *engine) {
+    if (!name || !engine) return -1;
+    
+    if (strcmp(name, "copy") == 0) {
+        *engine = TRANSFER_ENGINE_COPY;
+    } else if (strcmp(name, "pipeline") == 0) {
+        *engine = TRANSFER_ENGINE_PIPELINE;
+    } else if (strcmp(name, "splice") == 0) {
+        *engine = TRANSFER_ENGINE_SPLICE;
+    } else {
+        return -1;
+    }
+    return 0;
+}
+
+void set_job_queue_type(job_queue_type_t type) {
+    g_job_queue_type = type;
+}
+
+int parse_job_queue_type(const char *name, job_queue_type_t *type) {
+    if (!name || !type) return -1;
+    
+    if (strcmp(name, "list") == 0) {
+        *type = JOB_QUEUE_LIST;
+    } else if (strcmp(name, "ring") == 0) {
+        *type = JOB_QUEUE_RING;
+    } else if (strcmp(name, "steal") == 0) {
+        *type = JOB_QUEUE_STEAL;
+    } else {
+        return -1;
+    }
+    return 0;
+}
+
+static int send_all(int sockfd, const void *data, size_t len) {
+    const char *ptr = data;
+    while (len > 0) {
+        ssize_t sent = send(sockfd, ptr, len, 0);
+        if (sent < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        ptr += sent;
+        len -= sent;
+    }
+    return 0;
+}
+
+/**
+ * Consume the "<size> " header of a PULL reply without reading past it,
+ * so that the payload can be relayed untouched. For error replies
+ * ("-1 <message>") whatever part of the message has arrived is copied
+ * into error. Returns 0 on success, -1 on connection failure.
+ */
+static int read_pull_header(int source_fd, long *file_size, char *error, size_t error_size) {
+    char header[32];
+    size_t len = 0;
+    
+    while (1) {
+        if (len >= sizeof(header) - 1) {
+            return -1; // No size terminator, not a PULL reply
+        }
+        
+        ssize_t peeked = recv(source_fd, header + len, sizeof(header) - 1 - len, MSG_PEEK);
+        if (peeked < 0 && errno == EINTR) continue;
+        if (peeked <= 0) return -1;
+        
+        char *space = memchr(header + len, ' ', peeked);
+        size_t take = space ? (size_t)(space - (header + len)) + 1 : (size_t)peeked;
+        
+        // These bytes are already queued, so this never blocks
+        if (recv(source_fd, header + len, take, 0) != (ssize_t)take) {
+            return -1;
+        }
+        len += take;
+        if (space) break;
+    }
+    
+    header[len] = '\0';
+    *file_size = atol(header);
+    
+    if (*file_size < 0 && error && error_size > 0) {
+        ssize_t received = recv(source_fd, error, error_size - 1, MSG_DONTWAIT);
+        error[received > 0 ? received : 0] = '\0';
+        char *newline = strchr(error, '\n');
+        if (newline) *newline = '\0';
+    }
+    
+    return 0;
+}
+
+// Copy exactly len payload bytes through a user-space buffer
+static int relay_chunk_copy(int source_fd, int target_fd, size_t len) {
+    char buffer[MAX_BUFFER_SIZE];
+    
+    while (len > 0) {
+        size_t want = len < sizeof(buffer) ? len : sizeof(buffer);
+        ssize_t received = recv(source_fd, buffer, want, 0);
+        if (received < 0 && errno == EINTR) continue;
+        if (received <= 0) return -1;
+        
+        if (send_all(target_fd, buffer, received) != 0) return -1;
+        len -= received;
+    }
+    return 0;
+}
+
+/**
+ * Copy exactly len payload bytes through the worker's buffer ring,
+ * overlapping the two sockets: whenever the source has data and a buffer
+ * is free it is read, whenever a buffer holds data and the target can
+ * take it it is written. Both sockets are used with MSG_DONTWAIT and the
+ * worker only sleeps in poll() when neither side can move. Returns 0 on
+ * success, -1 on error, and 1 if no ring could be allocated (the caller
+ * then falls back to copying).
+ */
+static int relay_chunk_pipelined(int source_fd, int target_fd, size_t len) {
+    size_t slot = g_relay_buffer_size;
+    size_t capacity = slot * g_relay_depth;
+    if (t_relay_ring_size != capacity) {
+        free(t_relay_ring);
+        t_relay_ring = malloc(capacity);
+        t_relay_ring_size = t_relay_ring ? capacity : 0;
+        if (!t_relay_ring) return 1;
+    }
+    
+    // Running totals; buffer positions are taken modulo the ring size
+    size_t received = 0, sent = 0;
+    while (sent < len) {
+        int progress = 0;
+        int can_read = received < len && received - sent < capacity;
+        if (can_read) {
+            size_t pos = received % capacity;
+            size_t want = slot - pos % slot;
+            if (want > len - received) want = len - received;
+            if (want > capacity - (received - sent)) want = capacity - (received - sent);
+            
+            ssize_t got = recv(source_fd, t_relay_ring + pos, want, MSG_DONTWAIT);
+            if (got > 0) {
+                received += got;
+                progress = 1;
+            } else if (got == 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) {
+                return -1; // Source closed or failed mid-chunk
+            }
+        }
+        
+        if (sent < received) {
+            size_t pos = sent % capacity;
+            size_t want = slot - pos % slot;
+            if (want > received - sent) want = received - sent;
+            
+            ssize_t put = send(target_fd, t_relay_ring + pos, want, MSG_DONTWAIT | MSG_NOSIGNAL);
+            if (put > 0) {
+                sent += put;
+                progress = 1;
+            } else if (put < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                return -1;
+            }
+        }
+        if (progress) continue;
+        
+        // Neither side could move: sleep until one of them can
+        struct pollfd pfds[2] = {
+            { source_fd, can_read ? POLLIN : 0, 0 },
+            { target_fd, sent < received ? POLLOUT : 0, 0 },
+        };
+        if (poll(pfds, 2, -1) < 0 && errno != EINTR) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// Free the calling worker's buffer ring
+static void release_relay_ring(void) {
+    free(t_relay_ring);
+    t_relay_ring = NULL;
+    t_relay_ring_size = 0;
+}
+
+/**
+ * Move exactly len payload bytes from source to target through a pipe
+ * with splice(), never copying them into user space. Returns 0 on
+ * success, -1 on error, and 1 if splice() is unsupported before any byte
+ * of the chunk was moved (the caller then falls back to copying).
+ */
+static int relay_chunk_splice(int source_fd, int target_fd, int pipefd[2], size_t len) {
+#ifdef __linux__
+    int moved_any = 0;
+    
+    while (len > 0) {
+        size_t want = len < RELAY_CHUNK_SIZE ? len : RELAY_CHUNK_SIZE;
+        ssize_t in_pipe = splice(source_fd, NULL, pipefd[1], NULL, want,
+                                 SPLICE_F_MOVE | SPLICE_F_MORE);
+        if (in_pipe < 0) {
+            if (errno == EINTR) continue;
+            if (!moved_any && (errno == EINVAL || errno == ENOSYS)) return 1;
+            return -1;
+        }
+        if (in_pipe == 0) return -1; // Source closed mid-chunk
+        moved_any = 1;
+        
+        while (in_pipe > 0) {
+            ssize_t out = splice(pipefd[0], NULL, target_fd, NULL, in_pipe,
+                                 SPLICE_F_MOVE | SPLICE_F_MORE);
+            if (out < 0) {
+                if (errno == EINTR) continue;
+                return -1;
+            }
+            in_pipe -= out;
+            len -= out;
+        }
+    }
+    return 0;
+#else
+    (void)source_fd; (void)target_fd; (void)pipefd; (void)len;
+    return 1;
+#endif
+}
+
+/**
+ * Source side of a relayed file: the PULL reply being read.
+ */
+typedef struct {
+    int fd;                          ///< Connection to the source client
+    int version;                     ///< Protocol version spoken on fd
+    uint32_t stream_id;              ///< Stream id of the PULL (version 2)
+    long remaining;                  ///< Payload bytes still expected (version 1)
+    int64_t mtime;                   ///< Source modification time from END (version 2)
+    int64_t size;                    ///< Total size from END (version 2)
+    int clean;                       ///< Reply fully consumed, session reusable
+    char error[MAX_COMMAND_SIZE];    ///< Error reported by the source
+    uint16_t chunk_flags;            ///< DATA flags of the current chunk (version 2)
+    int compressed;                  ///< Some chunk arrived compressed
+} pull_stream_t;
+
+/**
+ * Target side of a relayed file: the PUSH stream being written.
+ */
+typedef struct {
+    int fd;                          ///< Connection to the target client
+    int version;                     ///< Protocol version spoken on fd
+    uint32_t stream_id;              ///< Stream id of the PUSH (version 2)
+    const char *path;                ///< Target file path
+    int clean;                       ///< Stream closed and acknowledged, session reusable
+    char error[MAX_COMMAND_SIZE];    ///< Error reported by the target
+} push_stream_t;
+
+// Read a frame payload of at most size - 1 bytes as a string
+static int recv_frame_text(int fd, const frame_header_t *header, char *out, size_t size) {
+    if (header->length >= size) return -1;
+    if (recv_exact(fd, out, header->length) != 0) return -1;
+    out[header->length] = '\0';
+    return 0;
+}
+
+// flags (a zlib level, see compress_flags()) only apply to version 2
+static int start_pull(pull_stream_t *pull, const char *source_path, uint16_t flags) {
+    char command[MAX_COMMAND_SIZE];
+    pull->error[0] = '\0';
+    pull->mtime = 0;
+    
+    if (pull->version >= 2) {
+        int len = snprintf(command, sizeof(command), "%s %s", CMD_PULL, source_path);
+        return send_frame_flags(pull->fd, FRAME_CMD, flags, pull->stream_id, command, len);
+    }
+    
+    snprintf(command, sizeof(command), "%s %s\n", CMD_PULL, source_path);
+    if (send_command(pull->fd, command) != 0) {
+        return -1;
+    }
+    
+    if (read_pull_header(pull->fd, &pull->remaining, pull->error, sizeof(pull->error)) != 0) {
+        snprintf(pull->error, sizeof(pull->error), "Invalid PULL reply");
+        return -1;
+    }
+    if (pull->remaining < 0) {
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Advance to the next payload chunk of the PULL reply. Only the framing
+ * is read; the caller relays the payload. Returns chunk length, 0 at end
+ * of file, or -1 on error (with pull->error set when the source sent one).
+ */
+static long next_pull_chunk(pull_stream_t *pull) {
+    if (pull->version < 2) {
+        if (pull->remaining == 0) pull->clean = 1;
+        return pull->remaining < RELAY_CHUNK_SIZE ? pull->remaining : RELAY_CHUNK_SIZE;
+    }
+    
+    frame_header_t header;
+    if (recv_frame_header(pull->fd, &header) != 0 || header.stream_id != pull->stream_id) {
+        snprintf(pull->error, sizeof(pull->error), "Invalid PULL reply");
+        return -1;
+    }
+    
+    switch (header.opcode) {
+    case FRAME_DATA:
+        pull->chunk_flags = header.flags;
+        if (header.flags & DATA_FLAG_ZLIB) pull->compressed = 1;
+        return (long)header.length;
+    case FRAME_END: {
+        unsigned char payload[END_PAYLOAD_SIZE];
+        if (header.length != END_PAYLOAD_SIZE || recv_exact(pull->fd, payload, sizeof(payload)) != 0) {
+            return -1;
+        }
+        pull->size = (int64_t)get_u64(payload);
+        pull->mtime = (int64_t)get_u64(payload + 8);
+        pull->clean = 1;
+        return 0;
+    }
+    case FRAME_ERROR:
+        if (recv_frame_text(pull->fd, &header, pull->error, sizeof(pull->error)) != 0) {
+            snprintf(pull->error, sizeof(pull->error), "Invalid PULL reply");
+        } else {
+            pull->clean = 1;
+        }
+        return -1;
+    default:
+        snprintf(pull->error, sizeof(pull->error), "Unexpected frame %d", header.opcode);
+        return -1;
+    }
+}
+
+// Files below the top directory of a recursive pair may land in directories the target lacks
+static uint32_t nested_open_flags(const char *name, size_t len) {
+    return memchr(name, '/', len) ? OPEN_FLAG_MKDIRS : 0;
+}
+
+/**
+ * Open the PUSH stream on the target. flags (OPEN_FLAG_*), offset and,
+ * with OPEN_FLAG_RANGE, the range group id only apply to version 2.
+ */
+static int start_push(push_stream_t *push, uint32_t flags, uint64_t offset, uint64_t group_id) {
+    if (push->version >= 2) {
+        unsigned char payload[OPEN_PAYLOAD_FIXED + OPEN_PAYLOAD_GROUP + MAX_PATH * 2];
+        size_t fixed = OPEN_PAYLOAD_FIXED + ((flags & OPEN_FLAG_RANGE) ? OPEN_PAYLOAD_GROUP : 0);
+        size_t path_len = strlen(push->path);
+        if (path_len >= sizeof(payload) - fixed) return -1;
+        
+        put_u32(payload, flags);
+        put_u64(payload + 4, offset);
+        if (flags & OPEN_FLAG_RANGE) put_u64(payload + OPEN_PAYLOAD_FIXED, group_id);
+        memcpy(payload + fixed, push->path, path_len);
+        return send_frame(push->fd, FRAME_OPEN, push->stream_id, payload, fixed + path_len);
+    }
+    
+    // Send -1 to indicate start of new file
+    char command[MAX_COMMAND_SIZE];
+    snprintf(command, sizeof(command), "%s %s -1\n", CMD_PUSH, push->path);
+    return send_command(push->fd, command);
+}
+
+// flags are the DATA flags of the chunk, passed on as the source sent them (version 2 only)
+static int push_chunk_header(push_stream_t *push, size_t len, uint16_t flags) {
+    if (push->version >= 2) {
+        return send_frame_header_flags(push->fd, FRAME_DATA, flags, push->stream_id, len);
+    }
+    
+    char command[MAX_COMMAND_SIZE];
+    snprintf(command, sizeof(command), "%s %s %zu ", CMD_PUSH, push->path, len);
+    return send_command(push->fd, command);
+}
+
+/**
+ * Send the end of a PUSH stream without waiting for the target. Text
+ * targets are done at this point; version 2 streams are acknowledged,
+ * see read_push_ack().
+ */
+static int end_push(push_stream_t *push, long size, int64_t mtime) {
+    push->error[0] = '\0';
+    
+    if (push->version < 2) {
+        char command[MAX_COMMAND_SIZE];
+        snprintf(command, sizeof(command), "%s %s 0\n", CMD_PUSH, push->path);
+        if (send_command(push->fd, command) != 0) {
+            return -1;
+        }
+        push->clean = 1;
+        return 0;
+    }
+    return send_end_frame(push->fd, push->stream_id, size, mtime);
+}
+
+/**
+ * Read the target's acknowledgement of a version 2 stream. Write errors
+ * on the target side (e.g. a full disk) are reported here.
+ */
+static int read_push_ack(push_stream_t *push) {
+    frame_header_t header;
+    if (recv_frame_header(push->fd, &header) != 0 || header.stream_id != push->stream_id) {
+        snprintf(push->error, sizeof(push->error), "No acknowledgement from target");
+        return -1;
+    }
+    if (header.opcode == FRAME_END) {
+        unsigned char payload[END_PAYLOAD_SIZE];
+        if (header.length != END_PAYLOAD_SIZE || recv_exact(push->fd, payload, sizeof(payload)) != 0) {
+            return -1;
+        }
+        push->clean = 1;
+        return 0;
+    }
+    if (header.opcode != FRAME_ERROR ||
+        recv_frame_text(push->fd, &header, push->error, sizeof(push->error)) != 0) {
+        snprintf(push->error, sizeof(push->error), "Invalid acknowledgement from target");
+    } else {
+        push->clean = 1;
+    }
+    return -1;
+}
+
+// Close the PUSH stream and, on version 2, wait for its acknowledgement
+static int finish_push(push_stream_t *push, long size, int64_t mtime) {
+    if (end_push(push, size, mtime) != 0) {
+        return -1;
+    }
+    return push->version < 2 ? 0 : read_push_ack(push);
+}
+
+static int pair_active(const sync_info_t *info) {
+    return __atomic_load_n(&info->active, __ATOMIC_RELAXED);
+}
+
+// Reason an interrupted relay gives in the log
+static const char* interrupt_reason(const sync_job_t *job, const pull_stream_t *pull) {
+    if (!pair_active(job->info)) return "cancelled";
+    return pull->error[0] ? pull->error : "transfer interrupted";
+}
+
+static void abort_push(push_stream_t *push) {
+    // Text targets keep nothing committed until the end marker arrives
+    if (push->version >= 2) {
+        send_frame(push->fd, FRAME_ABORT, push->stream_id, NULL, 0);
+    }
+}
+
+/**
+ * zlib level to request in a PULL or RANGE for this job: the pair's
+ * compress option, when both clients accepted compression.
+ */
+static uint16_t compress_flags(const sync_job_t *job, const client_conn_t *source, const client_conn_t *target) {
+    int level = job->info->options.compress;
+    if (level <= 0 || !(source->features & FEATURE_ZLIB) || !(target->features & FEATURE_ZLIB)) {
+        return 0;
+    }
+    return (uint16_t)level & PULL_FLAG_LEVEL_MASK;
+}
+
+// Log suffix giving the size a compressed transfer had on the wire, empty if it was raw
+static const char* wire_note(const pull_stream_t *pull, long wire_bytes, char *buffer, size_t size) {
+    if (!pull->compressed) return "";
+    snprintf(buffer, size, " (%ld compressed)", wire_bytes);
+    return buffer;
+}
+
+/**
+ * Relay the payload of a PULL reply to the target, chunk by chunk, with
+ * the configured engine. first_chunk is the length of the first chunk,
+ * already announced by the source. Compressed chunks are relayed as they
+ * are. With a journal_id, the progress of uncompressed data is recorded
+ * as file offsets counted from offset. Stops before the next chunk once
+ * the pair is cancelled. Returns file bytes relayed, or -1 on error or
+ * cancel; *wire_bytes gets the payload bytes that crossed the network.
+ */
+static long relay_file_data(pull_stream_t *pull, push_stream_t *push, long first_chunk,
+                            sync_info_t *info, uint64_t journal_id, int64_t offset, long *wire_bytes) {
+    int pipefd[2] = { -1, -1 };
+    int use_splice = (g_transfer_engine == TRANSFER_ENGINE_SPLICE);
+
+#ifdef __linux__
+    if (use_splice && first_chunk > 0) {
+        if (pipe2(pipefd, O_CLOEXEC) != 0) {
+            use_splice = 0;
+        } else {
+            // A pipe as large as a chunk lets each splice pair move it in one go
+            fcntl(pipefd[1], F_SETPIPE_SZ, RELAY_CHUNK_SIZE);
+        }
+    }
+#else
+    use_splice = 0;
+#endif
+    
+    long total_transferred = 0;
+    long chunk = first_chunk;
+    while (chunk > 0) {
+        throttle_pace(info, (size_t)chunk);
+        if (!pair_active(info) || push_chunk_header(push, chunk, pull->chunk_flags) != 0) {
+            chunk = -1;
+            break;
+        }
+        
+        int result = 1;
+        if (use_splice) {
+            result = relay_chunk_splice(pull->fd, push->fd, pipefd, chunk);
+            if (result == 1) use_splice = 0; // Unsupported: copy from now on
+        } else if (g_transfer_engine == TRANSFER_ENGINE_PIPELINE) {
+            result = relay_chunk_pipelined(pull->fd, push->fd, chunk);
+        }
+        if (result == 1) {
+            result = relay_chunk_copy(pull->fd, push->fd, chunk);
+        }
+        if (result != 0) {
+            chunk = -1;
+            break;
+        }
+        
+        // One chunk behind: the one just sent may not have reached the target's disk
+        if (journal_id && !pull->compressed && total_transferred > 0) {
+            journal_progress(g_journal, journal_id, offset + total_transferred);
+        }
+        total_transferred += chunk;
+        pull->remaining -= chunk;
+        chunk = next_pull_chunk(pull);
+    }
+    
+    if (pipefd[0] >= 0) {
+        close(pipefd[0]);
+        close(pipefd[1]);
+    }
+    
+    *wire_bytes = total_transferred;
+    if (chunk != 0) return -1;
+    
+    // Compressed chunks inflate at the target, END of the source counts file bytes
+    return pull->compressed ? (long)pull->size : total_transferred;
+}
+
+/**
+ * Update an existing target copy with a block delta (see delta.h): the
+ * target sends signatures of its copy, the source encodes its file
+ * against them, and the encoded stream is relayed to the target, which
+ * rebuilds the file. Both sessions must speak version 2. Returns 0 on
+ * success, -1 on failure, or 1 if the target copy was left untouched and
+ * the file should be copied in full instead. *source_clean and
+ * *target_clean tell whether each session may be reused; both are set
+ * whenever 1 is returned.
+ */
+static int sync_file_delta(sync_job_t *job, client_conn_t *source, client_conn_t *target,
+                           const char *source_path, const char *target_path,
+                           int *source_clean, int *target_clean) {
+    char command[MAX_COMMAND_SIZE];
+    uint32_t stream_id = next_stream_id();
+    *source_clean = 1;
+    *target_clean = 1;
+    
+    // Signatures of the target copy
+    pull_stream_t sigs = { target->fd, target->version, stream_id, 0, 0, 0, 0, "", 0, 0 };
+    int len = snprintf(command, sizeof(command), "%s %u %s", CMD_SIGS, job->delta_block_size, target_path);
+    long chunk = -1;
+    if (send_frame(target->fd, FRAME_CMD, stream_id, command, len) == 0) {
+        chunk = next_pull_chunk(&sigs);
+    }
+    if (chunk < 0) {
+        *target_clean = sigs.clean;
+        return sigs.clean ? 1 : -1;
+    }
+    
+    // Forward them to the source as the body of a DELTA request
+    push_stream_t request = { source->fd, source->version, stream_id, source_path, 0, "" };
+    len = snprintf(command, sizeof(command), "%s %u %s", CMD_DELTA, job->delta_block_size, source_path);
+    long sig_bytes = -1;
+    if (send_frame(source->fd, FRAME_CMD, stream_id, command, len) == 0) {
+        long wire_bytes;
+        sig_bytes = relay_file_data(&sigs, &request, chunk, job->info, 0, 0, &wire_bytes);
+    }
+    if (sig_bytes < 0) {
+        // The target reported an error mid-way: withdraw the request
+        if (sigs.clean && send_frame(source->fd, FRAME_ABORT, stream_id, NULL, 0) == 0) {
+            return 1;
+        }
+        *source_clean = 0;
+        *target_clean = sigs.clean;
+        return -1;
+    }
+    if (send_end_frame(source->fd, stream_id, sig_bytes, 0) != 0) {
+        *source_clean = 0;
+        return -1;
+    }
+    
+    // The encoded file comes back in the shape of a PULL reply
+    pull_stream_t delta = { source->fd, source->version, stream_id, 0, 0, 0, 0, "", 0, 0 };
+    chunk = next_pull_chunk(&delta);
+    if (chunk < 0) {
+        *source_clean = delta.clean;
+        return delta.clean ? 1 : -1;
+    }
+    
+    push_stream_t push = { target->fd, target->version, stream_id, target_path, 0, "" };
+    if (start_push(&push, OPEN_FLAG_DELTA, 0, 0) != 0) {
+        *source_clean = 0;
+        *target_clean = 0;
+        return -1;
+    }
+    
+    long wire_bytes;
+    long delta_bytes = relay_file_data(&delta, &push, chunk, job->info, 0, 0, &wire_bytes);
+    if (delta_bytes < 0) {
+        abort_push(&push);
+        log_worker_event(job, "PULL", "ERROR", "File: %s - %s", job->filename,
+                         !pair_active(job->info) ? "cancelled" :
+                         delta.error[0] ? delta.error : "delta transfer interrupted");
+        *source_clean = 0;
+        *target_clean = 0;
+        return -1;
+    }
+    
+    int push_result = finish_push(&push, delta.size, delta.mtime);
+    *source_clean = delta.clean;
+    *target_clean = push.clean;
+    
+    log_worker_event(job, "PULL", "SUCCESS", "%ld delta bytes pulled for %lld byte file",
+                     delta_bytes, (long long)delta.size);
+    if (push_result != 0) {
+        log_worker_event(job, "PUSH", "ERROR", "File: %s - delta rejected: %s", job->filename,
+                         push.error[0] ? push.error : "target connection failed");
+        // The target keeps its old copy when a rebuild fails
+        return push.clean ? 1 : -1;
+    }
+    log_worker_event(job, "PUSH", "SUCCESS", "%lld bytes rebuilt from %ld delta bytes",
+                     (long long)delta.size, delta_bytes);
+    note_transfer(job, delta_bytes, 1);
+    return 0;
+}
+
+/**
+ * Move one byte range of a file into the target part file of its group,
+ * or, without a group, the rest of a whole file resumed from the journal
+ * into the target file itself. Returns 0 on success, -1 on failure.
+ */
+static int transfer_range(sync_job_t *job, const range_group_t *group, const char *source_path,
+                          const char *target_path) {
+    client_conn_t source;
+    if (acquire_connection(g_connection_pool, job->info->source_host, job->info->source_port, &source) != 0) {
+        log_worker_event(job, "PULL", "ERROR", "Connection failed to source: %s", strerror(errno));
+        return -1;
+    }
+    
+    client_conn_t target;
+    if (acquire_connection(g_connection_pool, job->info->target_host, job->info->target_port, &target) != 0) {
+        log_worker_event(job, "PUSH", "ERROR", "Connection failed to target: %s", strerror(errno));
+        release_connection(g_connection_pool, &source, 1);
+        return -1;
+    }
+    
+    if (source.version < 2 || target.version < 2) {
+        log_worker_event(job, "PULL", "ERROR", "File: %s - ranged transfer needs protocol version 2",
+                         job->filename);
+        release_connection(g_connection_pool, &source, 1);
+        release_connection(g_connection_pool, &target, 1);
+        return -1;
+    }
+    
+    char command[MAX_COMMAND_SIZE];
+    uint32_t stream_id = next_stream_id();
+    pull_stream_t pull = { source.fd, source.version, stream_id, 0, 0, 0, 0, "", 0, 0 };
+    push_stream_t push = { target.fd, target.version, stream_id, target_path, 0, "" };
+    
+    int len = snprintf(command, sizeof(command), "%s %lld %lld %s", CMD_RANGE,
+                       (long long)job->range_offset, (long long)job->range_length, source_path);
+    long first_chunk = -1;
+    if (send_frame_flags(source.fd, FRAME_CMD, compress_flags(job, &source, &target), stream_id,
+                         command, len) == 0) {
+        first_chunk = next_pull_chunk(&pull);
+    }
+    if (first_chunk < 0) {
+        log_worker_event(job, "PULL", "ERROR", "File: %s - %s", job->filename,
+                         pull.error[0] ? pull.error : strerror(errno));
+        release_connection(g_connection_pool, &source, pull.clean);
+        release_connection(g_connection_pool, &target, 1);
+        return -1;
+    }
+    
+    uint32_t open_flags = (group ? OPEN_FLAG_RANGE : 0) | nested_open_flags(job->filename, strlen(job->filename));
+    if (start_push(&push, open_flags, job->range_offset, group ? group->id : 0) != 0) {
+        release_connection(g_connection_pool, &source, 0);
+        release_connection(g_connection_pool, &target, 0);
+        return -1;
+    }
+    
+    long wire_bytes;
+    long total_transferred = relay_file_data(&pull, &push, first_chunk, job->info, job->journal_id,
+                                             job->range_offset, &wire_bytes);
+    if (total_transferred != job->range_length) {
+        // A short range means the source file shrank since it was listed
+        abort_push(&push);
+        log_worker_event(job, "PULL", "ERROR", "File: %s - %s", job->filename,
+                         total_transferred >= 0 ? "source file changed during transfer" :
+                         interrupt_reason(job, &pull));
+        release_connection(g_connection_pool, &source, total_transferred >= 0 && pull.clean);
+        release_connection(g_connection_pool, &target, total_transferred >= 0);
+        return -1;
+    }
+    
+    int push_result = finish_push(&push, job->range_offset + total_transferred, group ? 0 : job->mtime);
+    
+    release_connection(g_connection_pool, &source, pull.clean);
+    release_connection(g_connection_pool, &target, push.clean);
+    
+    char note[64];
+    log_worker_event(job, "PULL", "SUCCESS", "%ld bytes pulled at offset %lld%s",
+                     total_transferred, (long long)job->range_offset,
+                     wire_note(&pull, wire_bytes, note, sizeof(note)));
+    if (push_result != 0) {
+        log_worker_event(job, "PUSH", "ERROR", "File: %s - %s", job->filename,
+                         push.error[0] ? push.error : "target connection failed");
+        return -1;
+    }
+    log_worker_event(job, "PUSH", "SUCCESS", "%ld bytes pushed at offset %lld",
+                     total_transferred, (long long)job->range_offset);
+    note_transfer(job, total_transferred, group ? 0 : 1);
+    return 0;
+}
+
+/**
+ * Finalize a file once all its ranges are settled: move the part file
+ * into place, or remove it if a range failed. Returns 0 if the file was
+ * committed, -1 otherwise.
+ */
+static int commit_range_group(sync_job_t *job, range_group_t *group, const char *target_path) {
+    client_conn_t target;
+    if (acquire_connection(g_connection_pool, job->info->target_host, job->info->target_port, &target) != 0) {
+        log_worker_event(job, "PUSH", "ERROR", "Connection failed to target: %s", strerror(errno));
+        return -1;
+    }
+    
+    char command[MAX_COMMAND_SIZE];
+    uint32_t stream_id = next_stream_id();
+    int len = snprintf(command, sizeof(command), "%s %lld %lld %llu %s", CMD_COMMIT,
+                       (long long)group->size, (long long)group->mtime,
+                       (unsigned long long)group->id, target_path);
+    
+    // COMMIT is answered like a PULL without data
+    pull_stream_t reply = { target.fd, target.version, stream_id, 0, 0, 0, 0, "", 0, 0 };
+    long result = -1;
+    if (target.version >= 2 &&
+        send_frame_flags(target.fd, FRAME_CMD, group->failed ? COMMIT_FLAG_DISCARD : 0,
+                         stream_id, command, len) == 0) {
+        result = next_pull_chunk(&reply);
+    }
+    release_connection(g_connection_pool, &target, reply.clean && result == 0);
+    
+    if (group->failed) {
+        log_worker_event(job, "PUSH", "ERROR", "File: %s - discarded, not all %d ranges arrived",
+                         job->filename, group->ranges);
+        return -1;
+    }
+    if (result != 0) {
+        log_worker_event(job, "PUSH", "ERROR", "File: %s - commit failed: %s", job->filename,
+                         reply.error[0] ? reply.error : "target connection failed");
+        return -1;
+    }
+    log_worker_event(job, "PUSH", "SUCCESS", "%lld bytes committed from %d ranges",
+                     (long long)group->size, group->ranges);
+    note_transfer(job, 0, 1);
+    return 0;
+}
+
+/**
+ * One file of a batch job on its way to the target.
+ */
+typedef struct {
+    const char *name;                ///< Name in the batch list, not terminated
+    int name_len;                    ///< Length of name
+    uint32_t stream_id;              ///< PUSH stream awaiting its acknowledgement
+    long size;                       ///< File bytes relayed
+} batch_file_t;
+
+/**
+ * Move the files of a batch job: one BATCH request to the source, whose
+ * replies are relayed to the target as one PUSH stream per file. The
+ * streams are not acknowledged one by one; the acknowledgements are read
+ * after the last file, so a file costs no round trip of its own. Returns
+ * the number of files that did not reach the target.
+ */
+static int transfer_batch(sync_job_t *job) {
+    file_batch_t *batch = job->batch;
+    batch_file_t files[BATCH_MAX_FILES];
+    int count = 0;
+    
+    for (const char *cursor = batch->names; count < BATCH_MAX_FILES && cursor < batch->names + batch->length; ) {
+        const char *newline = memchr(cursor, '\n', batch->names + batch->length - cursor);
+        if (!newline) break;
+        files[count].name = cursor;
+        files[count].name_len = (int)(newline - cursor);
+        count++;
+        cursor = newline + 1;
+    }
+    
+    client_conn_t source;
+    if (acquire_connection(g_connection_pool, job->info->source_host, job->info->source_port, &source) != 0) {
+        log_worker_event(job, "PULL", "ERROR", "Connection failed to source: %s", strerror(errno));
+        return count;
+    }
+    
+    client_conn_t target;
+    if (acquire_connection(g_connection_pool, job->info->target_host, job->info->target_port, &target) != 0) {
+        log_worker_event(job, "PUSH", "ERROR", "Connection failed to target: %s", strerror(errno));
+        release_connection(g_connection_pool, &source, 1);
+        return count;
+    }
+    
+    if (source.version < 2 || target.version < 2 || !(source.features & FEATURE_BATCH)) {
+        log_worker_event(job, "PULL", "ERROR", "Batch of %d files from %s to %s - source cannot serve BATCH",
+                         count, job->info->source_dir, job->info->target_dir);
+        release_connection(g_connection_pool, &source, 1);
+        release_connection(g_connection_pool, &target, 1);
+        return count;
+    }
+    
+    char command[MAX_COMMAND_SIZE];
+    uint32_t stream_id = next_stream_id();
+    int len = snprintf(command, sizeof(command), "%s %s", CMD_BATCH, job->info->source_dir);
+    int source_ok = send_frame_flags(source.fd, FRAME_CMD, compress_flags(job, &source, &target), stream_id,
+                                     command, len) == 0 &&
+                    send_frame(source.fd, FRAME_DATA, stream_id, batch->names, batch->length) == 0 &&
+                    send_end_frame(source.fd, stream_id, count, 0) == 0;
+    int target_ok = 1, target_reusable = 1;
+    
+    // Relay the replies in order; a file the source cannot send is skipped
+    int failed = 0, pushed = 0, next = 0, compressed = 0;
+    int64_t pulled = 0;
+    long wire_total = 0;
+    const char *reason = NULL;
+    for (; next < count && source_ok && target_ok; next++) {
+        batch_file_t *file = &files[next];
+        if (!pair_active(job->info)) {
+            reason = "cancelled";
+            break;
+        }
+        
+        pull_stream_t pull = { source.fd, source.version, stream_id, 0, 0, 0, 0, "", 0, 0 };
+        long first_chunk = next_pull_chunk(&pull);
+        if (first_chunk < 0) {
+            log_worker_event(job, "PULL", "ERROR", "File: %.*s - %s", file->name_len, file->name,
+                             pull.error[0] ? pull.error : strerror(errno));
+            failed++;
+            source_ok = pull.clean;
+            continue;
+        }
+        
+        char target_path[MAX_PATH * 2];
+        snprintf(target_path, sizeof(target_path), "%s/%.*s", job->info->target_dir,
+                 file->name_len, file->name);
+        push_stream_t push = { target.fd, target.version, next_stream_id(), target_path, 0, "" };
+        if (start_push(&push, nested_open_flags(file->name, file->name_len), 0, 0) != 0) {
+            failed++;
+            source_ok = target_ok = 0;
+            continue;
+        }
+        
+        long wire_bytes;
+        long size = relay_file_data(&pull, &push, first_chunk, job->info, 0, 0, &wire_bytes);
+        if (size < 0) {
+            // Streams already ended are still acknowledged, ahead of this one
+            abort_push(&push);
+            log_worker_event(job, "PULL", "ERROR", "File: %.*s - %s", file->name_len, file->name,
+                             interrupt_reason(job, &pull));
+            failed++;
+            source_ok = target_reusable = 0;
+            continue;
+        }
+        if (end_push(&push, size, pull.mtime) != 0) {
+            failed++;
+            source_ok = target_ok = 0;
+            continue;
+        }
+        
+        file->stream_id = push.stream_id;
+        file->size = size;
+        files[pushed++] = *file;
+        pulled += size;
+        wire_total += wire_bytes;
+        compressed |= pull.compressed;
+    }
+    
+    // Files never reached, as the batch broke off
+    if (next < count) {
+        log_worker_event(job, "PULL", "ERROR", "Batch from %s to %s - %d files not transferred: %s",
+                         job->info->source_dir, job->info->target_dir, count - next, reason ? reason : "transfer interrupted");
+        failed += count - next;
+    }
+    
+    char note[64] = "";
+    if (compressed) snprintf(note, sizeof(note), " (%ld compressed)", wire_total);
+    if (pushed > 0) {
+        log_worker_event(job, "PULL", "SUCCESS", "%d files, %lld bytes pulled in one batch%s",
+                         pushed, (long long)pulled, note);
+    }
+    
+    // The target acknowledges the streams in the order they were sent
+    int landed = 0;
+    int64_t bytes = 0;
+    for (int i = 0; i < pushed; i++) {
+        push_stream_t push = { target.fd, target.version, files[i].stream_id, NULL, 0, "" };
+        if (!target_ok || read_push_ack(&push) != 0) {
+            log_worker_event(job, "PUSH", "ERROR", "File: %.*s - %s", files[i].name_len, files[i].name,
+                             push.error[0] ? push.error : "target connection failed");
+            target_ok = target_ok && push.clean;
+            failed++;
+            continue;
+        }
+        landed++;
+        bytes += files[i].size;
+    }
+    
+    release_connection(g_connection_pool, &source, source_ok && next == count);
+    release_connection(g_connection_pool, &target, target_ok && target_reusable);
+    
+    if (landed > 0) {
+        log_worker_event(job, "PUSH", "SUCCESS", "%d files, %lld bytes pushed", landed, (long long)bytes);
+        note_transfer(job, bytes, landed);
+    }
+    return failed;
+}
+
+int sync_single_file(sync_job_t *job) {
+    if (!job) return -1;
+    
+    char source_path[MAX_PATH * 2];
+    char target_path[MAX_PATH * 2];
+    
+    // Build full paths
+    snprintf(source_path, sizeof(source_path), "%s/%s", job->info->source_dir, job->filename);
+    snprintf(target_path, sizeof(target_path), "%s/%s", job->info->target_dir, job->filename);
+    
+    // Jobs of a cancelled pair that were not purged end here, without I/O
+    int cancelled = !pair_active(job->info);
+    if (cancelled) {
+        log_worker_event(job, "PULL", "SKIPPED", "File: %s - cancelled", job->filename);
+    }
+    
+    if (job->group) {
+        // This worker settles the range, free_sync_job() must not
+        range_group_t *group = job->group;
+        job->group = NULL;
+        
+        // The last range settled discards the part file of a cancelled pair
+        int result = cancelled ? -1 : transfer_range(job, group, source_path, target_path);
+        if (finish_range(group, result == 0)) {
+            if (commit_range_group(job, group, target_path) != 0) result = -1;
+            free_range_group(group);
+        }
+        return result;
+    }
+    if (cancelled) {
+        return -1;
+    }
+    
+    if (job->range_length > 0) {
+        // A whole file resumed from the journal carries on at its offset
+        return transfer_range(job, NULL, source_path, target_path);
+    }
+    
+    if (job->batch) {
+        int failed = transfer_batch(job);
+        if (failed > 1) {
+            __atomic_add_fetch(&job->info->error_count, failed - 1, __ATOMIC_RELAXED);
+        }
+        return failed > 0 ? -1 : 0;
+    }
+    
+    // Borrow sessions to both clients. Each side may be an older client
+    // that only speaks the text protocol
+    client_conn_t source;
+    if (acquire_connection(g_connection_pool, job->info->source_host, job->info->source_port, &source) != 0) {
+        log_worker_event(job, "PULL", "ERROR", "Connection failed to source: %s", strerror(errno));
+        return -1;
+    }
+    
+    client_conn_t target;
+    if (acquire_connection(g_connection_pool, job->info->target_host, job->info->target_port, &target) != 0) {
+        log_worker_event(job, "PUSH", "ERROR", "Connection failed to target: %s", strerror(errno));
+        release_connection(g_connection_pool, &source, 1);
+        return -1;
+    }
+    
+    if (job->delta_block_size > 0 && source.version >= 2 && target.version >= 2) {
+        int source_clean, target_clean;
+        int result = sync_file_delta(job, &source, &target, source_path, target_path,
+                                     &source_clean, &target_clean);
+        if (result <= 0) {
+            release_connection(g_connection_pool, &source, source_clean);
+            release_connection(g_connection_pool, &target, target_clean);
+            return result;
+        }
+        // Nothing was written: copy the whole file over the same sessions
+    }
+    
+    uint32_t stream_id = next_stream_id();
+    pull_stream_t pull = { source.fd, source.version, stream_id, 0, 0, 0, 0, "", 0, 0 };
+    push_stream_t push = { target.fd, target.version, stream_id, target_path, 0, "" };
+    
+    // Send PULL command to source and wait for the first chunk, so a
+    // missing source file never touches the target
+    long first_chunk = -1;
+    if (start_pull(&pull, source_path, compress_flags(job, &source, &target)) == 0) {
+        first_chunk = next_pull_chunk(&pull);
+    }
+    if (first_chunk < 0) {
+        // Error from source
+        log_worker_event(job, "PULL", "ERROR", "File: %s - %s", job->filename,
+                         pull.error[0] ? pull.error : strerror(errno));
+        release_connection(g_connection_pool, &source, pull.clean);
+        release_connection(g_connection_pool, &target, 1);
+        return -1;
+    }
+    
+    if (start_push(&push, nested_open_flags(job->filename, strlen(job->filename)), 0, 0) != 0) {
+        release_connection(g_connection_pool, &source, 0);
+        release_connection(g_connection_pool, &target, 0);
+        return -1;
+    }
+    
+    long wire_bytes;
+    long total_transferred = relay_file_data(&pull, &push, first_chunk, job->info, job->journal_id, 0,
+                                             &wire_bytes);
+    if (total_transferred < 0) {
+        // No end marker: the target discards its part file and keeps the copy it had
+        abort_push(&push);
+        log_worker_event(job, "PULL", "ERROR", "File: %s - %s", job->filename,
+                         interrupt_reason(job, &pull));
+        release_connection(g_connection_pool, &source, 0);
+        release_connection(g_connection_pool, &target, 0);
+        return -1;
+    }
+    
+    // Send end-of-file marker to target
+    int push_result = finish_push(&push, total_transferred, pull.mtime);
+    
+    release_connection(g_connection_pool, &source, pull.clean);
+    release_connection(g_connection_pool, &target, push.clean);
+    
+    // Log transfer result
+    char note[64];
+    log_worker_event(job, "PULL", "SUCCESS", "%ld bytes pulled%s", total_transferred,
+                     wire_note(&pull, wire_bytes, note, sizeof(note)));
+    if (push_result != 0) {
+        log_worker_event(job, "PUSH", "ERROR", "File: %s - %s", job->filename,
+                         push.error[0] ? push.error : "target connection failed");
+        return -1;
+    }
+    log_worker_event(job, "PUSH", "SUCCESS", "%ld bytes pushed", total_transferred);
+    note_transfer(job, total_transferred, 1);
+    
+    return 0;
+}
+
+void* worker_thread(void *arg) {
+    thread_pool_t *pool = (thread_pool_t*)arg;
+    
+    // Index of this worker's stats and, with work stealing, of its queue
+    t_worker_index = __atomic_fetch_add(&pool->next_worker, 1, __ATOMIC_RELAXED);
+    worker_stats_t *stats = &pool->stats[t_worker_index % pool->thread_count];
+    t_worker_stats = stats;
+    
+    printf("Worker thread %d started\n", (int)pthread_self());
+    
+    while (1) {
+        sync_job_t *job = dequeue_sync_job(pool);
+        if (!job) {
+            // Pool is shutting down
+            break;
+        }
+        
+        LOG_DEBUG("Worker %d processing file: %s", (int)pthread_self(), job->filename);
+        
+        uint64_t started = metrics_now_us();
+        if (job->enqueued_us > 0) {
+            histogram_observe(&g_metrics.queue_wait, started - job->enqueued_us);
+        }
+        
+        // Process the sync job
+        int result = sync_single_file(job);
+        uint64_t elapsed = metrics_now_us() - started;
+        __atomic_add_fetch(&stats->jobs, 1, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&stats->busy_us, elapsed, __ATOMIC_RELAXED);
+        if (result != 0) {
+            __atomic_add_fetch(&stats->errors, 1, __ATOMIC_RELAXED);
+            __atomic_add_fetch(&job->info->error_count, 1, __ATOMIC_RELAXED);
+            LOG_WARN("Worker %d failed to sync file: %s", (int)pthread_self(), job->filename);
+        } else {
+            histogram_observe(&g_metrics.transfer, elapsed);
+            LOG_DEBUG("Worker %d successfully synced file: %s", (int)pthread_self(), job->filename);
+        }
+        
+        if (throttle_release(job->info)) {
+            wake_held_back(pool);
+        }
+        // Failed or not, the job is over: the target discarded a failed one's part file
+        journal_done(g_journal, job->journal_id);
+        job->journal_id = 0;
+        free_sync_job(job);
+    }
+    
+    release_relay_ring();
+    printf("Worker thread %d finished\n", (int)pthread_self());
+    return NULL;
+}
+
+void signal_shutdown(thread_pool_t *pool) {
+    if (!pool) return;
+    
+    pthread_mutex_lock(&pool->queue_mutex);
+    pool->shutdown = 1;
+    wake_all_workers(pool);
     pthread_mutex_unlock(&pool->queue_mutex);
 }
 
@@ -0,0 +1,374 @@
+#include "../include/throttle.h"
+#include "../include/metrics.h"
+#include <limits.h>
+#include <sched.h>
+
+// Session cap of one client
+typedef struct throttle_endpoint {
+    char host[MAX_HOST_SIZE];
+    int port;
+    int max_sessions;                ///< Sessions at most, 0 for no cap
+    int active;                      ///< Sessions of admitted jobs not yet released
+    struct throttle_endpoint *next;
+} throttle_endpoint_t;
+
+// Rate limit of one host
+typedef struct throttle_host {
+    char host[MAX_HOST_SIZE];
+    int64_t rate;                    ///< Bytes per second, 0 for no limit
+    token_bucket_t bucket;
+    struct throttle_host *next;
+} throttle_host_t;
+
+/**
+ * One lock for the tables and session counts, taken once per admitted or
+ * ended job. Pairs keep the entries of their hosts and clients (looked up
+ * again when g_generation moves on), and buckets have a spin lock each,
+ * so chunks are paced without this lock or a table walk.
+ */
+static pthread_mutex_t g_throttle_lock = PTHREAD_MUTEX_INITIALIZER;
+static int g_generation = 1;
+static throttle_endpoint_t *g_endpoints = NULL;
+static throttle_host_t *g_hosts = NULL;
+static int g_default_sessions = 0;
+static int64_t g_default_rate = 0;
+
+// Read without the lock on every job and chunk, written only at startup
+static int g_any_sessions = 0;
+static int g_any_rate = 0;
+
+// A quarter second of the rate, but never less than THROTTLE_BURST_MIN
+static double bucket_burst(int64_t rate) {
+    double burst = (double)rate / 4;
+    return burst < THROTTLE_BURST_MIN ? THROTTLE_BURST_MIN : burst;
+}
+
+static void refill_bucket(token_bucket_t *bucket, int64_t rate, uint64_t now_us) {
+    double burst = bucket_burst(rate);
+    if (bucket->updated_us == 0) {
+        bucket->tokens = burst;
+    } else if (now_us > bucket->updated_us) {
+        bucket->tokens += (double)(now_us - bucket->updated_us) * (double)rate / 1000000.0;
+        if (bucket->tokens > burst) bucket->tokens = burst;
+    }
+    if (now_us > bucket->updated_us) bucket->updated_us = now_us;
+}
+
+static void lock_bucket(token_bucket_t *bucket) {
+    while (__atomic_exchange_n(&bucket->busy, 1, __ATOMIC_ACQUIRE)) {
+        sched_yield();
+    }
+}
+
+static void unlock_bucket(token_bucket_t *bucket) {
+    __atomic_store_n(&bucket->busy, 0, __ATOMIC_RELEASE);
+}
+
+// token_bucket_delay() that other threads may share the bucket with
+static int64_t shared_bucket_delay(token_bucket_t *bucket, int64_t rate, uint64_t now_us) {
+    lock_bucket(bucket);
+    int64_t wait = token_bucket_delay(bucket, rate, now_us);
+    unlock_bucket(bucket);
+    return wait;
+}
+
+static int64_t shared_bucket_take(token_bucket_t *bucket, int64_t rate, int64_t bytes, uint64_t now_us) {
+    lock_bucket(bucket);
+    int64_t wait = token_bucket_take(bucket, rate, bytes, now_us);
+    unlock_bucket(bucket);
+    return wait;
+}
+
+int64_t token_bucket_delay(token_bucket_t *bucket, int64_t rate, uint64_t now_us) {
+    refill_bucket(bucket, rate, now_us);
+    if (bucket->tokens >= 0) return 0;
+    return (int64_t)(-bucket->tokens * 1000000.0 / (double)rate) + 1;
+}
+
+int64_t token_bucket_take(token_bucket_t *bucket, int64_t rate, int64_t bytes, uint64_t now_us) {
+    refill_bucket(bucket, rate, now_us);
+    bucket->tokens -= (double)bytes;
+    return token_bucket_delay(bucket, rate, now_us);
+}
+
+// Entry of a client, created with the default cap if it has none. Lock held
+static throttle_endpoint_t* find_endpoint(const char *host, int port, int create) {
+    for (throttle_endpoint_t *endpoint = g_endpoints; endpoint; endpoint = endpoint->next) {
+        if (endpoint->port == port && strcmp(endpoint->host, host) == 0) return endpoint;
+    }
+    if (!create) return NULL;
+    
+    throttle_endpoint_t *endpoint = calloc(1, sizeof(throttle_endpoint_t));
+    if (!endpoint) return NULL;
+    strncpy(endpoint->host, host, MAX_HOST_SIZE - 1);
+    endpoint->port = port;
+    endpoint->max_sessions = g_default_sessions;
+    endpoint->next = g_endpoints;
+    g_endpoints = endpoint;
+    return endpoint;
+}
+
+// Entry of a host, created with the default rate if it has none. Lock held
+static throttle_host_t* find_host(const char *host, int create) {
+    for (throttle_host_t *entry = g_hosts; entry; entry = entry->next) {
+        if (strcmp(entry->host, host) == 0) return entry;
+    }
+    if (!create) return NULL;
+    
+    throttle_host_t *entry = calloc(1, sizeof(throttle_host_t));
+    if (!entry) return NULL;
+    strncpy(entry->host, host, MAX_HOST_SIZE - 1);
+    entry->rate = g_default_rate;
+    entry->next = g_hosts;
+    g_hosts = entry;
+    return entry;
+}
+
+int throttle_set_sessions(const char *host, int port, int max_sessions) {
+    if (max_sessions < 0 || (host && (port <= 0 || !host[0]))) return -1;
+    
+    pthread_mutex_lock(&g_throttle_lock);
+    int result = 0;
+    if (!host) {
+        g_default_sessions = max_sessions;
+    } else {
+        throttle_endpoint_t *endpoint = find_endpoint(host, port, 1);
+        if (endpoint) {
+            endpoint->max_sessions = max_sessions;
+        } else {
+            result = -1;
+        }
+    }
+    if (max_sessions > 0 && result == 0) g_any_sessions = 1;
+    __atomic_add_fetch(&g_generation, 1, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&g_throttle_lock);
+    return result;
+}
+
+int throttle_set_rate(const char *host, int64_t bytes_per_sec) {
+    if (bytes_per_sec < 0 || (host && !host[0])) return -1;
+    
+    pthread_mutex_lock(&g_throttle_lock);
+    int result = 0;
+    if (!host) {
+        g_default_rate = bytes_per_sec;
+    } else {
+        throttle_host_t *entry = find_host(host, 1);
+        if (entry) {
+            entry->rate = bytes_per_sec;
+        } else {
+            result = -1;
+        }
+    }
+    if (bytes_per_sec > 0 && result == 0) g_any_rate = 1;
+    __atomic_add_fetch(&g_generation, 1, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&g_throttle_lock);
+    return result;
+}
+
+// Split "name=number" at the last '=': *name is NULL without one. Returns the number or -1
+static long long split_limit(char *text, char **name, long long max) {
+    char *equals = strrchr(text, '=');
+    char *number = text;
+    *name = NULL;
+    if (equals) {
+        *equals = '\0';
+        *name = text;
+        number = equals + 1;
+    }
+    
+    char *end;
+    long long value = strtoll(number, &end, 10);
+    if (*number == '\0' || *end != '\0' || value < 0 || value > max) return -1;
+    return value;
+}
+
+int parse_throttle_sessions(const char *text) {
+    char copy[MAX_HOST_SIZE + 32];
+    if (!text || strlen(text) >= sizeof(copy)) return -1;
+    strcpy(copy, text);
+    
+    char *host;
+    long long max_sessions = split_limit(copy, &host, INT_MAX);
+    if (max_sessions < 0) return -1;
+    if (!host) return throttle_set_sessions(NULL, 0, (int)max_sessions);
+    
+    char *colon = strrchr(host, ':');
+    if (!colon) return -1;
+    *colon = '\0';
+    char *end;
+    long port = strtol(colon + 1, &end, 10);
+    if (colon[1] == '\0' || *end != '\0' || port <= 0 || port > 65535) return -1;
+    return throttle_set_sessions(host, (int)port, (int)max_sessions);
+}
+
+int parse_throttle_rate(const char *text) {
+    char copy[MAX_HOST_SIZE + 32];
+    if (!text || strlen(text) >= sizeof(copy)) return -1;
+    strcpy(copy, text);
+    
+    char *host;
+    long long kib = split_limit(copy, &host, MAX_RATE_KIB);
+    if (kib < 0) return -1;
+    return throttle_set_rate(host, (int64_t)kib * 1024);
+}
+
+int throttle_caps_sessions(void) {
+    return g_any_sessions;
+}
+
+// Lower *retry_us to wait unless it already asks for less
+static void note_retry(uint64_t *retry_us, uint64_t wait) {
+    if (wait > THROTTLE_RETRY_MAX_US) wait = THROTTLE_RETRY_MAX_US;
+    if (*retry_us == 0 || wait < *retry_us) *retry_us = wait;
+}
+
+// Bucket of a limited host, NULL if it has no rate. Lock held
+static throttle_host_t* limited_host(const char *host) {
+    if (!g_any_rate) return NULL;
+    throttle_host_t *entry = find_host(host, g_default_rate > 0);
+    return entry && entry->rate > 0 ? entry : NULL;
+}
+
+// Client with a cap, NULL if it has none. Lock held
+static throttle_endpoint_t* capped_endpoint(const char *host, int port) {
+    throttle_endpoint_t *endpoint = find_endpoint(host, port, g_default_sessions > 0);
+    return endpoint && endpoint->max_sessions > 0 ? endpoint : NULL;
+}
+
+/**
+ * Look up the capped clients and limited hosts of a pair unless it has
+ * them from the current limits. A pair within one client keeps that
+ * client twice, as its jobs hold two sessions there; a pair within one
+ * host keeps it once, so its data counts once against the host rate.
+ * Lock held.
+ */
+static void resolve_limits(sync_info_t *info) {
+    int generation = __atomic_load_n(&g_generation, __ATOMIC_RELAXED);
+    if (info->throttle_generation == generation) return;
+    
+    info->capped[0] = g_any_sessions ? capped_endpoint(info->source_host, info->source_port) : NULL;
+    info->capped[1] = g_any_sessions ? capped_endpoint(info->target_host, info->target_port) : NULL;
+    info->limited[0] = limited_host(info->source_host);
+    info->limited[1] = limited_host(info->target_host);
+    if (info->limited[1] == info->limited[0]) info->limited[1] = NULL;
+    __atomic_store_n(&info->throttle_generation, generation, __ATOMIC_RELEASE);
+}
+
+int throttle_admit(sync_info_t *info, uint64_t *retry_us) {
+    if (!g_any_sessions && !g_any_rate && info->options.rate == 0) return 1;
+    
+    pthread_mutex_lock(&g_throttle_lock);
+    resolve_limits(info);
+    uint64_t now_us = metrics_now_us();
+    
+    // A pair or host in debt would only make the job sleep in throttle_pace()
+    int64_t wait = 0;
+    if (info->options.rate > 0) {
+        wait = shared_bucket_delay(&info->bucket, info->options.rate, now_us);
+    }
+    for (int i = 0; i < 2; i++) {
+        throttle_host_t *host = info->limited[i];
+        if (!host) continue;
+        int64_t host_wait = shared_bucket_delay(&host->bucket, host->rate, now_us);
+        if (host_wait > wait) wait = host_wait;
+    }
+    if (wait > 0) {
+        pthread_mutex_unlock(&g_throttle_lock);
+        note_retry(retry_us, (uint64_t)wait);
+        return 0;
+    }
+    
+    // A job holds a session against its source and one against its target.
+    // A client idle otherwise runs one job even if that is over its cap
+    int sessions = info->capped[0] == info->capped[1] ? 2 : 1;
+    for (int i = 0; i < 2; i++) {
+        throttle_endpoint_t *endpoint = info->capped[i];
+        if (endpoint && endpoint->active > 0 && endpoint->active + sessions > endpoint->max_sessions) {
+            // Freed by throttle_release(), which wakes the scheduler
+            pthread_mutex_unlock(&g_throttle_lock);
+            note_retry(retry_us, THROTTLE_RETRY_MAX_US);
+            return 0;
+        }
+    }
+    for (int i = 0; i < 2; i++) {
+        if (info->capped[i]) info->capped[i]->active++;
+    }
+    pthread_mutex_unlock(&g_throttle_lock);
+    return 1;
+}
+
+int throttle_release(sync_info_t *info) {
+    if (!g_any_sessions) return 0;
+    
+    pthread_mutex_lock(&g_throttle_lock);
+    int freed = 0;
+    for (int i = 0; i < 2; i++) {
+        throttle_endpoint_t *endpoint = info->capped[i];
+        if (endpoint && endpoint->active > 0) {
+            endpoint->active--;
+            freed = 1;
+        }
+    }
+    pthread_mutex_unlock(&g_throttle_lock);
+    return freed;
+}
+
+void throttle_pace(sync_info_t *info, size_t bytes) {
+    if (!g_any_rate && info->options.rate == 0) return;
+    
+    if (__atomic_load_n(&info->throttle_generation, __ATOMIC_ACQUIRE) !=
+        __atomic_load_n(&g_generation, __ATOMIC_ACQUIRE)) {
+        pthread_mutex_lock(&g_throttle_lock);
+        resolve_limits(info);
+        pthread_mutex_unlock(&g_throttle_lock);
+    }
+    
+    uint64_t now_us = metrics_now_us();
+    int64_t wait = 0;
+    if (info->options.rate > 0) {
+        wait = shared_bucket_take(&info->bucket, info->options.rate, (int64_t)bytes, now_us);
+    }
+    for (int i = 0; i < 2; i++) {
+        throttle_host_t *host = info->limited[i];
+        if (!host) continue;
+        int64_t host_wait = shared_bucket_take(&host->bucket, host->rate, (int64_t)bytes, now_us);
+        if (host_wait > wait) wait = host_wait;
+    }
+    
+    // Sleep in slices so a cancelled pair does not wait out its debt
+    while (wait > 0 && __atomic_load_n(&info->active, __ATOMIC_RELAXED)) {
+        int64_t slice = wait < THROTTLE_RETRY_MAX_US ? wait : THROTTLE_RETRY_MAX_US;
+        struct timespec pause = { slice / 1000000, (slice % 1000000) * 1000 };
+        nanosleep(&pause, NULL);
+        wait -= slice;
+    }
+}
+
+int throttle_active_sessions(const char *host, int port) {
+    pthread_mutex_lock(&g_throttle_lock);
+    throttle_endpoint_t *endpoint = find_endpoint(host, port, 0);
+    int active = endpoint && endpoint->max_sessions > 0 ? endpoint->active : 0;
+    pthread_mutex_unlock(&g_throttle_lock);
+    return active;
+}
+
+void throttle_reset(void) {
+    pthread_mutex_lock(&g_throttle_lock);
+    while (g_endpoints) {
+        throttle_endpoint_t *next = g_endpoints->next;
+        free(g_endpoints);
+        g_endpoints = next;
+    }
+    while (g_hosts) {
+        throttle_host_t *next = g_hosts->next;
+        free(g_hosts);
+        g_hosts = next;
+    }
+    g_default_sessions = 0;
+    g_default_rate = 0;
+    g_any_sessions = 0;
+    g_any_rate = 0;
+    __atomic_add_fetch(&g_generation, 1, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&g_throttle_lock);
+}
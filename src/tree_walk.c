@@ -0,0 +1,206 @@
+#include "../include/tree_walk.h"
+
+/**
+ * A directory waiting to be read, named by its path relative to the
+ * root of the walk ("" for the root itself).
+ */
+typedef struct pending_dir {
+    struct pending_dir *next;
+    char path[];
+} pending_dir_t;
+
+typedef struct {
+    int root_fd;                     ///< Root directory of the walk
+    int flags;                       ///< TREE_WALK_* flags
+    tree_visit_fn visit;             ///< Called for every regular file
+    void *ctx;                       ///< Passed to visit
+    pthread_mutex_t lock;            ///< Protects the fields below
+    pthread_cond_t ready;            ///< A directory was pushed, or the walk is over
+    pending_dir_t *stack;            ///< Directories still to read
+    int busy;                        ///< Threads reading a directory
+    int idle;                        ///< Threads waiting for a directory
+    int stopped;                     ///< visit stopped the walk
+    int max_threads;                 ///< Threads allowed, the caller included
+    int helpers;                     ///< Helper threads started
+    pthread_t helper[TREE_WALK_THREADS]; ///< Helper threads to join
+} tree_walk_t;
+
+static void* walk_worker(void *arg);
+
+// Queue a directory, starting a helper when no thread is free to take it. Called with lock held
+static void push_dir_locked(tree_walk_t *walk, pending_dir_t *dir) {
+    dir->next = walk->stack;
+    walk->stack = dir;
+    
+    if (walk->idle > 0) {
+        pthread_cond_signal(&walk->ready);
+    } else if (!walk->stopped && walk->helpers < walk->max_threads - 1 &&
+               pthread_create(&walk->helper[walk->helpers], NULL, walk_worker, walk) == 0) {
+        walk->helpers++;
+    }
+}
+
+static int queue_dir(tree_walk_t *walk, const char *path, size_t len) {
+    pending_dir_t *dir = malloc(sizeof(pending_dir_t) + len + 1);
+    if (!dir) {
+        fprintf(stderr, "Skipping directory %s: out of memory\n", path);
+        return -1;
+    }
+    memcpy(dir->path, path, len + 1);
+    
+    pthread_mutex_lock(&walk->lock);
+    push_dir_locked(walk, dir);
+    pthread_mutex_unlock(&walk->lock);
+    return 0;
+}
+
+/**
+ * Read one directory: queue its subdirectories and visit its regular
+ * files. Returns 0 on success (also when the directory cannot be
+ * opened), -1 if visit stopped the walk.
+ */
+static int read_dir(tree_walk_t *walk, const char *path) {
+    // A fresh descriptor even for the root, so readdir() offsets are never shared
+    int fd = openat(walk->root_fd, path[0] ? path : ".", O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    if (fd < 0) {
+        fprintf(stderr, "Error opening directory %s: %s\n", path[0] ? path : ".", strerror(errno));
+        return 0;
+    }
+    DIR *dir = fdopendir(fd);
+    if (!dir) {
+        fprintf(stderr, "Error opening directory %s: %s\n", path[0] ? path : ".", strerror(errno));
+        close(fd);
+        return 0;
+    }
+    
+    int result = 0;
+    struct dirent *entry;
+    while (result == 0 && (entry = readdir(dir)) != NULL) {
+        const char *name = entry->d_name;
+        if (name[0] == '.') {
+            // Skip hidden files and . .. entries, or hand the files over unexamined
+            if ((walk->flags & TREE_WALK_HIDDEN) && (entry->d_type == DT_REG || entry->d_type == DT_UNKNOWN) &&
+                name[1] != '\0' && strcmp(name, "..") != 0) {
+                result = walk->visit(walk->ctx, fd, name, NULL, NULL);
+            }
+            continue;
+        }
+        
+        // d_type spares a stat for everything but links and file systems without it
+        unsigned char type = entry->d_type;
+        struct stat file_stat;
+        int have_stat = 0;
+        if (type == DT_UNKNOWN) {
+            if (fstatat(fd, name, &file_stat, AT_SYMLINK_NOFOLLOW) != 0) continue;
+            type = S_ISDIR(file_stat.st_mode) ? DT_DIR : S_ISREG(file_stat.st_mode) ? DT_REG :
+                   S_ISLNK(file_stat.st_mode) ? DT_LNK : DT_UNKNOWN;
+            have_stat = type == DT_REG;
+        }
+        if (type == DT_LNK) {
+            // Links count as the regular file they point to, never as a directory
+            if (fstatat(fd, name, &file_stat, 0) != 0 || !S_ISREG(file_stat.st_mode)) continue;
+            type = DT_REG;
+            have_stat = 1;
+        }
+        if (type != DT_REG && (type != DT_DIR || !(walk->flags & TREE_WALK_RECURSIVE))) continue;
+        
+        char child[MAX_FILENAME];
+        int len = path[0] ? snprintf(child, sizeof(child), "%s/%s", path, name) :
+                            snprintf(child, sizeof(child), "%s", name);
+        if (len < 0 || (size_t)len >= sizeof(child)) {
+            fprintf(stderr, "Skipping %s/%s: path too long\n", path[0] ? path : ".", name);
+            continue;
+        }
+        
+        if (type == DT_DIR) {
+            queue_dir(walk, child, (size_t)len);
+            continue;
+        }
+        if ((walk->flags & TREE_WALK_STAT) && !have_stat) {
+            if (fstatat(fd, name, &file_stat, 0) != 0 || !S_ISREG(file_stat.st_mode)) continue;
+        }
+        result = walk->visit(walk->ctx, fd, name, child, (walk->flags & TREE_WALK_STAT) ? &file_stat : NULL);
+    }
+    
+    closedir(dir);
+    return result;
+}
+
+// Take directories off the stack until none is left and no thread can push more
+static void* walk_worker(void *arg) {
+    tree_walk_t *walk = arg;
+    
+    pthread_mutex_lock(&walk->lock);
+    while (1) {
+        while (!walk->stack && walk->busy > 0 && !walk->stopped) {
+            walk->idle++;
+            pthread_cond_wait(&walk->ready, &walk->lock);
+            walk->idle--;
+        }
+        if (!walk->stack || walk->stopped) break;
+        
+        pending_dir_t *dir = walk->stack;
+        walk->stack = dir->next;
+        walk->busy++;
+        pthread_mutex_unlock(&walk->lock);
+        
+        int result = read_dir(walk, dir->path);
+        free(dir);
+        
+        pthread_mutex_lock(&walk->lock);
+        walk->busy--;
+        if (result != 0) walk->stopped = 1;
+        if (walk->stopped || (walk->busy == 0 && !walk->stack)) {
+            pthread_cond_broadcast(&walk->ready);
+        }
+    }
+    pthread_mutex_unlock(&walk->lock);
+    return NULL;
+}
+
+int walk_tree(int root_fd, int flags, int threads, tree_visit_fn visit, void *ctx) {
+    if (root_fd < 0 || !visit) return -1;
+    
+    tree_walk_t walk;
+    memset(&walk, 0, sizeof(walk));
+    walk.root_fd = root_fd;
+    walk.flags = flags;
+    walk.visit = visit;
+    walk.ctx = ctx;
+    walk.max_threads = threads < 1 ? 1 : threads > TREE_WALK_THREADS ? TREE_WALK_THREADS : threads;
+    pthread_mutex_init(&walk.lock, NULL);
+    pthread_cond_init(&walk.ready, NULL);
+    
+    pending_dir_t *root = malloc(sizeof(pending_dir_t) + 1);
+    if (!root) {
+        pthread_mutex_destroy(&walk.lock);
+        pthread_cond_destroy(&walk.ready);
+        return -1;
+    }
+    root->next = NULL;
+    root->path[0] = '\0';
+    walk.stack = root;
+    
+    // The caller reads the root itself; helpers join in as directories pile up
+    walk_worker(&walk);
+    
+    // After a stop, wait out threads still reading: they may start no more helpers
+    pthread_mutex_lock(&walk.lock);
+    while (walk.busy > 0) {
+        pthread_cond_wait(&walk.ready, &walk.lock);
+    }
+    pthread_mutex_unlock(&walk.lock);
+    for (int i = 0; i < walk.helpers; i++) {
+        pthread_join(walk.helper[i], NULL);
+    }
+    
+    // A stopped walk leaves directories nobody will read
+    while (walk.stack) {
+        pending_dir_t *next = walk.stack->next;
+        free(walk.stack);
+        walk.stack = next;
+    }
+    pthread_mutex_destroy(&walk.lock);
+    pthread_cond_destroy(&walk.ready);
+    return walk.stopped ? -1 : 0;
+}
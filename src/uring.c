@@ -0,0 +1,250 @@
+#include "../include/uring.h"
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define HAVE_IO_URING 1
+#endif
+#endif
+
+#ifdef HAVE_IO_URING
+
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+
+static int sys_io_uring_setup(unsigned entries, struct io_uring_params *params) {
+    return (int)syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int sys_io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags) {
+    return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+static int sys_io_uring_register(int fd, unsigned opcode, const void *arg, unsigned nr_args) {
+    return (int)syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+int uring_init(uring_t *ring) {
+    memset(ring, 0, sizeof(*ring));
+    ring->fd = -1;
+    
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    int fd = sys_io_uring_setup(URING_ENTRIES, &params);
+    if (fd < 0) return -1;
+    ring->fd = fd;
+    
+    ring->sq_map_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->cq_map_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        if (ring->cq_map_size > ring->sq_map_size) ring->sq_map_size = ring->cq_map_size;
+        ring->cq_map_size = ring->sq_map_size;
+    }
+    
+    ring->sq_map = mmap(NULL, ring->sq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                        fd, IORING_OFF_SQ_RING);
+    if (ring->sq_map == MAP_FAILED) {
+        ring->sq_map = NULL;
+        uring_exit(ring);
+        return -1;
+    }
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        ring->cq_map = ring->sq_map;
+    } else {
+        ring->cq_map = mmap(NULL, ring->cq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                            fd, IORING_OFF_CQ_RING);
+        if (ring->cq_map == MAP_FAILED) {
+            ring->cq_map = NULL;
+            uring_exit(ring);
+            return -1;
+        }
+    }
+    
+    ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                      fd, IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED) {
+        ring->sqes = NULL;
+        uring_exit(ring);
+        return -1;
+    }
+    
+    char *sq = ring->sq_map;
+    char *cq = ring->cq_map;
+    ring->sq_head = (unsigned*)(sq + params.sq_off.head);
+    ring->sq_tail = (unsigned*)(sq + params.sq_off.tail);
+    ring->sq_mask = *(unsigned*)(sq + params.sq_off.ring_mask);
+    ring->sq_array = (unsigned*)(sq + params.sq_off.array);
+    ring->cq_head = (unsigned*)(cq + params.cq_off.head);
+    ring->cq_tail = (unsigned*)(cq + params.cq_off.tail);
+    ring->cq_mask = *(unsigned*)(cq + params.cq_off.ring_mask);
+    ring->cqes = cq + params.cq_off.cqes;
+    
+    // Registered buffers are pinned once instead of mapped on every operation
+    size_t buffers_size = (size_t)URING_BUFFER_COUNT * URING_BUFFER_SIZE;
+    ring->buffers = mmap(NULL, buffers_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (ring->buffers == MAP_FAILED) {
+        ring->buffers = NULL;
+        uring_exit(ring);
+        return -1;
+    }
+    struct iovec iovecs[URING_BUFFER_COUNT];
+    for (int i = 0; i < URING_BUFFER_COUNT; i++) {
+        iovecs[i].iov_base = ring->buffers + (size_t)i * URING_BUFFER_SIZE;
+        iovecs[i].iov_len = URING_BUFFER_SIZE;
+    }
+    if (sys_io_uring_register(fd, IORING_REGISTER_BUFFERS, iovecs, URING_BUFFER_COUNT) != 0) {
+        uring_exit(ring);
+        return -1;
+    }
+    return 0;
+}
+
+void uring_exit(uring_t *ring) {
+    if (ring->fd < 0) return;
+    
+    if (ring->buffers) munmap(ring->buffers, (size_t)URING_BUFFER_COUNT * URING_BUFFER_SIZE);
+    if (ring->sqes) munmap(ring->sqes, ring->sqes_size);
+    if (ring->cq_map && ring->cq_map != ring->sq_map) munmap(ring->cq_map, ring->cq_map_size);
+    if (ring->sq_map) munmap(ring->sq_map, ring->sq_map_size);
+    close(ring->fd);
+    memset(ring, 0, sizeof(*ring));
+    ring->fd = -1;
+}
+
+char* uring_buffer(uring_t *ring, int index) {
+    return ring->buffers + (size_t)index * URING_BUFFER_SIZE;
+}
+
+// Claim the next submission entry, NULL if the queue is full
+static struct io_uring_sqe* next_sqe(uring_t *ring) {
+    unsigned head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+    unsigned tail = *ring->sq_tail + ring->queued;
+    if (tail - head > ring->sq_mask) return NULL;
+    
+    unsigned index = tail & ring->sq_mask;
+    struct io_uring_sqe *sqe = (struct io_uring_sqe*)ring->sqes + index;
+    memset(sqe, 0, sizeof(*sqe));
+    ring->sq_array[index] = index;
+    ring->queued++;
+    return sqe;
+}
+
+static int queue_op(uring_t *ring, uint8_t opcode, int fd, int index, size_t len, off_t offset,
+                    int msg_flags, uint64_t user_data, int link) {
+    struct io_uring_sqe *sqe = next_sqe(ring);
+    if (!sqe) return -1;
+    
+    sqe->opcode = opcode;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t)(uintptr_t)uring_buffer(ring, index);
+    sqe->len = (uint32_t)len;
+    sqe->off = (uint64_t)offset;
+    sqe->user_data = user_data;
+    if (opcode == IORING_OP_READ_FIXED || opcode == IORING_OP_WRITE_FIXED) {
+        sqe->buf_index = (uint16_t)index;
+    } else {
+        sqe->msg_flags = (uint32_t)msg_flags;
+    }
+    if (link) sqe->flags |= IOSQE_IO_LINK;
+    return 0;
+}
+
+int uring_queue_read(uring_t *ring, int fd, int index, size_t len, off_t offset,
+                     uint64_t user_data, int link) {
+    return queue_op(ring, IORING_OP_READ_FIXED, fd, index, len, offset, 0, user_data, link);
+}
+
+int uring_queue_write(uring_t *ring, int fd, int index, size_t len, off_t offset,
+                      uint64_t user_data, int link) {
+    return queue_op(ring, IORING_OP_WRITE_FIXED, fd, index, len, offset, 0, user_data, link);
+}
+
+int uring_queue_send(uring_t *ring, int sockfd, int index, size_t len, uint64_t user_data, int link) {
+    return queue_op(ring, IORING_OP_SEND, sockfd, index, len, 0, MSG_WAITALL | MSG_NOSIGNAL, user_data, link);
+}
+
+int uring_queue_recv(uring_t *ring, int sockfd, int index, size_t len, uint64_t user_data, int link) {
+    return queue_op(ring, IORING_OP_RECV, sockfd, index, len, 0, MSG_WAITALL, user_data, link);
+}
+
+int uring_submit_and_wait(uring_t *ring, unsigned wait_nr) {
+    unsigned to_submit = ring->queued;
+    __atomic_store_n(ring->sq_tail, *ring->sq_tail + ring->queued, __ATOMIC_RELEASE);
+    ring->queued = 0;
+    
+    while (1) {
+        int result = sys_io_uring_enter(ring->fd, to_submit, wait_nr, IORING_ENTER_GETEVENTS);
+        if (result >= 0) {
+            to_submit -= (unsigned)result < to_submit ? (unsigned)result : to_submit;
+            if (to_submit == 0) return 0;
+            continue; // Partial submit: hand in the rest
+        }
+        if (errno != EINTR) return -1;
+        to_submit = 0; // Anything submitted before the signal stays submitted; keep waiting
+    }
+}
+
+int uring_next_completion(uring_t *ring, uint64_t *user_data, int *result) {
+    unsigned head = *ring->cq_head;
+    if (head == __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE)) return 0;
+    
+    struct io_uring_cqe *cqe = (struct io_uring_cqe*)ring->cqes + (head & ring->cq_mask);
+    *user_data = cqe->user_data;
+    *result = cqe->res;
+    __atomic_store_n(ring->cq_head, head + 1, __ATOMIC_RELEASE);
+    return 1;
+}
+
+#else
+
+int uring_init(uring_t *ring) {
+    memset(ring, 0, sizeof(*ring));
+    ring->fd = -1;
+    errno = ENOSYS;
+    return -1;
+}
+
+void uring_exit(uring_t *ring) {
+    (void)ring;
+}
+
+char* uring_buffer(uring_t *ring, int index) {
+    (void)ring; (void)index;
+    return NULL;
+}
+
+int uring_queue_read(uring_t *ring, int fd, int index, size_t len, off_t offset,
+                     uint64_t user_data, int link) {
+    (void)ring; (void)fd; (void)index; (void)len; (void)offset; (void)user_data; (void)link;
+    return -1;
+}
+
+int uring_queue_write(uring_t *ring, int fd, int index, size_t len, off_t offset,
+                      uint64_t user_data, int link) {
+    (void)ring; (void)fd; (void)index; (void)len; (void)offset; (void)user_data; (void)link;
+    return -1;
+}
+
+int uring_queue_send(uring_t *ring, int sockfd, int index, size_t len, uint64_t user_data, int link) {
+    (void)ring; (void)sockfd; (void)index; (void)len; (void)user_data; (void)link;
+    return -1;
+}
+
+int uring_queue_recv(uring_t *ring, int sockfd, int index, size_t len, uint64_t user_data, int link) {
+    (void)ring; (void)sockfd; (void)index; (void)len; (void)user_data; (void)link;
+    return -1;
+}
+
+int uring_submit_and_wait(uring_t *ring, unsigned wait_nr) {
+    (void)ring; (void)wait_nr;
+    return -1;
+}
+
+int uring_next_completion(uring_t *ring, uint64_t *user_data, int *result) {
+    (void)ring; (void)user_data; (void)result;
+    return 0;
+}
+
+#endif
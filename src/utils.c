@@ -1,5 +1,7 @@
 #include "../include/common.h"
 #include "../include/nfs_client_logic.h"
+#include "../include/compress.h"
+#include <poll.h>
 
 void get_timestamp(char* buffer, size_t size) {
   time_t now = time(NULL);
@@ -44,41 +46,6 @@ int create_server_socket(int port) {
   return sockfd;
 }
 
-void log_message(FILE *logfile, const char *format, ...) {
-    if (!format) {
-        fprintf(stderr, "Warning: log_message called with NULL format\n");
-        return;
-    }
-    
-    char timestamp[32];
-    get_timestamp(timestamp, sizeof(timestamp));
-    
-    va_list args;
-    va_start(args, format);
-    
-    // Create a safe buffer for the formatted message
-    char message_buffer[MAX_BUFFER_SIZE];
-    int result = vsnprintf(message_buffer, sizeof(message_buffer), format, args);
-    
-    if (result < 0) {
-        fprintf(stderr, "Warning: log_message formatting failed\n");
-        va_end(args);
-        return;
-    }
-    
-    // Print to stdout
-    printf("[%s] %s\n", timestamp, message_buffer);
-    
-    // Write to logfile if provided
-    if (logfile) {
-        fprintf(logfile, "[%s] %s\n", timestamp, message_buffer);
-        fflush(logfile);
-    }
-    
-    va_end(args);
-}
-
-
 int connect_to_server(const char *host, int port) {
   if (!host) {
       fprintf(stderr, "Error: NULL host provided to connect_to_server\n");
@@ -151,6 +118,114 @@ int receive_response(int sockfd, char *buffer, size_t buffer_size) {
   return received;
 }
 
+int recv_exact(int sockfd, void *buf, size_t len) {
+    char *ptr = buf;
+    while (len > 0) {
+        ssize_t received = recv(sockfd, ptr, len, MSG_WAITALL);
+        if (received < 0 && errno == EINTR) continue;
+        if (received <= 0) return -1;
+        ptr += received;
+        len -= received;
+    }
+    return 0;
+}
+
+void reader_init(buffered_reader_t *reader, int fd) {
+    reader->fd = fd;
+    reader->start = 0;
+    reader->end = 0;
+}
+
+static ssize_t reader_fill(buffered_reader_t *reader) {
+    ssize_t received;
+    do {
+        received = recv(reader->fd, reader->data, sizeof(reader->data), 0);
+    } while (received < 0 && errno == EINTR);
+    
+    if (received > 0) {
+        reader->start = 0;
+        reader->end = received;
+    }
+    return received;
+}
+
+int reader_getc(buffered_reader_t *reader) {
+    if (reader->start == reader->end && reader_fill(reader) <= 0) {
+        return -1;
+    }
+    return (unsigned char)reader->data[reader->start++];
+}
+
+ssize_t reader_read(buffered_reader_t *reader, void *buf, size_t len) {
+    if (len == 0) return 0;
+    
+    if (reader->start == reader->end) {
+        if (len >= sizeof(reader->data)) {
+            // Large read with nothing buffered: skip the intermediate copy
+            ssize_t received;
+            do {
+                received = recv(reader->fd, buf, len, 0);
+            } while (received < 0 && errno == EINTR);
+            return received;
+        }
+        
+        ssize_t received = reader_fill(reader);
+        if (received <= 0) return received;
+    }
+    
+    size_t buffered = reader->end - reader->start;
+    size_t n = buffered < len ? buffered : len;
+    memcpy(buf, reader->data + reader->start, n);
+    reader->start += n;
+    return n;
+}
+
+int reader_read_exact(buffered_reader_t *reader, void *buf, size_t len) {
+    char *ptr = buf;
+    while (len > 0) {
+        ssize_t received = reader_read(reader, ptr, len);
+        if (received <= 0) return -1;
+        ptr += received;
+        len -= received;
+    }
+    return 0;
+}
+
+int reader_read_line(buffered_reader_t *reader, char *line, size_t size) {
+    if (!line || size == 0) return -1;
+    
+    size_t len = 0;
+    while (1) {
+        int c = reader_getc(reader);
+        if (c < 0) {
+            line[len] = '\0';
+            return -1;
+        }
+        if (c == '\n') break;
+        if (len + 1 >= size) {
+            line[len] = '\0';
+            return -1;
+        }
+        line[len++] = (char)c;
+    }
+    
+    // Tolerate CRLF line endings
+    if (len > 0 && line[len - 1] == '\r') len--;
+    line[len] = '\0';
+    return len;
+}
+
+int reader_wait(buffered_reader_t *reader, int timeout_ms) {
+    if (reader->start < reader->end) return 1;
+    
+    struct pollfd pfd = { reader->fd, POLLIN, 0 };
+    int ready;
+    do {
+        ready = poll(&pfd, 1, timeout_ms);
+    } while (ready < 0 && errno == EINTR);
+    return ready;
+}
+
 int parse_directory_spec(const char *spec, char *host, int *port, char *dir) {
   if (!spec || !host || !port || !dir) {
       fprintf(stderr, "Error: NULL parameter provided to parse_directory_spec\n");
@@ -221,4 +296,141 @@ int parse_config_line(const char *line, char *source_host, int *source_port,
   }
   
   return 0;
-}
\ No newline at end of file
+}
+
+void init_sync_options(sync_options_t *options) {
+    options->check = SYNC_CHECK_NONE;
+    options->delta = 0;
+    options->split_size = DEFAULT_SPLIT_SIZE;
+    options->priority = DEFAULT_PRIORITY;
+    options->watch = 0;
+    options->compress = 0;
+    options->batch = 1;
+    options->recursive = 0;
+    options->rate = 0;
+}
+
+int parse_sync_options(const char *text, sync_options_t *options) {
+    if (!options) return -1;
+    if (!text) return 0;
+    
+    char copy[MAX_COMMAND_SIZE];
+    strncpy(copy, text, sizeof(copy) - 1);
+    copy[sizeof(copy) - 1] = '\0';
+    
+    char *saveptr = NULL;
+    for (char *token = strtok_r(copy, " \t\r\n", &saveptr); token;
+         token = strtok_r(NULL, " \t\r\n", &saveptr)) {
+        char *value = strchr(token, '=');
+        if (!value) {
+            fprintf(stderr, "Invalid pair option (expected key=value): %s\n", token);
+            return -1;
+        }
+        *value++ = '\0';
+        
+        if (strcmp(token, "check") == 0) {
+            if (strcmp(value, "none") == 0) {
+                options->check = SYNC_CHECK_NONE;
+            } else if (strcmp(value, "mtime") == 0) {
+                options->check = SYNC_CHECK_MTIME;
+            } else if (strcmp(value, "hash") == 0) {
+                options->check = SYNC_CHECK_HASH;
+            } else {
+                fprintf(stderr, "Invalid check mode: %s\n", value);
+                return -1;
+            }
+        } else if (strcmp(token, "delta") == 0) {
+            if (strcmp(value, "on") == 0) {
+                options->delta = 1;
+            } else if (strcmp(value, "off") == 0) {
+                options->delta = 0;
+            } else {
+                fprintf(stderr, "Invalid delta setting: %s\n", value);
+                return -1;
+            }
+        } else if (strcmp(token, "split") == 0) {
+            char *end;
+            long mib = strtol(value, &end, 10);
+            if (strcmp(value, "off") == 0) {
+                options->split_size = 0;
+            } else if (*value != '\0' && *end == '\0' && mib > 0 && mib <= 1024 * 1024) {
+                options->split_size = (int64_t)mib * 1024 * 1024;
+            } else {
+                fprintf(stderr, "Invalid split size (MiB or off): %s\n", value);
+                return -1;
+            }
+        } else if (strcmp(token, "priority") == 0) {
+            char *end;
+            long priority = strtol(value, &end, 10);
+            if (*value == '\0' || *end != '\0' || priority < 1 || priority > MAX_PRIORITY) {
+                fprintf(stderr, "Invalid priority (1-%d): %s\n", MAX_PRIORITY, value);
+                return -1;
+            }
+            options->priority = (int)priority;
+        } else if (strcmp(token, "watch") == 0) {
+            if (strcmp(value, "on") == 0) {
+                options->watch = 1;
+            } else if (strcmp(value, "off") == 0) {
+                options->watch = 0;
+            } else {
+                fprintf(stderr, "Invalid watch setting: %s\n", value);
+                return -1;
+            }
+        } else if (strcmp(token, "batch") == 0) {
+            if (strcmp(value, "on") == 0) {
+                options->batch = 1;
+            } else if (strcmp(value, "off") == 0) {
+                options->batch = 0;
+            } else {
+                fprintf(stderr, "Invalid batch setting: %s\n", value);
+                return -1;
+            }
+        } else if (strcmp(token, "recursive") == 0) {
+            if (strcmp(value, "on") == 0) {
+                options->recursive = 1;
+            } else if (strcmp(value, "off") == 0) {
+                options->recursive = 0;
+            } else {
+                fprintf(stderr, "Invalid recursive setting: %s\n", value);
+                return -1;
+            }
+        } else if (strcmp(token, "rate") == 0) {
+            char *end;
+            long long kib = strtoll(value, &end, 10);
+            if (strcmp(value, "off") == 0) {
+                options->rate = 0;
+            } else if (*value != '\0' && *end == '\0' && kib > 0 && kib <= MAX_RATE_KIB) {
+                options->rate = (int64_t)kib * 1024;
+            } else {
+                fprintf(stderr, "Invalid rate (KiB/s or off): %s\n", value);
+                return -1;
+            }
+        } else if (strcmp(token, "compress") == 0) {
+            char *end;
+            long level = strtol(value, &end, 10);
+            if (strcmp(value, "on") == 0) {
+                options->compress = COMPRESS_DEFAULT_LEVEL;
+            } else if (strcmp(value, "off") == 0) {
+                options->compress = 0;
+            } else if (*value != '\0' && *end == '\0' && level >= 1 && level <= COMPRESS_MAX_LEVEL) {
+                options->compress = (int)level;
+            } else {
+                fprintf(stderr, "Invalid compress setting (on, off or 1-%d): %s\n", COMPRESS_MAX_LEVEL, value);
+                return -1;
+            }
+        } else {
+            fprintf(stderr, "Unknown pair option: %s\n", token);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+uint64_t fnv1a_update(uint64_t hash, const void *data, size_t len) {
+    const unsigned char *bytes = data;
+    for (size_t i = 0; i < len; i++) {
+        hash ^= bytes[i];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
@@ -0,0 +1,315 @@
+#include "../include/common.h"  // First: defines _GNU_SOURCE for every system header
+#include "acutest.h"
+#include "../include/thread_pool.h"
+#include "../include/connection_pool.h"
+#include "../include/sync_info.h"
+#include "../include/log.h"
+#include "../include/metrics.h"
+#include "../include/journal.h"
+#include <pthread.h>
+
+/*
+ * Micro-benchmarks of the manager's job queues and sync pair store.
+ *
+ * Each benchmark prints one line per configuration with operations per
+ * second and a contention figure, so queue types and store versions can
+ * be compared on the same machine:
+ *
+ *   ./bench_utils              run everything
+ *   ./bench_utils queue_ring   run one benchmark
+ *
+ * Queue jobs belong to a cancelled pair, so workers finish them without
+ * any I/O and the figures measure the queue and job bookkeeping alone.
+ */
+
+// Globals the worker code expects from the manager
+FILE *g_worker_logfile = NULL;
+connection_pool_t *g_connection_pool = NULL;
+journal_t *g_journal = NULL;
+
+#define BENCH_QUEUE_JOBS 200000          ///< Jobs pushed through each queue configuration
+#define BENCH_QUEUE_BUFFER 256           ///< Job buffer size of the benchmarked pools
+#define BENCH_FIND_OPS 200000            ///< Hashed lookups per configuration
+#define BENCH_SCAN_VISITS 50000000       ///< Pairs visited by the linear-scan lookups of a configuration
+#define BENCH_CONTENDED_NS 10000         ///< Enqueues slower than this count as contended
+#define BENCH_MAX_THREADS 8              ///< Most producer or lookup threads
+
+static const int bench_thread_counts[] = { 1, 2, 4, 8 };
+static const int bench_pair_counts[] = { 10000, 100000 };
+
+#define ARRAY_COUNT(array) (sizeof(array) / sizeof((array)[0]))
+
+static double seconds_between(uint64_t start_us, uint64_t end_us) {
+    double seconds = (end_us - start_us) / 1e6;
+    return seconds > 0 ? seconds : 1e-6;
+}
+
+// Job queues
+
+typedef struct {
+    thread_pool_t *pool;
+    sync_info_t *info;
+    int jobs;                        ///< Jobs this producer enqueues
+    histogram_t enqueue;             ///< Time spent in each enqueue_sync_job()
+    uint64_t enqueue_ns;             ///< Total time spent in enqueue_sync_job()
+    uint64_t contended;              ///< Enqueues slower than BENCH_CONTENDED_NS
+} queue_producer_t;
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void* queue_producer(void *arg) {
+    queue_producer_t *producer = arg;
+    for (int i = 0; i < producer->jobs; i++) {
+        sync_job_t *job = create_sync_job(producer->info, "bench.bin");
+        if (!job) break;
+        
+        uint64_t started = now_ns();
+        if (enqueue_sync_job(producer->pool, job) != 0) {
+            free_sync_job(job);
+            break;
+        }
+        uint64_t elapsed = now_ns() - started;
+        histogram_observe(&producer->enqueue, elapsed / 1000);
+        producer->enqueue_ns += elapsed;
+        if (elapsed > BENCH_CONTENDED_NS) producer->contended++;
+    }
+    return NULL;
+}
+
+static uint64_t jobs_finished(thread_pool_t *pool) {
+    uint64_t jobs = 0;
+    for (int i = 0; i < pool->thread_count; i++) {
+        jobs += __atomic_load_n(&pool->stats[i].jobs, __ATOMIC_RELAXED);
+    }
+    return jobs;
+}
+
+/*
+ * Push BENCH_QUEUE_JOBS jobs from producers to consumers worker threads
+ * and report throughput. Contention is the share of enqueues slower than
+ * BENCH_CONTENDED_NS, which in practice are the ones that blocked on a
+ * full queue or a contended lock, plus the enqueue latency tail.
+ */
+static void run_queue_bench(const char *name, int producers, int consumers) {
+    thread_pool_t *pool = create_thread_pool(consumers, BENCH_QUEUE_BUFFER);
+    sync_info_t *info = create_sync_info("127.0.0.1", 1, "/bench_src", "127.0.0.1", 2, "/bench_dst");
+    if (!TEST_CHECK(pool != NULL && info != NULL)) {
+        if (pool) destroy_thread_pool(pool);
+        free_sync_info(info);
+        return;
+    }
+    info->active = 0;
+    
+    queue_producer_t state[BENCH_MAX_THREADS];
+    pthread_t threads[BENCH_MAX_THREADS];
+    memset(state, 0, sizeof(state));
+    
+    uint64_t start = metrics_now_us();
+    for (int i = 0; i < producers; i++) {
+        state[i].pool = pool;
+        state[i].info = info;
+        state[i].jobs = BENCH_QUEUE_JOBS / producers;
+        pthread_create(&threads[i], NULL, queue_producer, &state[i]);
+    }
+    for (int i = 0; i < producers; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    uint64_t expected = (uint64_t)(BENCH_QUEUE_JOBS / producers) * producers;
+    while (jobs_finished(pool) < expected) {
+        sched_yield();
+    }
+    uint64_t end = metrics_now_us();
+    
+    histogram_t enqueue;
+    memset(&enqueue, 0, sizeof(enqueue));
+    uint64_t enqueue_ns = 0, contended = 0;
+    for (int i = 0; i < producers; i++) {
+        for (int b = 0; b <= METRICS_BUCKETS; b++) {
+            enqueue.buckets[b] += state[i].enqueue.buckets[b];
+        }
+        enqueue_ns += state[i].enqueue_ns;
+        contended += state[i].contended;
+    }
+    
+    printf("  %-5s producers=%d consumers=%d  %10.0f jobs/s  enqueue avg %6.0fns p99<=%lluus  contended %5.2f%%\n",
+           name, producers, consumers, expected / seconds_between(start, end),
+           (double)enqueue_ns / expected, (unsigned long long)histogram_quantile(&enqueue, 0.99),
+           100.0 * contended / expected);
+    
+    TEST_CHECK(jobs_finished(pool) == expected);
+    destroy_thread_pool(pool);
+    release_sync_info(info);
+}
+
+static void bench_queue(job_queue_type_t type, const char *name) {
+    // Cancelled jobs count as failed, keep their warnings off the output
+    set_log_level(LOG_LEVEL_ERROR);
+    set_job_queue_type(type);
+    
+    printf("\n");
+    for (size_t p = 0; p < ARRAY_COUNT(bench_thread_counts); p++) {
+        for (size_t c = 0; c < ARRAY_COUNT(bench_thread_counts); c++) {
+            run_queue_bench(name, bench_thread_counts[p], bench_thread_counts[c]);
+        }
+    }
+    set_job_queue_type(JOB_QUEUE_LIST);
+    set_log_level(LOG_LEVEL_INFO);
+}
+
+void bench_queue_list(void) {
+    bench_queue(JOB_QUEUE_LIST, "list");
+}
+
+void bench_queue_ring(void) {
+    bench_queue(JOB_QUEUE_RING, "ring");
+}
+
+void bench_queue_steal(void) {
+    bench_queue(JOB_QUEUE_STEAL, "steal");
+}
+
+// Sync pair store
+
+static void pair_dir(char *buffer, size_t size, int index) {
+    snprintf(buffer, size, "/bench/pair_%d", index);
+}
+
+static sync_info_store_t* fill_store(int pairs, double *ops_per_s) {
+    sync_info_store_t *store = create_sync_info_store();
+    if (!store) return NULL;
+    
+    uint64_t start = metrics_now_us();
+    for (int i = 0; i < pairs; i++) {
+        char dir[64];
+        pair_dir(dir, sizeof(dir), i);
+        sync_info_t *info = create_sync_info("127.0.0.1", 9000 + i % 16, dir, "127.0.0.1", 9100, dir);
+        if (!info || add_sync_info(store, info) != 0) {
+            free_sync_info(info);
+            destroy_sync_info_store(store);
+            return NULL;
+        }
+    }
+    *ops_per_s = pairs / seconds_between(start, metrics_now_us());
+    return store;
+}
+
+/*
+ * The store before it was hashed: walk the list of every pair under the
+ * read lock. Kept here as the baseline the hash table is measured against.
+ */
+static sync_info_t* scan_sync_info(sync_info_store_t *store, const char *host, int port, const char *dir) {
+    pthread_rwlock_rdlock(&store->lock);
+    sync_info_t *found = NULL;
+    for (sync_info_t *current = store->head; current; current = current->next) {
+        if (current->source_port == port && strcmp(current->source_dir, dir) == 0 &&
+            strcmp(current->source_host, host) == 0) {
+            found = current;
+            break;
+        }
+    }
+    pthread_rwlock_unlock(&store->lock);
+    return found;
+}
+
+typedef struct {
+    sync_info_store_t *store;
+    int pairs;
+    int lookups;
+    int linear;                      ///< Use scan_sync_info() instead of find_sync_info()
+    unsigned int seed;
+    int misses;
+    uint64_t lock_wait_us;           ///< Time spent acquiring the read lock alone
+} store_reader_t;
+
+static void* store_reader(void *arg) {
+    store_reader_t *reader = arg;
+    for (int i = 0; i < reader->lookups; i++) {
+        int index = rand_r(&reader->seed) % reader->pairs;
+        char dir[64];
+        pair_dir(dir, sizeof(dir), index);
+        
+        sync_info_t *found = reader->linear
+            ? scan_sync_info(reader->store, "127.0.0.1", 9000 + index % 16, dir)
+            : find_sync_info(reader->store, "127.0.0.1", 9000 + index % 16, dir);
+        if (!found) reader->misses++;
+        
+        // Sample the lock itself every so often, it is what threads share
+        if (i % 64 == 0) {
+            uint64_t started = metrics_now_us();
+            pthread_rwlock_rdlock(&reader->store->lock);
+            reader->lock_wait_us += metrics_now_us() - started;
+            pthread_rwlock_unlock(&reader->store->lock);
+        }
+    }
+    return NULL;
+}
+
+static void run_find_bench(sync_info_store_t *store, int pairs, int threads, int linear) {
+    store_reader_t state[BENCH_MAX_THREADS];
+    pthread_t ids[BENCH_MAX_THREADS];
+    int lookups = (linear ? BENCH_SCAN_VISITS / pairs : BENCH_FIND_OPS) / threads;
+    
+    uint64_t start = metrics_now_us();
+    for (int i = 0; i < threads; i++) {
+        state[i] = (store_reader_t){ store, pairs, lookups, linear, (unsigned int)(i + 1), 0, 0 };
+        pthread_create(&ids[i], NULL, store_reader, &state[i]);
+    }
+    int misses = 0;
+    uint64_t lock_wait_us = 0;
+    for (int i = 0; i < threads; i++) {
+        pthread_join(ids[i], NULL);
+        misses += state[i].misses;
+        lock_wait_us += state[i].lock_wait_us;
+    }
+    uint64_t end = metrics_now_us();
+    
+    int samples = threads * ((lookups + 63) / 64);
+    printf("  find %-6s pairs=%-6d threads=%d  %12.0f lookups/s  read lock wait %.2fus avg\n",
+           linear ? "scan" : "hashed", pairs, threads, (double)lookups * threads / seconds_between(start, end),
+           samples ? (double)lock_wait_us / samples : 0.0);
+    TEST_CHECK(misses == 0);
+}
+
+void bench_store_add(void) {
+    printf("\n");
+    for (size_t p = 0; p < ARRAY_COUNT(bench_pair_counts); p++) {
+        double ops_per_s = 0;
+        sync_info_store_t *store = fill_store(bench_pair_counts[p], &ops_per_s);
+        if (!TEST_CHECK(store != NULL)) return;
+        
+        printf("  add         pairs=%-6d            %12.0f inserts/s  buckets=%zu\n",
+               bench_pair_counts[p], ops_per_s, store->bucket_count);
+        TEST_CHECK(get_sync_info_count(store) == bench_pair_counts[p]);
+        destroy_sync_info_store(store);
+    }
+}
+
+void bench_store_find(void) {
+    printf("\n");
+    for (size_t p = 0; p < ARRAY_COUNT(bench_pair_counts); p++) {
+        double ops_per_s = 0;
+        sync_info_store_t *store = fill_store(bench_pair_counts[p], &ops_per_s);
+        if (!TEST_CHECK(store != NULL)) return;
+        
+        for (size_t t = 0; t < ARRAY_COUNT(bench_thread_counts); t++) {
+            run_find_bench(store, bench_pair_counts[p], bench_thread_counts[t], 0);
+        }
+        for (size_t t = 0; t < ARRAY_COUNT(bench_thread_counts); t++) {
+            run_find_bench(store, bench_pair_counts[p], bench_thread_counts[t], 1);
+        }
+        destroy_sync_info_store(store);
+    }
+}
+
+TEST_LIST = {
+    {"queue_list", bench_queue_list},
+    {"queue_ring", bench_queue_ring},
+    {"queue_steal", bench_queue_steal},
+    {"store_add", bench_store_add},
+    {"store_find", bench_store_find},
+    {NULL, NULL}
+};
@@ -1,6 +1,8 @@
 #include "acutest.h"
 #include "../include/nfs_client_logic.h"
 #include "../include/common.h"
+#include "../include/manifest.h"
+#include "../include/compress.h"
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <unistd.h>
@@ -9,6 +11,10 @@
 #include <dirent.h>
 #include <signal.h>
 #include <sys/wait.h>
+#include <pthread.h>
+#include <poll.h>
+#include <sys/file.h>
+#include <utime.h>
 
 // Test directory setup
 static void setup_test_directory(void) {
@@ -73,6 +79,58 @@ void test_list_command_functionality(void) {
     cleanup_test_directory();
 }
 
+// Test LIST of a directory far larger than one send buffer
+void test_list_large_directory(void) {
+    system("mkdir -p test_client_data");
+    const int file_count = 2000;
+    for (int i = 0; i < file_count; i++) {
+        char path[64];
+        snprintf(path, sizeof(path), "test_client_data/entry_with_a_long_name_%04d.dat", i);
+        int fd = open(path, O_CREAT | O_WRONLY, 0644);
+        if (fd >= 0) close(fd);
+    }
+    
+    int sockpair[2];
+    TEST_CHECK(socketpair(AF_UNIX, SOCK_STREAM, 0, sockpair) == 0);
+    
+    pid_t pid = fork();
+    if (pid == 0) {
+        close(sockpair[0]);
+        handle_list_command(sockpair[1], "/test_client_data");
+        handle_list_command(sockpair[1], "/test_client_missing");
+        close(sockpair[1]);
+        exit(0);
+    } else if (pid > 0) {
+        close(sockpair[1]);
+        
+        // Count lines up to each end marker
+        int lines = 0, listings = 0, entries = 0;
+        char line[MAX_FILENAME];
+        buffered_reader_t reader;
+        reader_init(&reader, sockpair[0]);
+        while (reader_read_line(&reader, line, sizeof(line)) >= 0) {
+            if (strcmp(line, ".") == 0) {
+                if (listings++ == 0) entries = lines;
+                lines = 0;
+            } else {
+                lines++;
+            }
+        }
+        close(sockpair[0]);
+        
+        TEST_CHECK(entries == file_count);
+        TEST_MSG("Listed %d of %d files", entries, file_count);
+        TEST_CHECK(listings == 2);  // Missing directory still ends with "."
+        TEST_CHECK(lines == 0);
+        
+        int status;
+        waitpid(pid, &status, 0);
+        TEST_CHECK(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    }
+    
+    cleanup_test_directory();
+}
+
 // Test PULL command functionality
 void test_pull_command_functionality(void) {
     setup_test_directory();
@@ -184,15 +242,19 @@ void test_push_command_functionality(void) {
         // Child process - simulate receiving data
         close(sockpair[0]);
         
+        client_session_t session;
+        init_client_session(&session, sockpair[1]);
+        
         // Start new file (chunk_size = -1)
-        handle_push_command(sockpair[1], "test_client_output/pushed_file.txt", -1);
+        handle_push_command(&session, "test_client_output/pushed_file.txt", -1);
         
         // Read and write the data chunk
-        handle_push_command(sockpair[1], "test_client_output/pushed_file.txt", data_length);
+        handle_push_command(&session, "test_client_output/pushed_file.txt", data_length);
         
         // End file (chunk_size = 0)
-        handle_push_command(sockpair[1], "test_client_output/pushed_file.txt", 0);
+        handle_push_command(&session, "test_client_output/pushed_file.txt", 0);
         
+        close_client_session(&session);
         close(sockpair[1]);
         exit(0);
     } else if (pid > 0) {
@@ -231,6 +293,290 @@ void test_push_command_functionality(void) {
     system("rm -rf test_client_output");
 }
 
+// Test that two sessions can receive different files at the same time
+void test_push_interleaved_sessions(void) {
+    system("mkdir -p test_client_output");
+    
+    int pair_a[2], pair_b[2];
+    TEST_CHECK(socketpair(AF_UNIX, SOCK_STREAM, 0, pair_a) == 0);
+    TEST_CHECK(socketpair(AF_UNIX, SOCK_STREAM, 0, pair_b) == 0);
+    
+    client_session_t session_a, session_b;
+    init_client_session(&session_a, pair_a[1]);
+    init_client_session(&session_b, pair_b[1]);
+    
+    TEST_CHECK(write(pair_a[0], "AAAA", 4) == 4);
+    TEST_CHECK(write(pair_b[0], "BBBBBB", 6) == 6);
+    TEST_CHECK(write(pair_a[0], "aa", 2) == 2);
+    
+    // Interleave the two transfers chunk by chunk
+    handle_push_command(&session_a, "test_client_output/a.txt", -1);
+    handle_push_command(&session_b, "test_client_output/b.txt", -1);
+    TEST_CHECK(handle_push_command(&session_a, "test_client_output/a.txt", 4) == 0);
+    TEST_CHECK(handle_push_command(&session_b, "test_client_output/b.txt", 6) == 0);
+    TEST_CHECK(handle_push_command(&session_a, "test_client_output/a.txt", 2) == 0);
+    TEST_CHECK(session_a.push.offset == 6);
+    TEST_CHECK(session_b.push.offset == 6);
+    handle_push_command(&session_b, "test_client_output/b.txt", 0);
+    handle_push_command(&session_a, "test_client_output/a.txt", 0);
+    
+    close_client_session(&session_a);
+    close_client_session(&session_b);
+    for (int i = 0; i < 2; i++) {
+        close(pair_a[i]);
+        close(pair_b[i]);
+    }
+    
+    char buffer[32];
+    FILE *file = fopen("test_client_output/a.txt", "r");
+    TEST_CHECK(file != NULL);
+    if (file) {
+        size_t n = fread(buffer, 1, sizeof(buffer) - 1, file);
+        buffer[n] = '\0';
+        TEST_CHECK(strcmp(buffer, "AAAAaa") == 0);
+        fclose(file);
+    }
+    
+    file = fopen("test_client_output/b.txt", "r");
+    TEST_CHECK(file != NULL);
+    if (file) {
+        size_t n = fread(buffer, 1, sizeof(buffer) - 1, file);
+        buffer[n] = '\0';
+        TEST_CHECK(strcmp(buffer, "BBBBBB") == 0);
+        fclose(file);
+    }
+    
+    system("rm -rf test_client_output");
+}
+
+// Test a full PUSH sequence arriving in a single segment
+void test_push_through_connection(void) {
+    system("mkdir -p test_client_output");
+    
+    int sockpair[2];
+    TEST_CHECK(socketpair(AF_UNIX, SOCK_STREAM, 0, sockpair) == 0);
+    
+    // Headers and chunk data coalesced exactly as TCP may deliver them
+    const char *stream = "PUSH /test_client_output/conn.txt -1\n"
+                         "PUSH /test_client_output/conn.txt 5 hello"
+                         "PUSH /test_client_output/conn.txt 6  world"
+                         "PUSH /test_client_output/conn.txt 0\n";
+    TEST_CHECK(write(sockpair[0], stream, strlen(stream)) == (ssize_t)strlen(stream));
+    close(sockpair[0]);
+    
+    handle_client_connection(sockpair[1]);
+    
+    FILE *file = fopen("test_client_output/conn.txt", "r");
+    TEST_CHECK(file != NULL);
+    if (file) {
+        char buffer[32];
+        size_t n = fread(buffer, 1, sizeof(buffer) - 1, file);
+        buffer[n] = '\0';
+        TEST_CHECK(strcmp(buffer, "hello world") == 0);
+        TEST_MSG("Received: '%s'", buffer);
+        fclose(file);
+    }
+    
+    system("rm -rf test_client_output");
+}
+
+// Test a version 2 PUSH stream: negotiation, OPEN/DATA/END and the ack
+void test_push_frames(void) {
+    system("mkdir -p test_client_output");
+    
+    int sockpair[2];
+    TEST_CHECK(socketpair(AF_UNIX, SOCK_STREAM, 0, sockpair) == 0);
+    
+    const char *path = "/test_client_output/frames.txt";
+    unsigned char open_payload[OPEN_PAYLOAD_FIXED + 64];
+    memset(open_payload, 0, OPEN_PAYLOAD_FIXED);
+    memcpy(open_payload + OPEN_PAYLOAD_FIXED, path, strlen(path));
+    
+    TEST_CHECK(send_command(sockpair[0], "HELLO 2\n") == 0);
+    TEST_CHECK(send_frame(sockpair[0], FRAME_OPEN, 7, open_payload, OPEN_PAYLOAD_FIXED + strlen(path)) == 0);
+    TEST_CHECK(send_frame(sockpair[0], FRAME_DATA, 7, "hello ", 6) == 0);
+    TEST_CHECK(send_frame(sockpair[0], FRAME_DATA, 7, "frames", 6) == 0);
+    TEST_CHECK(send_end_frame(sockpair[0], 7, 12, 0) == 0);
+    shutdown(sockpair[0], SHUT_WR);
+    
+    handle_client_connection(sockpair[1]);
+    
+    char reply[8];
+    TEST_CHECK(recv_exact(sockpair[0], reply, 5) == 0);
+    TEST_CHECK(memcmp(reply, "OK 2\n", 5) == 0);
+    
+    frame_header_t header;
+    TEST_CHECK(recv_frame_header(sockpair[0], &header) == 0);
+    TEST_CHECK(header.opcode == FRAME_END);
+    TEST_CHECK(header.stream_id == 7);
+    close(sockpair[0]);
+    
+    FILE *file = fopen("test_client_output/frames.txt", "r");
+    TEST_CHECK(file != NULL);
+    if (file) {
+        char buffer[32];
+        size_t n = fread(buffer, 1, sizeof(buffer) - 1, file);
+        buffer[n] = '\0';
+        TEST_CHECK(strcmp(buffer, "hello frames") == 0);
+        TEST_MSG("Received: '%s'", buffer);
+        fclose(file);
+    }
+    
+    system("rm -rf test_client_output");
+}
+
+// Test metadata LIST over frames, and that END keeps the source mtime
+void test_list_metadata_frames(void) {
+    setup_test_directory();
+    
+    int sockpair[2];
+    TEST_CHECK(socketpair(AF_UNIX, SOCK_STREAM, 0, sockpair) == 0);
+    
+    const char *path = "/test_client_data/file1.txt";
+    unsigned char open_payload[OPEN_PAYLOAD_FIXED + 64];
+    memset(open_payload, 0, OPEN_PAYLOAD_FIXED);
+    memcpy(open_payload + OPEN_PAYLOAD_FIXED, path, strlen(path));
+    
+    // Rewrite file1.txt with an old mtime, then list with hashes
+    const char *list = "LIST /test_client_data";
+    TEST_CHECK(send_command(sockpair[0], "HELLO 2\n") == 0);
+    TEST_CHECK(send_frame(sockpair[0], FRAME_OPEN, 1, open_payload, OPEN_PAYLOAD_FIXED + strlen(path)) == 0);
+    TEST_CHECK(send_frame(sockpair[0], FRAME_DATA, 1, "abc", 3) == 0);
+    TEST_CHECK(send_end_frame(sockpair[0], 1, 3, 1000000000) == 0);
+    TEST_CHECK(send_frame_flags(sockpair[0], FRAME_CMD, LIST_FLAG_META | LIST_FLAG_HASH, 2,
+                                list, strlen(list)) == 0);
+    shutdown(sockpair[0], SHUT_WR);
+    
+    handle_client_connection(sockpair[1]);
+    
+    char reply[8];
+    TEST_CHECK(recv_exact(sockpair[0], reply, 5) == 0);
+    
+    frame_header_t header;
+    TEST_CHECK(recv_frame_header(sockpair[0], &header) == 0);
+    TEST_CHECK(header.opcode == FRAME_END && header.stream_id == 1);
+    unsigned char end[END_PAYLOAD_SIZE];
+    TEST_CHECK(recv_exact(sockpair[0], end, sizeof(end)) == 0);
+    
+    char listing[4096] = "";
+    size_t used = 0;
+    while (recv_frame_header(sockpair[0], &header) == 0 && header.opcode == FRAME_DATA &&
+           used + header.length < sizeof(listing)) {
+        TEST_CHECK(recv_exact(sockpair[0], listing + used, header.length) == 0);
+        used += header.length;
+    }
+    listing[used] = '\0';
+    TEST_CHECK(header.opcode == FRAME_END);
+    close(sockpair[0]);
+    
+    // The entry for file1.txt carries size, the END mtime and the hash of "abc"
+    char expected[128];
+    snprintf(expected, sizeof(expected), "3 1000000000 %016llx file1.txt\n",
+             (unsigned long long)fnv1a_update(FNV1A_INIT, "abc", 3));
+    TEST_CHECK(strstr(listing, expected) != NULL);
+    TEST_MSG("Listing: %s", listing);
+    TEST_CHECK(strstr(listing, " sample.txt\n") != NULL);
+    
+    // An edit that keeps the size and mtime is not hidden by the cached hash
+    FILE *edited = fopen("test_client_data/file1.txt", "w");
+    TEST_ASSERT(edited != NULL);
+    fputs("xyz", edited);
+    fclose(edited);
+    struct utimbuf times = { 1000000000, 1000000000 };
+    TEST_CHECK(utime("test_client_data/file1.txt", &times) == 0);
+    TEST_CHECK(socketpair(AF_UNIX, SOCK_STREAM, 0, sockpair) == 0);
+    TEST_CHECK(send_command(sockpair[0], "HELLO 2\n") == 0);
+    TEST_CHECK(send_frame_flags(sockpair[0], FRAME_CMD, LIST_FLAG_META | LIST_FLAG_HASH, 1,
+                                list, strlen(list)) == 0);
+    shutdown(sockpair[0], SHUT_WR);
+    handle_client_connection(sockpair[1]);
+    TEST_CHECK(recv_exact(sockpair[0], reply, 5) == 0);
+    used = 0;
+    while (recv_frame_header(sockpair[0], &header) == 0 && header.opcode == FRAME_DATA &&
+           used + header.length < sizeof(listing)) {
+        TEST_CHECK(recv_exact(sockpair[0], listing + used, header.length) == 0);
+        used += header.length;
+    }
+    listing[used] = '\0';
+    close(sockpair[0]);
+    snprintf(expected, sizeof(expected), "3 1000000000 %016llx file1.txt\n",
+             (unsigned long long)fnv1a_update(FNV1A_INIT, "xyz", 3));
+    TEST_CHECK(strstr(listing, expected) != NULL);
+    TEST_MSG("Listing: %s", listing);
+    
+    cleanup_test_directory();
+}
+
+// Test a recursive metadata LIST, and a PUSH that creates its missing directories
+void test_recursive_list_frames(void) {
+    system("rm -rf test_client_tree && mkdir -p test_client_tree/a/b/c test_client_tree/.hidden");
+    system("echo top > test_client_tree/top.txt && echo one > test_client_tree/a/one.txt && "
+           "echo three > test_client_tree/a/b/c/three.txt && echo no > test_client_tree/.hidden/x.txt");
+    // Enough directories to keep several walker threads busy
+    for (int i = 0; i < 40; i++) {
+        char command[128];
+        snprintf(command, sizeof(command), "mkdir -p test_client_tree/d%d && echo %d > test_client_tree/d%d/f.txt",
+                 i, i, i);
+        system(command);
+    }
+    
+    int sockpair[2];
+    TEST_CHECK(socketpair(AF_UNIX, SOCK_STREAM, 0, sockpair) == 0);
+    
+    const char *path = "/test_client_tree/new/deeper/pushed.txt";
+    unsigned char open_payload[OPEN_PAYLOAD_FIXED + 64];
+    memset(open_payload, 0, OPEN_PAYLOAD_FIXED);
+    memcpy(open_payload + OPEN_PAYLOAD_FIXED, path, strlen(path));
+    put_u32(open_payload, OPEN_FLAG_MKDIRS);
+    
+    const char *list = "LIST /test_client_tree";
+    TEST_CHECK(send_command(sockpair[0], "HELLO 2 tree\n") == 0);
+    TEST_CHECK(send_frame(sockpair[0], FRAME_OPEN, 1, open_payload, OPEN_PAYLOAD_FIXED + strlen(path)) == 0);
+    TEST_CHECK(send_frame(sockpair[0], FRAME_DATA, 1, "abc", 3) == 0);
+    TEST_CHECK(send_end_frame(sockpair[0], 1, 3, 0) == 0);
+    TEST_CHECK(send_frame_flags(sockpair[0], FRAME_CMD, LIST_FLAG_META | LIST_FLAG_RECURSIVE, 2,
+                                list, strlen(list)) == 0);
+    shutdown(sockpair[0], SHUT_WR);
+    
+    handle_client_connection(sockpair[1]);
+    
+    char reply[16];
+    TEST_CHECK(recv_exact(sockpair[0], reply, 10) == 0);
+    TEST_CHECK(memcmp(reply, "OK 2 tree\n", 10) == 0);
+    
+    frame_header_t header;
+    TEST_CHECK(recv_frame_header(sockpair[0], &header) == 0);
+    TEST_CHECK(header.opcode == FRAME_END && header.stream_id == 1);
+    unsigned char end[END_PAYLOAD_SIZE];
+    TEST_CHECK(recv_exact(sockpair[0], end, sizeof(end)) == 0);
+    
+    static char listing[16384];
+    size_t used = 0;
+    while (recv_frame_header(sockpair[0], &header) == 0 && header.opcode == FRAME_DATA &&
+           used + header.length < sizeof(listing)) {
+        TEST_CHECK(recv_exact(sockpair[0], listing + used, header.length) == 0);
+        used += header.length;
+    }
+    listing[used] = '\0';
+    TEST_CHECK(header.opcode == FRAME_END);
+    close(sockpair[0]);
+    
+    int lines = 0;
+    for (size_t i = 0; i < used; i++) {
+        if (listing[i] == '\n') lines++;
+    }
+    TEST_CHECK(lines == 44);
+    TEST_MSG("Listing: %s", listing);
+    TEST_CHECK(strstr(listing, " top.txt\n") != NULL);
+    TEST_CHECK(strstr(listing, " a/one.txt\n") != NULL);
+    TEST_CHECK(strstr(listing, " a/b/c/three.txt\n") != NULL);
+    TEST_CHECK(strstr(listing, " d39/f.txt\n") != NULL);
+    TEST_CHECK(strstr(listing, " new/deeper/pushed.txt\n") != NULL);
+    TEST_CHECK(strstr(listing, "x.txt") == NULL);
+    
+    system("rm -rf test_client_tree");
+}
+
 // Test client connection handling
 void test_client_connection_handling(void) {
     setup_test_directory();
@@ -386,12 +732,802 @@ void test_buffer_handling(void) {
     }
 }
 
+// Pull a file through a socketpair and return the bytes received after the size header
+static size_t pull_file_contents(const char *path, char *out, size_t out_size) {
+    int sockpair[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sockpair) != 0) return 0;
+    
+    pid_t pid = fork();
+    if (pid == 0) {
+        close(sockpair[0]);
+        handle_pull_command(sockpair[1], path);
+        close(sockpair[1]);
+        exit(0);
+    }
+    close(sockpair[1]);
+    
+    // Skip "<size> " header
+    char c;
+    while (read(sockpair[0], &c, 1) == 1 && c != ' ');
+    
+    size_t total = 0;
+    ssize_t n;
+    while (total < out_size && (n = read(sockpair[0], out + total, out_size - total)) > 0) {
+        total += n;
+    }
+    close(sockpair[0]);
+    waitpid(pid, NULL, 0);
+    return total;
+}
+
+// Test that the zero-copy and buffered PULL engines send identical bytes
+void test_pull_engines_match(void) {
+    const size_t size = 3 * MAX_BUFFER_SIZE + 123;
+    char *expected = malloc(size);
+    char *via_sendfile = malloc(size + 16);
+    char *via_buffered = malloc(size + 16);
+    TEST_ASSERT(expected && via_sendfile && via_buffered);
+    
+    for (size_t i = 0; i < size; i++) {
+        expected[i] = (char)(i * 31 + 7);
+    }
+    int fd = open("engine_test_file.bin", O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    TEST_ASSERT(fd >= 0);
+    TEST_CHECK(write(fd, expected, size) == (ssize_t)size);
+    close(fd);
+    
+    client_io_engine_t engine;
+    TEST_CHECK(parse_client_io_engine("bogus", &engine) == -1);
+    TEST_CHECK(parse_client_io_engine("buffered", &engine) == 0 && engine == CLIENT_IO_BUFFERED);
+    TEST_CHECK(parse_client_io_engine("uring", &engine) == 0 && engine == CLIENT_IO_URING);
+    
+    set_client_io_engine(CLIENT_IO_SENDFILE);
+    size_t got_sendfile = pull_file_contents("engine_test_file.bin", via_sendfile, size + 16);
+    set_client_io_engine(CLIENT_IO_BUFFERED);
+    size_t got_buffered = pull_file_contents("engine_test_file.bin", via_buffered, size + 16);
+    set_client_io_engine(CLIENT_IO_SENDFILE);
+    
+    TEST_CHECK(got_sendfile == size);
+    TEST_CHECK(got_buffered == size);
+    TEST_CHECK(memcmp(via_sendfile, expected, size) == 0);
+    TEST_CHECK(memcmp(via_buffered, expected, size) == 0);
+    
+    // A reply cut short leaves the connection unusable; an error reply does not
+    signal(SIGPIPE, SIG_IGN);
+    int sockpair[2];
+    TEST_ASSERT(socketpair(AF_UNIX, SOCK_STREAM, 0, sockpair) == 0);
+    TEST_CHECK(handle_pull_command(sockpair[1], "no_such_engine_file.bin") == 0);
+    close(sockpair[0]);
+    TEST_CHECK(handle_pull_command(sockpair[1], "engine_test_file.bin") == -1);
+    close(sockpair[1]);
+    
+    unlink("engine_test_file.bin");
+    free(expected);
+    free(via_sendfile);
+    free(via_buffered);
+}
+
+// Test the uring engine: a PULL and a framed PUSH spanning several rounds of buffers
+void test_uring_engine(void) {
+    const size_t size = 1024 * 1024 + 300 * 1024 + 123;
+    char *expected = malloc(size);
+    char *received = malloc(size + 16);
+    TEST_ASSERT(expected && received);
+    
+    for (size_t i = 0; i < size; i++) {
+        expected[i] = (char)(i * 131 + i / 4099);
+    }
+    int fd = open("uring_test_file.bin", O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    TEST_ASSERT(fd >= 0);
+    TEST_CHECK(write(fd, expected, size) == (ssize_t)size);
+    close(fd);
+    
+    set_client_io_engine(CLIENT_IO_URING);
+    size_t got = pull_file_contents("uring_test_file.bin", received, size + 16);
+    TEST_CHECK(got == size);
+    TEST_CHECK(memcmp(received, expected, size) == 0);
+    
+    system("mkdir -p test_client_output");
+    int sockpair[2];
+    TEST_ASSERT(socketpair(AF_UNIX, SOCK_STREAM, 0, sockpair) == 0);
+    
+    pid_t pid = fork();
+    if (pid == 0) {
+        close(sockpair[1]);
+        const char *path = "/test_client_output/uring.bin";
+        unsigned char open_payload[OPEN_PAYLOAD_FIXED + 64];
+        memset(open_payload, 0, OPEN_PAYLOAD_FIXED);
+        memcpy(open_payload + OPEN_PAYLOAD_FIXED, path, strlen(path));
+        
+        // Two frames, the first one as large as a sender emits
+        int ok = send_command(sockpair[0], "HELLO 2\n") == 0 &&
+                 send_frame(sockpair[0], FRAME_OPEN, 3, open_payload, OPEN_PAYLOAD_FIXED + strlen(path)) == 0 &&
+                 send_frame(sockpair[0], FRAME_DATA, 3, expected, FRAME_DATA_MAX) == 0 &&
+                 send_frame(sockpair[0], FRAME_DATA, 3, expected + FRAME_DATA_MAX, size - FRAME_DATA_MAX) == 0 &&
+                 send_end_frame(sockpair[0], 3, size, 0) == 0;
+        shutdown(sockpair[0], SHUT_WR);
+        
+        char c;
+        while (read(sockpair[0], &c, 1) == 1);
+        exit(ok ? 0 : 1);
+    }
+    close(sockpair[0]);
+    handle_client_connection(sockpair[1]);
+    
+    int status = 0;
+    waitpid(pid, &status, 0);
+    TEST_CHECK(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    set_client_io_engine(CLIENT_IO_SENDFILE);
+    
+    FILE *file = fopen("test_client_output/uring.bin", "rb");
+    TEST_CHECK(file != NULL);
+    if (file) {
+        got = fread(received, 1, size + 16, file);
+        TEST_CHECK(got == size);
+        TEST_CHECK(memcmp(received, expected, size) == 0);
+        fclose(file);
+    }
+    
+    system("rm -rf test_client_output");
+    unlink("uring_test_file.bin");
+    free(expected);
+    free(received);
+}
+
 // Test list to run
+// Collect the DATA frames of a reply. Returns the END size, or -1 on ERROR
+static long long read_reply_stream(int fd, uint32_t stream_id, unsigned char *out, size_t size, size_t *len) {
+    *len = 0;
+    while (1) {
+        frame_header_t header;
+        if (recv_frame_header(fd, &header) != 0 || header.stream_id != stream_id) return -1;
+        
+        unsigned char payload[END_PAYLOAD_SIZE];
+        switch (header.opcode) {
+        case FRAME_DATA:
+            if (*len + header.length > size || recv_exact(fd, out + *len, header.length) != 0) return -1;
+            *len += header.length;
+            break;
+        case FRAME_END:
+            if (header.length != END_PAYLOAD_SIZE || recv_exact(fd, payload, sizeof(payload)) != 0) return -1;
+            return (long long)get_u64(payload);
+        default:
+            return -1;
+        }
+    }
+}
+
+// Run one version 2 session over a socketpair: input is sent, then the client serves it
+static int serve_frames_input(int sockpair[2]) {
+    shutdown(sockpair[0], SHUT_WR);
+    handle_client_connection(sockpair[1]);
+    
+    char reply[8];
+    if (recv_exact(sockpair[0], reply, 5) != 0) return -1;
+    return memcmp(reply, "OK 2\n", 5) == 0 ? 0 : -1;
+}
+
+// Test SIGS, DELTA and a delta stream rebuilding a modified file
+void test_delta_frames(void) {
+    system("mkdir -p test_client_output");
+    
+    const size_t size = 64 * 1024;
+    const uint32_t block_size = 2048;
+    static unsigned char basis[64 * 1024], updated[64 * 1024];
+    for (size_t i = 0; i < size; i++) {
+        basis[i] = (unsigned char)((i * 7919) >> 5);
+    }
+    memcpy(updated, basis, size);
+    memset(updated + 10000, 'x', 50);
+    
+    int fd = open("test_client_output/basis.bin", O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    TEST_ASSERT(fd >= 0);
+    TEST_CHECK(write(fd, basis, size) == (ssize_t)size);
+    close(fd);
+    fd = open("test_client_output/new.bin", O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    TEST_ASSERT(fd >= 0);
+    TEST_CHECK(write(fd, updated, size) == (ssize_t)size);
+    close(fd);
+    
+    // Signatures of the basis
+    static unsigned char sigs[64 * 1024];
+    size_t sig_len = 0;
+    int sockpair[2];
+    TEST_ASSERT(socketpair(AF_UNIX, SOCK_STREAM, 0, sockpair) == 0);
+    const char *sigs_cmd = "SIGS 2048 /test_client_output/basis.bin";
+    TEST_CHECK(send_command(sockpair[0], "HELLO 2\n") == 0);
+    TEST_CHECK(send_frame(sockpair[0], FRAME_CMD, 3, sigs_cmd, strlen(sigs_cmd)) == 0);
+    TEST_CHECK(serve_frames_input(sockpair) == 0);
+    TEST_CHECK(read_reply_stream(sockpair[0], 3, sigs, sizeof(sigs), &sig_len) == (long long)sig_len);
+    TEST_CHECK(sig_len == size / block_size * DELTA_SIG_SIZE);
+    close(sockpair[0]);
+    
+    // Delta of the modified file against them
+    static unsigned char delta[128 * 1024];
+    size_t delta_len = 0;
+    TEST_ASSERT(socketpair(AF_UNIX, SOCK_STREAM, 0, sockpair) == 0);
+    const char *delta_cmd = "DELTA 2048 /test_client_output/new.bin";
+    TEST_CHECK(send_command(sockpair[0], "HELLO 2\n") == 0);
+    TEST_CHECK(send_frame(sockpair[0], FRAME_CMD, 4, delta_cmd, strlen(delta_cmd)) == 0);
+    TEST_CHECK(send_frame(sockpair[0], FRAME_DATA, 4, sigs, sig_len) == 0);
+    TEST_CHECK(send_end_frame(sockpair[0], 4, sig_len, 0) == 0);
+    TEST_CHECK(serve_frames_input(sockpair) == 0);
+    TEST_CHECK(read_reply_stream(sockpair[0], 4, delta, sizeof(delta), &delta_len) == (long long)size);
+    TEST_CHECK(delta_len > 0 && delta_len < 3 * block_size);
+    TEST_MSG("delta is %zu bytes", delta_len);
+    close(sockpair[0]);
+    
+    // Apply it to the basis twice at once: each stream rebuilds in its own part file
+    const char *path = "/test_client_output/basis.bin";
+    unsigned char open_payload[OPEN_PAYLOAD_FIXED + 64];
+    put_u32(open_payload, OPEN_FLAG_DELTA);
+    put_u64(open_payload + 4, 0);
+    memcpy(open_payload + OPEN_PAYLOAD_FIXED, path, strlen(path));
+    
+    TEST_ASSERT(socketpair(AF_UNIX, SOCK_STREAM, 0, sockpair) == 0);
+    TEST_CHECK(send_command(sockpair[0], "HELLO 2\n") == 0);
+    TEST_CHECK(send_frame(sockpair[0], FRAME_OPEN, 5, open_payload, OPEN_PAYLOAD_FIXED + strlen(path)) == 0);
+    TEST_CHECK(send_frame(sockpair[0], FRAME_OPEN, 6, open_payload, OPEN_PAYLOAD_FIXED + strlen(path)) == 0);
+    TEST_CHECK(send_frame(sockpair[0], FRAME_DATA, 5, delta, delta_len / 2) == 0);
+    TEST_CHECK(send_frame(sockpair[0], FRAME_DATA, 6, delta, delta_len) == 0);
+    TEST_CHECK(send_frame(sockpair[0], FRAME_DATA, 5, delta + delta_len / 2, delta_len - delta_len / 2) == 0);
+    TEST_CHECK(send_end_frame(sockpair[0], 5, size, 0) == 0);
+    TEST_CHECK(send_end_frame(sockpair[0], 6, size, 0) == 0);
+    TEST_CHECK(serve_frames_input(sockpair) == 0);
+    
+    unsigned char end[END_PAYLOAD_SIZE];
+    for (uint32_t stream_id = 5; stream_id <= 6; stream_id++) {
+        frame_header_t header;
+        TEST_CHECK(recv_frame_header(sockpair[0], &header) == 0);
+        TEST_CHECK(header.opcode == FRAME_END && header.stream_id == stream_id);
+        TEST_CHECK(recv_exact(sockpair[0], end, sizeof(end)) == 0);
+    }
+    close(sockpair[0]);
+    
+    static unsigned char rebuilt[64 * 1024 + 1];
+    fd = open("test_client_output/basis.bin", O_RDONLY);
+    TEST_ASSERT(fd >= 0);
+    TEST_CHECK(read(fd, rebuilt, sizeof(rebuilt)) == (ssize_t)size);
+    TEST_CHECK(memcmp(rebuilt, updated, size) == 0);
+    close(fd);
+    
+    // Neither stream left its part file behind
+    DIR *dir = opendir("test_client_output");
+    TEST_ASSERT(dir != NULL);
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        TEST_CHECK(strncmp(entry->d_name, ".basis.bin.", strlen(".basis.bin.")) != 0);
+        TEST_MSG("left behind: %s", entry->d_name);
+    }
+    closedir(dir);
+    
+    system("rm -rf test_client_output");
+}
+
+// Read the whole of a small file into buffer as a string, -1 if it cannot be read
+static ssize_t read_small_file(const char *path, char *buffer, size_t size) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return -1;
+    ssize_t n = read(fd, buffer, size - 1);
+    close(fd);
+    if (n >= 0) buffer[n] = '\0';
+    return n;
+}
+
+// Test RANGE, ranged OPEN streams and COMMIT of the assembled file
+void test_range_frames(void) {
+    system("mkdir -p test_client_output");
+    system("printf 'abcdefghijklmnopqrstuvwxyz' > test_client_output/source.txt");
+    system("printf 'stale content from before, longer than the file' > "
+           "test_client_output/.assembled.txt.000000000000002a.part");
+    system("printf 'another transfer' > test_client_output/.assembled.txt.0000000000000007.part");
+    
+    // Middle of the source file
+    int sockpair[2];
+    TEST_ASSERT(socketpair(AF_UNIX, SOCK_STREAM, 0, sockpair) == 0);
+    const char *range_cmd = "RANGE 10 5 /test_client_output/source.txt";
+    TEST_CHECK(send_command(sockpair[0], "HELLO 2\n") == 0);
+    TEST_CHECK(send_frame(sockpair[0], FRAME_CMD, 2, range_cmd, strlen(range_cmd)) == 0);
+    TEST_CHECK(serve_frames_input(sockpair) == 0);
+    
+    unsigned char data[64];
+    size_t len = 0;
+    TEST_CHECK(read_reply_stream(sockpair[0], 2, data, sizeof(data), &len) == 5);
+    TEST_CHECK(len == 5 && memcmp(data, "klmno", 5) == 0);
+    close(sockpair[0]);
+    
+    // Two ranges out of order on one session, then the commit
+    const char *path = "/test_client_output/assembled.txt";
+    unsigned char open_payload[OPEN_PAYLOAD_FIXED + OPEN_PAYLOAD_GROUP + 64];
+    put_u32(open_payload, OPEN_FLAG_RANGE);
+    put_u64(open_payload + OPEN_PAYLOAD_FIXED, 42);
+    memcpy(open_payload + OPEN_PAYLOAD_FIXED + OPEN_PAYLOAD_GROUP, path, strlen(path));
+    size_t open_len = OPEN_PAYLOAD_FIXED + OPEN_PAYLOAD_GROUP + strlen(path);
+    const char *commit_cmd = "COMMIT 8 1000000000 42 /test_client_output/assembled.txt";
+    
+    TEST_ASSERT(socketpair(AF_UNIX, SOCK_STREAM, 0, sockpair) == 0);
+    TEST_CHECK(send_command(sockpair[0], "HELLO 2\n") == 0);
+    put_u64(open_payload + 4, 4);
+    TEST_CHECK(send_frame(sockpair[0], FRAME_OPEN, 10, open_payload, open_len) == 0);
+    TEST_CHECK(send_frame(sockpair[0], FRAME_DATA, 10, "5678", 4) == 0);
+    TEST_CHECK(send_end_frame(sockpair[0], 10, 8, 0) == 0);
+    put_u64(open_payload + 4, 0);
+    TEST_CHECK(send_frame(sockpair[0], FRAME_OPEN, 11, open_payload, open_len) == 0);
+    TEST_CHECK(send_frame(sockpair[0], FRAME_DATA, 11, "1234", 4) == 0);
+    TEST_CHECK(send_end_frame(sockpair[0], 11, 4, 0) == 0);
+    TEST_CHECK(send_frame(sockpair[0], FRAME_CMD, 12, commit_cmd, strlen(commit_cmd)) == 0);
+    TEST_CHECK(serve_frames_input(sockpair) == 0);
+    
+    TEST_CHECK(read_reply_stream(sockpair[0], 10, data, sizeof(data), &len) == 8);
+    TEST_CHECK(read_reply_stream(sockpair[0], 11, data, sizeof(data), &len) == 4);
+    TEST_CHECK(read_reply_stream(sockpair[0], 12, data, sizeof(data), &len) == 8);
+    close(sockpair[0]);
+    
+    char buffer[64];
+    int fd = open("test_client_output/assembled.txt", O_RDONLY);
+    TEST_ASSERT(fd >= 0);
+    ssize_t n = read(fd, buffer, sizeof(buffer));
+    TEST_CHECK(n == 8 && memcmp(buffer, "12345678", 8) == 0);
+    struct stat st;
+    TEST_CHECK(fstat(fd, &st) == 0 && st.st_mtime == 1000000000);
+    close(fd);
+    TEST_CHECK(access("test_client_output/.assembled.txt.000000000000002a.part", F_OK) != 0);
+    
+    // The part file of another group of the same file is not touched
+    TEST_CHECK(read_small_file("test_client_output/.assembled.txt.0000000000000007.part",
+                               buffer, sizeof(buffer)) == 16);
+    
+    system("rm -rf test_client_output");
+}
+
+// Test that streams land through the part file, continue it at an offset and leave the old copy alone
+void test_atomic_push_frames(void) {
+    system("mkdir -p test_client_output");
+    system("printf 'old copy' > test_client_output/atomic.txt");
+    
+    const char *path = "/test_client_output/atomic.txt";
+    unsigned char open_payload[OPEN_PAYLOAD_FIXED + 64];
+    memset(open_payload, 0, OPEN_PAYLOAD_FIXED);
+    memcpy(open_payload + OPEN_PAYLOAD_FIXED, path, strlen(path));
+    size_t open_len = OPEN_PAYLOAD_FIXED + strlen(path);
+    char buffer[64];
+    
+    // A session dropped mid-file: the old copy stays, the part file keeps what arrived
+    int sockpair[2];
+    TEST_ASSERT(socketpair(AF_UNIX, SOCK_STREAM, 0, sockpair) == 0);
+    TEST_CHECK(send_command(sockpair[0], "HELLO 2 part\n") == 0);
+    TEST_CHECK(send_frame(sockpair[0], FRAME_OPEN, 1, open_payload, open_len) == 0);
+    TEST_CHECK(send_frame(sockpair[0], FRAME_DATA, 1, "new c", 5) == 0);
+    shutdown(sockpair[0], SHUT_WR);
+    handle_client_connection(sockpair[1]);
+    TEST_CHECK(recv_exact(sockpair[0], buffer, 10) == 0 && memcmp(buffer, "OK 2 part\n", 10) == 0);
+    close(sockpair[0]);
+    TEST_CHECK(read_small_file("test_client_output/atomic.txt", buffer, sizeof(buffer)) == 8);
+    TEST_CHECK(strcmp(buffer, "old copy") == 0);
+    TEST_CHECK(read_small_file("test_client_output/.atomic.txt.part", buffer, sizeof(buffer)) == 5);
+    
+    // The rest of it at its offset completes the file and renames it into place
+    unsigned char data[16];
+    size_t len = 0;
+    put_u64(open_payload + 4, 5);
+    TEST_ASSERT(socketpair(AF_UNIX, SOCK_STREAM, 0, sockpair) == 0);
+    TEST_CHECK(send_command(sockpair[0], "HELLO 2\n") == 0);
+    TEST_CHECK(send_frame(sockpair[0], FRAME_OPEN, 3, open_payload, open_len) == 0);
+    TEST_CHECK(send_frame(sockpair[0], FRAME_DATA, 3, "opy", 3) == 0);
+    TEST_CHECK(send_end_frame(sockpair[0], 3, 8, 0) == 0);
+    TEST_CHECK(serve_frames_input(sockpair) == 0);
+    TEST_CHECK(read_reply_stream(sockpair[0], 3, data, sizeof(data), &len) == 8);
+    close(sockpair[0]);
+    TEST_CHECK(read_small_file("test_client_output/atomic.txt", buffer, sizeof(buffer)) == 8);
+    TEST_CHECK(strcmp(buffer, "new copy") == 0);
+    TEST_CHECK(access("test_client_output/.atomic.txt.part", F_OK) != 0);
+    
+    // Past the end of the part file nothing can be continued, and the copy stays
+    put_u64(open_payload + 4, 9);
+    TEST_ASSERT(socketpair(AF_UNIX, SOCK_STREAM, 0, sockpair) == 0);
+    TEST_CHECK(send_command(sockpair[0], "HELLO 2\n") == 0);
+    TEST_CHECK(send_frame(sockpair[0], FRAME_OPEN, 2, open_payload, open_len) == 0);
+    TEST_CHECK(send_frame(sockpair[0], FRAME_DATA, 2, "py", 2) == 0);
+    TEST_CHECK(send_end_frame(sockpair[0], 2, 11, 0) == 0);
+    TEST_CHECK(serve_frames_input(sockpair) == 0);
+    TEST_CHECK(read_reply_stream(sockpair[0], 2, data, sizeof(data), &len) < 0);
+    close(sockpair[0]);
+    TEST_CHECK(access("test_client_output/.atomic.txt.part", F_OK) != 0);
+    TEST_CHECK(read_small_file("test_client_output/atomic.txt", buffer, sizeof(buffer)) == 8);
+    TEST_CHECK(strcmp(buffer, "new copy") == 0);
+    
+    // An aborted stream leaves neither a part file nor a changed copy
+    put_u64(open_payload + 4, 0);
+    TEST_ASSERT(socketpair(AF_UNIX, SOCK_STREAM, 0, sockpair) == 0);
+    TEST_CHECK(send_command(sockpair[0], "HELLO 2\n") == 0);
+    TEST_CHECK(send_frame(sockpair[0], FRAME_OPEN, 4, open_payload, open_len) == 0);
+    TEST_CHECK(send_frame(sockpair[0], FRAME_DATA, 4, "torn", 4) == 0);
+    TEST_CHECK(send_frame(sockpair[0], FRAME_ABORT, 4, NULL, 0) == 0);
+    TEST_CHECK(serve_frames_input(sockpair) == 0);
+    close(sockpair[0]);
+    TEST_CHECK(access("test_client_output/.atomic.txt.part", F_OK) != 0);
+    TEST_CHECK(read_small_file("test_client_output/atomic.txt", buffer, sizeof(buffer)) == 8);
+    TEST_CHECK(strcmp(buffer, "new copy") == 0);
+    
+    // While another stream writes the part file it is not continued, and a fresh
+    // stream lands through a part file of its own
+    int held = open("test_client_output/.atomic.txt.part", O_WRONLY | O_CREAT, 0644);
+    TEST_ASSERT(held >= 0 && flock(held, LOCK_EX) == 0);
+    TEST_CHECK(write(held, "held", 4) == 4);
+    put_u64(open_payload + 4, 4);
+    TEST_ASSERT(socketpair(AF_UNIX, SOCK_STREAM, 0, sockpair) == 0);
+    TEST_CHECK(send_command(sockpair[0], "HELLO 2\n") == 0);
+    TEST_CHECK(send_frame(sockpair[0], FRAME_OPEN, 5, open_payload, open_len) == 0);
+    TEST_CHECK(send_end_frame(sockpair[0], 5, 4, 0) == 0);
+    TEST_CHECK(serve_frames_input(sockpair) == 0);
+    TEST_CHECK(read_reply_stream(sockpair[0], 5, data, sizeof(data), &len) < 0);
+    close(sockpair[0]);
+    
+    put_u64(open_payload + 4, 0);
+    TEST_ASSERT(socketpair(AF_UNIX, SOCK_STREAM, 0, sockpair) == 0);
+    TEST_CHECK(send_command(sockpair[0], "HELLO 2\n") == 0);
+    TEST_CHECK(send_frame(sockpair[0], FRAME_OPEN, 6, open_payload, open_len) == 0);
+    TEST_CHECK(send_frame(sockpair[0], FRAME_DATA, 6, "newest", 6) == 0);
+    TEST_CHECK(send_end_frame(sockpair[0], 6, 6, 0) == 0);
+    TEST_CHECK(serve_frames_input(sockpair) == 0);
+    TEST_CHECK(read_reply_stream(sockpair[0], 6, data, sizeof(data), &len) == 6);
+    close(sockpair[0]);
+    TEST_CHECK(read_small_file("test_client_output/atomic.txt", buffer, sizeof(buffer)) == 6);
+    TEST_CHECK(strcmp(buffer, "newest") == 0);
+    TEST_CHECK(read_small_file("test_client_output/.atomic.txt.part", buffer, sizeof(buffer)) == 4);
+    close(held);
+    
+    system("rm -rf test_client_output");
+}
+
+// Test that LIST removes part files left long ago, but none still written or recent
+void test_stale_part_sweep(void) {
+    system("mkdir -p test_client_output");
+    system("printf 'kept' > test_client_output/file.txt");
+    system("printf 'x' > test_client_output/.old.txt.part");
+    system("printf 'x' > test_client_output/.locked.txt.part");
+    system("printf 'x' > test_client_output/.recent.txt.part");
+    system("printf 'x' > test_client_output/.hidden_config");
+    
+    struct utimbuf old = { time(NULL) - PART_STALE_SEC - 60, time(NULL) - PART_STALE_SEC - 60 };
+    TEST_CHECK(utime("test_client_output/.old.txt.part", &old) == 0);
+    TEST_CHECK(utime("test_client_output/.locked.txt.part", &old) == 0);
+    TEST_CHECK(utime("test_client_output/.hidden_config", &old) == 0);
+    int held = open("test_client_output/.locked.txt.part", O_RDONLY);
+    TEST_ASSERT(held >= 0 && flock(held, LOCK_SH) == 0);
+    
+    int sockpair[2];
+    TEST_ASSERT(socketpair(AF_UNIX, SOCK_STREAM, 0, sockpair) == 0);
+    handle_list_command(sockpair[1], "test_client_output");
+    char listing[256];
+    ssize_t received = recv(sockpair[0], listing, sizeof(listing) - 1, 0);
+    TEST_CHECK(received == 11 && memcmp(listing, "file.txt\n.\n", 11) == 0);
+    close(sockpair[0]);
+    close(sockpair[1]);
+    
+    TEST_CHECK(access("test_client_output/.old.txt.part", F_OK) != 0);
+    TEST_CHECK(access("test_client_output/.locked.txt.part", F_OK) == 0);
+    TEST_CHECK(access("test_client_output/.recent.txt.part", F_OK) == 0);
+    TEST_CHECK(access("test_client_output/.hidden_config", F_OK) == 0);
+    close(held);
+    
+    system("rm -rf test_client_output");
+}
+
+// Test the -f modes and that a group of landed files is synced in time
+void test_durability_modes(void) {
+    TEST_CHECK(parse_durability("none") == 0 && durability_mode() == DURABILITY_NONE);
+    TEST_CHECK(parse_durability("file") == 0 && durability_mode() == DURABILITY_FILE);
+    TEST_CHECK(parse_durability("group") == 0 && durability_mode() == DURABILITY_GROUP);
+    TEST_CHECK(parse_durability("group:8") == 0);
+    TEST_CHECK(parse_durability("group:3:20") == 0);
+    TEST_CHECK(parse_durability("group:0") == -1);
+    TEST_CHECK(parse_durability("group:3:") == -1);
+    TEST_CHECK(parse_durability("group:3:20:1") == -1);
+    TEST_CHECK(parse_durability("groups") == -1);
+    TEST_CHECK(parse_durability("always") == -1);
+    TEST_CHECK(durability_mode() == DURABILITY_GROUP);
+    
+    system("mkdir -p test_client_output");
+    for (int i = 0; i < 2; i++) {
+        int mode_group = i == 0;
+        set_durability(mode_group ? DURABILITY_GROUP : DURABILITY_FILE, 3, 20);
+        int fd = open("test_client_output/.landed.part", O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        TEST_ASSERT(fd >= 0);
+        TEST_CHECK(write(fd, "data", 4) == 4);
+        TEST_CHECK(durability_land(fd, "test_client_output/.landed.part", "test_client_output/landed") == 0);
+        TEST_CHECK(access("test_client_output/landed", F_OK) == 0);
+        TEST_CHECK(access("test_client_output/.landed.part", F_OK) != 0);
+        if (mode_group) {
+            // One file short of a group: synced once its 20 ms are up
+            for (int tries = 0; tries < 100 && durability_pending() > 0; tries++) poll(NULL, 0, 10);
+        }
+        TEST_CHECK(durability_pending() == 0);
+    }
+    
+    // A part file that is gone is reported, not renamed
+    int fd = open("test_client_output/landed", O_RDONLY);
+    TEST_ASSERT(fd >= 0);
+    TEST_CHECK(durability_land(fd, "test_client_output/.missing.part", "test_client_output/other") == -1);
+    TEST_CHECK(errno == ENOENT);
+    set_durability(DURABILITY_NONE, DURABILITY_GROUP_FILES, DURABILITY_GROUP_MS);
+    system("rm -rf test_client_output");
+}
+
+static int append_inflated(void *ctx, const void *data, size_t len) {
+    unsigned char **out = ctx;
+    memcpy(*out, data, len);
+    *out += len;
+    return 0;
+}
+
+// Collect a PULL reply, inflating DATA_FLAG_ZLIB frames. Returns the END size, or -1
+static long long read_compressed_reply(int fd, uint32_t stream_id, unsigned char *out, size_t *len,
+                                       int *compressed_frames, int *raw_frames) {
+    static unsigned char payload[2 * COMPRESS_CHUNK_SIZE];
+    unsigned char *cursor = out;
+    *compressed_frames = 0;
+    *raw_frames = 0;
+    while (1) {
+        frame_header_t header;
+        if (recv_frame_header(fd, &header) != 0 || header.stream_id != stream_id) return -1;
+        if (header.length > sizeof(payload) || recv_exact(fd, payload, header.length) != 0) return -1;
+        
+        if (header.opcode == FRAME_END) {
+            *len = cursor - out;
+            return header.length == END_PAYLOAD_SIZE ? (long long)get_u64(payload) : -1;
+        }
+        if (header.opcode != FRAME_DATA) return -1;
+        
+        if (header.flags & DATA_FLAG_ZLIB) {
+            frame_inflater_t inflater;
+            if (frame_inflate_begin(&inflater) != 0) return -1;
+            int fed = frame_inflate_feed(&inflater, payload, header.length, append_inflated, &cursor);
+            if (frame_inflate_end(&inflater) != 0 || fed != 0) return -1;
+            (*compressed_frames)++;
+        } else {
+            memcpy(cursor, payload, header.length);
+            cursor += header.length;
+            (*raw_frames)++;
+        }
+    }
+}
+
+// Test compressed PULL replies, the already-compressed skip and compressed PUSH streams
+void test_compressed_frames(void) {
+    system("mkdir -p test_client_output");
+    
+    // 300 KiB of text spans two compressed chunks; random bytes do not compress
+    size_t text_size = 300 * 1024, random_size = 64 * 1024;
+    unsigned char *text = malloc(text_size);
+    unsigned char *random_data = malloc(random_size);
+    unsigned char *received = malloc(text_size);
+    TEST_ASSERT(text && random_data && received);
+    for (size_t i = 0; i < text_size; i++) text[i] = "timestamp,level,message\n"[i % 24];
+    unsigned int seed = 7;
+    for (size_t i = 0; i < random_size; i++) random_data[i] = (unsigned char)rand_r(&seed);
+    
+    FILE *file = fopen("test_client_output/log.csv", "wb");
+    TEST_ASSERT(file != NULL);
+    fwrite(text, 1, text_size, file);
+    fclose(file);
+    file = fopen("test_client_output/photo.jpg", "wb");
+    TEST_ASSERT(file != NULL);
+    fwrite(random_data, 1, random_size, file);
+    fclose(file);
+    
+    int sockpair[2];
+    TEST_ASSERT(socketpair(AF_UNIX, SOCK_STREAM, 0, sockpair) == 0);
+    const char *pull_text = "PULL /test_client_output/log.csv";
+    const char *pull_random = "PULL /test_client_output/photo.jpg";
+    TEST_CHECK(send_command(sockpair[0], "HELLO 2 zlib\n") == 0);
+    TEST_CHECK(send_frame_flags(sockpair[0], FRAME_CMD, 6, 1, pull_text, strlen(pull_text)) == 0);
+    TEST_CHECK(send_frame_flags(sockpair[0], FRAME_CMD, 6, 2, pull_random, strlen(pull_random)) == 0);
+    shutdown(sockpair[0], SHUT_WR);
+    handle_client_connection(sockpair[1]);
+    
+    char reply[16];
+    TEST_CHECK(recv_exact(sockpair[0], reply, 10) == 0);
+    TEST_CHECK(memcmp(reply, "OK 2 zlib\n", 10) == 0);
+    
+    size_t len = 0;
+    int compressed_frames, raw_frames;
+    TEST_CHECK(read_compressed_reply(sockpair[0], 1, received, &len, &compressed_frames, &raw_frames) ==
+               (long long)text_size);
+    TEST_CHECK(len == text_size && memcmp(received, text, text_size) == 0);
+    TEST_CHECK(compressed_frames == 2 && raw_frames == 0);
+    
+    TEST_CHECK(read_compressed_reply(sockpair[0], 2, received, &len, &compressed_frames, &raw_frames) ==
+               (long long)random_size);
+    TEST_CHECK(len == random_size && memcmp(received, random_data, random_size) == 0);
+    TEST_CHECK(compressed_frames == 0 && raw_frames == 1);
+    TEST_MSG("compressed %d raw %d", compressed_frames, raw_frames);
+    close(sockpair[0]);
+    
+    // A compressed PUSH stream, then one whose DATA is corrupt
+    size_t bound = compress_frame_bound(COMPRESS_CHUNK_SIZE);
+    unsigned char *packed = malloc(bound);
+    TEST_ASSERT(packed != NULL);
+    long packed_len = compress_frame(text, COMPRESS_CHUNK_SIZE, packed, bound, 6);
+    TEST_ASSERT(packed_len > 0);
+    
+    const char *path = "/test_client_output/pushed.csv";
+    unsigned char open_payload[OPEN_PAYLOAD_FIXED + 64];
+    memset(open_payload, 0, OPEN_PAYLOAD_FIXED);
+    memcpy(open_payload + OPEN_PAYLOAD_FIXED, path, strlen(path));
+    size_t open_len = OPEN_PAYLOAD_FIXED + strlen(path);
+    
+    TEST_ASSERT(socketpair(AF_UNIX, SOCK_STREAM, 0, sockpair) == 0);
+    TEST_CHECK(send_command(sockpair[0], "HELLO 2 zlib\n") == 0);
+    TEST_CHECK(send_frame(sockpair[0], FRAME_OPEN, 3, open_payload, open_len) == 0);
+    TEST_CHECK(send_frame_flags(sockpair[0], FRAME_DATA, DATA_FLAG_ZLIB, 3, packed, packed_len) == 0);
+    TEST_CHECK(send_frame(sockpair[0], FRAME_DATA, 3, "tail", 4) == 0);
+    TEST_CHECK(send_end_frame(sockpair[0], 3, COMPRESS_CHUNK_SIZE + 4, 0) == 0);
+    packed[packed_len / 2] ^= 0xFF;
+    memcpy(open_payload + OPEN_PAYLOAD_FIXED, "/test_client_output/broken.csv", open_len - OPEN_PAYLOAD_FIXED);
+    TEST_CHECK(send_frame(sockpair[0], FRAME_OPEN, 4, open_payload, open_len) == 0);
+    TEST_CHECK(send_frame_flags(sockpair[0], FRAME_DATA, DATA_FLAG_ZLIB, 4, packed, packed_len) == 0);
+    TEST_CHECK(send_end_frame(sockpair[0], 4, COMPRESS_CHUNK_SIZE, 0) == 0);
+    shutdown(sockpair[0], SHUT_WR);
+    handle_client_connection(sockpair[1]);
+    
+    TEST_CHECK(recv_exact(sockpair[0], reply, 10) == 0);
+    frame_header_t header;
+    TEST_CHECK(recv_frame_header(sockpair[0], &header) == 0);
+    TEST_CHECK(header.opcode == FRAME_END && header.stream_id == 3);
+    unsigned char end_payload[END_PAYLOAD_SIZE];
+    TEST_CHECK(recv_exact(sockpair[0], end_payload, sizeof(end_payload)) == 0);
+    TEST_CHECK(recv_frame_header(sockpair[0], &header) == 0);
+    TEST_CHECK(header.opcode == FRAME_ERROR && header.stream_id == 4);
+    close(sockpair[0]);
+    
+    file = fopen("test_client_output/pushed.csv", "rb");
+    TEST_ASSERT(file != NULL);
+    len = fread(received, 1, text_size, file);
+    fclose(file);
+    TEST_CHECK(len == COMPRESS_CHUNK_SIZE + 4);
+    TEST_CHECK(memcmp(received, text, COMPRESS_CHUNK_SIZE) == 0 &&
+               memcmp(received + COMPRESS_CHUNK_SIZE, "tail", 4) == 0);
+    
+    free(packed);
+    free(text);
+    free(random_data);
+    free(received);
+    system("rm -rf test_client_output");
+}
+
+// Test BATCH: every listed file is answered in order like a PULL
+void test_batch_frames(void) {
+    system("rm -rf test_client_output && mkdir -p test_client_output");
+    system("printf 'first' > test_client_output/a.txt; : > test_client_output/empty.txt");
+    system("printf 'third file' > test_client_output/c.txt");
+    
+    int sockpair[2];
+    TEST_ASSERT(socketpair(AF_UNIX, SOCK_STREAM, 0, sockpair) == 0);
+    const char *batch_cmd = "BATCH /test_client_output";
+    const char *names = "a.txt\nmissing.txt\nempty.txt\nc.txt\n";
+    TEST_CHECK(send_command(sockpair[0], "HELLO 2 zlib batch\n") == 0);
+    TEST_CHECK(send_frame(sockpair[0], FRAME_CMD, 8, batch_cmd, strlen(batch_cmd)) == 0);
+    TEST_CHECK(send_frame(sockpair[0], FRAME_DATA, 8, names, 12) == 0);
+    TEST_CHECK(send_frame(sockpair[0], FRAME_DATA, 8, names + 12, strlen(names) - 12) == 0);
+    TEST_CHECK(send_end_frame(sockpair[0], 8, 4, 0) == 0);
+    shutdown(sockpair[0], SHUT_WR);
+    handle_client_connection(sockpair[1]);
+    
+    char reply[32];
+    TEST_CHECK(recv_exact(sockpair[0], reply, 16) == 0);
+    TEST_CHECK(memcmp(reply, "OK 2 zlib batch\n", 16) == 0);
+    
+    unsigned char data[64];
+    size_t len;
+    TEST_CHECK(read_reply_stream(sockpair[0], 8, data, sizeof(data), &len) == 5);
+    TEST_CHECK(len == 5 && memcmp(data, "first", 5) == 0);
+    
+    // A file that cannot be read is skipped with ERROR, the batch goes on
+    frame_header_t header;
+    TEST_CHECK(recv_frame_header(sockpair[0], &header) == 0);
+    TEST_CHECK(header.opcode == FRAME_ERROR && header.stream_id == 8 && header.length < sizeof(data));
+    TEST_CHECK(recv_exact(sockpair[0], data, header.length) == 0);
+    
+    TEST_CHECK(read_reply_stream(sockpair[0], 8, data, sizeof(data), &len) == 0);
+    TEST_CHECK(len == 0);
+    TEST_CHECK(read_reply_stream(sockpair[0], 8, data, sizeof(data), &len) == 10);
+    TEST_CHECK(len == 10 && memcmp(data, "third file", 10) == 0);
+    
+    // Nothing follows the last file
+    TEST_CHECK(recv(sockpair[0], data, 1, 0) == 0);
+    close(sockpair[0]);
+    
+    TEST_CHECK(parse_feature_list("batch zlib") == (FEATURE_ZLIB | FEATURE_BATCH));
+    format_hello_reply(2, FEATURE_BATCH, reply, sizeof(reply));
+    TEST_CHECK(strcmp(reply, "OK 2 batch\n") == 0);
+    system("rm -rf test_client_output");
+}
+
+static void* serve_connection_thread(void *arg) {
+    handle_client_connection(*(int*)arg);
+    return NULL;
+}
+
+// Test WATCH: changes are pushed as metadata lines until ABORT
+void test_watch_frames(void) {
+    system("rm -rf test_client_output && mkdir -p test_client_output");
+    
+    int sockpair[2];
+    TEST_ASSERT(socketpair(AF_UNIX, SOCK_STREAM, 0, sockpair) == 0);
+    const char *watch_cmd = "WATCH /test_client_output";
+    TEST_CHECK(send_command(sockpair[0], "HELLO 2\n") == 0);
+    TEST_CHECK(send_frame(sockpair[0], FRAME_CMD, 7, watch_cmd, strlen(watch_cmd)) == 0);
+    
+    pthread_t server;
+    TEST_ASSERT(pthread_create(&server, NULL, serve_connection_thread, &sockpair[1]) == 0);
+    
+    char reply[8];
+    TEST_CHECK(recv_exact(sockpair[0], reply, 5) == 0 && memcmp(reply, "OK 2\n", 5) == 0);
+    
+    // The watch is set up asynchronously: write until the first report arrives
+    struct pollfd pfd = { sockpair[0], POLLIN, 0 };
+    int reported = 0;
+    for (int i = 0; i < 50 && !reported; i++) {
+        system("echo hidden > test_client_output/.hidden; echo four > test_client_output/w1.txt");
+        reported = poll(&pfd, 1, 100) > 0;
+    }
+    TEST_CHECK(reported);
+    
+    frame_header_t header;
+    char lines[1024];
+    TEST_CHECK(recv_frame_header(sockpair[0], &header) == 0);
+    TEST_CHECK(header.opcode == FRAME_DATA && header.stream_id == 7 && header.length < sizeof(lines));
+    TEST_CHECK(recv_exact(sockpair[0], lines, header.length) == 0);
+    lines[header.length] = '\0';
+    
+    // Repeated writes were coalesced into one line, hidden files left out
+    file_meta_t meta;
+    char *newline = strchr(lines, '\n');
+    TEST_ASSERT(newline != NULL);
+    *newline = '\0';
+    TEST_CHECK(parse_list_entry(lines, &meta) == 0);
+    TEST_CHECK(strcmp(meta.name, "w1.txt") == 0 && meta.size == 5 && !meta.has_hash);
+    TEST_CHECK(newline[1] == '\0');
+    
+    // ABORT ends the watch with END, the session stays usable
+    TEST_CHECK(send_frame(sockpair[0], FRAME_ABORT, 7, NULL, 0) == 0);
+    unsigned char data[1024];
+    size_t len = 0;
+    TEST_CHECK(read_reply_stream(sockpair[0], 7, data, sizeof(data), &len) >= 0);
+    
+    const char *bad_cmd = "WATCH /test_client_output/missing";
+    TEST_CHECK(send_frame(sockpair[0], FRAME_CMD, 8, bad_cmd, strlen(bad_cmd)) == 0);
+    TEST_CHECK(recv_frame_header(sockpair[0], &header) == 0);
+    TEST_CHECK(header.opcode == FRAME_ERROR && header.stream_id == 8);
+    
+    shutdown(sockpair[0], SHUT_WR);
+    pthread_join(server, NULL);
+    close(sockpair[0]);
+    system("rm -rf test_client_output");
+}
+
 TEST_LIST = {
     { "list_command_functionality", test_list_command_functionality },
+    { "list_large_directory", test_list_large_directory },
     { "pull_command_functionality", test_pull_command_functionality },
     { "pull_command_error", test_pull_command_error },
+    { "pull_engines_match", test_pull_engines_match },
+    { "uring_engine", test_uring_engine },
     { "push_command_functionality", test_push_command_functionality },
+    { "push_interleaved_sessions", test_push_interleaved_sessions },
+    { "push_through_connection", test_push_through_connection },
+    { "push_frames", test_push_frames },
+    { "list_metadata_frames", test_list_metadata_frames },
+    { "recursive_list_frames", test_recursive_list_frames },
+    { "delta_frames", test_delta_frames },
+    { "range_frames", test_range_frames },
+    { "atomic_push_frames", test_atomic_push_frames },
+    { "stale_part_sweep", test_stale_part_sweep },
+    { "durability_modes", test_durability_modes },
+    { "compressed_frames", test_compressed_frames },
+    { "batch_frames", test_batch_frames },
+    { "watch_frames", test_watch_frames },
     { "client_connection_handling", test_client_connection_handling },
     { "edge_cases", test_edge_cases },
     { "buffer_handling", test_buffer_handling },
@@ -1,6 +1,19 @@
+#include "../include/common.h"  // First: defines _GNU_SOURCE for every system header
 #include "acutest.h"
-#include "../include/common.h"
+#include "../include/protocol.h"
+#include "../include/connection_pool.h"
+#include "../include/manifest.h"
+#include "../include/delta.h"
+#include "../include/job_ring.h"
+#include "../include/slab.h"
+#include "../include/sync_info.h"
+#include "../include/log.h"
+#include "../include/metrics.h"
+#include "../include/compress.h"
+#include "../include/throttle.h"
+#include "../include/journal.h"
 #include <sys/socket.h>
+#include <sched.h>
 #include <netinet/in.h>
 #include <unistd.h>
 #include <string.h>
@@ -109,18 +122,25 @@ void test_command_validation(void) {
 
 // Test memory allocation patterns
 void test_memory_allocation(void) {
-    // Test sync_job allocation
+    // Jobs reference their pair and keep short names inline
+    TEST_CHECK(sizeof(sync_job_t) < 256);
+    
+    sync_info_t pair;
+    memset(&pair, 0, sizeof(pair));
+    strcpy(pair.source_host, "127.0.0.1");
+    pair.source_port = 8080;
+    
     sync_job_t *job = malloc(sizeof(sync_job_t));
     TEST_CHECK(job != NULL);
     
     if (job) {
         memset(job, 0, sizeof(sync_job_t));
-        strcpy(job->source_host, "127.0.0.1");
-        job->source_port = 8080;
+        job->info = &pair;
+        job->filename = job->name_inline;
         strcpy(job->filename, "test.txt");
         
-        TEST_CHECK(strcmp(job->source_host, "127.0.0.1") == 0);
-        TEST_CHECK(job->source_port == 8080);
+        TEST_CHECK(strcmp(job->info->source_host, "127.0.0.1") == 0);
+        TEST_CHECK(job->info->source_port == 8080);
         TEST_CHECK(strcmp(job->filename, "test.txt") == 0);
         
         free(job);
@@ -195,7 +215,1097 @@ void test_buffer_boundaries(void) {
     TEST_CHECK(buffer[MAX_BUFFER_SIZE - 1] == '\0');
 }
 
+// Test frame header encoding round trip
+void test_frame_header_encoding(void) {
+    frame_header_t header = { FRAME_DATA, 0x0102, 0xAABBCCDD, 0x0000000123456789ULL };
+    unsigned char encoded[FRAME_HEADER_SIZE];
+    encode_frame_header(&header, encoded);
+    
+    // Big-endian on the wire
+    TEST_CHECK(encoded[0] == FRAME_MAGIC);
+    TEST_CHECK(encoded[1] == FRAME_DATA);
+    TEST_CHECK(encoded[4] == 0xAA && encoded[7] == 0xDD);
+    TEST_CHECK(encoded[12] == 0x23 && encoded[15] == 0x89);
+    
+    frame_header_t decoded;
+    TEST_CHECK(decode_frame_header(encoded, &decoded) == 0);
+    TEST_CHECK(decoded.opcode == header.opcode);
+    TEST_CHECK(decoded.flags == header.flags);
+    TEST_CHECK(decoded.stream_id == header.stream_id);
+    TEST_CHECK(decoded.length == header.length);
+    
+    // Anything that is not a frame is rejected
+    encoded[0] = 'P';
+    TEST_CHECK(decode_frame_header(encoded, &decoded) == -1);
+}
+
+// Test that only an explicit reply decides the version, a late one included
+void test_negotiate_protocol(void) {
+    // A version 1 client answers the HELLO PULL like a missing file, without a newline
+    const char *replies[] = { "OK 2 zlib tree\n", "-1 No such file or directory", "OK 7\n" };
+    const int versions[] = { 2, 1, 2 };
+    char hello[MAX_COMMAND_SIZE];
+    
+    for (int i = 0; i < 3; i++) {
+        int sockpair[2];
+        TEST_ASSERT(socketpair(AF_UNIX, SOCK_STREAM, 0, sockpair) == 0);
+        
+        // The reply is queued before HELLO is read, as from a client that was busy
+        TEST_CHECK(send(sockpair[1], replies[i], strlen(replies[i]), 0) == (ssize_t)strlen(replies[i]));
+        uint32_t features = ~0u;
+        TEST_CHECK(negotiate_protocol(sockpair[0], &features) == versions[i]);
+        TEST_CHECK(features == (i == 0 ? (FEATURE_ZLIB | FEATURE_TREE) : 0));
+        
+        ssize_t received = recv(sockpair[1], hello, sizeof(hello) - 1, 0);
+        TEST_CHECK(received > 0 && strncmp(hello, CMD_HELLO_PULL " 2", strlen(CMD_HELLO_PULL) + 2) == 0);
+        close(sockpair[0]);
+        close(sockpair[1]);
+    }
+    
+    // A client that hangs up is an error, not a version 1 client
+    int sockpair[2];
+    TEST_ASSERT(socketpair(AF_UNIX, SOCK_STREAM, 0, sockpair) == 0);
+    shutdown(sockpair[1], SHUT_WR);
+    TEST_CHECK(negotiate_protocol(sockpair[0], NULL) == -1);
+    close(sockpair[0]);
+    close(sockpair[1]);
+}
+
+// Test that returned sessions are reused and dead ones are dropped
+void test_connection_pool_reuse(void) {
+    connection_pool_t *pool = create_connection_pool(2, POOL_IDLE_TIMEOUT_SEC);
+    TEST_CHECK(pool != NULL);
+    if (!pool) return;
+    
+    int sockpair[2];
+    TEST_CHECK(socketpair(AF_UNIX, SOCK_STREAM, 0, sockpair) == 0);
+    
+    // Nothing listens on port 1, so only pooled sessions can be handed out
+    client_conn_t conn = { sockpair[0], 2, "127.0.0.1", 1, 0 };
+    release_connection(pool, &conn, 1);
+    TEST_CHECK(conn.fd == -1);
+    
+    client_conn_t again;
+    TEST_CHECK(acquire_connection(pool, "127.0.0.1", 1, &again) == 0);
+    TEST_CHECK(again.fd == sockpair[0]);
+    TEST_CHECK(again.version == 2);
+    TEST_CHECK(pool->reuses == 1);
+    
+    // Peer went away while idle: the session must not be handed out again
+    release_connection(pool, &again, 1);
+    close(sockpair[1]);
+    TEST_CHECK(acquire_connection(pool, "127.0.0.1", 1, &again) == -1);
+    TEST_CHECK(pool->reuses == 1);
+    
+    // Sessions in an unknown state are closed, not pooled
+    TEST_CHECK(socketpair(AF_UNIX, SOCK_STREAM, 0, sockpair) == 0);
+    client_conn_t dirty = { sockpair[0], 1, "127.0.0.1", 1, 0 };
+    release_connection(pool, &dirty, 0);
+    TEST_CHECK(connection_is_healthy(sockpair[1]) == 0); // Sees EOF
+    close(sockpair[1]);
+    
+    destroy_connection_pool(pool);
+}
+
+typedef struct {
+    int server_fd;
+    char command[MAX_COMMAND_SIZE];
+} legacy_endpoint_t;
+
+// Hang up on the first connection, then serve like a version 1 client that ignores HELLO
+static void* legacy_endpoint_thread(void *arg) {
+    legacy_endpoint_t *endpoint = arg;
+    for (int i = 0; i < 3; i++) {
+        int fd = accept(endpoint->server_fd, NULL, NULL);
+        if (fd < 0) break;
+        char buffer[MAX_COMMAND_SIZE];
+        ssize_t received = i == 0 ? 0 : recv(fd, buffer, sizeof(buffer) - 1, 0);
+        while (received > 0) {
+            buffer[received] = '\0';
+            if (strncmp(buffer, CMD_PULL, strlen(CMD_PULL)) == 0) {
+                send(fd, "-1 No such file or directory", 28, 0);
+            } else if (strncmp(buffer, CMD_HELLO, strlen(CMD_HELLO)) != 0) {
+                strcpy(endpoint->command, buffer);
+            }
+            received = recv(fd, buffer, sizeof(buffer) - 1, 0);
+        }
+        close(fd);
+    }
+    return NULL;
+}
+
+// Test that a version 1 answer, not a failed HELLO, marks an endpoint legacy
+void test_connection_pool_legacy(void) {
+    connection_pool_t *pool = create_connection_pool(2, POOL_IDLE_TIMEOUT_SEC);
+    TEST_ASSERT(pool != NULL);
+    
+    legacy_endpoint_t endpoint = { socket(AF_INET, SOCK_STREAM, 0), "" };
+    struct sockaddr_in addr = { .sin_family = AF_INET, .sin_addr.s_addr = htonl(INADDR_LOOPBACK) };
+    socklen_t addr_len = sizeof(addr);
+    int server_fd = endpoint.server_fd;
+    TEST_ASSERT(server_fd >= 0);
+    TEST_ASSERT(bind(server_fd, (struct sockaddr*)&addr, sizeof(addr)) == 0 && listen(server_fd, 4) == 0);
+    TEST_ASSERT(getsockname(server_fd, (struct sockaddr*)&addr, &addr_len) == 0);
+    int port = ntohs(addr.sin_port);
+    
+    pthread_t thread;
+    TEST_ASSERT(pthread_create(&thread, NULL, legacy_endpoint_thread, &endpoint) == 0);
+    
+    client_conn_t conn;
+    TEST_CHECK(acquire_connection(pool, "127.0.0.1", port, &conn) == -1);
+    TEST_CHECK(pool->endpoints == NULL || pool->endpoints->legacy_until == 0);
+    
+    // Detected from the refused PULL right away, not after NEGOTIATE_TIMEOUT_MS
+    time_t started = time(NULL);
+    TEST_CHECK(acquire_connection(pool, "127.0.0.1", port, &conn) == 0);
+    TEST_CHECK(time(NULL) - started < 5);
+    TEST_CHECK(conn.version == 1);
+    TEST_CHECK(pool->endpoints != NULL && pool->endpoints->legacy_until > time(NULL));
+    
+    // The session handed out is a fresh one carrying only version 1 commands
+    TEST_CHECK(send_command(conn.fd, "LIST /\n") == 0);
+    release_connection(pool, &conn, 1);
+    
+    pthread_join(thread, NULL);
+    TEST_CHECK(strcmp(endpoint.command, "LIST /\n") == 0);
+    close(server_fd);
+    destroy_connection_pool(pool);
+}
+
+// Test per-pair option parsing
+void test_sync_options(void) {
+    sync_options_t options;
+    init_sync_options(&options);
+    TEST_CHECK(options.check == SYNC_CHECK_NONE);
+    
+    TEST_CHECK(parse_sync_options(NULL, &options) == 0);
+    TEST_CHECK(parse_sync_options("check=hash\n", &options) == 0);
+    TEST_CHECK(options.check == SYNC_CHECK_HASH);
+    TEST_CHECK(parse_sync_options("  check=none ", &options) == 0);
+    TEST_CHECK(options.check == SYNC_CHECK_NONE);
+    
+    TEST_CHECK(parse_sync_options("check=sometimes", &options) == -1);
+    TEST_CHECK(parse_sync_options("colour=blue", &options) == -1);
+    TEST_CHECK(parse_sync_options("check", &options) == -1);
+    
+    TEST_CHECK(options.delta == 0);
+    TEST_CHECK(parse_sync_options("check=mtime delta=on", &options) == 0);
+    TEST_CHECK(options.delta == 1);
+    TEST_CHECK(parse_sync_options("delta=maybe", &options) == -1);
+    
+    TEST_CHECK(options.split_size == DEFAULT_SPLIT_SIZE);
+    TEST_CHECK(parse_sync_options("split=16", &options) == 0);
+    TEST_CHECK(options.split_size == 16LL * 1024 * 1024);
+    TEST_CHECK(parse_sync_options("split=off", &options) == 0);
+    TEST_CHECK(options.split_size == 0);
+    TEST_CHECK(parse_sync_options("split=0", &options) == -1);
+    TEST_CHECK(parse_sync_options("split=12k", &options) == -1);
+    
+    TEST_CHECK(options.priority == DEFAULT_PRIORITY);
+    TEST_CHECK(parse_sync_options("priority=10", &options) == 0);
+    TEST_CHECK(options.priority == 10);
+    TEST_CHECK(parse_sync_options("priority=0", &options) == -1);
+    TEST_CHECK(parse_sync_options("priority=101", &options) == -1);
+    
+    TEST_CHECK(options.watch == 0);
+    TEST_CHECK(parse_sync_options("watch=on", &options) == 0);
+    TEST_CHECK(options.watch == 1);
+    TEST_CHECK(parse_sync_options("watch=off", &options) == 0);
+    TEST_CHECK(options.watch == 0);
+    TEST_CHECK(parse_sync_options("watch=yes", &options) == -1);
+    
+    TEST_CHECK(options.compress == 0);
+    TEST_CHECK(parse_sync_options("compress=on", &options) == 0);
+    TEST_CHECK(options.compress == COMPRESS_DEFAULT_LEVEL);
+    TEST_CHECK(parse_sync_options("compress=6", &options) == 0);
+    TEST_CHECK(options.compress == 6);
+    TEST_CHECK(parse_sync_options("compress=off", &options) == 0);
+    TEST_CHECK(options.compress == 0);
+    TEST_CHECK(parse_sync_options("compress=10", &options) == -1);
+    TEST_CHECK(parse_sync_options("compress=lz4", &options) == -1);
+    
+    TEST_CHECK(options.batch == 1);
+    TEST_CHECK(parse_sync_options("batch=off", &options) == 0);
+    TEST_CHECK(options.batch == 0);
+    TEST_CHECK(parse_sync_options("batch=on", &options) == 0);
+    TEST_CHECK(options.batch == 1);
+    TEST_CHECK(parse_sync_options("batch=maybe", &options) == -1);
+    
+    TEST_CHECK(options.recursive == 0);
+    TEST_CHECK(parse_sync_options("recursive=on", &options) == 0);
+    TEST_CHECK(options.recursive == 1);
+    TEST_CHECK(parse_sync_options("recursive=off", &options) == 0);
+    TEST_CHECK(options.recursive == 0);
+    TEST_CHECK(parse_sync_options("recursive=deep", &options) == -1);
+    
+    TEST_CHECK(options.rate == 0);
+    TEST_CHECK(parse_sync_options("rate=512", &options) == 0);
+    TEST_CHECK(options.rate == 512 * 1024);
+    TEST_CHECK(parse_sync_options("rate=off", &options) == 0);
+    TEST_CHECK(options.rate == 0);
+    TEST_CHECK(parse_sync_options("rate=0", &options) == -1);
+    TEST_CHECK(parse_sync_options("rate=fast", &options) == -1);
+}
+
+// Test manifest lookups and change detection
+void test_manifest_change_detection(void) {
+    manifest_t *manifest = create_manifest();
+    TEST_CHECK(manifest != NULL);
+    if (!manifest) return;
+    
+    // Enough entries to force the bucket array to grow
+    for (int i = 0; i < 3000; i++) {
+        file_meta_t meta = { "", i, 1000 + i, (uint64_t)i * 7, 1 };
+        snprintf(meta.name, sizeof(meta.name), "file%d", i);
+        TEST_CHECK(manifest_put(manifest, &meta) == 0);
+    }
+    TEST_CHECK(manifest->count == 3000);
+    
+    file_meta_t found;
+    TEST_CHECK(manifest_get(manifest, "file2999", &found) == 1);
+    TEST_CHECK(found.size == 2999 && found.mtime == 3999);
+    TEST_CHECK(manifest_get(manifest, "missing", NULL) == 0);
+    
+    file_meta_t same = { "file10", 10, 1010, 70, 1 };
+    file_meta_t touched = { "file10", 10, 5, 70, 1 };
+    file_meta_t edited = { "file10", 10, 1010, 71, 1 };
+    file_meta_t grown = { "file10", 11, 1010, 70, 1 };
+    file_meta_t fresh = { "new_file", 1, 1, 1, 1 };
+    
+    TEST_CHECK(manifest_needs_sync(manifest, &same, SYNC_CHECK_MTIME) == 0);
+    TEST_CHECK(manifest_needs_sync(manifest, &touched, SYNC_CHECK_MTIME) == 1);
+    TEST_CHECK(manifest_needs_sync(manifest, &touched, SYNC_CHECK_HASH) == 0);
+    TEST_CHECK(manifest_needs_sync(manifest, &edited, SYNC_CHECK_HASH) == 1);
+    TEST_CHECK(manifest_needs_sync(manifest, &grown, SYNC_CHECK_MTIME) == 1);
+    TEST_CHECK(manifest_needs_sync(manifest, &fresh, SYNC_CHECK_MTIME) == 1);
+    TEST_CHECK(manifest_needs_sync(manifest, &same, SYNC_CHECK_NONE) == 1);
+    
+    manifest_clear(manifest);
+    TEST_CHECK(manifest_get(manifest, "file10", NULL) == 0);
+    destroy_manifest(manifest);
+}
+
+// Test metadata LIST line round trip
+void test_list_entry_format(void) {
+    file_meta_t meta = { " spaced name.txt", 12345, 1700000000, 0x0123456789abcdefULL, 1 };
+    char line[MAX_FILENAME + 64];
+    int len = format_list_entry(&meta, line, sizeof(line));
+    TEST_CHECK(len > 0 && line[len - 1] == '\n');
+    TEST_CHECK(strcmp(line, "12345 1700000000 0123456789abcdef  spaced name.txt\n") == 0);
+    
+    line[len - 1] = '\0';
+    file_meta_t parsed;
+    TEST_CHECK(parse_list_entry(line, &parsed) == 0);
+    TEST_CHECK(strcmp(parsed.name, meta.name) == 0);
+    TEST_CHECK(parsed.size == meta.size && parsed.mtime == meta.mtime);
+    TEST_CHECK(parsed.has_hash && parsed.hash == meta.hash);
+    
+    TEST_CHECK(parse_list_entry("10 20 - plain.txt", &parsed) == 0);
+    TEST_CHECK(!parsed.has_hash);
+    TEST_CHECK(parse_list_entry("plain.txt", &parsed) == -1);
+    TEST_CHECK(parse_list_entry("10 20 -", &parsed) == -1);
+    
+    // Reference value of the 64-bit FNV-1a hash
+    TEST_CHECK(fnv1a_update(FNV1A_INIT, "a", 1) == 0xaf63dc4c8601ec8cULL);
+}
+
 // Test list to run
+// Growable output buffer for delta_emit_fn
+typedef struct {
+    unsigned char *data;
+    size_t len;
+} test_output_t;
+
+static int collect_output(void *ctx, const void *data, size_t len) {
+    test_output_t *out = ctx;
+    unsigned char *grown = realloc(out->data, out->len + len);
+    if (!grown) return -1;
+    memcpy(grown + out->len, data, len);
+    out->data = grown;
+    out->len += len;
+    return 0;
+}
+
+// Open an anonymous scratch file holding len bytes of data
+static int temp_file_with(const unsigned char *data, size_t len) {
+    static int counter = 0;
+    char path[64];
+    snprintf(path, sizeof(path), "/tmp/nfs_delta_test_%d_%d", (int)getpid(), counter++);
+    int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0600);
+    if (fd < 0) return -1;
+    unlink(path);
+    if (write(fd, data, len) != (ssize_t)len) {
+        close(fd);
+        return -1;
+    }
+    lseek(fd, 0, SEEK_SET);
+    return fd;
+}
+
+// Test block delta encoding and rebuilding
+void test_delta_roundtrip(void) {
+    const size_t basis_size = 512 * 1024;
+    const size_t new_size = basis_size + 1010;
+    unsigned char *basis = malloc(basis_size);
+    unsigned char *updated = malloc(new_size);
+    TEST_ASSERT(basis != NULL && updated != NULL);
+    
+    uint32_t seed = 12345;
+    for (size_t i = 0; i < basis_size; i++) {
+        seed = seed * 1103515245 + 12345;
+        basis[i] = (unsigned char)(seed >> 16);
+    }
+    
+    // Overwrite 100 bytes, insert 10 bytes further on and append 1000
+    memcpy(updated, basis, 300000);
+    memset(updated + 200000, 'x', 100);
+    memset(updated + 300000, 'y', 10);
+    memcpy(updated + 300010, basis + 300000, basis_size - 300000);
+    memset(updated + basis_size + 10, 'z', 1000);
+    
+    uint32_t block_size = delta_block_size(basis_size);
+    TEST_CHECK(block_size >= DELTA_MIN_BLOCK && block_size <= DELTA_MAX_BLOCK);
+    TEST_CHECK(delta_block_size(1) == DELTA_MIN_BLOCK);
+    TEST_CHECK(delta_block_size((int64_t)1 << 40) == DELTA_MAX_BLOCK);
+    
+    int basis_fd = temp_file_with(basis, basis_size);
+    int new_fd = temp_file_with(updated, new_size);
+    int out_fd = temp_file_with(NULL, 0);
+    TEST_ASSERT(basis_fd >= 0 && new_fd >= 0 && out_fd >= 0);
+    
+    test_output_t sigs = { NULL, 0 };
+    long blocks = delta_write_signatures(basis_fd, block_size, collect_output, &sigs);
+    TEST_CHECK(blocks == (long)(basis_size / block_size));
+    TEST_CHECK(sigs.len == (size_t)blocks * DELTA_SIG_SIZE);
+    
+    test_output_t delta = { NULL, 0 };
+    int64_t encoded = delta_encode(new_fd, block_size, sigs.data, blocks, collect_output, &delta);
+    TEST_CHECK(encoded == (int64_t)new_size);
+    TEST_CHECK(delta.len < new_size / 10);
+    TEST_MSG("delta is %zu bytes for %zu byte file", delta.len, new_size);
+    
+    // Feed in small pieces so instruction headers are split
+    delta_patch_t patch;
+    delta_patch_init(&patch, basis_fd, out_fd);
+    int result = 0;
+    for (size_t offset = 0; result == 0 && offset < delta.len; offset += 7) {
+        size_t piece = delta.len - offset < 7 ? delta.len - offset : 7;
+        result = delta_patch_feed(&patch, delta.data + offset, piece);
+    }
+    TEST_CHECK(result == 0);
+    TEST_CHECK(delta_patch_finish(&patch) == 0);
+    TEST_CHECK(patch.written == new_size);
+    
+    unsigned char *rebuilt = malloc(new_size);
+    TEST_ASSERT(rebuilt != NULL);
+    lseek(out_fd, 0, SEEK_SET);
+    TEST_CHECK(read(out_fd, rebuilt, new_size) == (ssize_t)new_size);
+    TEST_CHECK(memcmp(rebuilt, updated, new_size) == 0);
+    
+    // A stream cut in the middle of an instruction is incomplete
+    delta_patch_init(&patch, basis_fd, out_fd);
+    TEST_CHECK(delta_patch_feed(&patch, delta.data, 6) == 0);
+    TEST_CHECK(delta_patch_finish(&patch) == -1);
+    
+    free(rebuilt);
+    free(delta.data);
+    free(sigs.data);
+    close(out_fd);
+    close(new_fd);
+    close(basis_fd);
+    free(updated);
+    free(basis);
+}
+
+#define RING_TEST_THREADS 4
+#define RING_TEST_JOBS 4000
+
+typedef struct {
+    job_ring_t *ring;
+    sync_job_t *jobs;         // Producers: first job to push
+    int *seen;                // Consumers: times each job was popped
+    int *popped;              // Shared total of popped jobs
+} ring_test_arg_t;
+
+static void* ring_test_producer(void *arg) {
+    ring_test_arg_t *test = arg;
+    for (int i = 0; i < RING_TEST_JOBS / RING_TEST_THREADS; i++) {
+        while (job_ring_push(test->ring, &test->jobs[i]) != 0) {
+            sched_yield();
+        }
+    }
+    return NULL;
+}
+
+static void* ring_test_consumer(void *arg) {
+    ring_test_arg_t *test = arg;
+    while (__atomic_load_n(test->popped, __ATOMIC_RELAXED) < RING_TEST_JOBS) {
+        sync_job_t *job = job_ring_pop(test->ring);
+        if (!job) {
+            sched_yield();
+            continue;
+        }
+        __atomic_add_fetch(&test->seen[job - test->jobs], 1, __ATOMIC_RELAXED);
+        __atomic_add_fetch(test->popped, 1, __ATOMIC_RELAXED);
+    }
+    return NULL;
+}
+
+// Test slab allocator
+void test_slab_allocator(void) {
+    slab_pool_t pool;
+    TEST_ASSERT(slab_pool_init(&pool, sizeof(sync_job_t)) == 0);
+    
+    void *objects[SLAB_OBJECTS + 1];
+    for (int i = 0; i <= SLAB_OBJECTS; i++) {
+        objects[i] = slab_alloc(&pool);
+        TEST_ASSERT(objects[i] != NULL);
+        TEST_CHECK(((uintptr_t)objects[i] & (SLAB_ALIGN - 1)) == 0);
+        memset(objects[i], 0xab, sizeof(sync_job_t));
+    }
+    TEST_CHECK(pool.slab_count == 2);
+    TEST_CHECK(pool.in_use == SLAB_OBJECTS + 1);
+    
+    // Freed objects are reused before a new slab is carved
+    slab_free(&pool, objects[7]);
+    TEST_CHECK(slab_alloc(&pool) == objects[7]);
+    TEST_CHECK(pool.slab_count == 2);
+    
+    // Slabs stay while objects are allocated
+    TEST_CHECK(slab_pool_release(&pool) == -1);
+    for (int i = 0; i <= SLAB_OBJECTS; i++) {
+        slab_free(&pool, objects[i]);
+    }
+    TEST_CHECK(pool.in_use == 0);
+    TEST_CHECK(slab_pool_release(&pool) == 0);
+    TEST_CHECK(pool.slab_count == 0);
+    
+    slab_pool_destroy(&pool);
+}
+
+// Test lock-free job ring
+void test_job_ring(void) {
+    TEST_CHECK(create_job_ring(0) == NULL);
+    
+    // Capacity rounds up to a power of two
+    job_ring_t *ring = create_job_ring(5);
+    TEST_ASSERT(ring != NULL);
+    TEST_CHECK(job_ring_capacity(ring) == 8);
+    
+    sync_job_t *jobs = calloc(RING_TEST_JOBS, sizeof(sync_job_t));
+    TEST_ASSERT(jobs != NULL);
+    
+    // FIFO order, full and empty reported without blocking
+    TEST_CHECK(job_ring_pop(ring) == NULL);
+    for (int i = 0; i < 8; i++) {
+        TEST_CHECK(job_ring_push(ring, &jobs[i]) == 0);
+    }
+    TEST_CHECK(job_ring_push(ring, &jobs[8]) == -1);
+    for (int i = 0; i < 8; i++) {
+        TEST_CHECK(job_ring_pop(ring) == &jobs[i]);
+    }
+    TEST_CHECK(job_ring_pop(ring) == NULL);
+    
+    // Several producers and consumers: every job comes out exactly once
+    int *seen = calloc(RING_TEST_JOBS, sizeof(int));
+    TEST_ASSERT(seen != NULL);
+    int popped = 0;
+    pthread_t producers[RING_TEST_THREADS], consumers[RING_TEST_THREADS];
+    ring_test_arg_t args[RING_TEST_THREADS];
+    for (int i = 0; i < RING_TEST_THREADS; i++) {
+        args[i].ring = ring;
+        args[i].jobs = jobs + i * (RING_TEST_JOBS / RING_TEST_THREADS);
+        args[i].seen = seen;
+        args[i].popped = &popped;
+        pthread_create(&producers[i], NULL, ring_test_producer, &args[i]);
+    }
+    ring_test_arg_t consumer_arg = { ring, jobs, seen, &popped };
+    for (int i = 0; i < RING_TEST_THREADS; i++) {
+        pthread_create(&consumers[i], NULL, ring_test_consumer, &consumer_arg);
+    }
+    for (int i = 0; i < RING_TEST_THREADS; i++) {
+        pthread_join(producers[i], NULL);
+        pthread_join(consumers[i], NULL);
+    }
+    
+    int exactly_once = 1;
+    for (int i = 0; i < RING_TEST_JOBS; i++) {
+        if (seen[i] != 1) exactly_once = 0;
+    }
+    TEST_CHECK(popped == RING_TEST_JOBS);
+    TEST_CHECK(exactly_once);
+    TEST_CHECK(job_ring_pop(ring) == NULL);
+    
+    free(seen);
+    free(jobs);
+    destroy_job_ring(ring);
+}
+
+// Test hashed sync pair store: lookups, growth, removal and list order
+void test_sync_info_store(void) {
+    sync_info_store_t *store = create_sync_info_store();
+    TEST_ASSERT(store != NULL);
+    
+    // Enough pairs to grow the table a few times
+    const int pairs = SYNC_STORE_BUCKETS * 5;
+    char dir[64];
+    for (int i = 0; i < pairs; i++) {
+        snprintf(dir, sizeof(dir), "/src%d", i);
+        sync_info_t *info = create_sync_info("127.0.0.1", 8000 + i % 3, dir, "127.0.0.1", 9000, "/dst");
+        TEST_ASSERT(info != NULL);
+        TEST_CHECK(add_sync_info(store, info) == 0);
+        TEST_CHECK(info->id == i + 1);
+    }
+    TEST_CHECK(get_sync_info_count(store) == pairs);
+    TEST_CHECK(store->bucket_count >= (size_t)pairs);
+    
+    sync_info_t *duplicate = create_sync_info("127.0.0.1", 8000, "/src0", "10.0.0.1", 9000, "/other");
+    TEST_CHECK(add_sync_info(store, duplicate) == 1);
+    free_sync_info(duplicate);
+    
+    for (int i = 0; i < pairs; i++) {
+        snprintf(dir, sizeof(dir), "/src%d", i);
+        sync_info_t *info = find_sync_info(store, "127.0.0.1", 8000 + i % 3, dir);
+        TEST_CHECK(info != NULL && info->id == i + 1);
+        TEST_CHECK(find_sync_info(store, "127.0.0.1", 8000 + (i + 1) % 3, dir) == NULL);
+    }
+    
+    // Remove the newest, the oldest and one in the middle
+    TEST_CHECK(remove_sync_info(store, "127.0.0.1", 8000 + (pairs - 1) % 3, "/src319") == 0);
+    TEST_CHECK(remove_sync_info(store, "127.0.0.1", 8000, "/src0") == 0);
+    TEST_CHECK(remove_sync_info(store, "127.0.0.1", 8000 + 100 % 3, "/src100") == 0);
+    TEST_CHECK(remove_sync_info(store, "127.0.0.1", 8000 + 100 % 3, "/src100") == 1);
+    TEST_CHECK(find_sync_info(store, "127.0.0.1", 8000 + 100 % 3, "/src100") == NULL);
+    TEST_CHECK(get_sync_info_count(store) == pairs - 3);
+    
+    // The list still runs newest first, in both directions
+    int listed = 0;
+    int last_id = pairs + 1;
+    for (sync_info_t *info = store->head; info; info = info->next) {
+        TEST_CHECK(info->id < last_id);
+        TEST_CHECK(info->next == NULL || info->next->prev == info);
+        last_id = info->id;
+        listed++;
+    }
+    TEST_CHECK(listed == pairs - 3);
+    TEST_CHECK(store->head->prev == NULL && store->head->id == pairs - 1);
+    
+    TEST_CHECK(deactivate_sync_info(store, "127.0.0.1", 8001, "/src1") == 0);
+    TEST_CHECK(find_sync_info(store, "127.0.0.1", 8001, "/src1")->active == 0);
+    TEST_CHECK(deactivate_sync_info(store, "127.0.0.1", 8001, "/missing") == 1);
+    
+    destroy_sync_info_store(store);
+}
+
+#define LOG_TEST_THREADS 4
+#define LOG_TEST_RECORDS 500
+
+static FILE *g_test_log = NULL;
+
+static void* log_events_thread(void *arg) {
+    char source[16];
+    snprintf(source, sizeof(source), "t%d", (int)(intptr_t)arg);
+    for (int i = 0; i < LOG_TEST_RECORDS; i++) {
+        log_event(g_test_log, source, "dst", "PULL", "SUCCESS", "n=%d \"q\"", i);
+    }
+    return NULL;
+}
+
+static int g_log_phase = 0;
+
+// Log once before a log_stop()/log_start() cycle and once after it, to the new file
+static void* log_across_restart_thread(void *arg) {
+    log_event(g_test_log, "r", "dst", "PULL", "SUCCESS", "before");
+    __atomic_store_n(&g_log_phase, 1, __ATOMIC_RELEASE);
+    while (__atomic_load_n(&g_log_phase, __ATOMIC_ACQUIRE) != 2) sched_yield();
+    log_event((FILE*)arg, "r", "dst", "PULL", "SUCCESS", "after");
+    return NULL;
+}
+
+// Count the lines of a file that contain text
+static int count_lines_with(FILE *file, const char *text) {
+    char line[LOG_LINE_MAX + 128];
+    int count = 0;
+    rewind(file);
+    while (fgets(line, sizeof(line), file)) {
+        if (strstr(line, text)) count++;
+    }
+    return count;
+}
+
+void test_async_log(void) {
+    g_test_log = tmpfile();
+    TEST_ASSERT(g_test_log != NULL);
+    
+    log_format_t format;
+    log_level_t level;
+    TEST_CHECK(parse_log_format("json", &format) == 0 && format == LOG_FORMAT_JSON);
+    TEST_CHECK(parse_log_format("xml", &format) == -1);
+    TEST_CHECK(parse_log_level("warn", &level) == 0 && level == LOG_LEVEL_WARN);
+    TEST_CHECK(parse_log_level("trace", &level) == -1);
+    
+    set_log_format(LOG_FORMAT_JSON);
+    TEST_ASSERT(log_start(g_test_log) == 0);
+    TEST_CHECK(log_start(g_test_log) == -1);
+    
+    // Far more records per thread than a ring holds: nothing may be lost
+    pthread_t threads[LOG_TEST_THREADS];
+    for (int i = 0; i < LOG_TEST_THREADS; i++) {
+        TEST_ASSERT(pthread_create(&threads[i], NULL, log_events_thread, (void*)(intptr_t)i) == 0);
+    }
+    for (int i = 0; i < LOG_TEST_THREADS; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    
+    // Below the level: dropped; errors still pass
+    set_log_level(LOG_LEVEL_WARN);
+    log_event(g_test_log, "t0", "dst", "PULL", "SUCCESS", "hidden");
+    log_event(g_test_log, "t0", "dst", "PUSH", "ERROR", "failed");
+    set_log_level(LOG_LEVEL_INFO);
+    log_stop();
+    set_log_format(LOG_FORMAT_TEXT);
+    
+    rewind(g_test_log);
+    char line[LOG_LINE_MAX + 128];
+    char last_time[32] = "";
+    int next[LOG_TEST_THREADS] = { 0 };
+    int lines = 0, errors = 0;
+    while (fgets(line, sizeof(line), g_test_log)) {
+        lines++;
+        TEST_CHECK(line[0] == '{' && strstr(line, "}\n") != NULL);
+        
+        // Written oldest first
+        char time[32];
+        TEST_ASSERT(sscanf(line, "{\"time\":\"%31[^\"]\"", time) == 1);
+        TEST_CHECK(strcmp(time, last_time) >= 0);
+        strcpy(last_time, time);
+        
+        if (strstr(line, "\"level\":\"error\"")) {
+            errors++;
+            TEST_CHECK(strstr(line, "\"result\":\"ERROR\"") != NULL);
+            continue;
+        }
+        int thread, n;
+        const char *source = strstr(line, "\"source\":\"t");
+        const char *details = strstr(line, "\"details\":\"n=");
+        TEST_ASSERT(source != NULL && details != NULL);
+        TEST_ASSERT(sscanf(source, "\"source\":\"t%d", &thread) == 1);
+        TEST_ASSERT(sscanf(details, "\"details\":\"n=%d", &n) == 1);
+        TEST_ASSERT(thread >= 0 && thread < LOG_TEST_THREADS);
+        TEST_CHECK(n == next[thread]);
+        next[thread] = n + 1;
+        TEST_CHECK(strstr(details, "\\\"q\\\"\"") != NULL);
+    }
+    TEST_CHECK(lines == LOG_TEST_THREADS * LOG_TEST_RECORDS + 1);
+    TEST_CHECK(errors == 1);
+    fclose(g_test_log);
+    g_test_log = NULL;
+    
+    // Not flushed: written right away as text
+    FILE *file = tmpfile();
+    TEST_ASSERT(file != NULL);
+    log_event(file, "a@h:1", "b@h:2", "PUSH", "SUCCESS", "5 bytes");
+    rewind(file);
+    TEST_CHECK(fgets(line, sizeof(line), file) != NULL);
+    TEST_CHECK(line[0] == '[' && strstr(line, "] [a@h:1] [b@h:2] [") != NULL);
+    TEST_CHECK(strstr(line, "] [PUSH] [SUCCESS] [5 bytes]\n") != NULL);
+    fclose(file);
+    
+    // A thread alive across a restart logs through its ring again; log_write() stays off the file
+    FILE *second = tmpfile();
+    g_test_log = tmpfile();
+    TEST_ASSERT(g_test_log != NULL && second != NULL);
+    TEST_ASSERT(log_start(g_test_log) == 0);
+    pthread_t thread;
+    TEST_ASSERT(pthread_create(&thread, NULL, log_across_restart_thread, second) == 0);
+    while (__atomic_load_n(&g_log_phase, __ATOMIC_ACQUIRE) != 1) sched_yield();
+    LOG_WARN("stdout only");
+    log_stop();
+    TEST_ASSERT(log_start(second) == 0);
+    __atomic_store_n(&g_log_phase, 2, __ATOMIC_RELEASE);
+    pthread_join(thread, NULL);
+    log_stop();
+    TEST_CHECK(count_lines_with(g_test_log, "[before]") == 1);
+    TEST_CHECK(count_lines_with(g_test_log, "stdout only") == 0);
+    TEST_CHECK(count_lines_with(second, "[after]") == 1);
+    TEST_CHECK(count_lines_with(second, "[before]") == 0);
+    fclose(g_test_log);
+    fclose(second);
+    g_test_log = NULL;
+}
+
+void test_metrics(void) {
+    histogram_t histogram;
+    memset(&histogram, 0, sizeof(histogram));
+    TEST_CHECK(histogram_quantile(&histogram, 0.5) == 0);
+    
+    // Bounds double from the first: 100us, 200us, 400us, ...
+    histogram_observe(&histogram, 0);
+    histogram_observe(&histogram, METRICS_FIRST_BOUND_US);
+    histogram_observe(&histogram, METRICS_FIRST_BOUND_US + 1);
+    histogram_observe(&histogram, 350);
+    TEST_CHECK(histogram.buckets[0] == 2);
+    TEST_CHECK(histogram.buckets[1] == 1);
+    TEST_CHECK(histogram.buckets[2] == 1);
+    TEST_CHECK(histogram.sum_us == 551);
+    TEST_CHECK(histogram_quantile(&histogram, 0.5) == METRICS_FIRST_BOUND_US);
+    TEST_CHECK(histogram_quantile(&histogram, 0.75) == 2 * METRICS_FIRST_BOUND_US);
+    TEST_CHECK(histogram_quantile(&histogram, 1.0) == 4 * METRICS_FIRST_BOUND_US);
+    
+    histogram_observe(&histogram, UINT64_C(1) << 40);
+    TEST_CHECK(histogram.buckets[METRICS_BUCKETS] == 1);
+    TEST_CHECK(histogram_quantile(&histogram, 1.0) == UINT64_MAX);
+    
+    // Counters of a pair show up with escaped labels
+    sync_info_store_t *store = create_sync_info_store();
+    TEST_ASSERT(store != NULL);
+    sync_info_t *info = create_sync_info("127.0.0.1", 8001, "/a\"b", "127.0.0.1", 8002, "/dst");
+    TEST_ASSERT(info != NULL);
+    TEST_ASSERT(add_sync_info(store, info) == 0);
+    info->bytes_synced = 4096;
+    info->files_synced = 3;
+    info->error_count = 1;
+    
+    char *text = NULL;
+    size_t len = 0;
+    FILE *out = open_memstream(&text, &len);
+    TEST_ASSERT(out != NULL);
+    write_metrics(out, NULL, store);
+    fclose(out);
+    TEST_CHECK(strstr(text, "# TYPE nfs_pair_bytes_total counter\n") != NULL);
+    TEST_CHECK(strstr(text, "nfs_pair_bytes_total{pair=\"1\",source=\"/a\\\"b@127.0.0.1:8001\","
+                            "target=\"/dst@127.0.0.1:8002\"} 4096\n") != NULL);
+    TEST_CHECK(strstr(text, "nfs_pair_files_total{pair=\"1\"") != NULL);
+    TEST_CHECK(strstr(text, "} 3\n") != NULL);
+    TEST_CHECK(strstr(text, "# TYPE nfs_transfer_seconds histogram\n") != NULL);
+    TEST_CHECK(strstr(text, "nfs_transfer_seconds_bucket{le=\"+Inf\"}") != NULL);
+    TEST_CHECK(strstr(text, "nfs_pair_active{pair=\"1\"") != NULL);
+    free(text);
+    
+    text = NULL;
+    out = open_memstream(&text, &len);
+    TEST_ASSERT(out != NULL);
+    write_stats_summary(out, NULL, store);
+    fclose(out);
+    TEST_CHECK(strstr(text, "Pair 1 /a\"b@127.0.0.1:8001 -> /dst@127.0.0.1:8002: 3 files, 0.0 MiB, 1 errors\n") != NULL);
+    free(text);
+    
+    destroy_sync_info_store(store);
+}
+
+static int collect_inflated(void *ctx, const void *data, size_t len) {
+    unsigned char **out = ctx;
+    memcpy(*out, data, len);
+    *out += len;
+    return 0;
+}
+
+// Test per-frame compression, the incompressible skip and feature negotiation strings
+void test_compress_frame(void) {
+    size_t size = COMPRESS_CHUNK_SIZE;
+    size_t bound = compress_frame_bound(size);
+    unsigned char *text = malloc(size);
+    unsigned char *packed = malloc(bound);
+    unsigned char *inflated = malloc(FRAME_DATA_MAX + MAX_BUFFER_SIZE);
+    TEST_ASSERT(text && packed && inflated);
+    for (size_t i = 0; i < size; i++) text[i] = "2024-01-01,GET,/index.html,200\n"[i % 31];
+    
+    long packed_len = compress_frame(text, size, packed, bound, COMPRESS_DEFAULT_LEVEL);
+    TEST_CHECK(packed_len > 0 && (size_t)packed_len < size / 10);
+    
+    // Fed in small pieces, as a frame arrives from the socket
+    frame_inflater_t inflater;
+    unsigned char *cursor = inflated;
+    TEST_ASSERT(frame_inflate_begin(&inflater) == 0);
+    for (long offset = 0; offset < packed_len; offset += 1000) {
+        size_t piece = packed_len - offset < 1000 ? (size_t)(packed_len - offset) : 1000;
+        TEST_CHECK(frame_inflate_feed(&inflater, packed + offset, piece, collect_inflated, &cursor) == 0);
+    }
+    TEST_CHECK(frame_inflate_end(&inflater) == 0);
+    TEST_CHECK((size_t)(cursor - inflated) == size && memcmp(inflated, text, size) == 0);
+    
+    // A frame cut short never completes
+    cursor = inflated;
+    TEST_ASSERT(frame_inflate_begin(&inflater) == 0);
+    TEST_CHECK(frame_inflate_feed(&inflater, packed, packed_len / 2, collect_inflated, &cursor) == 0);
+    TEST_CHECK(frame_inflate_end(&inflater) == -1);
+    
+    // Random bytes do not shrink: sent raw
+    unsigned int seed = 42;
+    for (size_t i = 0; i < size; i++) text[i] = (unsigned char)rand_r(&seed);
+    TEST_CHECK(compress_frame(text, size, packed, bound, COMPRESS_MAX_LEVEL) == 0);
+    TEST_CHECK(compress_frame(text, size, packed, bound, 0) == -1);
+    
+    // A frame inflating past FRAME_DATA_MAX is rejected
+    unsigned char *zeros = calloc(1, FRAME_DATA_MAX + 1);
+    size_t big_bound = compress_frame_bound(FRAME_DATA_MAX + 1);
+    unsigned char *big = malloc(big_bound);
+    TEST_ASSERT(zeros && big);
+    packed_len = compress_frame(zeros, FRAME_DATA_MAX + 1, big, big_bound, 1);
+    TEST_CHECK(packed_len > 0);
+    cursor = inflated;
+    TEST_ASSERT(frame_inflate_begin(&inflater) == 0);
+    TEST_CHECK(frame_inflate_feed(&inflater, big, packed_len, collect_inflated, &cursor) == -1);
+    frame_inflate_end(&inflater);
+    
+    TEST_CHECK(parse_feature_list(" zlib brotli\n") == FEATURE_ZLIB);
+    TEST_CHECK(parse_feature_list(NULL) == 0);
+    char reply[32];
+    format_hello_reply(2, FEATURE_ZLIB, reply, sizeof(reply));
+    TEST_CHECK(strcmp(reply, "OK 2 zlib\n") == 0);
+    format_hello_reply(2, 0, reply, sizeof(reply));
+    TEST_CHECK(strcmp(reply, "OK 2\n") == 0);
+    format_hello_reply(1, FEATURE_ZLIB, reply, sizeof(reply));
+    TEST_CHECK(strcmp(reply, "OK 1\n") == 0);
+    
+    free(zeros);
+    free(big);
+    free(text);
+    free(packed);
+    free(inflated);
+}
+
+// Test token buckets, session caps and how jobs are held back
+void test_throttle(void) {
+    // A new bucket holds its burst, then refills at the rate up to it
+    token_bucket_t bucket = { 0, 0, 0 };
+    int64_t rate = 1024 * 1024;
+    TEST_CHECK(token_bucket_delay(&bucket, rate, 1000000) == 0);
+    TEST_CHECK(token_bucket_take(&bucket, rate, 256 * 1024, 1000000) == 0);
+    int64_t wait = token_bucket_take(&bucket, rate, 1024 * 1024, 1000000);
+    TEST_CHECK(wait > 999000 && wait <= 1000001);
+    TEST_MSG("wait %lld", (long long)wait);
+    TEST_CHECK(token_bucket_delay(&bucket, rate, 1500000) > 0);
+    TEST_CHECK(token_bucket_delay(&bucket, rate, 2000001) == 0);
+    TEST_CHECK(token_bucket_delay(&bucket, rate, 60000000) == 0);
+    TEST_CHECK(bucket.tokens <= 256 * 1024);
+    
+    // Slow rates still allow THROTTLE_BURST_MIN at once
+    token_bucket_t slow = { 0, 0, 0 };
+    TEST_CHECK(token_bucket_take(&slow, 1024, THROTTLE_BURST_MIN, 1000000) == 0);
+    TEST_CHECK(token_bucket_take(&slow, 1024, 1024, 1000000) > 0);
+    
+    TEST_CHECK(parse_throttle_sessions("2") == 0);
+    TEST_CHECK(parse_throttle_sessions("10.0.0.1:8001=1") == 0);
+    TEST_CHECK(parse_throttle_sessions("10.0.0.1=1") == -1);
+    TEST_CHECK(parse_throttle_sessions("10.0.0.1:0=1") == -1);
+    TEST_CHECK(parse_throttle_sessions("many") == -1);
+    TEST_CHECK(parse_throttle_rate("10.0.0.9=-5") == -1);
+    TEST_CHECK(parse_throttle_rate("=5") == -1);
+    TEST_CHECK(throttle_caps_sessions() == 1);
+    
+    sync_info_t *a = create_sync_info("10.0.0.1", 8001, "/a", "10.0.0.2", 8002, "/a");
+    sync_info_t *b = create_sync_info("10.0.0.3", 8001, "/b", "10.0.0.2", 8002, "/b");
+    TEST_ASSERT(a && b);
+    
+    // 10.0.0.1:8001 takes one job, 10.0.0.2:8002 the default two
+    uint64_t retry = 0;
+    TEST_CHECK(throttle_admit(a, &retry) == 1);
+    TEST_CHECK(throttle_active_sessions("10.0.0.1", 8001) == 1);
+    TEST_CHECK(throttle_active_sessions("10.0.0.2", 8002) == 1);
+    TEST_CHECK(throttle_admit(a, &retry) == 0);
+    TEST_CHECK(retry > 0 && retry <= THROTTLE_RETRY_MAX_US);
+    TEST_CHECK(throttle_admit(b, &retry) == 1);
+    TEST_CHECK(throttle_active_sessions("10.0.0.2", 8002) == 2);
+    TEST_CHECK(throttle_admit(b, &retry) == 0);
+    
+    // A released session lets the held back pair through
+    TEST_CHECK(throttle_release(b) == 1);
+    TEST_CHECK(throttle_active_sessions("10.0.0.2", 8002) == 1);
+    TEST_CHECK(throttle_admit(b, &retry) == 1);
+    TEST_CHECK(throttle_release(a) == 1);
+    TEST_CHECK(throttle_release(b) == 1);
+    TEST_CHECK(throttle_active_sessions("10.0.0.1", 8001) == 0);
+    TEST_CHECK(throttle_active_sessions("10.0.0.2", 8002) == 0);
+    TEST_CHECK(throttle_admit(a, &retry) == 1);
+    TEST_CHECK(throttle_release(a) == 1);
+    
+    // A pair within one client holds two sessions there; alone, it may exceed a cap of one
+    sync_info_t *c = create_sync_info("10.0.0.2", 8002, "/c", "10.0.0.2", 8002, "/d");
+    sync_info_t *d = create_sync_info("10.0.0.1", 8001, "/c", "10.0.0.1", 8001, "/d");
+    TEST_ASSERT(c && d);
+    TEST_CHECK(throttle_admit(c, &retry) == 1);
+    TEST_CHECK(throttle_active_sessions("10.0.0.2", 8002) == 2);
+    TEST_CHECK(throttle_admit(b, &retry) == 0);
+    TEST_CHECK(throttle_release(c) == 1);
+    TEST_CHECK(throttle_active_sessions("10.0.0.2", 8002) == 0);
+    TEST_CHECK(throttle_admit(d, &retry) == 1);
+    TEST_CHECK(throttle_active_sessions("10.0.0.1", 8001) == 2);
+    TEST_CHECK(throttle_admit(d, &retry) == 0);
+    TEST_CHECK(throttle_admit(a, &retry) == 0);
+    TEST_CHECK(throttle_release(d) == 1);
+    release_sync_info(c);
+    release_sync_info(d);
+    
+    // A pair in debt on its own rate waits, others do not
+    throttle_reset();
+    TEST_CHECK(throttle_caps_sessions() == 0);
+    TEST_CHECK(parse_sync_options("rate=64", &a->options) == 0);
+    retry = 0;
+    TEST_CHECK(throttle_admit(a, &retry) == 1);
+    throttle_pace(a, THROTTLE_BURST_MIN);
+    a->bucket.tokens -= 64 * 1024;
+    TEST_CHECK(throttle_admit(a, &retry) == 0);
+    TEST_CHECK(retry > 0 && retry <= THROTTLE_RETRY_MAX_US);
+    TEST_CHECK(throttle_admit(b, &retry) == 1);
+    
+    // So does every pair of a host in debt
+    TEST_CHECK(parse_throttle_rate("10.0.0.2=64") == 0);
+    throttle_pace(b, THROTTLE_BURST_MIN);
+    retry = 0;
+    TEST_CHECK(throttle_admit(b, &retry) == 1);
+    a->active = 0; // Cancelled: pacing returns at once
+    throttle_pace(a, 64 * 1024);
+    TEST_CHECK(throttle_admit(b, &retry) == 0);
+    throttle_reset();
+    TEST_CHECK(throttle_admit(b, &retry) == 1);
+    
+    release_sync_info(a);
+    release_sync_info(b);
+}
+
+void test_journal(void) {
+    char path[64];
+    snprintf(path, sizeof(path), "/tmp/nfs_journal_test_%d", (int)getpid());
+    unlink(path);
+    
+    sync_info_t *a = create_sync_info("10.0.0.1", 8001, "/a", "10.0.0.2", 8002, "/a");
+    sync_info_t *b = create_sync_info("10.0.0.1", 8001, "/b", "10.0.0.2", 8002, "/b");
+    TEST_ASSERT(a && b);
+    TEST_CHECK(journal_pair_key(a) != journal_pair_key(b));
+    
+    // Two ranges of one file (one ends), a whole file, and a pair later cancelled
+    journal_t *journal = journal_open(path);
+    TEST_ASSERT(journal != NULL);
+    journal_add_pair(journal, journal_pair_key(a), "/a@10.0.0.1:8001 /a@10.0.0.2:8002 rate=64\n");
+    journal_add_pair(journal, journal_pair_key(b), "/b@10.0.0.1:8001 /b@10.0.0.2:8002");
+    uint64_t first = journal_add_job(journal, a, "big", 300, 7, 0, 200, 42);
+    uint64_t second = journal_add_job(journal, a, "big", 300, 7, 200, 100, 42);
+    uint64_t whole = journal_add_job(journal, a, "whole", 5000, 9, 0, 5000, 0);
+    uint64_t gone = journal_add_job(journal, b, "other", 10, 1, 0, 10, 0);
+    TEST_CHECK(first != 0 && second != first && whole != 0 && gone != 0);
+    journal_progress(journal, second, 250);
+    journal_done(journal, first);
+    journal_progress(journal, whole, 4096);
+    journal_drop_pair(journal, journal_pair_key(b));
+    journal_close(journal);
+    
+    // Replay brings back the pair lines and the open jobs with their offsets
+    journal = journal_open(path);
+    TEST_ASSERT(journal != NULL);
+    int count = 0;
+    char **lines = journal_pair_lines(journal, &count);
+    TEST_CHECK(count == 1);
+    if (count == 1) TEST_CHECK(strcmp(lines[0], "/a@10.0.0.1:8001 /a@10.0.0.2:8002 rate=64") == 0);
+    for (int i = 0; i < count; i++) free(lines[i]);
+    free(lines);
+    
+    journal_entry_t *entries = NULL;
+    TEST_CHECK(journal_take_resume(journal, a, "big", 300, 7, &entries) == 1);
+    TEST_ASSERT(entries != NULL);
+    TEST_CHECK(entries->id == second && entries->group == 42);
+    TEST_CHECK(entries->offset == 200 && entries->length == 100 && entries->committed == 250);
+    TEST_CHECK(entries->next == NULL);
+    free(entries);
+    
+    // Taken entries are gone; a changed file ends its entries
+    TEST_CHECK(journal_take_resume(journal, a, "big", 300, 7, &entries) == 0);
+    TEST_CHECK(journal_take_resume(journal, b, "other", 10, 1, &entries) == 0);
+    uint64_t next = journal_add_job(journal, a, "next", 10, 1, 0, 10, 0);
+    TEST_CHECK(next > gone);
+    journal_close(journal);
+    
+    // The whole file is still open until a listing drops it; the resumed range never ended
+    journal = journal_open(path);
+    TEST_ASSERT(journal != NULL);
+    TEST_CHECK(journal_take_resume(journal, a, "whole", 5000, 10, &entries) == 0);
+    TEST_CHECK(entries == NULL);
+    TEST_CHECK(journal_drop_resume(journal, a) == 2);
+    TEST_CHECK(journal_drop_resume(journal, a) == 0);
+    journal_close(journal);
+    
+    // A torn record at the tail is ignored along with what follows it
+    journal = journal_open(path);
+    TEST_ASSERT(journal != NULL);
+    uint64_t torn = journal_add_job(journal, a, "torn", 300, 7, 0, 300, 0);
+    journal_close(journal);
+    int fd = open(path, O_RDWR);
+    TEST_ASSERT(fd >= 0);
+    char file_data[4096];
+    ssize_t got = pread(fd, file_data, sizeof(file_data), 0);
+    TEST_ASSERT(got > 48);
+    for (ssize_t i = got - 8; i > 16; i--) {
+        if (memcmp(file_data + i, "torn", 4) == 0) {
+            file_data[i] = 'x';
+            TEST_CHECK(pwrite(fd, file_data + i, 1, i) == 1);
+            break;
+        }
+    }
+    close(fd);
+    journal = journal_open(path);
+    TEST_ASSERT(journal != NULL);
+    TEST_CHECK(torn != 0);
+    TEST_CHECK(journal_take_resume(journal, a, "torn", 300, 7, &entries) == 0);
+    TEST_CHECK(journal_take_resume(journal, a, "xorn", 300, 7, &entries) == 0);
+    lines = journal_pair_lines(journal, &count);
+    TEST_CHECK(count == 1);
+    for (int i = 0; i < count; i++) free(lines[i]);
+    free(lines);
+    
+    // Progress is overwritten in place, and compaction keeps the jobs still open
+    uint64_t open_job = journal_add_job(journal, a, "long", 1 << 30, 3, 0, 1 << 30, 0);
+    TEST_ASSERT(open_job != 0);
+    struct stat before, after;
+    TEST_ASSERT(stat(path, &before) == 0);
+    for (int i = 1; i <= 100000; i++) {
+        journal_progress(journal, open_job, (int64_t)i * 4096);
+    }
+    TEST_ASSERT(stat(path, &after) == 0);
+    TEST_CHECK(after.st_size == before.st_size);
+    for (int i = 0; i < 50000; i++) {
+        journal_done(journal, journal_add_job(journal, a, "short", 1 << 20, 3, 0, 1 << 20, 0));
+    }
+    TEST_ASSERT(stat(path, &after) == 0);
+    TEST_CHECK(after.st_size < JOURNAL_COMPACT_SIZE);
+    TEST_MSG("journal size %lld", (long long)after.st_size);
+    journal_progress(journal, open_job, 8192);
+    journal_close(journal);
+    journal = journal_open(path);
+    TEST_ASSERT(journal != NULL);
+    TEST_CHECK(journal_take_resume(journal, a, "short", 1 << 20, 3, &entries) == 0);
+    TEST_CHECK(journal_take_resume(journal, a, "long", 1 << 30, 3, &entries) == 1);
+    if (entries) {
+        TEST_CHECK(entries->id == open_job && entries->committed == 8192);
+        free(entries);
+    }
+    lines = journal_pair_lines(journal, &count);
+    TEST_CHECK(count == 1);
+    for (int i = 0; i < count; i++) free(lines[i]);
+    free(lines);
+    journal_close(journal);
+    
+    // Anything else is refused rather than overwritten
+    fd = open(path, O_WRONLY | O_TRUNC);
+    TEST_ASSERT(fd >= 0);
+    TEST_CHECK(write(fd, "not a journal at all\n", 21) == 21);
+    close(fd);
+    TEST_CHECK(journal_open(path) == NULL);
+    
+    // Without a journal every call does nothing
+    TEST_CHECK(journal_add_job(NULL, a, "x", 1, 1, 0, 1, 0) == 0);
+    journal_progress(NULL, 1, 1);
+    journal_done(NULL, 1);
+    TEST_CHECK(journal_pair_lines(NULL, &count) == NULL && count == 0);
+    TEST_CHECK(journal_drop_resume(NULL, a) == 0);
+    
+    unlink(path);
+    char temp_path[80];
+    snprintf(temp_path, sizeof(temp_path), "%s.tmp", path);
+    unlink(temp_path);
+    release_sync_info(a);
+    release_sync_info(b);
+}
+
 TEST_LIST = {
     { "get_timestamp", test_get_timestamp },
     { "parse_directory_spec", test_parse_directory_spec },
@@ -205,5 +1315,21 @@ TEST_LIST = {
     { "memory_allocation", test_memory_allocation },
     { "file_operations_safety", test_file_operations_safety },
     { "buffer_boundaries", test_buffer_boundaries },
+    { "frame_header_encoding", test_frame_header_encoding },
+    { "negotiate_protocol", test_negotiate_protocol },
+    { "connection_pool_reuse", test_connection_pool_reuse },
+    { "connection_pool_legacy", test_connection_pool_legacy },
+    { "sync_options", test_sync_options },
+    { "manifest_change_detection", test_manifest_change_detection },
+    { "list_entry_format", test_list_entry_format },
+    { "delta_roundtrip", test_delta_roundtrip },
+    { "compress_frame", test_compress_frame },
+    { "job_ring", test_job_ring },
+    { "slab_allocator", test_slab_allocator },
+    { "sync_info_store", test_sync_info_store },
+    { "async_log", test_async_log },
+    { "metrics", test_metrics },
+    { "throttle", test_throttle },
+    { "journal", test_journal },
     { NULL, NULL }
 };
\ No newline at end of file